@@ -0,0 +1,216 @@
+/*
+** Mini FaaS - Affinity scheduling benchmark
+** Discrete-event simulation of the LB dispatching to single-threaded workers
+** with an LRU module cache each. Compares RR / WEIGHTED / AFFINITY on module
+** cache hit rate and latency percentiles, using the LB's own affinity code.
+**
+** Usage: bench_affinity [functions] [workers] [cache_per_worker] [load] [requests]
+** Defaults: 500 functions, 8 workers, 64 modules/worker, 0.15 load, 200000 requests
+** (load is relative to all-warm capacity; RR already runs near saturation there)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "affinity.h"
+
+#define WARM_MS 2.0     // mean execution time, module cached
+#define COMPILE_MS 25.0 // extra cost of a module cache miss
+#define ZIPF_S 1.0      // function popularity skew
+#define MAX_W 64
+
+typedef enum { SIM_RR, SIM_WEIGHTED, SIM_AFFINITY } sim_strategy_t;
+
+typedef struct {
+    double done_at;
+    int fn;
+    int evicted; // -1 if none
+} pending_t;
+
+typedef struct {
+    double free_at;      // time the worker finishes its queue
+    pending_t *pending;  // FIFO of dispatched, not yet completed requests
+    int head, tail, cap;
+    int *cache_fn;       // actual module cache (LRU)
+    unsigned long *cache_used;
+    unsigned char *lb_warm; // LB's view, updated when responses come back
+} sim_worker_t;
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static double rng_uniform(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (double)(rng_state >> 11) / 9007199254740992.0;
+}
+
+static double rng_exp(double mean) {
+    double u = rng_uniform();
+    if (u < 1e-12) u = 1e-12;
+    return -mean * log(u);
+}
+
+static int zipf_sample(const double *cdf, int n) {
+    double u = rng_uniform();
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Touch fn in worker cache; returns 1 on hit, sets *evicted on miss
+static int cache_touch(sim_worker_t *w, int cache_size, int fn, unsigned long clock, int *evicted) {
+    int victim = 0;
+    *evicted = -1;
+    for (int i = 0; i < cache_size; i++) {
+        if (w->cache_fn[i] == fn) {
+            w->cache_used[i] = clock;
+            return 1;
+        }
+        if (w->cache_fn[i] < 0) {
+            if (w->cache_fn[victim] >= 0) victim = i;
+        } else if (w->cache_fn[victim] >= 0 && w->cache_used[i] < w->cache_used[victim]) {
+            victim = i;
+        }
+    }
+    *evicted = w->cache_fn[victim];
+    w->cache_fn[victim] = fn;
+    w->cache_used[victim] = clock;
+    return 0;
+}
+
+static void run(sim_strategy_t strat, const char *label, int nfn, int nw, int cache_size,
+                double load, int nreq, char names[][32]) {
+    sim_worker_t workers[MAX_W];
+    for (int i = 0; i < nw; i++) {
+        memset(&workers[i], 0, sizeof(sim_worker_t));
+        workers[i].cap = nreq + 1;
+        workers[i].pending = malloc(sizeof(pending_t) * (size_t)workers[i].cap);
+        workers[i].cache_fn = malloc(sizeof(int) * (size_t)cache_size);
+        workers[i].cache_used = calloc((size_t)cache_size, sizeof(unsigned long));
+        workers[i].lb_warm = calloc((size_t)nfn, 1);
+        for (int c = 0; c < cache_size; c++) workers[i].cache_fn[c] = -1;
+    }
+
+    double *cdf = malloc(sizeof(double) * (size_t)nfn);
+    double sum = 0;
+    for (int i = 0; i < nfn; i++) sum += 1.0 / pow(i + 1, ZIPF_S);
+    double acc = 0;
+    for (int i = 0; i < nfn; i++) {
+        acc += 1.0 / pow(i + 1, ZIPF_S) / sum;
+        cdf[i] = acc;
+    }
+
+    int ids[MAX_W];
+    for (int i = 0; i < nw; i++) ids[i] = i;
+    hash_ring_t ring = {0};
+    ring_build(&ring, ids, nw);
+
+    double *lat = malloc(sizeof(double) * (size_t)nreq);
+    double rate = load * nw / WARM_MS; // arrivals per ms
+    double now = 0;
+    int rr = 0;
+    long hits = 0;
+    rng_state = 88172645463325252ULL; // same arrival sequence for every strategy
+
+    for (int r = 0; r < nreq; r++) {
+        now += rng_exp(1.0 / rate);
+        int fn = zipf_sample(cdf, nfn);
+
+        // Completed responses reach the LB: update load and warm view
+        int loadv[MAX_W];
+        unsigned char warmv[MAX_W];
+        for (int i = 0; i < nw; i++) {
+            sim_worker_t *w = &workers[i];
+            while (w->head < w->tail && w->pending[w->head].done_at <= now) {
+                pending_t *p = &w->pending[w->head++];
+                w->lb_warm[p->fn] = 1;
+                if (p->evicted >= 0) w->lb_warm[p->evicted] = 0;
+            }
+            loadv[i] = w->tail - w->head;
+            warmv[i] = w->lb_warm[fn];
+        }
+
+        int widx = 0;
+        if (strat == SIM_RR) {
+            widx = rr++ % nw;
+        } else if (strat == SIM_WEIGHTED) {
+            for (int i = 1; i < nw; i++) if (loadv[i] < loadv[widx]) widx = i;
+        } else {
+            widx = affinity_pick(&ring, affinity_hash(names[fn]), loadv, warmv, AFFINITY_BALANCE);
+        }
+
+        sim_worker_t *w = &workers[widx];
+        int evicted;
+        int hit = cache_touch(w, cache_size, fn, (unsigned long)r + 1, &evicted);
+        hits += hit;
+        double service = rng_exp(WARM_MS) + (hit ? 0 : COMPILE_MS);
+        double start = w->free_at > now ? w->free_at : now;
+        w->free_at = start + service;
+        w->pending[w->tail].done_at = w->free_at;
+        w->pending[w->tail].fn = fn;
+        w->pending[w->tail].evicted = evicted;
+        w->tail++;
+        lat[r] = w->free_at - now;
+    }
+
+    qsort(lat, (size_t)nreq, sizeof(double), cmp_double);
+    double hit_rate = (double)hits / nreq;
+    double p50 = lat[(size_t)(nreq * 0.50)];
+    double p99 = lat[(size_t)(nreq * 0.99)];
+    double p999 = lat[(size_t)(nreq * 0.999)];
+
+    printf("%-10s %8.1f%% %10.2f %10.2f %10.2f\n", label, hit_rate * 100, p50, p99, p999);
+    fprintf(stderr, "{\"bench\":\"affinity\",\"strategy\":\"%s\",\"functions\":%d,\"workers\":%d,"
+            "\"cache\":%d,\"load\":%.2f,\"hit_rate\":%.4f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f}\n",
+            label, nfn, nw, cache_size, load, hit_rate, p50, p99, p999);
+
+    for (int i = 0; i < nw; i++) {
+        free(workers[i].pending);
+        free(workers[i].cache_fn);
+        free(workers[i].cache_used);
+        free(workers[i].lb_warm);
+    }
+    ring_free(&ring);
+    free(cdf);
+    free(lat);
+}
+
+int main(int argc, char **argv) {
+    int nfn = argc > 1 ? atoi(argv[1]) : 500;
+    int nw = argc > 2 ? atoi(argv[2]) : 8;
+    int cache_size = argc > 3 ? atoi(argv[3]) : 64;
+    double load = argc > 4 ? atof(argv[4]) : 0.15;
+    int nreq = argc > 5 ? atoi(argv[5]) : 200000;
+
+    if (nfn <= 0 || nw <= 0 || nw > MAX_W || cache_size <= 0 || load <= 0 || nreq <= 0) {
+        fprintf(stderr, "Usage: %s [functions] [workers] [cache_per_worker] [load] [requests]\n", argv[0]);
+        return 1;
+    }
+
+    char (*names)[32] = malloc(sizeof(*names) * (size_t)nfn);
+    for (int i = 0; i < nfn; i++) snprintf(names[i], sizeof(names[i]), "fn%d_v1", i);
+
+    printf("=== Affinity scheduling (simulated) ===\n");
+    printf("Functions: %d (zipf s=%.1f), workers: %d, cache: %d modules/worker\n", nfn, ZIPF_S, nw, cache_size);
+    printf("Offered load: %.0f%% (warm %.0fms, compile %.0fms), requests: %d\n\n",
+           load * 100, WARM_MS, COMPILE_MS, nreq);
+    printf("%-10s %9s %10s %10s %10s\n", "strategy", "hit rate", "p50 ms", "p99 ms", "p99.9 ms");
+
+    run(SIM_RR, "RR", nfn, nw, cache_size, load, nreq, names);
+    run(SIM_WEIGHTED, "WEIGHTED", nfn, nw, cache_size, load, nreq, names);
+    run(SIM_AFFINITY, "AFFINITY", nfn, nw, cache_size, load, nreq, names);
+
+    free(names);
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*
+** Mini FaaS - Cold start benchmark
+** Deploys functions to a running server and times, for each repetition:
+**   deploy   POST /deploy round trip, until the version is ready
+**   store, compile, prewarm   server-side phases (deploy "timing" field)
+**   first    first invoke of the new version
+**   warm     median of the invokes that follow
+** Functions: every file of the examples directory (language from the
+** extension) plus generated ones of increasing size in each language.
+** Languages whose toolchain is not installed on this host are skipped;
+** nothing is downloaded.
+**
+** Usage: bench_coldstart [-e host:port] [-r reps] [-n warm] [-x dir]
+**                        [-s bytes,...] [-l lang,...] [-j out.json]
+**   -e  gateway (default 127.0.0.1:8080), server on this host
+**   -r  repetitions, each deploying a new version (default 5)
+**   -n  warm invokes per repetition (default 10)
+**   -x  examples directory (default examples, "" for none)
+**   -s  sizes of the generated functions (default 512,2048,6144; deploys
+**       travel as one JSON line, which the server caps at 8 KiB)
+**   -l  only these languages
+**   -j  write results as JSON (compare runs with bench_compare)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "bench_common.h"
+#include "ipc.h"
+
+#define MAX_SIZES 16
+#define MAX_REPS 100
+#define MAX_WARM 1000
+#define MAX_CODE (1024 * 1024)   // gateway MAX_BODY
+#define RESP_CAP (256 * 1024)
+#define GEN_MARKER "cold-ok"     // printed by generated functions
+
+typedef enum { PH_DEPLOY, PH_STORE, PH_COMPILE, PH_PREWARM, PH_FIRST, PH_WARM, PH_COUNT } phase_t;
+static const char *phase_names[PH_COUNT] = { "deploy", "store", "compile", "prewarm", "first", "warm" };
+
+static const struct {
+    const char *lang;
+    const char *ext;
+    const char *tool;    // needed on the server host, NULL = none
+} langs[] = {
+    { "c",      "c",    "/opt/wasi-sdk/bin/clang" },
+    { "rust",   "rs",   "rustc" },
+    { "go",     "go",   "tinygo" },
+    { "python", "py",   "python3" },
+    { "js",     "js",   "node" },
+    { "php",    "php",  "php" },
+    { "html",   "html", NULL },
+};
+#define NLANGS (sizeof(langs) / sizeof(langs[0]))
+
+static int lang_ok[NLANGS];
+static char *resp;
+
+// Executable given as a path, or found in $PATH
+static int have_tool(const char *tool) {
+    if (!tool) return 1;
+    if (strchr(tool, '/')) return access(tool, X_OK) == 0;
+    const char *env = getenv("PATH");
+    if (!env) return 0;
+    char *path = strdup(env);
+    if (!path) return 0;
+    int found = 0;
+    char *save = NULL;
+    for (char *dir = strtok_r(path, ":", &save); dir && !found; dir = strtok_r(NULL, ":", &save)) {
+        char full[1024];
+        snprintf(full, sizeof(full), "%s/%s", dir, tool);
+        found = access(full, X_OK) == 0;
+    }
+    free(path);
+    return found;
+}
+
+static double json_ms(const char *body, const char *key) {
+    char pat[32];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *p = strstr(body, pat);
+    return p ? atof(p + strlen(pat)) : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Generated functions: small functions repeated up to the size, then a
+// print of GEN_MARKER (a truncated deploy shows up as a failed invoke)
+// ---------------------------------------------------------------------------
+
+static size_t gen_code(const char *lang, size_t size, char *buf, size_t cap) {
+    const char *head = "", *fmt = "", *tail = "";
+    if (strcmp(lang, "c") == 0) {
+        head = "#include <stdio.h>\n";
+        fmt = "int f%d(int x) { return x * %d + 1; }\n";
+        tail = "int main(void) { puts(\"" GEN_MARKER "\"); return 0; }\n";
+    } else if (strcmp(lang, "rust") == 0) {
+        head = "#![allow(dead_code)]\n";
+        fmt = "fn f%d(x: i64) -> i64 { x * %d + 1 }\n";
+        tail = "fn main() { println!(\"" GEN_MARKER "\"); }\n";
+    } else if (strcmp(lang, "go") == 0) {
+        head = "package main\n\nimport \"fmt\"\n\n";
+        fmt = "func f%d(x int) int { return x*%d + 1 }\n";
+        tail = "func main() { fmt.Println(\"" GEN_MARKER "\") }\n";
+    } else if (strcmp(lang, "python") == 0) {
+        fmt = "def f%d(x):\n    return x * %d + 1\n";
+        tail = "print('" GEN_MARKER "')\n";
+    } else if (strcmp(lang, "js") == 0) {
+        fmt = "function f%d(x) { return x * %d + 1; }\n";
+        tail = "console.log('" GEN_MARKER "');\n";
+    } else if (strcmp(lang, "php") == 0) {
+        head = "<?php\n";
+        fmt = "function f%d($x) { return $x * %d + 1; }\n";
+        tail = "echo \"" GEN_MARKER "\\n\";\n";
+    } else {
+        fmt = "<p id=\"p%d\">%d</p>\n";
+        tail = "<p>" GEN_MARKER "</p>\n";
+    }
+
+    size_t len = (size_t)snprintf(buf, cap, "%s", head);
+    size_t tail_len = strlen(tail);
+    for (int i = 0; len + tail_len < size && len + 128 < cap; i++) {
+        len += (size_t)snprintf(buf + len, cap - len, fmt, i, i);
+    }
+    len += (size_t)snprintf(buf + len, cap - len, "%s", tail);
+    return len;
+}
+
+// ---------------------------------------------------------------------------
+// Measurement
+// ---------------------------------------------------------------------------
+
+static double median(double *v, int n) {
+    qsort(v, (size_t)n, sizeof(double), cmp_double);
+    return n ? v[n / 2] : 0;
+}
+
+// Deploys name reps times and records the median of every phase.
+// marker: expected in the invoke output (NULL = any successful invoke)
+static int bench_function(const char *label, const char *name, const char *lang, const char *code,
+                          size_t code_len, const char *marker, int reps, int warm_runs) {
+    static double ph[PH_COUNT][MAX_REPS];
+    static double warm[MAX_WARM];
+    char path[256];
+    int done = 0;
+
+    for (int r = 0; r < reps; r++) {
+        snprintf(path, sizeof(path), "/deploy?name=%s&lang=%s", name, lang);
+        double t0 = now_s();
+        int st = http_request("POST", path, code, code_len, resp, RESP_CAP);
+        ph[PH_DEPLOY][done] = (now_s() - t0) * 1e3;
+        if (st < 0) {
+            fprintf(stderr, "gateway unreachable\n");
+            return -1;
+        }
+        if (st != 201) {
+            printf("%-28s deploy failed: %.*s\n", label, (int)strcspn(resp, "\n"), resp);
+            return 0;
+        }
+        ph[PH_STORE][done] = json_ms(resp, "store_ms");
+        ph[PH_COMPILE][done] = json_ms(resp, "compile_ms");
+        ph[PH_PREWARM][done] = json_ms(resp, "warm_ms");
+
+        snprintf(path, sizeof(path), "/invoke?fn=%s", name);
+        t0 = now_s();
+        st = http_request("POST", path, "x", 1, resp, RESP_CAP);
+        ph[PH_FIRST][done] = (now_s() - t0) * 1e3;
+        if (st != 200 || !strstr(resp, "\"ok\":true") || (marker && !strstr(resp, marker))) {
+            printf("%-28s invoke failed: %.*s\n", label, (int)strcspn(resp, "\n"), resp);
+            return 0;
+        }
+        for (int k = 0; k < warm_runs; k++) {
+            t0 = now_s();
+            http_request("POST", path, "x", 1, resp, RESP_CAP);
+            warm[k] = (now_s() - t0) * 1e3;
+        }
+        ph[PH_WARM][done] = median(warm, warm_runs);
+        done++;
+    }
+
+    printf("%-28s %-7s %7zu", label, lang, code_len);
+    for (int p = 0; p < PH_COUNT; p++) {
+        double m = median(ph[p], done);
+        printf(" %9.2f", m);
+        char rname[64];
+        snprintf(rname, sizeof(rname), "cold.%s.%s", label, phase_names[p]);
+        add_result(rname, m, "ms", 0);
+    }
+    printf("\n");
+    fflush(stdout);
+    return 0;
+}
+
+static int bench_examples(const char *dir, int reps, int warm_runs, char *code) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return 0;
+    }
+    struct dirent *e;
+    int rc = 0;
+    while (rc == 0 && (e = readdir(d))) {
+        const char *dot = strrchr(e->d_name, '.');
+        if (!dot || e->d_name[0] == '.') continue;
+        int li = -1;
+        for (size_t i = 0; i < NLANGS && li < 0; i++) {
+            if (strcmp(dot + 1, langs[i].ext) == 0) li = (int)i;
+        }
+        if (li < 0 || !lang_ok[li]) continue;
+
+        char file[1024], name[64];
+        snprintf(file, sizeof(file), "%s/%s", dir, e->d_name);
+        FILE *f = fopen(file, "rb");
+        if (!f) continue;
+        size_t len = fread(code, 1, MAX_CODE, f);
+        fclose(f);
+        // hello.c -> cs_hello_c (function names are [A-Za-z0-9_-])
+        snprintf(name, sizeof(name), "cs_%.60s", e->d_name);
+        for (char *c = name; *c; c++) {
+            if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '-')) *c = '_';
+        }
+        rc = bench_function(e->d_name, name, langs[li].lang, code, len, NULL, reps, warm_runs);
+    }
+    closedir(d);
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    const char *endpoint = "127.0.0.1:8080", *examples = "examples", *json_path = NULL;
+    const char *only = NULL;
+    char sizes_arg[256] = "512,2048,6144";
+    int reps = 5, warm_runs = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:r:n:x:s:l:j:")) != -1) {
+        switch (opt) {
+            case 'e': endpoint = optarg; break;
+            case 'r': reps = atoi(optarg); break;
+            case 'n': warm_runs = atoi(optarg); break;
+            case 'x': examples = optarg; break;
+            case 's': snprintf(sizes_arg, sizeof(sizes_arg), "%s", optarg); break;
+            case 'l': only = optarg; break;
+            case 'j': json_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-e host:port] [-r reps] [-n warm] [-x dir] [-s bytes,...] "
+                        "[-l lang,...] [-j out.json]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (reps < 1 || reps > MAX_REPS) reps = 5;
+    if (warm_runs < 1 || warm_runs > MAX_WARM) warm_runs = 10;
+
+    size_t sizes[MAX_SIZES];
+    int nsizes = 0;
+    char *save = NULL;
+    for (char *t = strtok_r(sizes_arg, ",", &save); t && nsizes < MAX_SIZES; t = strtok_r(NULL, ",", &save)) {
+        long v = atol(t);
+        if (v > 0 && v < MAX_CODE) sizes[nsizes++] = (size_t)v;
+    }
+
+    if (gateway_init(endpoint) < 0) return 1;
+
+    resp = malloc(RESP_CAP);
+    char *code = malloc(MAX_CODE + 1);
+    if (!resp || !code) die("malloc");
+
+    printf("=== Cold start (%d repetitions, %d warm invokes each, medians in ms) ===\n", reps, warm_runs);
+    for (size_t i = 0; i < NLANGS; i++) {
+        int wanted = !only;
+        if (only) {
+            char list[256];
+            snprintf(list, sizeof(list), "%s", only);
+            char *s2 = NULL;
+            for (char *t = strtok_r(list, ",", &s2); t && !wanted; t = strtok_r(NULL, ",", &s2)) {
+                wanted = strcmp(t, langs[i].lang) == 0;
+            }
+        }
+        lang_ok[i] = wanted && have_tool(langs[i].tool);
+        if (wanted && !lang_ok[i]) printf("%-28s skipped (%s not found)\n", langs[i].lang, langs[i].tool);
+    }
+    printf("%-28s %-7s %7s", "function", "lang", "bytes");
+    for (int p = 0; p < PH_COUNT; p++) printf(" %9s", phase_names[p]);
+    printf("\n");
+
+    int rc = 0;
+    if (examples[0]) rc = bench_examples(examples, reps, warm_runs, code);
+    for (size_t i = 0; i < NLANGS && rc == 0; i++) {
+        if (!lang_ok[i]) continue;
+        for (int s = 0; s < nsizes && rc == 0; s++) {
+            char label[48], name[64];
+            size_t len = gen_code(langs[i].lang, sizes[s], code, MAX_CODE);
+            snprintf(label, sizeof(label), "gen_%s_%zu", langs[i].lang, sizes[s]);
+            snprintf(name, sizeof(name), "cs_%s", label);
+            rc = bench_function(label, name, langs[i].lang, code, len, GEN_MARKER, reps, warm_runs);
+        }
+    }
+
+    free(code);
+    free(resp);
+    if (rc < 0) return 1;
+    return json_path ? (write_json(json_path, "coldstart") < 0) : 0;
+}
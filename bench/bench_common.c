@@ -0,0 +1,108 @@
+/*
+** Mini FaaS - Benchmark helpers
+** Clock, result list and JSON writer, and the gateway HTTP client shared by
+** the benchmark suites.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "bench_common.h"
+#include "ipc.h"
+
+#define MAX_RESULTS 512
+
+typedef struct {
+    char name[64];
+    double value;
+    const char *unit;
+    int higher_is_better;
+} result_t;
+
+static result_t results[MAX_RESULTS];
+static int nresults = 0;
+static struct sockaddr_in gw_addr;
+
+double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+void add_result(const char *name, double value, const char *unit, int higher_is_better) {
+    if (nresults == MAX_RESULTS) return;
+    result_t *r = &results[nresults++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->value = value;
+    r->unit = unit;
+    r->higher_is_better = higher_is_better;
+}
+
+int write_json(const char *path, const char *suite) {
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    // One result per line, read back by bench_compare
+    fprintf(f, "{\"suite\":\"%s\",\"time\":%ld,\"results\":[\n", suite, (long)time(NULL));
+    for (int i = 0; i < nresults; i++) {
+        fprintf(f, "{\"name\":\"%s\",\"value\":%.4f,\"unit\":\"%s\",\"better\":\"%s\"}%s\n",
+                results[i].name, results[i].value, results[i].unit,
+                results[i].higher_is_better ? "higher" : "lower", i + 1 < nresults ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    if (f != stdout) fclose(f);
+    return 0;
+}
+
+int gateway_init(const char *endpoint) {
+    char host[64] = "127.0.0.1";
+    int port = 8080;
+    sscanf(endpoint, "%63[^:]:%d", host, &port);
+    memset(&gw_addr, 0, sizeof(gw_addr));
+    gw_addr.sin_family = AF_INET;
+    gw_addr.sin_port = htons((unsigned short)port);
+    if (inet_pton(AF_INET, host, &gw_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad gateway address %s\n", endpoint);
+        return -1;
+    }
+    return 0;
+}
+
+int http_request(const char *method, const char *path, const char *body, size_t body_len,
+                 char *resp, size_t resp_cap) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&gw_addr, sizeof(gw_addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    char hdr[512];
+    int n = snprintf(hdr, sizeof(hdr), "%s %s HTTP/1.1\r\nHost: bench\r\nContent-Length: %zu\r\n"
+                     "Connection: close\r\n\r\n", method, path, body_len);
+    write_all(fd, hdr, (size_t)n);
+    if (body_len) write_all(fd, body, body_len);
+
+    size_t off = 0;
+    ssize_t r;
+    while (off + 1 < resp_cap && (r = read(fd, resp + off, resp_cap - 1 - off)) > 0) off += (size_t)r;
+    resp[off] = '\0';
+    close(fd);
+
+    int status = 0;
+    if (sscanf(resp, "HTTP/1.1 %d", &status) != 1) return -1;
+    char *b = strstr(resp, "\r\n\r\n");
+    if (b) memmove(resp, b + 4, strlen(b + 4) + 1);
+    return status;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+// Shared by the benchmarks: a clock, the results in the JSON format read
+// back by bench_compare, and an HTTP client for the gateway.
+
+double now_s(void);                                  // monotonic, in seconds
+int cmp_double(const void *a, const void *b);        // qsort() ascending
+
+// unit: a string literal, kept as is; higher_is_better for rates
+void add_result(const char *name, double value, const char *unit, int higher_is_better);
+
+// Writes the results as suite ("-" = stdout); -1 if path cannot be opened
+int write_json(const char *path, const char *suite);
+
+// Gateway given as host:port; -1 (reported) if the address is invalid
+int gateway_init(const char *endpoint);
+
+// One HTTP request (Connection: close); returns the status (-1 if the
+// gateway is unreachable), body in resp
+int http_request(const char *method, const char *path, const char *body, size_t body_len,
+                 char *resp, size_t resp_cap);
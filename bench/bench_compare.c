@@ -0,0 +1,104 @@
+/*
+** Mini FaaS - Benchmark comparison
+** Compares two bench_invoke JSON files result by result and flags the ones
+** that got worse than the threshold. Exits with 1 if any did, so it can
+** gate a build.
+**
+** Usage: bench_compare [-t percent] baseline.json current.json
+** Default threshold: 10%
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_RESULTS 256
+
+typedef struct {
+    char name[64];
+    double value;
+    char unit[16];
+    int higher_is_better;
+} result_t;
+
+// bench_invoke writes one result object per line
+static int load_results(const char *path, result_t *out, int max) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[512];
+    int n = 0;
+    while (n < max && fgets(line, sizeof(line), f)) {
+        const char *p = strstr(line, "{\"name\":\"");
+        if (!p) continue;
+        result_t *r = &out[n];
+        char better[16] = "lower";
+        if (sscanf(p, "{\"name\":\"%63[^\"]\",\"value\":%lf,\"unit\":\"%15[^\"]\",\"better\":\"%15[^\"]\"",
+                   r->name, &r->value, r->unit, better) < 2) {
+            continue;
+        }
+        r->higher_is_better = strcmp(better, "higher") == 0;
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    double threshold = 10.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't') {
+            threshold = atof(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-t percent] baseline.json current.json\n", argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-t percent] baseline.json current.json\n", argv[0]);
+        return 2;
+    }
+
+    static result_t base[MAX_RESULTS], cur[MAX_RESULTS];
+    int nb = load_results(argv[optind], base, MAX_RESULTS);
+    int nc = load_results(argv[optind + 1], cur, MAX_RESULTS);
+    if (nb < 0 || nc < 0) return 2;
+
+    printf("=== %s -> %s (threshold %.0f%%) ===\n", argv[optind], argv[optind + 1], threshold);
+    printf("%-36s %12s %12s %-8s %9s\n", "benchmark", "baseline", "current", "unit", "change");
+    int regressions = 0;
+    for (int i = 0; i < nc; i++) {
+        const result_t *c = &cur[i];
+        const result_t *b = NULL;
+        for (int j = 0; j < nb && !b; j++) {
+            if (strcmp(base[j].name, c->name) == 0) b = &base[j];
+        }
+        if (!b || b->value == 0) {
+            printf("%-36s %12s %12.2f %-8s %9s\n", c->name, "-", c->value, c->unit, "new");
+            continue;
+        }
+        double change = (c->value - b->value) / b->value * 100.0;
+        // Positive = worse, whatever the direction of the unit
+        double worse = c->higher_is_better ? -change : change;
+        const char *flag = "";
+        if (worse > threshold) {
+            flag = "  REGRESSION";
+            regressions++;
+        } else if (worse < -threshold) {
+            flag = "  improved";
+        }
+        printf("%-36s %12.2f %12.2f %-8s %+8.1f%%%s\n", c->name, b->value, c->value, c->unit, change, flag);
+    }
+    for (int j = 0; j < nb; j++) {
+        int found = 0;
+        for (int i = 0; i < nc && !found; i++) found = strcmp(base[j].name, cur[i].name) == 0;
+        if (!found) printf("%-36s %12.2f %12s %-8s %9s\n", base[j].name, base[j].value, "-", base[j].unit, "missing");
+    }
+
+    printf("%d regression(s)\n", regressions);
+    return regressions > 0;
+}
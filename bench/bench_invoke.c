@@ -0,0 +1,479 @@
+/*
+** Mini FaaS - Invoke path micro-benchmarks
+** One isolated benchmark per stage a request goes through, using the
+** components' own code: JSON-line IPC (write_all/read_line over UNIX
+** sockets and pipes), HTTP request parsing in the gateway, JSON
+** escape/unescape of deployed code, metadata lookups in the function store,
+** Wasmer engine/module/instance creation as in execute_wasm(), and, against
+** a running server, cold and warm invokes per language.
+**
+** Usage: bench_invoke [-j out.json] [-f functions] [-e host:port] [-w file.wasm]
+**   -j  write results as JSON (compare runs with bench_compare)
+**   -f  functions in the store for the lookup benchmarks (default 1000)
+**   -e  gateway for the end-to-end benchmarks (skipped without it); deploys
+**       bench_<lang> functions and keeps them
+**   -w  module for the WASM benchmarks (default: a minimal WASI module)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "bench_common.h"
+#include "http.h"
+#include "ipc.h"
+#include "storage.h"
+
+#ifdef USE_WASMER
+#include <wasm.h>
+#include <wasmer.h>
+#endif
+
+#define MIN_TIME_S 0.2       // each measurement runs at least this long
+#define E2E_WARM_RUNS 20
+
+static void report(const char *name, double value, const char *unit, int higher_is_better) {
+    printf("%-36s %14.2f %s\n", name, value, unit);
+    fflush(stdout);
+    add_result(name, value, unit, higher_is_better);
+}
+
+static void skip(const char *name, const char *why) {
+    printf("%-36s %14s (%s)\n", name, "skipped", why);
+}
+
+// Run fn with growing iteration counts until it lasts MIN_TIME_S;
+// returns the time per iteration in ns
+typedef void (*bench_fn_t)(void *ctx, long iters);
+
+static double ns_per_op(bench_fn_t fn, void *ctx) {
+    long iters = 1;
+    for (;;) {
+        double t0 = now_s();
+        fn(ctx, iters);
+        double dt = now_s() - t0;
+        if (dt >= MIN_TIME_S) return dt * 1e9 / (double)iters;
+        iters = dt < MIN_TIME_S / 100 ? iters * 10 : (long)(iters * MIN_TIME_S * 1.2 / dt) + 1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// IPC: one JSON line written with write_all(), read back with read_line()
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int fd;
+    const char *line;
+    size_t len;
+    long count;
+} writer_args_t;
+
+static void *line_writer(void *arg) {
+    writer_args_t *w = arg;
+    for (long i = 0; i < w->count; i++) write_all(w->fd, w->line, w->len);
+    return NULL;
+}
+
+typedef struct {
+    int pipe;        // pipe (worker hop) instead of a UNIX socket (other hops)
+    size_t len;
+} ipc_ctx_t;
+
+static void bench_ipc_lines(void *arg, long iters) {
+    ipc_ctx_t *c = arg;
+    int fds[2];
+    if (c->pipe ? pipe(fds) : socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) die("ipc pair");
+    int rfd = fds[0], wfd = fds[1];
+
+    char *line = malloc(c->len + 1);
+    char *buf = malloc(c->len + 64);
+    if (!line || !buf) die("malloc");
+    memcpy(line, "{\"ok\":true,\"output\":\"", 21);
+    memset(line + 21, 'x', c->len - 24);
+    memcpy(line + c->len - 3, "\"}\n", 3);
+
+    writer_args_t w = { wfd, line, c->len, iters };
+    pthread_t t;
+    pthread_create(&t, NULL, line_writer, &w);
+    for (long i = 0; i < iters; i++) {
+        if (read_line(rfd, buf, c->len + 64) != (ssize_t)c->len) die("short line");
+    }
+    pthread_join(t, NULL);
+    close(rfd);
+    close(wfd);
+    free(line);
+    free(buf);
+}
+
+static void bench_ipc(void) {
+    const struct { const char *name; int pipe; size_t len; } cases[] = {
+        { "ipc.unix.line_128B", 0, 128 },
+        { "ipc.unix.line_4KiB", 0, 4096 },
+        { "ipc.pipe.line_4KiB", 1, 4096 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        ipc_ctx_t c = { cases[i].pipe, cases[i].len };
+        report(cases[i].name, ns_per_op(bench_ipc_lines, &c) / 1000.0, "us/line", 0);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// HTTP request parsing (gateway)
+// ---------------------------------------------------------------------------
+
+static const char *invoke_req =
+    "POST /invoke?fn=hello%3Astable HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "X-Tenant: acme\r\n"
+    "X-Request-Id: 5f2a9c-000142\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 16\r\n"
+    "\r\n"
+    "{\"input\":\"test\"}";
+
+static const char *deploy_req =
+    "POST /deploy?name=thumbnail&lang=python&alias=stable&priority=high&weight=4"
+    "&max_concurrency=8&rate_limit=100&burst=20 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "Content-Length: 2048\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "\r\n";
+
+static volatile int sink;
+
+static void bench_parse_invoke(void *arg, long iters) {
+    (void)arg;
+    char fn[128], tenant[64], rid[64], conn[32], flag[8];
+    for (long i = 0; i < iters; i++) {
+        int r = http_header_value(invoke_req, "Connection", conn, sizeof(conn));
+        r += http_header_value(invoke_req, "X-Trace", flag, sizeof(flag));
+        r += http_header_value(invoke_req, "X-Request-Id", rid, sizeof(rid));
+        r += http_query_param(invoke_req, "fn", fn, sizeof(fn));
+        r += http_header_value(invoke_req, "X-Tenant", tenant, sizeof(tenant));
+        r += http_content_length(invoke_req);
+        sink = r;
+    }
+}
+
+static void bench_parse_deploy(void *arg, long iters) {
+    (void)arg;
+    static const char *keys[] = { "name", "lang", "alias", "priority", "weight",
+                                  "max_concurrency", "rate_limit", "burst" };
+    char val[64];
+    for (long i = 0; i < iters; i++) {
+        int r = http_content_length(deploy_req);
+        for (size_t k = 0; k < sizeof(keys) / sizeof(keys[0]); k++) {
+            r += http_query_param(deploy_req, keys[k], val, sizeof(val));
+        }
+        sink = r;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// JSON escape/unescape of function code (deploy) and output (worker)
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    char *plain, *escaped, *out;
+    size_t plain_len, escaped_len, cap;
+} json_ctx_t;
+
+static void bench_json_escape(void *arg, long iters) {
+    json_ctx_t *c = arg;
+    for (long i = 0; i < iters; i++) sink = (int)json_escape(c->plain, c->plain_len, c->out, c->cap);
+}
+
+static void bench_json_unescape(void *arg, long iters) {
+    json_ctx_t *c = arg;
+    for (long i = 0; i < iters; i++) sink = (int)json_unescape(c->escaped, c->escaped_len, c->out, c->cap);
+}
+
+static void bench_json(void) {
+    // 64 KiB of source code: the escaping cost depends on quotes and newlines
+    const char *src_line = "    printf(\"value=%d\\n\", compute(\"key\", i));\n";
+    json_ctx_t c;
+    c.plain_len = 64 * 1024;
+    c.cap = c.plain_len * 6 + 1;
+    c.plain = malloc(c.plain_len + 1);
+    c.escaped = malloc(c.cap);
+    c.out = malloc(c.cap);
+    if (!c.plain || !c.escaped || !c.out) die("malloc");
+    size_t sl = strlen(src_line);
+    for (size_t i = 0; i < c.plain_len; i++) c.plain[i] = src_line[i % sl];
+    c.plain[c.plain_len] = '\0';
+    c.escaped_len = json_escape(c.plain, c.plain_len, c.escaped, c.cap);
+
+    double mb = c.plain_len / (1024.0 * 1024.0);
+    report("json.escape_64KiB", mb / (ns_per_op(bench_json_escape, &c) / 1e9), "MB/s", 1);
+    report("json.unescape_64KiB", mb / (ns_per_op(bench_json_unescape, &c) / 1e9), "MB/s", 1);
+    free(c.plain);
+    free(c.escaped);
+    free(c.out);
+}
+
+// ---------------------------------------------------------------------------
+// Function store lookups with N deployed functions
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int n;
+    unsigned seed;
+} store_ctx_t;
+
+static void bench_load_metadata(void *arg, long iters) {
+    store_ctx_t *c = arg;
+    function_metadata_t meta;
+    char id[MAX_FUNC_ID];
+    for (long i = 0; i < iters; i++) {
+        c->seed = c->seed * 1103515245 + 12345;
+        char name[MAX_FUNC_NAME];
+        snprintf(name, sizeof(name), "fn%05u", (c->seed >> 8) % (unsigned)c->n);
+        generate_function_id(id, sizeof(id), name, 1);
+        if (load_function_metadata(id, &meta) < 0) die("load_function_metadata");
+    }
+}
+
+static void bench_find_by_name(void *arg, long iters) {
+    store_ctx_t *c = arg;
+    char id[MAX_FUNC_ID];
+    for (long i = 0; i < iters; i++) {
+        c->seed = c->seed * 1103515245 + 12345;
+        char name[MAX_FUNC_NAME];
+        snprintf(name, sizeof(name), "fn%05u", (c->seed >> 8) % (unsigned)c->n);
+        if (find_function_by_name(name, id) < 0) die("find_function_by_name");
+    }
+}
+
+static void rm_tree(const char *dir) {
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd) != 0) fprintf(stderr, "could not remove %s\n", dir);
+}
+
+static void bench_store(int nfuncs) {
+    // The store uses paths relative to the working directory
+    char dir[] = "/tmp/faas_bench_XXXXXX";
+    if (!mkdtemp(dir)) die("mkdtemp");
+    int cwd = open(".", O_RDONLY | O_DIRECTORY);
+    if (cwd < 0 || chdir(dir) < 0) die("chdir");
+    mkdir(FUNCTIONS_DIR, 0755);
+
+    const char *code = "print('hello')\n";
+    for (int i = 0; i < nfuncs; i++) {
+        char name[MAX_FUNC_NAME], id[MAX_FUNC_ID];
+        snprintf(name, sizeof(name), "fn%05d", i);
+        if (store_function(name, "python", code, strlen(code), 1, NULL, id) < 0) die("store_function");
+    }
+
+    char label[64];
+    store_ctx_t c = { nfuncs, 42 };
+    snprintf(label, sizeof(label), "storage.load_metadata_%d", nfuncs);
+    report(label, ns_per_op(bench_load_metadata, &c) / 1000.0, "us/op", 0);
+    snprintf(label, sizeof(label), "storage.find_by_name_%d", nfuncs);
+    report(label, ns_per_op(bench_find_by_name, &c) / 1000.0, "us/op", 0);
+
+    if (fchdir(cwd) < 0) die("fchdir");
+    close(cwd);
+    rm_tree(dir);
+}
+
+// ---------------------------------------------------------------------------
+// Wasmer: the steps of execute_wasm()
+// ---------------------------------------------------------------------------
+
+#ifdef USE_WASMER
+// (module (memory (export "memory") 1) (func (export "_start")))
+static const unsigned char min_wasm[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+    0x01, 0x04, 0x01, 0x60, 0x00, 0x00,                   // type: () -> ()
+    0x03, 0x02, 0x01, 0x00,                               // func 0: type 0
+    0x05, 0x03, 0x01, 0x00, 0x01,                         // memory: min 1 page
+    0x07, 0x13, 0x02,                                     // exports
+    0x06, '_', 's', 't', 'a', 'r', 't', 0x00, 0x00,
+    0x06, 'm', 'e', 'm', 'o', 'r', 'y', 0x02, 0x00,
+    0x0a, 0x04, 0x01, 0x02, 0x00, 0x0b,                   // code: empty body
+};
+
+typedef struct {
+    wasm_engine_t *engine;
+    wasm_store_t *store;
+    wasm_module_t *module;
+    wasm_byte_vec_t binary;
+} wasm_ctx_t;
+
+static void bench_module_new(void *arg, long iters) {
+    wasm_ctx_t *c = arg;
+    for (long i = 0; i < iters; i++) {
+        wasm_store_t *store = wasm_store_new(c->engine);
+        wasm_module_t *module = wasm_module_new(store, &c->binary);
+        if (module) wasm_module_delete(module);
+        wasm_store_delete(store);
+    }
+}
+
+// Per-invoke work on a cached module: WASI environment, imports, instance
+static void bench_instantiate(void *arg, long iters) {
+    wasm_ctx_t *c = arg;
+    for (long i = 0; i < iters; i++) {
+        wasi_config_t *config = wasi_config_new("worker");
+        wasi_env_t *env = wasi_env_new(c->store, config);
+        wasm_extern_vec_t imports;
+        if (!env || !wasi_get_imports(c->store, env, c->module, &imports)) die("wasi setup");
+        wasm_instance_t *instance = wasm_instance_new(c->store, c->module, &imports, NULL);
+        if (!instance) die("wasm_instance_new");
+        wasm_instance_delete(instance);
+        wasm_extern_vec_delete(&imports);
+        wasi_env_delete(env);
+    }
+}
+
+static void bench_wasm(const char *path) {
+    wasm_ctx_t c;
+    memset(&c, 0, sizeof(c));
+    if (path) {
+        FILE *f = fopen(path, "rb");
+        if (!f) {
+            perror(path);
+            return;
+        }
+        fseek(f, 0, SEEK_END);
+        size_t size = (size_t)ftell(f);
+        rewind(f);
+        wasm_byte_vec_new_uninitialized(&c.binary, size);
+        if (fread(c.binary.data, 1, size, f) != size) die("short read");
+        fclose(f);
+    } else {
+        wasm_byte_vec_new(&c.binary, sizeof(min_wasm), (const char *)min_wasm);
+    }
+
+    double t0 = now_s();
+    c.engine = wasm_engine_new();
+    double t1 = now_s();
+    if (!c.engine) {
+        skip("wasm.*", "no Wasmer engine");
+        wasm_byte_vec_delete(&c.binary);
+        return;
+    }
+    report("wasm.engine_new", (t1 - t0) * 1e3, "ms", 0);
+
+    c.store = wasm_store_new(c.engine);
+    c.module = wasm_module_new(c.store, &c.binary);
+    if (!c.module) {
+        skip("wasm.module_new", "module does not compile");
+    } else {
+        report("wasm.module_new", ns_per_op(bench_module_new, &c) / 1000.0, "us/op", 0);
+        report("wasm.instantiate", ns_per_op(bench_instantiate, &c) / 1000.0, "us/op", 0);
+        wasm_module_delete(c.module);
+    }
+    wasm_store_delete(c.store);
+    wasm_engine_delete(c.engine);
+    wasm_byte_vec_delete(&c.binary);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// End to end through a running server
+// ---------------------------------------------------------------------------
+
+static const struct {
+    const char *lang;
+    const char *code;
+} e2e_functions[] = {
+    { "html",   "<p>hello</p>\n" },
+    { "python", "print('hello')\n" },
+    { "js",     "console.log('hello');\n" },
+    { "php",    "<?php echo \"hello\\n\";\n" },
+    { "c",      "#include <stdio.h>\nint main(void) { puts(\"hello\"); return 0; }\n" },
+};
+
+static void bench_e2e(const char *endpoint) {
+    if (gateway_init(endpoint) < 0) return;
+
+    char resp[16384], path[256], label[64];
+    for (size_t i = 0; i < sizeof(e2e_functions) / sizeof(e2e_functions[0]); i++) {
+        const char *lang = e2e_functions[i].lang;
+        snprintf(path, sizeof(path), "/deploy?name=bench_%s&lang=%s", lang, lang);
+        snprintf(label, sizeof(label), "e2e.%s.*", lang);
+        int st = http_request("POST", path, e2e_functions[i].code, strlen(e2e_functions[i].code), resp, sizeof(resp));
+        if (st < 0) {
+            skip("e2e.*", "gateway unreachable");
+            return;
+        }
+        if (st != 200 && st != 201) {
+            skip(label, "deploy failed");
+            continue;
+        }
+
+        // Cold: first invoke of the new version; warm: median of the next ones
+        snprintf(path, sizeof(path), "/invoke?fn=bench_%s", lang);
+        double t0 = now_s();
+        st = http_request("POST", path, "x", 1, resp, sizeof(resp));
+        double cold = now_s() - t0;
+        if (st != 200 || !strstr(resp, "\"ok\":true") || !strstr(resp, "hello")) {
+            skip(label, "invoke failed (runtime missing?)");
+            continue;
+        }
+        double warm[E2E_WARM_RUNS];
+        for (int k = 0; k < E2E_WARM_RUNS; k++) {
+            t0 = now_s();
+            http_request("POST", path, "x", 1, resp, sizeof(resp));
+            warm[k] = now_s() - t0;
+        }
+        qsort(warm, E2E_WARM_RUNS, sizeof(double), cmp_double);
+        snprintf(label, sizeof(label), "e2e.%s.cold", lang);
+        report(label, cold * 1e3, "ms", 0);
+        snprintf(label, sizeof(label), "e2e.%s.warm_p50", lang);
+        report(label, warm[E2E_WARM_RUNS / 2] * 1e3, "ms", 0);
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+    const char *json_path = NULL, *endpoint = NULL, *wasm_path = NULL;
+    int nfuncs = 1000;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:f:e:w:")) != -1) {
+        switch (opt) {
+            case 'j': json_path = optarg; break;
+            case 'f': nfuncs = atoi(optarg); break;
+            case 'e': endpoint = optarg; break;
+            case 'w': wasm_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-j out.json] [-f functions] [-e host:port] [-w file.wasm]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (nfuncs <= 0 || nfuncs > 99999) nfuncs = 1000;
+
+    printf("=== Invoke path micro-benchmarks ===\n");
+    bench_ipc();
+    report("http.parse_invoke", ns_per_op(bench_parse_invoke, NULL), "ns/op", 0);
+    report("http.parse_deploy", ns_per_op(bench_parse_deploy, NULL), "ns/op", 0);
+    bench_json();
+    bench_store(nfuncs);
+#ifdef USE_WASMER
+    bench_wasm(wasm_path);
+#else
+    (void)wasm_path;
+    skip("wasm.*", "built without USE_WASMER");
+#endif
+    if (endpoint) {
+        bench_e2e(endpoint);
+    } else {
+        skip("e2e.*", "no -e host:port");
+    }
+
+    return json_path ? (write_json(json_path, "invoke_path") < 0) : 0;
+}
@@ -0,0 +1,112 @@
+/*
+** Mini FaaS - Logging overhead benchmark
+** Threads emit request-sized log lines (like the per-hop "[LB] 📨 Received
+** invoke request: {...}" lines) and we measure what the request path pays:
+** synchronous fprintf(stderr) as before, the async logger, a sampled line,
+** and a debug line disabled at runtime.
+**
+** Usage: bench_log [threads] [lines_per_thread] [sink]
+** Defaults: 8 threads, 200000 lines, stderr redirected to /dev/null
+** (use a file on disk as sink to include the filesystem)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "log.h"
+
+#define MAX_THREADS 256
+
+typedef enum { MODE_FPRINTF, MODE_ASYNC, MODE_SAMPLED, MODE_DEBUG_OFF, MODE_COUNT } bench_mode_t;
+
+static const char *mode_names[MODE_COUNT] = {
+    "fprintf(stderr)", "log_info (async)", "log_sampled", "log_debug (disabled)",
+};
+
+typedef struct {
+    bench_mode_t mode;
+    int id;
+    int lines;
+} bench_args_t;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *arg) {
+    bench_args_t *a = arg;
+    const char *payload = "{\"input\":\"some request payload of typical size for a small function\"}";
+    for (int i = 0; i < a->lines; i++) {
+        switch (a->mode) {
+            case MODE_FPRINTF:
+                fprintf(stderr, "[LB] 📨 Received invoke request: {\"type\":\"invoke\",\"fn\":\"hello_v%d\","
+                        "\"rid\":\"%x-%x\",\"payload\":\"%s\"}\n", i % 50, a->id, i, payload);
+                break;
+            case MODE_ASYNC:
+                log_info("[LB] 📨 Received invoke request: {\"type\":\"invoke\",\"fn\":\"hello_v%d\","
+                         "\"rid\":\"%x-%x\",\"payload\":\"%s\"}", i % 50, a->id, i, payload);
+                break;
+            case MODE_SAMPLED:
+                log_sampled(LOG_LEVEL_INFO, "[LB] 📨 Received invoke request: {\"type\":\"invoke\",\"fn\":\"hello_v%d\","
+                            "\"rid\":\"%x-%x\",\"payload\":\"%s\"}", i % 50, a->id, i, payload);
+                break;
+            default:
+                log_debug("[LB] 📨 Received invoke request: {\"type\":\"invoke\",\"fn\":\"hello_v%d\","
+                          "\"rid\":\"%x-%x\",\"payload\":\"%s\"}", i % 50, a->id, i, payload);
+                break;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int lines = argc > 2 ? atoi(argv[2]) : 200000;
+    const char *sink = argc > 3 ? argv[3] : "/dev/null";
+    if (threads <= 0 || threads > MAX_THREADS || lines <= 0) {
+        fprintf(stderr, "usage: %s [threads] [lines_per_thread] [sink]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(sink, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0 || dup2(fd, STDERR_FILENO) < 0) {
+        perror(sink);
+        return 1;
+    }
+    close(fd);
+    log_init();
+    log_level = LOG_LEVEL_INFO;
+
+    printf("=== Logging overhead: %d threads x %d lines, sink %s ===\n", threads, lines, sink);
+    printf("%-22s %12s %10s %12s %10s\n", "mode", "lines/s", "ns/line", "drain (ms)", "dropped");
+    printf("(async lines are dropped, never waited for, when a thread outruns the drainer)\n");
+
+    pthread_t tids[MAX_THREADS];
+    bench_args_t args[MAX_THREADS];
+    for (int m = 0; m < MODE_COUNT; m++) {
+        unsigned long dropped0 = log_dropped();
+        double t0 = now_s();
+        for (int i = 0; i < threads; i++) {
+            args[i] = (bench_args_t){ (bench_mode_t)m, i, lines };
+            pthread_create(&tids[i], NULL, producer, &args[i]);
+        }
+        for (int i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+        double t1 = now_s();
+        if (m == MODE_FPRINTF) fflush(stderr);
+        log_flush();
+        double t2 = now_s();
+
+        double total = (double)threads * lines;
+        // Per-thread cost: every thread ran concurrently for t1 - t0
+        printf("%-22s %12.0f %10.1f %12.2f %10lu\n", mode_names[m], total / (t1 - t0),
+               (t1 - t0) * 1e9 / lines, (t2 - t1) * 1e3, log_dropped() - dropped0);
+    }
+    return 0;
+}
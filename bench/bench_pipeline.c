@@ -0,0 +1,162 @@
+/*
+** Mini FaaS - Pipeline benchmark
+** Deploys a chain of stages (each appends "+<n>" to its stdin) and the same
+** chain as a pipeline, then times, for each repetition:
+**   client    the client invokes every stage in turn, sending each output
+**             back as the next payload (one gateway round trip per stage)
+**   pipeline  one invoke of the pipeline: the stages run on one worker and
+**             pass their outputs in memory
+** Both must return the same output.
+**
+** Usage: bench_pipeline [-e host:port] [-r reps] [-n stages] [-l lang] [-j out.json]
+**   -e  gateway (default 127.0.0.1:8080)
+**   -r  repetitions (default 20)
+**   -n  stages (default 5)
+**   -l  stage language: python, js or php (default python)
+**   -j  write results as JSON (compare runs with bench_compare)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "ipc.h"
+
+#define MAX_REPS 1000
+#define MAX_STAGES 16            // PIPELINE_MAX_STAGES
+#define RESP_CAP (256 * 1024)
+#define PAYLOAD_CAP 4096
+
+static char *resp;
+
+// The "output" string of an invoke response, unescaped; -1 if absent
+static int json_output(const char *body, char *out, size_t cap) {
+    const char *p = strstr(body, "\"output\":\"");
+    if (!p) return -1;
+    p += 10;
+    size_t len = 0;
+    for (; *p && *p != '"' && len + 1 < cap; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+            switch (*p) {
+                case 'n': out[len++] = '\n'; break;
+                case 't': out[len++] = '\t'; break;
+                case 'r': out[len++] = '\r'; break;
+                case 'u': out[len++] = '?'; p += 4; break;   // not produced by the stages
+                default: out[len++] = *p; break;
+            }
+        } else {
+            out[len++] = *p;
+        }
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+static const char *stage_code(const char *lang, int n, char *buf, size_t cap) {
+    if (strcmp(lang, "js") == 0) {
+        snprintf(buf, cap, "const s = require('fs').readFileSync(0, 'utf8').trim();\n"
+                 "console.log(s + '+%d');\n", n);
+    } else if (strcmp(lang, "php") == 0) {
+        snprintf(buf, cap, "<?php\necho trim(file_get_contents('php://stdin')) . \"+%d\\n\";\n", n);
+    } else {
+        snprintf(buf, cap, "import sys\nprint(sys.stdin.read().strip() + '+%d')\n", n);
+    }
+    return buf;
+}
+
+static void report(const char *label, double *v, int n) {
+    qsort(v, (size_t)n, sizeof(double), cmp_double);
+    double p50 = v[n / 2], p99 = v[(int)(n * 0.99)];
+    printf("  %-9s p50 %8.2f ms  p99 %8.2f ms\n", label, p50, p99);
+    char name[64];
+    snprintf(name, sizeof(name), "pipeline.%s.p50", label);
+    add_result(name, p50, "ms", 0);
+    snprintf(name, sizeof(name), "pipeline.%s.p99", label);
+    add_result(name, p99, "ms", 0);
+}
+
+int main(int argc, char **argv) {
+    const char *endpoint = "127.0.0.1:8080", *lang = "python", *json_path = NULL;
+    int reps = 20, stages = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:r:n:l:j:")) != -1) {
+        switch (opt) {
+            case 'e': endpoint = optarg; break;
+            case 'r': reps = atoi(optarg); break;
+            case 'n': stages = atoi(optarg); break;
+            case 'l': lang = optarg; break;
+            case 'j': json_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-e host:port] [-r reps] [-n stages] [-l lang] [-j out.json]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (reps < 1 || reps > MAX_REPS) reps = 20;
+    if (stages < 1 || stages > MAX_STAGES) stages = 5;
+
+    if (gateway_init(endpoint) < 0) return 1;
+    resp = malloc(RESP_CAP);
+    if (!resp) die("malloc");
+
+    // Stages bp_s1..bp_sN, and bp_chain running them in order
+    char code[512], path[256], spec[1024] = "";
+    size_t spec_len = 0;
+    for (int i = 1; i <= stages; i++) {
+        stage_code(lang, i, code, sizeof(code));
+        snprintf(path, sizeof(path), "/deploy?name=bp_s%d&lang=%s", i, lang);
+        int st = http_request("POST", path, code, strlen(code), resp, RESP_CAP);
+        if (st != 201) {
+            fprintf(stderr, "deploy bp_s%d failed (%d): %.*s\n", i, st, (int)strcspn(resp, "\n"), resp);
+            return 1;
+        }
+        spec_len += (size_t)snprintf(spec + spec_len, sizeof(spec) - spec_len, "bp_s%d\n", i);
+    }
+    snprintf(path, sizeof(path), "/deploy?name=bp_chain&lang=pipeline");
+    int st = http_request("POST", path, spec, spec_len, resp, RESP_CAP);
+    if (st != 201) {
+        fprintf(stderr, "deploy bp_chain failed (%d): %.*s\n", st, (int)strcspn(resp, "\n"), resp);
+        return 1;
+    }
+
+    static double client[MAX_REPS], pipeline[MAX_REPS];
+    char payload[PAYLOAD_CAP], expect[PAYLOAD_CAP], out[PAYLOAD_CAP];
+    printf("=== Pipeline: %d %s stages, %d repetitions ===\n", stages, lang, reps);
+    for (int r = 0; r < reps; r++) {
+        // Client-side chaining
+        double t0 = now_s();
+        snprintf(payload, sizeof(payload), "r%d", r);
+        for (int i = 1; i <= stages; i++) {
+            snprintf(path, sizeof(path), "/invoke?fn=bp_s%d", i);
+            st = http_request("POST", path, payload, strlen(payload), resp, RESP_CAP);
+            if (st != 200 || json_output(resp, payload, sizeof(payload)) < 0) {
+                fprintf(stderr, "invoke bp_s%d failed (%d): %.*s\n", i, st, (int)strcspn(resp, "\n"), resp);
+                return 1;
+            }
+        }
+        client[r] = (now_s() - t0) * 1e3;
+        snprintf(expect, sizeof(expect), "%s", payload);
+
+        // One pipeline invoke
+        snprintf(payload, sizeof(payload), "r%d", r);
+        t0 = now_s();
+        st = http_request("POST", "/invoke?fn=bp_chain", payload, strlen(payload), resp, RESP_CAP);
+        pipeline[r] = (now_s() - t0) * 1e3;
+        if (st != 200 || json_output(resp, out, sizeof(out)) < 0) {
+            fprintf(stderr, "invoke bp_chain failed (%d): %.*s\n", st, (int)strcspn(resp, "\n"), resp);
+            return 1;
+        }
+        if (strcmp(out, expect) != 0) {
+            fprintf(stderr, "outputs differ: client %s, pipeline %s\n", expect, out);
+            return 1;
+        }
+    }
+    report("client", client, reps);
+    report("pipeline", pipeline, reps);
+
+    free(resp);
+    return json_path ? (write_json(json_path, "pipeline") < 0) : 0;
+}
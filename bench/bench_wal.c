@@ -0,0 +1,185 @@
+/*
+** Mini FaaS - Job WAL benchmark
+** Threads append job-sized records to a fresh WAL and wait for each one to
+** be on disk, as a POST /invoke?async=1 does before answering 202. With one
+** thread every append pays its own fdatasync; with more, appends arriving
+** during a sync share the next one (group commit). Then the log is opened
+** again and replayed, as on a gateway restart.
+**
+** Usage: bench_wal [-t threads,...] [-n records] [-s bytes] [-d dir] [-j out.json]
+**   -t  appender thread counts (default 1,16,64)
+**   -n  records per run (default 20000)
+**   -s  record size (default 512, a small invoke line)
+**   -d  WAL directory, emptied before each run (default /tmp/bench_wal);
+**       put it on the disk the gateway uses, tmpfs makes syncs free
+**   -j  write results as JSON (compare runs with bench_compare)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "bench_common.h"
+#include "wal.h"
+
+#define MAX_THREADS 256
+#define MAX_RUNS 8
+#define SEGMENT_BYTES (16u << 20)
+
+typedef struct {
+    wal_t *wal;
+    int records;
+    size_t size;
+    double *lat_us;              // per append
+} appender_t;
+
+static void clear_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *e;
+    char path[512];
+    while ((e = readdir(d))) {
+        if (strncmp(e->d_name, "wal-", 4) != 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+static void *appender(void *arg) {
+    appender_t *a = arg;
+    char *rec = malloc(a->size);
+    if (!rec) return NULL;
+    memset(rec, 'x', a->size);
+    for (int i = 0; i < a->records; i++) {
+        double t0 = now_s();
+        if (wal_append(a->wal, 1, rec, a->size, 1, 0) < 0) {
+            fprintf(stderr, "wal_append failed\n");
+            break;
+        }
+        a->lat_us[i] = (now_s() - t0) * 1e6;
+    }
+    free(rec);
+    return NULL;
+}
+
+static int run_appends(const char *dir, int threads, int records, size_t size) {
+    clear_dir(dir);
+    wal_t *wal = wal_open(dir, SEGMENT_BYTES);
+    if (!wal) {
+        fprintf(stderr, "cannot open a WAL in %s\n", dir);
+        return -1;
+    }
+    int per = records / threads;
+    if (per < 1) per = 1;
+    pthread_t tids[MAX_THREADS];
+    appender_t args[MAX_THREADS];
+    double *lat = calloc((size_t)per * threads, sizeof(double));
+    if (!lat) {
+        wal_close(wal);
+        return -1;
+    }
+
+    double t0 = now_s();
+    for (int i = 0; i < threads; i++) {
+        args[i] = (appender_t){ wal, per, size, lat + (size_t)i * per };
+        pthread_create(&tids[i], NULL, appender, &args[i]);
+    }
+    for (int i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+    double elapsed = now_s() - t0;
+
+    wal_stats_t st;
+    wal_get_stats(wal, &st);
+    wal_close(wal);
+
+    int total = per * threads;
+    qsort(lat, (size_t)total, sizeof(double), cmp_double);
+    double ops = total / elapsed;
+    double p50 = lat[total / 2], p99 = lat[(int)(total * 0.99)];
+    double group = st.syncs ? (double)st.appends / st.syncs : 0;
+    free(lat);
+
+    printf("  %3d thread%s  %9.0f appends/s  p50 %8.1f us  p99 %8.1f us  %6.1f appends/sync\n",
+           threads, threads > 1 ? "s" : " ", ops, p50, p99, group);
+
+    char name[64];
+    snprintf(name, sizeof(name), "append_sync_t%d_ops", threads);
+    add_result(name, ops, "ops/s", 1);
+    snprintf(name, sizeof(name), "append_sync_t%d_p99", threads);
+    add_result(name, p99, "us", 0);
+    snprintf(name, sizeof(name), "append_sync_t%d_group", threads);
+    add_result(name, group, "appends/sync", 1);
+    return 0;
+}
+
+static void count_record(void *ctx, uint32_t seg, uint8_t type, const void *data, size_t len) {
+    (void)seg; (void)type; (void)data;
+    long *c = ctx;
+    c[0]++;
+    c[1] += (long)len;
+}
+
+// Replays what the last append run left on disk
+static int run_replay(const char *dir) {
+    double t0 = now_s();
+    wal_t *wal = wal_open(dir, SEGMENT_BYTES);
+    if (!wal) return -1;
+    long counts[2] = { 0, 0 };
+    int n = wal_replay(wal, count_record, counts);
+    double elapsed = now_s() - t0;
+    wal_close(wal);
+    if (n < 0) return -1;
+    double rate = elapsed > 0 ? n / elapsed : 0;
+    printf("  replay      %9.0f records/s  (%d records, %.1f MiB, %.1f ms)\n",
+           rate, n, counts[1] / 1048576.0, elapsed * 1e3);
+    add_result("replay_records", rate, "records/s", 1);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = "/tmp/bench_wal", *json_path = NULL;
+    char thread_list[128] = "1,16,64";
+    int records = 20000;
+    size_t size = 512;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:s:d:j:")) != -1) {
+        switch (opt) {
+            case 't': snprintf(thread_list, sizeof(thread_list), "%s", optarg); break;
+            case 'n': records = atoi(optarg); break;
+            case 's': size = (size_t)atol(optarg); break;
+            case 'd': dir = optarg; break;
+            case 'j': json_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-t threads,...] [-n records] [-s bytes] [-d dir] [-j out.json]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (records < 1 || size < 1) {
+        fprintf(stderr, "records and size must be positive\n");
+        return 1;
+    }
+    mkdir(dir, 0755);
+
+    printf("WAL appends waiting for disk: %d records of %zu bytes in %s\n", records, size, dir);
+    int runs = 0;
+    for (char *save = NULL, *tok = strtok_r(thread_list, ",", &save); tok && runs < MAX_RUNS;
+         tok = strtok_r(NULL, ",", &save), runs++) {
+        int threads = atoi(tok);
+        if (threads < 1 || threads > MAX_THREADS) {
+            fprintf(stderr, "thread count must be 1..%d\n", MAX_THREADS);
+            return 1;
+        }
+        if (run_appends(dir, threads, records, size) < 0) return 1;
+    }
+    if (run_replay(dir) < 0) return 1;
+    clear_dir(dir);
+
+    return json_path ? (write_json(json_path, "wal") < 0) : 0;
+}
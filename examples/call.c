@@ -0,0 +1,19 @@
+// C function calling another deployed function (host import faas.call)
+#include <stdio.h>
+#include <string.h>
+
+__attribute__((import_module("faas"), import_name("call")))
+int faas_call(const char *fn, int fn_len, const char *in, int in_len, char *out, int out_cap);
+
+int main() {
+    const char *fn = "hello:v1";
+    const char *in = "from call.c";
+    char out[1024] = {0};
+    int n = faas_call(fn, (int)strlen(fn), in, (int)strlen(in), out, (int)sizeof(out) - 1);
+    if (n < 0) {
+        printf("call failed: %s\n", out);
+        return 1;
+    }
+    printf("hello said: %s", out);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+// Bounded-load consistent hashing of function IDs onto workers.
+// A function always maps to the same ordered list of workers on the ring;
+// the LB walks that list and takes the first worker that is not saturated,
+// preferring one that already has the function warm.
+
+#define AFFINITY_VNODES 64        // virtual nodes per worker on the ring
+#define AFFINITY_BALANCE 1.25     // load bound factor c: max load = ceil(c * avg)
+#define AFFINITY_MIN_BOUND 2      // queueing behind one warm request beats a cold compile
+
+typedef struct {
+    uint32_t point;
+    int worker;
+} ring_point_t;
+
+typedef struct {
+    ring_point_t *points;
+    int npoints;
+    int nworkers;
+} hash_ring_t;
+
+uint64_t affinity_hash(const char *s);
+
+// (Re)build ring for the given worker ids. Returns 0 on success.
+int ring_build(hash_ring_t *ring, const int *worker_ids, int n);
+void ring_free(hash_ring_t *ring);
+
+// Pick a worker for key. load[] and warm[] are indexed by worker id;
+// a negative load marks a worker as unavailable (no free slot), warm may
+// be NULL. Returns worker id or -1 if no worker on the ring is available.
+int affinity_pick(const hash_ring_t *ring, uint64_t key, const int *load,
+                  const unsigned char *warm, double balance);
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Gateway traffic capture, replayed by load_injector -R.
+// FAAS_CAPTURE=<file> makes the gateway append one binary record per HTTP
+// request; FAAS_CAPTURE_PAYLOADS=0 keeps only the length and a hash of the
+// bodies. Records are buffered in memory and written at most once a second
+// (or when the buffer fills), so the request path only pays a memcpy.
+//
+// File: "FAASCAP1", u64 wall clock start (us), then records, little endian:
+//   u32 size of the rest   u64 offset_us      u32 latency_us   u16 status
+//   u8  flags              u64 payload hash   u32 payload_len
+//   u8 + method   u16 + path (with query)   u8 + function   u8 + tenant
+//   payload bytes (only with CAPTURE_F_PAYLOAD)
+
+#define CAPTURE_MAGIC "FAASCAP1"
+#define CAPTURE_F_PAYLOAD 0x01   // payload bytes follow the record
+
+typedef struct {
+    uint64_t offset_us;          // request arrival since capture start
+    uint32_t latency_us;         // headers received to response written
+    uint16_t status;
+    uint8_t flags;
+    uint64_t payload_hash;       // FNV-1a 64 of the body
+    uint32_t payload_len;
+    char method[8];
+    char path[512];
+    char fn[128];
+    char tenant[64];
+    char *payload;               // malloc'd, NULL without CAPTURE_F_PAYLOAD
+} capture_record_t;
+
+// Gateway side: per-request state, filled while the request is served
+typedef struct {
+    uint64_t start_us;
+    int status;
+    char method[8];
+    char path[512];
+    char fn[128];
+    char tenant[64];
+    uint64_t payload_hash;
+    uint32_t payload_len;
+    char *body;                  // copy of the payload (grows, reused per thread)
+    size_t body_cap;
+    int has_body;
+} capture_req_t;
+
+int capture_open(const char *path, int store_payloads);   // starts the flusher
+int capture_enabled(void);
+uint64_t capture_now_us(void);
+uint64_t capture_hash(const void *data, size_t len);
+
+// Start a request from its raw HTTP headers
+void capture_begin(capture_req_t *r, const char *request);
+void capture_body(capture_req_t *r, const char *body, size_t len);
+void capture_end(capture_req_t *r);       // append the record
+void capture_flush(void);
+
+// Reader: returns 1 with a record, 0 at end of file, -1 on a corrupt file
+typedef struct capture_reader capture_reader_t;
+capture_reader_t *capture_reader_open(const char *path, uint64_t *start_wall_us);
+int capture_read(capture_reader_t *rd, capture_record_t *rec);
+void capture_record_free(capture_record_t *rec);
+void capture_reader_close(capture_reader_t *rd);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+// Log-linear latency histogram in the spirit of HdrHistogram: values are
+// bucketed by power of two, each power split into 2^HIST_SUB_BITS linear
+// sub-buckets, so any recorded value is reproduced within 0.1%.
+// Not thread-safe: keep one per thread and merge.
+
+#define HIST_SUB_BITS 10
+#define HIST_MAX_BITS 40      // values up to 2^40 (~12 days in microseconds)
+
+typedef struct {
+    uint64_t *counts;
+    int nbuckets;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+} histogram_t;
+
+int hist_init(histogram_t *h);
+void hist_free(histogram_t *h);
+void hist_reset(histogram_t *h);
+void hist_record(histogram_t *h, uint64_t value);
+void hist_merge(histogram_t *dst, const histogram_t *src);
+
+// Value at percentile p (0..100); 0 if empty
+uint64_t hist_percentile(const histogram_t *h, double p);
+double hist_mean(const histogram_t *h);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+// HTTP/1.1 request parsing used by the API gateway. req is the NUL-terminated
+// request head (request line and headers, possibly followed by body bytes).
+
+// Content-Length header value, -1 if absent
+int http_content_length(const char *hdrs);
+
+// Copy the value of a request header (case-insensitive name). Returns 0 if found.
+int http_header_value(const char *req, const char *name, char *out, size_t out_len);
+
+// Extract a query parameter from the request line ("POST /path?a=1&b=2 HTTP/1.1").
+// Decodes %XX escapes (e.g. %3A for ':'). Returns 0 if found.
+int http_query_param(const char *req, const char *key, char *out, size_t out_len);
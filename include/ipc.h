@@ -5,6 +5,8 @@
 
 #define LB_SOCK_PATH "/tmp/faas_lb.sock"
 #define SERVER_SOCK_PATH "/tmp/faas_server.sock"
+#define BATCH_MAX 1000  // invokes in one POST /invoke/batch
+#define MAP_MAX 100000  // inputs of one POST /map
 
 int create_unix_server_socket(const char *path);     // returns listen fd
 int create_unix_client_socket(const char *path);     // returns connected fd
@@ -13,7 +15,53 @@ int set_nonblocking(int fd);
 ssize_t write_all(int fd, const void *buf, size_t len);
 ssize_t read_line(int fd, char *buf, size_t maxlen); // reads up to \n (included)
 
+// Buffered reads for connections carrying many lines (read_line issues one
+// read() per byte). Don't mix with read_line on the same fd.
+typedef struct {
+    int fd;
+    size_t start, end;
+    char buf[8192];
+} line_reader_t;
+
+void line_reader_init(line_reader_t *r, int fd);
+ssize_t line_reader_next(line_reader_t *r, char *out, size_t maxlen); // like read_line
+
+// Streamed invokes ("stream":1): the worker sends its output as it comes, in
+// {"chunk":"<escaped>"} lines, before the usual reply line. Every hop passes
+// chunk lines on and blocks while the next one is behind, so a slow client
+// slows the function down instead of filling buffers.
+#define CHUNK_PREFIX "{\"chunk\":"
+#define STREAM_CHUNK 1024  // raw output bytes per chunk line (escaped: under LINE_MAX)
+
+// Reply line from r, chunk lines before it written to relay_fd (-1: dropped).
+// After a failed write to relay_fd, chunks are still read and dropped so the
+// connection stays in step.
+ssize_t read_reply(line_reader_t *r, int relay_fd, char *out, size_t maxlen);
+
+// Request bodies that are large or not line-safe (quotes, backslashes,
+// control or binary bytes) travel beside the lines: the gateway spools them
+// to a memfd and the line names it, "<key>":"/proc/<gateway pid>/fd/<n>",
+// with the size in "<key_len>". Readers open the path for their own offset;
+// the gateway keeps the memfd open until the reply.
+#define BODY_REF_PREFIX "/proc/"
+#define PAYLOAD_INLINE_MAX 4096  // larger payloads are always spooled
+
+// Bytes the JSON lines can carry as they are (no escaping on any hop)
+int line_safe(const char *p, size_t len);
+
+// Opens the ref under key in line (read-only): -1 if the line has none,
+// -2 if it cannot be opened (the request is gone, or not /proc/<pid>/fd/<n>).
+// A ref with "<name>_off" (e.g. payload_off) names the <name>_len bytes at
+// that offset: they come back alone in a fresh memfd.
+int body_ref_open(const char *line, const char *key);
+
 void trim_newline(char *s);
 
-void die(const char *msg);
+// JSON string escaping for JSON-lines messages (no surrounding quotes).
+// Both return the number of bytes written to out (always NUL-terminated);
+// output is truncated on an escape boundary when out_cap is too small.
+size_t json_escape(const char *in, size_t len, char *out, size_t out_cap);
+size_t json_unescape(const char *in, size_t len, char *out, size_t out_cap);
+
+void die(const char *msg) __attribute__((noreturn));
 void warnx(const char *msg);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+
+// Asynchronous invocations (POST /invoke?async=1, GET /jobs/:id).
+// The gateway keeps a job table in memory and answers 202 with the job id
+// straight away. One dispatcher thread sends queued jobs to the server (the
+// same path as synchronous invokes: alias resolution, LB queues, admission)
+// over non-blocking sockets, so a queued job holds no connection or thread.
+// Jobs the LB rejects with 429 go back to the queue until Retry-After.
+// Finished jobs are kept FAAS_JOB_TTL seconds, then forgotten.
+//
+// Submits and results are logged to a WAL (FAAS_JOB_WAL, see wal.h) and a
+// submit is acknowledged once on disk. On startup the table is rebuilt from
+// the log and unfinished jobs run again: execution is at least once. An
+// idempotency key maps a retried submit to the job it already created.
+
+#define JOB_ID_MAX 24
+#define JOB_PAYLOAD_MAX 8000     // kept whole with the job and in its WAL record
+#define JOB_CALLBACK_MAX 256
+#define JOB_KEY_MAX 65
+
+typedef enum {
+    JOB_SUBMIT_OK,
+    JOB_SUBMIT_DUPLICATE,        // key already used: id_out is the existing job
+    JOB_SUBMIT_FULL,
+    JOB_SUBMIT_BAD_CALLBACK,
+    JOB_SUBMIT_IO,               // could not be logged
+} job_submit_t;
+
+// Reads FAAS_JOB_TTL, FAAS_JOBS_MAX, FAAS_ASYNC_INFLIGHT, FAAS_JOB_WAL and
+// replays the WAL
+int jobs_init(void);
+
+// Queue an invocation. callback: http://127.0.0.1:<port>/<path> (or
+// localhost) receiving the final job status as a POST, may be NULL.
+// key: idempotency key (may be NULL), remembered as long as the job.
+// payload: any payload_len bytes; those the invoke line can't carry go to
+// the server in a memfd, as for a synchronous invoke.
+job_submit_t jobs_submit(const char *fn, const char *tenant, const char *rid,
+                         const char *payload, size_t payload_len, const char *callback,
+                         const char *key, char id_out[JOB_ID_MAX]);
+
+// Job status as JSON, waiting up to wait_s for it to finish.
+// Returns a malloc'd string, NULL for an unknown (or expired) id.
+char *jobs_status_json(const char *id, int wait_s);
+
+// Table counts as JSON (malloc'd), for GET /jobs
+char *jobs_stats_json(void);
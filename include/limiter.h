@@ -0,0 +1,36 @@
+#pragma once
+
+// Adaptive concurrency limit (gradient / AIMD hybrid).
+// Each completed request gives a latency sample and the latency the same
+// request would have had without queueing (its baseline). While latency
+// stays within LIMIT_TOLERANCE of the baseline the limit grows; beyond that
+// the limit shrinks in proportion to the inflation, so the worker is kept
+// busy with at most a short queue behind it.
+
+#define LIMIT_INITIAL 2.0
+#define LIMIT_MIN 1.0
+#define LIMIT_MAX 8.0
+#define LIMIT_TOLERANCE 1.5   // latency inflation accepted before backing off
+#define LIMIT_SMOOTHING 0.2   // weight of each new estimate
+#define LIMIT_HEADROOM 1.0    // queued requests allowed beyond the gradient estimate
+
+typedef struct {
+    double limit;
+    double min_limit;
+    double max_limit;
+    double gradient;          // last computed gradient, 1.0 = no inflation
+    unsigned long samples;
+    unsigned long increases;  // times the integer limit went up
+    unsigned long decreases;  // times the integer limit went down
+} conc_limit_t;
+
+// min == max pins the limit (no adaptation)
+void limit_init(conc_limit_t *l, double initial, double min, double max);
+
+// Feed one sample; inflight is the number of requests that were running
+// with it. The limit only grows when it is actually being used.
+// Returns +1 / -1 if the integer limit changed, 0 otherwise.
+int limit_update(conc_limit_t *l, double rtt_ms, double baseline_ms, int inflight);
+
+// Current limit as a number of in-flight requests (>= 1)
+int limit_value(const conc_limit_t *l);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdatomic.h>
+
+// Asynchronous logger. Each thread formats into its own lock-free ring
+// (single producer, single consumer) and a background thread drains all
+// rings to stderr in batches, so the request path never blocks on stderr.
+// A full ring drops the line and counts it instead of waiting.
+//
+// Environment:
+//   FAAS_LOG_LEVEL  error | warn | info (default) | debug
+//   FAAS_LOG_RATE   per call site limit of log_sampled(), lines/s (default 20)
+//   FAAS_LOG_SYNC   1 = write synchronously (debugging crashes)
+//
+// Debug logs (full request/response lines) are compiled out of release
+// builds (make RELEASE=1 sets LOG_COMPILE_LEVEL to LOG_LEVEL_INFO).
+
+typedef enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+} log_level_t;
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+extern int log_level;
+
+// Per call site fixed-window rate limit for log_sampled()
+typedef struct {
+    atomic_long window;          // current second
+    atomic_int count;            // lines emitted in this window
+    atomic_ulong suppressed;     // lines dropped since the last one emitted
+} log_limit_t;
+
+void log_init(void);             // reads the environment; safe to call again
+void log_flush(void);            // drain every ring now (also run at exit)
+unsigned long log_dropped(void); // lines lost to full rings since start
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_write_sampled(int level, log_limit_t *lim, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+int log_allow(log_limit_t *lim);
+
+#define log_enabled(lvl) ((lvl) <= LOG_COMPILE_LEVEL && (lvl) <= log_level)
+
+#define log_at(lvl, ...) do { \
+    if (log_enabled(lvl)) log_write((lvl), __VA_ARGS__); \
+} while (0)
+
+// Per-request lines: at most FAAS_LOG_RATE per second from this call site,
+// the next line emitted reports how many were suppressed
+#define log_sampled(lvl, ...) do { \
+    static log_limit_t log_site_; \
+    if (log_enabled(lvl) && log_allow(&log_site_)) log_write_sampled((lvl), &log_site_, __VA_ARGS__); \
+} while (0)
+
+#define log_error(...) log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...)  log_at(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(...)  log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
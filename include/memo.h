@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "storage.h"
+
+// Result memoization for functions deployed with memo=<seconds>: the gateway
+// keeps successful replies keyed by version ID and payload (two 64-bit hash
+// lanes plus length) for that long, in MEMO_SHARDS locked shards, each an
+// LRU bounded in bytes. Identical requests arriving while one is executing
+// wait for its reply instead of executing again (single flight).
+
+#define MEMO_SHARDS 16
+#define MEMO_BUCKETS 1024                      // hash chains per shard
+#define MEMO_BYTES (64 * 1024 * 1024)          // kept replies (FAAS_MEMO_MB)
+#define MEMO_ENTRY_MAX (1024 * 1024)           // larger replies are not kept
+#define MEMO_WAIT_SEC 30                       // followers then execute alone
+
+typedef struct {
+    char id[MAX_FUNC_ID];
+    uint64_t h1, h2;
+    size_t len;
+} memo_key_t;
+
+// Held by the request executing for a key, passed back to memo_finish
+typedef struct {
+    void *entry;             // NULL: nothing to finish
+    int shard;
+} memo_ticket_t;
+
+void memo_init(size_t max_bytes);
+
+void memo_key(memo_key_t *k, const char *id, const void *payload, size_t len);
+
+// A malloc'd copy of the cached reply (*coalesced set if it was produced
+// while this request waited), or NULL: the caller executes and then calls
+// memo_finish with t
+char *memo_begin(const memo_key_t *k, int ttl, int *coalesced, memo_ticket_t *t);
+
+// resp: the reply to keep, or NULL (failed, not kept: one waiter executes).
+// No-op on an empty ticket.
+void memo_finish(memo_ticket_t *t, const char *resp);
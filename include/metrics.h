@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+
+// Process-shared metrics for GET /metrics (Prometheus text format).
+// The main process creates the segment (memfd) before starting anything;
+// the forked server inherits the mapping and exec'd workers map it again
+// from FAAS_METRICS_FD. Counters are split in cache-line aligned shards,
+// each thread adding to its own with relaxed atomics, and summed when
+// rendered. Every recording call is a no-op when no segment is mapped.
+
+#define METRICS_MAX_FNS 256      // functions tracked (later ones are not)
+#define METRICS_MAX_WORKERS 32
+
+typedef enum {
+    ROUTE_DEPLOY,
+    ROUTE_INVOKE,
+    ROUTE_BATCH,
+    ROUTE_MAP,
+    ROUTE_ALIAS,
+    ROUTE_FUNCTION,
+    ROUTE_QUEUES,
+    ROUTE_METRICS,
+    ROUTE_ADMIN,
+    ROUTE_JOBS,
+    ROUTE_STATIC,
+    ROUTE_OTHER,
+    ROUTE_COUNT
+} metrics_route_t;
+
+typedef enum { INVOKE_OK, INVOKE_ERROR, INVOKE_REJECTED, INVOKE_OUTCOME_COUNT } metrics_outcome_t;
+typedef enum { MEMO_HIT, MEMO_MISS, MEMO_COALESCED, MEMO_RESULT_COUNT } metrics_memo_t;
+typedef enum { COMPILE_DEPLOY, COMPILE_MODULE, COMPILE_STAGE_COUNT } metrics_compile_t;
+
+int metrics_init(void);          // main process: create the segment, export FAAS_METRICS_FD
+int metrics_attach(void);        // exec'd process: map the inherited segment
+
+void metrics_http(metrics_route_t route, int status);
+void metrics_invoke(const char *fn, metrics_outcome_t outcome, double seconds);
+// Resources reported by the worker for one invocation of fn
+void metrics_usage(const char *fn, double cpu_seconds, unsigned long out_bytes, unsigned long mem_bytes);
+void metrics_queue_wait(double seconds);
+void metrics_queue_depth(long depth);
+void metrics_worker_job(int worker, double busy_seconds);
+void metrics_cache(int hit);
+// Gateway result cache lookup for a memoized function
+void metrics_memo(const char *fn, metrics_memo_t result);
+void metrics_compile(metrics_compile_t stage, double seconds);
+void metrics_worker_spawn(void);
+void metrics_worker_crash(void);
+
+// Render all metrics; returns a malloc'd NUL-terminated buffer (NULL if none)
+char *metrics_render(void);
+
+// Live status (GET /admin/status), kept in the same segment: each worker
+// publishes its own state, the server worker pids, the LB its strategy,
+// lane depths and drained workers. Plain atomic stores, read without locks.
+typedef enum { WORKER_DEAD, WORKER_IDLE, WORKER_BUSY, WORKER_COMPILING, WORKER_STATE_COUNT } metrics_worker_state_t;
+
+#define METRICS_LANES 2          // LB lanes: 0 = high, 1 = normal
+
+void metrics_worker_pid(int worker, int pid);      // server: spawned, or 0 when gone
+void metrics_worker_state(int worker, metrics_worker_state_t state, const char *fn);
+void metrics_worker_cached(int worker, int modules);
+void metrics_worker_draining(int worker, int draining);
+void metrics_lb_strategy(const char *name);
+void metrics_lane_depth(int lane, long depth);
+
+// Status as one JSON object; malloc'd (NULL if no segment)
+char *metrics_status_json(void);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "storage.h"
+
+// Pipelines are deployed like functions (lang=pipeline); the code is a spec,
+// one stage per line ('#' starts a comment):
+//   <stage> = <function> [<- <input>, ...]
+//   <function>                    (stage named s<N>)
+// A stage reads the previous stage's output, or the outputs of the listed
+// stages (joined by newlines); "input" is the pipeline payload. Stages only
+// read earlier stages, so a spec is always a DAG; the last stage's output is
+// the pipeline's. At deploy the server resolves every function reference and
+// stores the spec with version IDs: a pipeline version pins its stages.
+
+#define PIPELINE_MAX_STAGES 16
+#define PIPELINE_MAX_INPUTS 4
+#define PIPELINE_STAGE_NAME 32
+#define PIPELINE_INPUT -1           // stage input: the pipeline payload
+
+typedef struct {
+    char name[PIPELINE_STAGE_NAME];
+    char fn[MAX_FUNC_ID];           // reference as written, or version ID
+    int inputs[PIPELINE_MAX_INPUTS];
+    int ninputs;
+} pipeline_stage_t;
+
+typedef struct {
+    pipeline_stage_t stages[PIPELINE_MAX_STAGES];
+    int nstages;
+} pipeline_t;
+
+// Returns 0, or -1 with a message in err
+int pipeline_parse(const char *spec, pipeline_t *p, char *err, size_t err_len);
+
+// Spec text with every stage explicit (name = fn <- inputs); returns its length
+size_t pipeline_format(const pipeline_t *p, char *out, size_t cap);
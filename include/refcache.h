@@ -0,0 +1,23 @@
+#pragma once
+
+#include "storage.h"
+
+// Gateway-side function references: name, name:alias, name:vN or a version
+// ID resolved to a version (same rules as the server) from the persisted
+// aliases, with the metadata the gateway acts on. Results are remembered in
+// a small direct-mapped table until ref_invalidate().
+
+#define REF_MAX (MAX_FUNC_NAME + MAX_ALIAS_NAME + 2)
+
+typedef struct {
+    char id[MAX_FUNC_ID];
+    char lang[16];
+    int memo_ttl;            // function_options_t.memo_ttl
+    int pinned;              // the ref names one version (ID or name:vN)
+} ref_info_t;
+
+// 0 with info filled, -1 if ref names no stored version
+int ref_lookup(const char *ref, ref_info_t *info);
+
+// Aliases may have moved (deploy, alias): resolve references again
+void ref_invalidate(void);
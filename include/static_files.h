@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+
+#include "storage.h"
+
+// Static functions (lang=html) are served by the gateway from their stored
+// file, without going through the server, the LB or a worker. A version's
+// file never changes once deployed, so the version ID and the file's mtime
+// make the ETag, and hot files stay mapped in an LRU (bounded in bytes);
+// larger files are sent with sendfile() on each request. References are
+// resolved by refcache.
+
+#define STATIC_CACHE_ENTRIES 128
+#define STATIC_CACHE_BYTES (64 * 1024 * 1024)   // mapped bytes kept (FAAS_STATIC_CACHE_MB)
+#define STATIC_CACHED_MAX (1024 * 1024)         // larger files are not kept mapped
+
+typedef struct {
+    char id[MAX_FUNC_ID];
+    const char *data;        // mapped content (cached), or NULL: read fd
+    int fd;                  // -1 when data is set
+    size_t size;
+    time_t mtime;
+    char etag[MAX_FUNC_ID + 24];
+    int pinned;              // the ref names one version (ID or name:vN)
+    int slot;                // cache entry held until static_release, -1 if none
+} static_file_t;
+
+void static_init(size_t cache_bytes);
+
+// 1 with f to release if ref is a static function, 0 if it is not (or is
+// unknown: the usual invoke path reports it), -1 if its file can't be read
+int static_open(const char *ref, static_file_t *f);
+void static_release(static_file_t *f);
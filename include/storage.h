@@ -5,6 +5,20 @@
 #define FUNCTIONS_DIR "functions"
 #define MAX_FUNC_NAME 64
 #define MAX_FUNC_ID 128
+#define MAX_ALIAS_NAME 32
+#define ALIASES_DIR FUNCTIONS_DIR "/.aliases"
+
+// Scheduling options set at deploy time (query params), stored in metadata.json
+typedef struct {
+    char priority[8];     // "high" (latency-sensitive lane) or "normal"
+    int weight;           // fair-queuing weight, >= 1
+    int max_concurrency;  // max requests in flight for the function, 0 = unlimited
+    double rate_limit;    // token bucket refill, requests/s, 0 = unlimited
+    int burst;            // token bucket size (defaults to max(1, rate_limit))
+    int memo_ttl;         // seconds the gateway may reuse a result for the same payload, 0 = off
+} function_options_t;
+
+void function_options_default(function_options_t *opts);
 
 typedef struct {
     char id[MAX_FUNC_ID];
@@ -12,25 +26,57 @@ typedef struct {
     char language[16];
     char entrypoint[64];
     size_t size;
+    int version;        // 1 for functions deployed before versioning
+    long created_at;
+    function_options_t options;
 } function_metadata_t;
 
-// Generate unique function ID
-void generate_function_id(char *buf, size_t len, const char *name);
+// Generate function ID for a given version of a function (name_v<version>)
+void generate_function_id(char *buf, size_t len, const char *name, int version);
 
-// Store function code and metadata
-int store_function(const char *name, const char *lang, const char *code, size_t code_len, char *out_id);
+// Next version number for a function name (1 if never deployed), its
+// directory created so that concurrent deploys get distinct numbers; -1 on error
+int reserve_function_version(const char *name);
+
+// Store function code and metadata as a new version (opts may be NULL for defaults)
+int store_function(const char *name, const char *lang, const char *code, size_t code_len, int version,
+                   const function_options_t *opts, char *out_id);
+
+// Same, the code read from code_fd (code_len bytes from its offset): large
+// uploads go from the gateway's spool to disk without passing through memory
+int store_function_fd(const char *name, const char *lang, int code_fd, size_t code_len, int version,
+                      const function_options_t *opts, char *out_id);
 
 // Load function code by ID
 int load_function(const char *id, char *code_buf, size_t buf_len);
 
+// Path of the code file of a version (FUNCTIONS_DIR/<id>/code.<ext>)
+void function_code_path(const char *id, const char *lang, char *path, size_t len);
+
 // Load function metadata by ID
 int load_function_metadata(const char *id, function_metadata_t *meta);
 
 // Check if function exists by ID
 int function_exists(const char *id);
 
+// Delete a version that was never published (its directory and files)
+int remove_function_version(const char *id);
+
 // Check if function name already exists
 int function_name_exists(const char *name);
 
-// Find function ID by name (returns most recent if multiple)
+// Find function ID by name (returns most recent version if multiple)
 int find_function_by_name(const char *name, char *out_id);
+
+// Call cb for every stored function (metadata parsed)
+int scan_functions(void (*cb)(const function_metadata_t *meta, void *ctx), void *ctx);
+
+// Persist alias (e.g. "latest", "stable") of a function name pointing at a version ID.
+// The alias file is replaced atomically (write + rename).
+int set_function_alias(const char *name, const char *alias, const char *id);
+
+// Read a persisted alias: -1 if it was never set
+int get_function_alias(const char *name, const char *alias, char *out_id, size_t len);
+
+// Call cb for every persisted alias
+int scan_function_aliases(void (*cb)(const char *name, const char *alias, const char *id, void *ctx), void *ctx);
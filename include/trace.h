@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+// Per-hop request tracing. The gateway tags an invoke with "rid" and, when
+// tracing is on, "trace":1. Every hop then appends the monotonic timestamps
+// (microseconds, CLOCK_MONOTONIC is shared by all processes of the host) of
+// its stages to the reply line, in a "trace" field kept last:
+//   {"ok":true,"output":"...","trace":"wk_recv:123;wk_ready:130;..."}
+// Untraced requests carry no field and cost one clock read per stage.
+
+#define TRACE_RID_MAX 64
+
+// Stage names, in request order
+#define TRACE_GW_RECV  "gw_recv"   // gateway: headers parsed
+#define TRACE_SRV_RECV "srv_recv"  // server: invoke line read
+#define TRACE_LB_RECV  "lb_recv"   // LB: invoke line read
+#define TRACE_LB_SCHED "lb_sched"  // LB: worker slot acquired (or request rejected)
+#define TRACE_FWD_RECV "fwd_recv"  // server: forward_to_worker read
+#define TRACE_WK_RECV  "wk_recv"   // worker: job read from the pipe
+#define TRACE_WK_READY "wk_ready"  // worker: metadata loaded, module compiled or cached
+#define TRACE_WK_DONE  "wk_done"   // worker: execution finished
+#define TRACE_FWD_DONE "fwd_done"  // server: worker reply read
+#define TRACE_LB_DONE  "lb_done"   // LB: reply read from the server
+#define TRACE_SRV_DONE "srv_done"  // server: reply read from the LB
+#define TRACE_GW_DONE  "gw_done"   // gateway: reply read from the server
+
+double trace_now_us(void);
+
+// Non-zero if a request line asks for tracing
+int trace_requested(const char *line);
+
+// Add a stage timestamp to a one-line JSON reply (ending in "}" or "}\n").
+// Silently skipped when the line would not fit in cap.
+void trace_append(char *resp, size_t cap, const char *stage, double ts_us);
+
+// Timestamp of stage in a traced reply, 0 if absent
+double trace_get(const char *resp, const char *stage);
+
+// Remove the trace field, restoring the reply as the function returned it
+void trace_strip(char *resp);
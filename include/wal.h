@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Append-only write-ahead log in numbered segment files
+// (<dir>/wal-00000001.log, ...). Record, little endian:
+//   u32 length of type + data   u32 CRC-32 of type + data   u8 type   data
+// Appenders copy records into a shared buffer; one flusher thread writes and
+// fdatasync()s whatever accumulated meanwhile (group commit), so appenders
+// waiting for durability at the same time share one sync.
+// Each open starts a new segment; older ones are only read by wal_replay,
+// which stops a segment at its first torn or corrupt record (a crash in the
+// middle of a write). The owner counts the live records of each segment with
+// wal_ref(): a closed segment whose count drops to zero is deleted.
+
+typedef struct wal wal_t;
+
+typedef struct {
+    unsigned segments;           // files on disk, active one included
+    uint32_t active;             // segment receiving appends
+    unsigned long appends;
+    unsigned long syncs;         // fdatasync calls (appends / syncs = group size)
+    unsigned long bytes;         // appended since open
+} wal_stats_t;
+
+typedef void (*wal_replay_fn)(void *ctx, uint32_t seg, uint8_t type, const void *data, size_t len);
+
+wal_t *wal_open(const char *dir, size_t segment_bytes);
+void wal_close(wal_t *w);        // flushes and syncs what is buffered
+
+// Feed every intact record of the previous segments to fn, in order.
+// Call before appending; returns the number of records, -1 on error.
+int wal_replay(wal_t *w, wal_replay_fn fn, void *ctx);
+// Delete closed segments nobody took a reference on during replay
+void wal_gc(wal_t *w);
+
+// Append a record; returns its segment number, -1 on error.
+// With sync, returns only once the record is on disk. With pin, the record
+// holds a reference on its segment (as wal_ref(+1)) from the moment it is
+// appended, given back with wal_ref(-1).
+long wal_append(wal_t *w, uint8_t type, const void *data, size_t len, int sync, int pin);
+int wal_sync(wal_t *w);          // everything appended so far is on disk
+
+void wal_ref(wal_t *w, uint32_t seg, int delta);
+// Oldest closed segment still referenced when more than keep are, else 0:
+// its live records are worth rewriting at the head so it can be deleted
+uint32_t wal_compact_candidate(wal_t *w, unsigned keep);
+
+void wal_get_stats(wal_t *w, wal_stats_t *st);
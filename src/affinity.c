@@ -0,0 +1,106 @@
+#include "affinity.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_RING_WORKERS 64
+
+uint64_t affinity_hash(const char *s) {
+    // FNV-1a 64
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint32_t mix32(uint64_t x) {
+    // Finalizer from splitmix64, folded to 32 bits
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27; x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (uint32_t)(x ^ (x >> 32));
+}
+
+static int cmp_point(const void *a, const void *b) {
+    uint32_t pa = ((const ring_point_t *)a)->point;
+    uint32_t pb = ((const ring_point_t *)b)->point;
+    return (pa > pb) - (pa < pb);
+}
+
+int ring_build(hash_ring_t *ring, const int *worker_ids, int n) {
+    ring_free(ring);
+    if (n <= 0) return 0;
+    if (n > MAX_RING_WORKERS) n = MAX_RING_WORKERS;
+
+    ring->points = malloc(sizeof(ring_point_t) * (size_t)n * AFFINITY_VNODES);
+    if (!ring->points) return -1;
+    for (int i = 0; i < n; i++) {
+        for (int v = 0; v < AFFINITY_VNODES; v++) {
+            ring_point_t *p = &ring->points[i * AFFINITY_VNODES + v];
+            p->point = mix32(((uint64_t)worker_ids[i] << 32) | (uint64_t)v);
+            p->worker = worker_ids[i];
+        }
+    }
+    ring->npoints = n * AFFINITY_VNODES;
+    ring->nworkers = n;
+    qsort(ring->points, (size_t)ring->npoints, sizeof(ring_point_t), cmp_point);
+    return 0;
+}
+
+void ring_free(hash_ring_t *ring) {
+    free(ring->points);
+    ring->points = NULL;
+    ring->npoints = 0;
+    ring->nworkers = 0;
+}
+
+int affinity_pick(const hash_ring_t *ring, uint64_t key, const int *load,
+                  const unsigned char *warm, double balance) {
+    if (ring->npoints == 0) return -1;
+
+    // Bound: no worker may exceed ceil(c * (total + 1) / n), over available workers
+    int total = 0, navail = 0;
+    int seen_ids[MAX_RING_WORKERS];
+    int nseen = 0;
+    for (int i = 0; i < ring->npoints && nseen < ring->nworkers; i++) {
+        int w = ring->points[i].worker, dup = 0;
+        for (int j = 0; j < nseen; j++) if (seen_ids[j] == w) { dup = 1; break; }
+        if (dup) continue;
+        seen_ids[nseen++] = w;
+        if (load[w] >= 0) { total += load[w]; navail++; }
+    }
+    if (navail == 0) return -1;
+    double avg = (double)(total + 1) / navail;
+    int bound = (int)(balance * avg);
+    if (bound < balance * avg) bound++;
+    if (bound < AFFINITY_MIN_BOUND) bound = AFFINITY_MIN_BOUND;
+
+    // Binary search first point >= hash
+    uint32_t h = mix32(key);
+    int lo = 0, hi = ring->npoints;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring->points[mid].point < h) lo = mid + 1; else hi = mid;
+    }
+
+    // Walk clockwise over distinct workers: first warm under bound wins,
+    // otherwise the first one under bound.
+    int order[MAX_RING_WORKERS];
+    int norder = 0;
+    int first_free = -1, first_avail = -1;
+    for (int i = 0; i < ring->npoints && norder < ring->nworkers; i++) {
+        int w = ring->points[(lo + i) % ring->npoints].worker, dup = 0;
+        for (int j = 0; j < norder; j++) if (order[j] == w) { dup = 1; break; }
+        if (dup) continue;
+        order[norder++] = w;
+        if (load[w] < 0) continue;
+        if (first_avail < 0) first_avail = w;
+        if (load[w] < bound) {
+            if (!warm || warm[w]) return w;
+            if (first_free < 0) first_free = w;
+        }
+    }
+    return first_free >= 0 ? first_free : first_avail;
+}
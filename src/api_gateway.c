@@ -1,20 +1,56 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <time.h>
 
+#include "capture.h"
+#include "http.h"
 #include "ipc.h"
+#include "jobs.h"
+#include "log.h"
+#include "metrics.h"
+#include "refcache.h"
+#include "memo.h"
+#include "static_files.h"
 #include "storage.h"
+#include "trace.h"
 
 #define HTTP_PORT 8080
 #define RECV_BUF 8192
 #define MAX_BODY 1024*1024 // 1MB max
+#define MAP_BODY_MAX (64 * 1024 * 1024)
+#define QUEUE_STATS_MAX (64 * 1024)
+#define KEEPALIVE_IDLE_S 5     // idle keep-alive connections are closed after this
+
+// Admission control: connections are capped outright; invokes in flight are
+// capped by a limit that shrinks when the LB reports overload (AIMD)
+#define GW_CONN_MAX 1024       // concurrent connections (threads), FAAS_GATEWAY_CONNS
+#define GW_INFLIGHT_MAX 256    // invoke limit ceiling (FAAS_GATEWAY_INFLIGHT)
+#define GW_INFLIGHT_MIN 8
+#define GW_BACKOFF 0.9         // multiplicative decrease on LB overload
+
+static pthread_mutex_t admit_lock = PTHREAD_MUTEX_INITIALIZER;
+static int conns_active = 0;
+static int conns_max = GW_CONN_MAX;
+static int invokes_inflight = 0;
+static int inflight_max = GW_INFLIGHT_MAX;
+static double invoke_limit = GW_INFLIGHT_MAX;
+static int last_retry_after = 1; // latest Retry-After estimate from the LB
+static int jobs_ready = 0;        // async invokes available (jobs_init succeeded)
 
 // API Gateway no longer compiles - it delegates to Server
 
@@ -36,125 +72,376 @@ static int start_http_server(void) {
     return fd;
 }
 
-static void send_http(int cfd, int status, const char *status_text, const char *body, const char *ctype) {
-    char hdr[512];
+// HTTP/1.1 keep-alive state of the connection served by this thread.
+// Error responses close the connection: the handler may not have consumed
+// the request body.
+static _Thread_local int keep_alive = 0;
+
+// Route of the request being served, for faas_http_requests_total
+static _Thread_local metrics_route_t cur_route = ROUTE_OTHER;
+
+// Request being recorded when FAAS_CAPTURE is set (see capture.h)
+static _Thread_local capture_req_t cap_req;
+
+// extra: additional header lines, each ending in \r\n (may be NULL)
+static void send_http_headers(int cfd, int status, const char *status_text, const char *body,
+                              const char *ctype, const char *extra) {
+    char hdr[1024];
     int blen = body ? (int)strlen(body) : 0;
+    if (status >= 400) keep_alive = 0;
     int n = snprintf(hdr, sizeof(hdr),
-        "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
-        status, status_text, ctype ? ctype : "text/plain", blen);
+        "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n%sConnection: %s\r\n\r\n",
+        status, status_text, ctype ? ctype : "text/plain", blen, extra ? extra : "",
+        keep_alive ? "keep-alive" : "close");
     write_all(cfd, hdr, (size_t)n);
     if (blen > 0) write_all(cfd, body, (size_t)blen);
+    metrics_http(cur_route, status);
+    cap_req.status = status;
+}
+
+static void send_http(int cfd, int status, const char *status_text, const char *body, const char *ctype) {
+    send_http_headers(cfd, status, status_text, body, ctype, NULL);
+}
+
+static void send_too_many(int cfd, const char *body, int retry_after) {
+    char extra[64];
+    snprintf(extra, sizeof(extra), "Retry-After: %d\r\n", retry_after > 0 ? retry_after : 1);
+    send_http_headers(cfd, 429, "Too Many Requests", body, "application/json", extra);
+}
+
+// Chunked response for results sent as they come
+static void start_chunked(int cfd, const char *ctype, const char *extra) {
+    char hdr[512];
+    int m = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\n"
+                     "%sConnection: %s\r\n\r\n", ctype, extra, keep_alive ? "keep-alive" : "close");
+    write_all(cfd, hdr, (size_t)m);
+    metrics_http(cur_route, 200);
+    cap_req.status = 200;
+}
+
+// -1 once the client is gone
+static int send_chunk(int cfd, const char *data, size_t len) {
+    char hdr[16];
+    int n = snprintf(hdr, sizeof(hdr), "%zx\r\n", len);
+    if (write_all(cfd, hdr, (size_t)n) < 0 || write_all(cfd, data, len) < 0) return -1;
+    return write_all(cfd, "\r\n", 2) < 0 ? -1 : 0;
+}
+
+// Reserve an invoke slot; returns 0 if admitted
+static int admit_invoke(int *retry_after) {
+    pthread_mutex_lock(&admit_lock);
+    int ok = invokes_inflight < (int)invoke_limit;
+    if (ok) invokes_inflight++;
+    *retry_after = last_retry_after;
+    pthread_mutex_unlock(&admit_lock);
+    return ok ? 0 : -1;
+}
+
+// Release an invoke slot and adapt the limit: back off when the LB sheds
+// load, grow by ~1 per limit's worth of successful requests otherwise
+static void admit_done(int overloaded, int retry_after) {
+    pthread_mutex_lock(&admit_lock);
+    invokes_inflight--;
+    if (overloaded) {
+        invoke_limit *= GW_BACKOFF;
+        if (invoke_limit < GW_INFLIGHT_MIN) invoke_limit = GW_INFLIGHT_MIN;
+        last_retry_after = retry_after > 0 ? retry_after : 1;
+    } else {
+        invoke_limit += 1.0 / invoke_limit;
+        if (invoke_limit > inflight_max) invoke_limit = inflight_max;
+        if (invoke_limit >= inflight_max) last_retry_after = 1;
+    }
+    pthread_mutex_unlock(&admit_lock);
+}
+
+// Request ids and per-hop tracing (include/trace.h). FAAS_TRACE=1 traces
+// every invoke, an "X-Trace: 1" header a single one. Traced invokes get a
+// Server-Timing header; with FAAS_TRACE_FILE they are also appended to a
+// Chrome trace-event file (chrome://tracing, Perfetto), one row per request.
+typedef struct {
+    char rid[TRACE_RID_MAX];
+    int traced;
+    double start_us;
+} invoke_trace_t;
+
+static int trace_all = 0;
+static FILE *trace_file = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long rid_prefix = 0;
+static unsigned long rid_seq = 0;
+static unsigned long trace_rows = 0;
+
+// Hop durations reported in Server-Timing: [from, to] plus an optional
+// second span for the way back
+static const struct {
+    const char *name;
+    const char *from, *to, *back_from, *back_to;
+} timing_spans[] = {
+    { "gateway",  TRACE_GW_RECV,  TRACE_SRV_RECV, TRACE_SRV_DONE, TRACE_GW_DONE },
+    { "server",   TRACE_SRV_RECV, TRACE_LB_RECV,  TRACE_LB_DONE,  TRACE_SRV_DONE },
+    { "lb-queue", TRACE_LB_RECV,  TRACE_LB_SCHED, NULL, NULL },
+    { "forward",  TRACE_LB_SCHED, TRACE_FWD_RECV, TRACE_FWD_DONE, TRACE_LB_DONE },
+    { "pipe",     TRACE_FWD_RECV, TRACE_WK_RECV,  TRACE_WK_DONE,  TRACE_FWD_DONE },
+    { "load",     TRACE_WK_RECV,  TRACE_WK_READY, NULL, NULL },
+    { "exec",     TRACE_WK_READY, TRACE_WK_DONE,  NULL, NULL },
+    { "total",    TRACE_GW_RECV,  TRACE_GW_DONE,  NULL, NULL },
+};
+
+// Nested trace events of one request (each contains the next hops)
+static const struct {
+    const char *name, *cat, *from, *to;
+} trace_events[] = {
+    { "invoke",  "gateway", TRACE_GW_RECV,  TRACE_GW_DONE },
+    { "route",   "server",  TRACE_SRV_RECV, TRACE_SRV_DONE },
+    { "balance", "lb",      TRACE_LB_RECV,  TRACE_LB_DONE },
+    { "queue",   "lb",      TRACE_LB_RECV,  TRACE_LB_SCHED },
+    { "forward", "server",  TRACE_FWD_RECV, TRACE_FWD_DONE },
+    { "job",     "worker",  TRACE_WK_RECV,  TRACE_WK_DONE },
+    { "load",    "worker",  TRACE_WK_RECV,  TRACE_WK_READY },
+    { "exec",    "worker",  TRACE_WK_READY, TRACE_WK_DONE },
+};
+
+static void trace_setup(void) {
+    const char *env = getenv("FAAS_TRACE");
+    trace_all = env && strcmp(env, "0") != 0;
+    rid_prefix = (unsigned long)time(NULL);
+
+    const char *path = getenv("FAAS_TRACE_FILE");
+    if (!path || !path[0]) return;
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        perror("fopen FAAS_TRACE_FILE");
+        return;
+    }
+    trace_all = 1;
+    // JSON array format; the closing bracket is optional for trace viewers
+    fprintf(trace_file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"faas invokes\"}},\n");
+    fflush(trace_file);
+    log_info("[GATEWAY] 🧭 Writing invoke traces to %s\n", path);
+}
+
+static void invoke_trace_init(invoke_trace_t *t, const char *buf) {
+    t->start_us = trace_now_us();
+    char flag[8] = {0};
+    t->traced = trace_all || (http_header_value(buf, "X-Trace", flag, sizeof(flag)) == 0 && strcmp(flag, "1") == 0);
+
+    // Keep a caller-supplied id when it is safe to embed in JSON and headers
+    if (http_header_value(buf, "X-Request-Id", t->rid, sizeof(t->rid)) == 0 && t->rid[0]) {
+        const char *c = t->rid;
+        while (*c && (isalnum((unsigned char)*c) || strchr("-_.", *c))) c++;
+        if (!*c) return;
+    }
+    unsigned long seq = __atomic_add_fetch(&rid_seq, 1, __ATOMIC_RELAXED);
+    snprintf(t->rid, sizeof(t->rid), "%lx-%lx", rid_prefix, seq);
 }
 
-static int parse_content_length(const char *hdrs) {
-    const char *p = strcasestr(hdrs, "Content-Length:");
-    if (!p) return -1;
-    p += strlen("Content-Length:");
-    while (*p == ' ') p++;
-    return atoi(p);
+static double trace_stamp(const char *resp, const char *stage, const invoke_trace_t *t, double done_us) {
+    if (strcmp(stage, TRACE_GW_RECV) == 0) return t->start_us;
+    if (strcmp(stage, TRACE_GW_DONE) == 0) return done_us;
+    return trace_get(resp, stage);
+}
+
+// Server-Timing header line (durations in ms) for a traced reply
+static void server_timing(const char *resp, const invoke_trace_t *t, double done_us, char *out, size_t cap) {
+    size_t off = (size_t)snprintf(out, cap, "Server-Timing: ");
+    const char *sep = "";
+    for (size_t i = 0; i < sizeof(timing_spans) / sizeof(timing_spans[0]); i++) {
+        double from = trace_stamp(resp, timing_spans[i].from, t, done_us);
+        double to = trace_stamp(resp, timing_spans[i].to, t, done_us);
+        if (!from || !to) continue;
+        double us = to - from;
+        if (timing_spans[i].back_from) {
+            double bf = trace_stamp(resp, timing_spans[i].back_from, t, done_us);
+            double bt = trace_stamp(resp, timing_spans[i].back_to, t, done_us);
+            if (!bf || !bt) continue;
+            us += bt - bf;
+        }
+        if (off < cap) off += (size_t)snprintf(out + off, cap - off, "%s%s;dur=%.3f", sep, timing_spans[i].name, us / 1000.0);
+        sep = ", ";
+    }
+    if (off < cap) snprintf(out + off, cap - off, "\r\n");
+}
+
+static void trace_export(const char *resp, const invoke_trace_t *t, double done_us, const char *fn) {
+    char events[4096];
+    size_t off = 0;
+    pthread_mutex_lock(&trace_lock);
+    unsigned long row = ++trace_rows;
+    pthread_mutex_unlock(&trace_lock);
+    for (size_t i = 0; i < sizeof(trace_events) / sizeof(trace_events[0]); i++) {
+        double from = trace_stamp(resp, trace_events[i].from, t, done_us);
+        double to = trace_stamp(resp, trace_events[i].to, t, done_us);
+        if (!from || !to || off >= sizeof(events)) continue;
+        off += (size_t)snprintf(events + off, sizeof(events) - off,
+            "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.0f,\"dur\":%.0f,"
+            "\"args\":{\"rid\":\"%s\",\"fn\":\"%s\"}},\n",
+            trace_events[i].name, trace_events[i].cat, row, from, to - from, t->rid, fn);
+    }
+    if (off >= sizeof(events)) off = sizeof(events) - 1;
+    pthread_mutex_lock(&trace_lock);
+    fwrite(events, 1, off, trace_file);
+    fflush(trace_file);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Spooled request bodies (see BODY_REF_PREFIX): invoke payloads over
+// PAYLOAD_INLINE_MAX or not line-safe, and raw-body deploys. They go to a
+// memfd in SPOOL_IO pieces as they arrive, never whole in the heap, up to
+// body_max bytes (FAAS_BODY_MAX).
+#define BODY_SPOOL_MAX (512L * 1024 * 1024)
+#define SPOOL_IO (64 * 1024)
+
+static long body_max = BODY_SPOOL_MAX;
+
+typedef struct {
+    int fd;           // -1: nothing spooled
+    size_t len;
+    char ref[64];     // /proc/<pid>/fd/<fd>
+} spool_t;
+
+// Clients sending large bodies (curl over 1MB) wait for this before the body
+static void send_continue(int cfd, const char *buf) {
+    char expect[32] = {0};
+    if (http_header_value(buf, "Expect", expect, sizeof(expect)) == 0 && strcasecmp(expect, "100-continue") == 0) {
+        write_all(cfd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+    }
+}
+
+static void spool_close(spool_t *sp) {
+    if (sp->fd >= 0) close(sp->fd);
+    sp->fd = -1;
+}
+
+// A len-byte body into a memfd: the head_len bytes already read first, the
+// rest straight from the client. -1 if the client went away.
+static int spool_body(int cfd, const char *head, size_t head_len, size_t len, spool_t *sp) {
+    sp->fd = memfd_create("faas_body", MFD_CLOEXEC);
+    if (sp->fd < 0) return -1;
+    sp->len = len;
+    snprintf(sp->ref, sizeof(sp->ref), "/proc/%d/fd/%d", (int)getpid(), sp->fd);
+    if (head_len > len) head_len = len;
+    if (head_len && write_all(sp->fd, head, head_len) < 0) {
+        spool_close(sp);
+        return -1;
+    }
+    char *chunk = malloc(SPOOL_IO);
+    if (!chunk) die("malloc");
+    size_t copied = head_len;
+    while (copied < len) {
+        size_t want = len - copied < SPOOL_IO ? len - copied : SPOOL_IO;
+        ssize_t r = recv(cfd, chunk, want, 0);
+        if (r <= 0 || write_all(sp->fd, chunk, (size_t)r) < 0) break;
+        copied += (size_t)r;
+    }
+    free(chunk);
+    if (copied < len) {
+        spool_close(sp);
+        return -1;
+    }
+    if (capture_enabled() && len) {
+        void *m = mmap(NULL, len, PROT_READ, MAP_SHARED, sp->fd, 0);
+        if (m != MAP_FAILED) {
+            capture_body(&cap_req, m, len);
+            munmap(m, len);
+        }
+    }
+    return 0;
 }
 
 static void handle_deploy(int cfd, const char *buf, ssize_t n);
 static void handle_invoke(int cfd, const char *buf, ssize_t n);
+static void handle_batch(int cfd, const char *buf, ssize_t n);
+static void handle_map(int cfd, const char *buf, ssize_t n);
+static void handle_alias(int cfd, const char *buf);
+static void handle_queues(int cfd);
+static void handle_metrics(int cfd);
+static void handle_admin_status(int cfd);
+static void handle_admin(int cfd, const char *buf);
+static void handle_job(int cfd, const char *buf);
+static void handle_static(int cfd, const char *buf);
+static void handle_function(int cfd, const char *buf);
+static void route_request(int cfd, const char *buf, ssize_t n);
 
-static void handle_client(int cfd) {
+// Serve one request. Returns 1 if the connection stays open for another.
+static int handle_client(int cfd) {
     char buf[RECV_BUF];
-    ssize_t n = recv(cfd, buf, sizeof(buf)-1, 0);
-    if (n <= 0) return;
-    buf[n] = '\0';
+    ssize_t n = 0;
+    // Read up to the end of the headers (the body is read by the handlers)
+    while (n < (ssize_t)sizeof(buf) - 1) {
+        ssize_t r = recv(cfd, buf + n, sizeof(buf) - 1 - (size_t)n, 0);
+        if (r <= 0) return 0;
+        n += r;
+        buf[n] = '\0';
+        if (strstr(buf, "\r\n\r\n")) break;
+    }
+
+    // HTTP/1.1 defaults to keep-alive, HTTP/1.0 must ask for it
+    char conn_hdr[32] = {0};
+    http_header_value(buf, "Connection", conn_hdr, sizeof(conn_hdr));
+    const char *eol = strstr(buf, "\r\n");
+    int http11 = eol && eol - buf >= 8 && strncmp(eol - 8, "HTTP/1.1", 8) == 0;
+    keep_alive = http11 ? strcasecmp(conn_hdr, "close") != 0 : strcasecmp(conn_hdr, "keep-alive") == 0;
+
+    if (capture_enabled()) capture_begin(&cap_req, buf);
+    route_request(cfd, buf, n);
+    if (capture_enabled()) capture_end(&cap_req);
+    return keep_alive;
+}
 
+static void route_request(int cfd, const char *buf, ssize_t n) {
     // Route requests
+    cur_route = ROUTE_OTHER;
     if (strncmp(buf, "POST /deploy", 12) == 0) {
+        cur_route = ROUTE_DEPLOY;
         handle_deploy(cfd, buf, n);
         return;
+    } else if (strncmp(buf, "POST /map", 9) == 0) {
+        cur_route = ROUTE_MAP;
+        handle_map(cfd, buf, n);
+        return;
+    } else if (strncmp(buf, "POST /invoke/batch", 18) == 0) {
+        cur_route = ROUTE_BATCH;
+        handle_batch(cfd, buf, n);
+        return;
     } else if (strncmp(buf, "POST /invoke", 12) == 0) {
+        cur_route = ROUTE_INVOKE;
         handle_invoke(cfd, buf, n);
         return;
+    } else if (strncmp(buf, "POST /alias", 11) == 0) {
+        cur_route = ROUTE_ALIAS;
+        handle_alias(cfd, buf);
+        return;
+    } else if (strncmp(buf, "GET /queues", 11) == 0) {
+        cur_route = ROUTE_QUEUES;
+        handle_queues(cfd);
+        return;
+    } else if (strncmp(buf, "GET /metrics", 12) == 0) {
+        cur_route = ROUTE_METRICS;
+        handle_metrics(cfd);
+        return;
+    } else if (strncmp(buf, "GET /admin/status", 17) == 0) {
+        cur_route = ROUTE_ADMIN;
+        handle_admin_status(cfd);
+        return;
+    } else if (strncmp(buf, "POST /admin", 11) == 0) {
+        cur_route = ROUTE_ADMIN;
+        handle_admin(cfd, buf);
+        return;
+    } else if (strncmp(buf, "GET /jobs", 9) == 0) {
+        cur_route = ROUTE_JOBS;
+        handle_job(cfd, buf);
+        return;
+    } else if (strncmp(buf, "GET /static/", 12) == 0) {
+        cur_route = ROUTE_STATIC;
+        handle_static(cfd, buf);
+        return;
     } else if (strncmp(buf, "GET /function/", 14) == 0) {
-        // Extract function name from path
-        const char *path_start = buf + 14; // Skip "GET /function/"
-        const char *path_end = strchr(path_start, ' ');
-        if (!path_end || (path_end - path_start) >= MAX_FUNC_NAME) {
-            send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid function name\"}", "application/json");
-            return;
-        }
-        
-        char func_name[MAX_FUNC_NAME];
-        memcpy(func_name, path_start, (size_t)(path_end - path_start));
-        func_name[path_end - path_start] = '\0';
-        
-        // Find function by name
-        char func_id[MAX_FUNC_ID];
-        if (find_function_by_name(func_name, func_id) < 0) {
-            char resp[256];
-            snprintf(resp, sizeof(resp), "{\"error\":\"function '%s' not found\"}", func_name);
-            send_http(cfd, 404, "Not Found", resp, "application/json");
-            return;
-        }
-        
-        // Load function code
-        char code_buf[MAX_BODY];
-        int code_len = load_function(func_id, code_buf, sizeof(code_buf));
-        if (code_len < 0) {
-            send_http(cfd, 500, "Internal Error", "{\"error\":\"failed to load function code\"}", "application/json");
-            return;
-        }
-        
-        // Load metadata
-        function_metadata_t meta;
-        if (load_function_metadata(func_id, &meta) < 0) {
-            send_http(cfd, 500, "Internal Error", "{\"error\":\"failed to load metadata\"}", "application/json");
-            return;
-        }
-        
-        // Build JSON response with code and metadata
-        char *resp = (char*)malloc(code_len + 1024);
-        if (!resp) {
-            send_http(cfd, 500, "Internal Error", "{\"error\":\"malloc failed\"}", "application/json");
-            return;
-        }
-        
-        // Escape code for JSON (simple: replace " with ')
-        char *escaped_code = (char*)malloc(code_len * 2 + 1);
-        if (!escaped_code) {
-            free(resp);
-            send_http(cfd, 500, "Internal Error", "{\"error\":\"malloc failed\"}", "application/json");
-            return;
-        }
-        
-        int j = 0;
-        for (int i = 0; i < code_len; i++) {
-            if (code_buf[i] == '\"') {
-                escaped_code[j++] = '\\';
-                escaped_code[j++] = '\"';
-            } else if (code_buf[i] == '\n') {
-                escaped_code[j++] = '\\';
-                escaped_code[j++] = 'n';
-            } else if (code_buf[i] == '\r') {
-                escaped_code[j++] = '\\';
-                escaped_code[j++] = 'r';
-            } else if (code_buf[i] == '\t') {
-                escaped_code[j++] = '\\';
-                escaped_code[j++] = 't';
-            } else if (code_buf[i] == '\\') {
-                escaped_code[j++] = '\\';
-                escaped_code[j++] = '\\';
-            } else {
-                escaped_code[j++] = code_buf[i];
-            }
-        }
-        escaped_code[j] = '\0';
-        
-        snprintf(resp, code_len + 1024,
-            "{\"ok\":true,\"id\":\"%s\",\"name\":\"%s\",\"lang\":\"%s\",\"size\":%zu,\"code\":\"%s\"}",
-            meta.id, meta.name, meta.language, meta.size, escaped_code);
-        
-        send_http(cfd, 200, "OK", resp, "application/json");
-        free(escaped_code);
-        free(resp);
+        cur_route = ROUTE_FUNCTION;
+        handle_function(cfd, buf);
         return;
     } else {
-        const char *msg = "{\"error\":\"use POST /deploy or POST /invoke\"}";
+        const char *msg = "{\"error\":\"use POST /deploy, POST /invoke, POST /alias or GET /function/<name>\"}";
         send_http(cfd, 404, "Not Found", msg, "application/json");
         return;
     }
@@ -162,8 +449,9 @@ static void handle_client(int cfd) {
 
 static void handle_deploy(int cfd, const char *buf, ssize_t n) {
     // Support 2 formats:
-    // 1. JSON: {"name":"x","lang":"c","code":"..."}  (small code)
-    // 2. Query params + raw body: POST /deploy?name=x&lang=c  (large files)
+    // 1. JSON: {"name":"x","lang":"c","code":"..."}  (small code, MAX_BODY)
+    // 2. Query params + raw body: POST /deploy?name=x&lang=c  (large files:
+    //    spooled, the server copies the spool to disk)
     
     const char *hdr_end = strstr(buf, "\r\n\r\n");
     if (!hdr_end) {
@@ -171,54 +459,76 @@ static void handle_deploy(int cfd, const char *buf, ssize_t n) {
         return;
     }
 
-    int content_length = parse_content_length(buf);
-    if (content_length <= 0 || content_length > MAX_BODY) {
-        send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid content length\"}", "application/json");
-        return;
-    }
-
     // Check if query params present (format 2: file upload)
     char name[MAX_FUNC_NAME] = {0};
     char lang[16] = {0};
-    const char *query_start = strstr(buf, "POST /deploy?");
-    if (query_start) {
-        // Parse query params: ?name=xxx&lang=yyy
-        const char *name_param = strstr(query_start, "name=");
-        const char *lang_param = strstr(query_start, "lang=");
-        if (name_param && lang_param) {
-            sscanf(name_param, "name=%63[^& \r\n]", name);
-            sscanf(lang_param, "lang=%15[^& \r\n]", lang);
-        }
+    char alias[MAX_ALIAS_NAME] = {0};
+    if (http_query_param(buf, "name", name, sizeof(name)) < 0 ||
+        http_query_param(buf, "lang", lang, sizeof(lang)) < 0) {
+        name[0] = lang[0] = '\0';
+    }
+    // Optional alias flipped together with "latest" once the version is warm
+    http_query_param(buf, "alias", alias, sizeof(alias));
+
+    // Optional scheduling options: priority=high, weight=N, max_concurrency=N,
+    // rate_limit=R (requests/s), burst=N, memo=S (seconds results are reused)
+    char priority[8] = "normal";
+    char weight[16] = "1";
+    char max_conc[16] = "0";
+    char rate[16] = "0";
+    char burst[16] = "0";
+    char memo[16] = "0";
+    http_query_param(buf, "priority", priority, sizeof(priority));
+    http_query_param(buf, "weight", weight, sizeof(weight));
+    http_query_param(buf, "max_concurrency", max_conc, sizeof(max_conc));
+    http_query_param(buf, "rate_limit", rate, sizeof(rate));
+    http_query_param(buf, "burst", burst, sizeof(burst));
+    http_query_param(buf, "memo", memo, sizeof(memo));
+
+    int raw = name[0] && lang[0];
+    int content_length = http_content_length(buf);
+    if (content_length <= 0 || content_length > (raw ? body_max : MAX_BODY)) {
+        if (content_length > 0) keep_alive = 0;   // the body is left unread
+        send_http(cfd, content_length > 0 ? 413 : 400, content_length > 0 ? "Payload Too Large" : "Bad Request",
+                  "{\"error\":\"invalid content length\"}", "application/json");
+        return;
     }
 
+    send_continue(cfd, buf);
     const char *body = hdr_end + 4;
     int already = (int)(n - (body - buf));
-    char *payload = (char*)malloc((size_t)content_length + 1);
+    spool_t spool = { .fd = -1 };
+    if (raw && spool_body(cfd, body, already > 0 ? (size_t)already : 0, (size_t)content_length, &spool) < 0) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"incomplete body\"}", "application/json");
+        return;
+    }
+    char *payload = (char*)malloc(raw ? 1 : (size_t)content_length + 1);
     if (!payload) {
         send_http(cfd, 500, "Internal Error", "{\"error\":\"malloc failed\"}", "application/json");
+        spool_close(&spool);
         return;
     }
 
     int copied = 0;
-    if (already > 0) {
+    if (!raw && already > 0) {
         int tocopy = already > content_length ? content_length : already;
         memcpy(payload, body, (size_t)tocopy);
         copied = tocopy;
     }
-    while (copied < content_length) {
+    while (!raw && copied < content_length) {
         ssize_t r = recv(cfd, payload + copied, (size_t)(content_length - copied), 0);
         if (r <= 0) { free(payload); send_http(cfd, 400, "Bad Request", "{\"error\":\"incomplete body\"}", "application/json"); return; }
         copied += (int)r;
     }
-    payload[content_length] = '\0';
+    payload[raw ? 0 : content_length] = '\0';
+    if (!raw && capture_enabled()) capture_body(&cap_req, payload, (size_t)content_length);
 
     char *code = NULL;
     size_t code_len = 0;
 
-    // If name/lang from query, body is raw code (format 2)
-    if (name[0] && lang[0]) {
+    // If name/lang from query, body is raw code (format 2), sent by reference
+    if (raw) {
         code = payload;
-        code_len = (size_t)content_length;
     } else {
         // Format 1: JSON body
         const char *name_p = strstr(payload, "\"name\":");
@@ -262,14 +572,19 @@ static void handle_deploy(int cfd, const char *buf, ssize_t n) {
         send_http(cfd, 503, "Service Unavailable", "{\"error\":\"server down\"}", "application/json");
         if (code != payload) free(code);
         free(payload);
+        spool_close(&spool);
         return;
     }
 
     // Send deploy message to Server
     char msg[RECV_BUF];
+    char ref[128] = "";
+    if (raw) snprintf(ref, sizeof(ref), ",\"code_ref\":\"%s\",\"code_len\":%zu", spool.ref, spool.len);
     int msg_len = snprintf(msg, sizeof(msg), 
-        "{\"type\":\"deploy\",\"name\":\"%s\",\"lang\":\"%s\",\"code\":\"", 
-        name, lang);
+        "{\"type\":\"deploy\",\"name\":\"%s\",\"lang\":\"%s\",\"alias\":\"%s\","
+        "\"priority\":\"%s\",\"weight\":%d,\"max_concurrency\":%d,\"rate_limit\":%g,\"burst\":%d,"
+        "\"memo_ttl\":%d%s,\"code\":\"", 
+        name, lang, alias, priority, atoi(weight), atoi(max_conc), atof(rate), atoi(burst), atoi(memo), ref);
     write_all(sfd, msg, (size_t)msg_len);
     
     // Send code (escape quotes)
@@ -295,6 +610,8 @@ static void handle_deploy(int cfd, const char *buf, ssize_t n) {
     char resp[RECV_BUF];
     ssize_t rl = read_line(sfd, resp, sizeof(resp));
     close(sfd);
+    spool_close(&spool);
+    ref_invalidate();   // "latest" (and alias) moved
     
     if (rl <= 0) {
         send_http(cfd, 502, "Bad Gateway", "{\"error\":\"no response from server\"}", "application/json");
@@ -304,45 +621,335 @@ static void handle_deploy(int cfd, const char *buf, ssize_t n) {
     }
 
     // Forward Server's response to client
-    send_http(cfd, 201, "Created", resp, "application/json");
+    if (strstr(resp, "\"ok\":true")) {
+        send_http(cfd, 201, "Created", resp, "application/json");
+    } else {
+        send_http(cfd, 400, "Bad Request", resp, "application/json");
+    }
 
     if (code != payload) free(code);
     free(payload);
 }
 
-static void handle_invoke(int cfd, const char *buf, ssize_t n) {
+// Decoded query values and headers go into JSON lines unescaped: no quote,
+// backslash or control character
+static int line_field_ok(const char *s) {
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\' || (unsigned char)*s < 0x20 || *s == 0x7f) return 0;
+    }
+    return 1;
+}
 
-    // Extract function name from query (?fn=...)
-    const char *q = strchr(buf, ' ');
-    const char *path_start = q ? q+1 : NULL;
-    const char *path_end = path_start ? strchr(path_start, ' ') : NULL;
-    char fn[128] = {0};
-    if (path_start && path_end && (path_end - path_start) < 256) {
-        char path[256];
-        memcpy(path, path_start, (size_t)(path_end - path_start));
-        path[path_end - path_start] = '\0';
-        const char *fnk = strstr(path, "?fn=");
-        if (fnk) {
-            fnk += 4;
-            strncpy(fn, fnk, sizeof(fn)-1);
+// Function reference from query: ?fn=<id> | <name> | <name>:<alias> | <name>:v<N>
+// Optional tenant: the LB queues each function/tenant pair separately.
+// -1 if either can't go into an invoke line.
+static int invoke_target(const char *buf, char *fn, size_t fn_cap, char *tenant, size_t tenant_cap) {
+    if (http_query_param(buf, "fn", fn, fn_cap) < 0 || !fn[0]) {
+        snprintf(fn, fn_cap, "echo");
+    }
+    tenant[0] = '\0';
+    http_header_value(buf, "X-Tenant", tenant, tenant_cap);
+    return line_field_ok(fn) && line_field_ok(tenant) ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Static content, served here without the server, LB or workers
+//   GET /static/<ref>     a static function's file as is (text/html), with
+//                         ETag/Last-Modified and 304s; refs naming a version
+//                         (ID, name:vN) are cacheable forever
+//   POST /invoke?fn=<static function>  the usual JSON reply, whole file
+//   GET /function/<name>  code and metadata of the latest version
+// Bodies are written from the mapped file (or sendfile) in pieces: nothing
+// is copied whole into a buffer.
+// ---------------------------------------------------------------------------
+
+#define ESCAPE_PIECE 16384
+
+// Length of [p, p + len) once JSON-escaped (same rules as json_escape)
+static size_t escaped_len(const char *p, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)p[i];
+        n += c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t' ? 2 : c < 0x20 ? 6 : 1;
+    }
+    return n;
+}
+
+// JSON-escaped [p, p + len) to cfd; -1 once the client is gone
+static int write_escaped(int cfd, const char *p, size_t len) {
+    char *out = malloc(ESCAPE_PIECE * 6 + 1);
+    if (!out) die("malloc");
+    int rc = 0;
+    for (size_t off = 0; off < len && rc == 0; off += ESCAPE_PIECE) {
+        size_t n = len - off < ESCAPE_PIECE ? len - off : ESCAPE_PIECE;
+        size_t m = json_escape(p + off, n, out, ESCAPE_PIECE * 6 + 1);
+        if (write_all(cfd, out, m) < 0) rc = -1;
+    }
+    free(out);
+    return rc;
+}
+
+// Headers to be followed by the body: held back to go out in one segment
+static void send_headers_more(int cfd, const char *hdr, size_t len) {
+    while (len > 0) {
+        ssize_t w = send(cfd, hdr, len, MSG_MORE | MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return;
+        hdr += w;
+        len -= (size_t)w;
+    }
+}
+
+// Read and drop a request body; -1 if the client went away
+static int discard_body(int cfd, const char *buf, ssize_t n) {
+    int len = http_content_length(buf);
+    const char *hdr_end = strstr(buf, "\r\n\r\n");
+    if (len <= 0 || !hdr_end) return 0;
+    ssize_t already = n - (hdr_end + 4 - buf);
+    size_t left = (ssize_t)len > already ? (size_t)((ssize_t)len - already) : 0;
+    if (left) send_continue(cfd, buf);
+    char scratch[4096];
+    while (left > 0) {
+        ssize_t r = recv(cfd, scratch, left < sizeof(scratch) ? left : sizeof(scratch), 0);
+        if (r <= 0) return -1;
+        left -= (size_t)r;
+    }
+    return 0;
+}
+
+// 1 if the client's copy is current (If-None-Match, else If-Modified-Since)
+static int not_modified(const char *buf, const char *etag, time_t mtime) {
+    char inm[256] = {0}, ims[64] = {0};
+    if (http_header_value(buf, "If-None-Match", inm, sizeof(inm)) == 0) {
+        return strcmp(inm, "*") == 0 || strstr(inm, etag) != NULL;
+    }
+    if (http_header_value(buf, "If-Modified-Since", ims, sizeof(ims)) == 0) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(ims, "%a, %d %b %Y %H:%M:%S GMT", &tm)) return timegm(&tm) >= mtime;
+    }
+    return 0;
+}
+
+static void send_not_modified(int cfd, const char *validators) {
+    char hdr[768];
+    int m = snprintf(hdr, sizeof(hdr), "HTTP/1.1 304 Not Modified\r\n%sConnection: %s\r\n\r\n",
+                     validators, keep_alive ? "keep-alive" : "close");
+    write_all(cfd, hdr, (size_t)m);
+    metrics_http(cur_route, 304);
+    cap_req.status = 304;
+}
+
+static void handle_static(int cfd, const char *buf) {
+    const char *p = buf + 12; // Skip "GET /static/"
+    size_t len = strcspn(p, " ?");
+    char ref[REF_MAX];
+    if (len == 0 || len >= sizeof(ref)) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid function reference\"}", "application/json");
+        return;
+    }
+    memcpy(ref, p, len);
+    ref[len] = '\0';
+
+    static_file_t f;
+    int rc = static_open(ref, &f);
+    if (rc <= 0) {
+        if (rc == 0) {
+            send_http(cfd, 404, "Not Found", "{\"error\":\"no static function with this name\"}", "application/json");
         } else {
-            strncpy(fn, "echo", sizeof(fn)-1);
+            send_http(cfd, 500, "Internal Error", "{\"error\":\"failed to read html file\"}", "application/json");
         }
+        return;
+    }
+
+    char lm[64], validators[384];
+    struct tm tm;
+    gmtime_r(&f.mtime, &tm);
+    strftime(lm, sizeof(lm), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    snprintf(validators, sizeof(validators), "ETag: %s\r\nLast-Modified: %s\r\nCache-Control: %s\r\n",
+             f.etag, lm, f.pinned ? "public, max-age=31536000, immutable" : "no-cache");
+    if (not_modified(buf, f.etag, f.mtime)) {
+        send_not_modified(cfd, validators);
+        static_release(&f);
+        return;
+    }
+
+    char hdr[768];
+    int m = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\nContent-Length: %zu\r\n"
+                     "%sConnection: %s\r\n\r\n", f.size, validators, keep_alive ? "keep-alive" : "close");
+    send_headers_more(cfd, hdr, (size_t)m);
+    int sent = 0;
+    if (f.data) {
+        sent = write_all(cfd, f.data, f.size) == (ssize_t)f.size;
     } else {
-        strncpy(fn, "echo", sizeof(fn)-1);
+        off_t off = 0;
+        while ((size_t)off < f.size) {
+            ssize_t w = sendfile(cfd, f.fd, &off, f.size - (size_t)off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+        }
+        sent = (size_t)off == f.size;
     }
+    if (!sent) keep_alive = 0;
+    metrics_http(cur_route, 200);
+    cap_req.status = 200;
+    static_release(&f);
+}
 
-    const char *hdr_end = strstr(buf, "\r\n\r\n");
-    if (!hdr_end) {
-        send_http(cfd, 400, "Bad Request", "{\"error\":\"bad headers\"}", "application/json");
+// Invoke of a static function: answered from the file (the payload is read
+// and dropped). Returns 0 if fn is not static, for the usual path.
+static int invoke_static(int cfd, const char *buf, ssize_t n, const invoke_trace_t *trace) {
+    char fn[128] = {0}, tenant[64] = {0};
+    if (invoke_target(buf, fn, sizeof(fn), tenant, sizeof(tenant)) < 0) return 0;
+    static_file_t f;
+    int rc = static_open(fn, &f);
+    if (rc == 0) return 0;
+    if (discard_body(cfd, buf, n) < 0) {
+        keep_alive = 0;
+        static_release(&f);
+        return 1;
+    }
+    void *map = NULL;
+    const char *data = f.data;
+    if (rc > 0 && !data && f.size) {
+        map = mmap(NULL, f.size, PROT_READ, MAP_SHARED, f.fd, 0);
+        data = map == MAP_FAILED ? NULL : map;
+    }
+    if (rc < 0 || (!data && f.size)) {
+        send_http(cfd, 500, "Internal Error", "{\"ok\":false,\"error\":\"failed to read html file\"}",
+                  "application/json");
+        static_release(&f);
+        return 1;
+    }
+
+    static const char head[] = "{\"ok\":true,\"output\":\"", tail[] = "\",\"static\":true}";
+    size_t body_len = sizeof(head) - 1 + escaped_len(data, f.size) + sizeof(tail) - 1;
+    char hdr[512];
+    int m = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+                     "X-Request-Id: %s\r\nConnection: %s\r\n\r\n%s",
+                     body_len, trace->rid, keep_alive ? "keep-alive" : "close", head);
+    send_headers_more(cfd, hdr, (size_t)m);
+    if (write_escaped(cfd, data, f.size) < 0 || write_all(cfd, tail, sizeof(tail) - 1) < 0) keep_alive = 0;
+    metrics_http(cur_route, 200);
+    metrics_invoke(f.id, INVOKE_OK, (trace_now_us() - trace->start_us) / 1e6);
+    cap_req.status = 200;
+    if (map && map != MAP_FAILED) munmap(map, f.size);
+    static_release(&f);
+    return 1;
+}
+
+static void handle_function(int cfd, const char *buf) {
+    // Extract function name from path
+    const char *path_start = buf + 14; // Skip "GET /function/"
+    size_t name_len = strcspn(path_start, " ?");
+    if (!path_start[name_len] || name_len >= REF_MAX || memchr(path_start, '"', name_len)) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid function name\"}", "application/json");
         return;
     }
+    char func_name[REF_MAX];
+    memcpy(func_name, path_start, name_len);
+    func_name[name_len] = '\0';
 
-    int content_length = parse_content_length(buf);
+    // Same resolution as invokes: name follows "latest" (rollbacks included),
+    // name:alias and name:vN work too
+    ref_info_t info;
+    function_metadata_t meta;
+    if (ref_lookup(func_name, &info) < 0) {
+        char resp[256];
+        snprintf(resp, sizeof(resp), "{\"error\":\"function '%s' not found\"}", func_name);
+        send_http(cfd, 404, "Not Found", resp, "application/json");
+        return;
+    }
+    const char *func_id = info.id;
+    if (load_function_metadata(func_id, &meta) < 0) {
+        send_http(cfd, 500, "Internal Error", "{\"error\":\"failed to load metadata\"}", "application/json");
+        return;
+    }
+
+    // A version never changes: its ID is the ETag
+    char validators[MAX_FUNC_ID + 64];
+    snprintf(validators, sizeof(validators), "ETag: \"%s\"\r\nCache-Control: no-cache\r\n", func_id);
+    char etag[MAX_FUNC_ID + 4];
+    snprintf(etag, sizeof(etag), "\"%s\"", func_id);
+    char inm[256] = {0};
+    if (http_header_value(buf, "If-None-Match", inm, sizeof(inm)) == 0 && strstr(inm, etag)) {
+        send_not_modified(cfd, validators);
+        return;
+    }
+
+    char path[512];
+    function_code_path(func_id, meta.language, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        send_http(cfd, 500, "Internal Error", "{\"error\":\"failed to load function code\"}", "application/json");
+        return;
+    }
+    size_t code_len = (size_t)st.st_size;
+    const char *code = code_len ? mmap(NULL, code_len, PROT_READ, MAP_SHARED, fd, 0) : "";
+    close(fd);
+    if (code == MAP_FAILED) {
+        send_http(cfd, 500, "Internal Error", "{\"error\":\"failed to load function code\"}", "application/json");
+        return;
+    }
+
+    char head[512];
+    int hl = snprintf(head, sizeof(head),
+                      "{\"ok\":true,\"id\":\"%s\",\"name\":\"%s\",\"lang\":\"%s\",\"version\":%d,\"size\":%zu,\"code\":\"",
+                      meta.id, meta.name, meta.language, meta.version, meta.size);
+    char hdr[1024];
+    int m = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+                     "%sConnection: %s\r\n\r\n%s", (size_t)hl + escaped_len(code, code_len) + 2, validators,
+                     keep_alive ? "keep-alive" : "close", head);
+    send_headers_more(cfd, hdr, (size_t)m);
+    if (write_escaped(cfd, code, code_len) < 0 || write_all(cfd, "\"}", 2) < 0) keep_alive = 0;
+    metrics_http(cur_route, 200);
+    cap_req.status = 200;
+    if (code_len) munmap((void *)code, code_len);
+}
+
+static void forward_invoke(int cfd, const char *buf, ssize_t n, const invoke_trace_t *trace,
+                           int *overloaded, int *retry_after);
+static void submit_invoke(int cfd, const char *buf, ssize_t n, const invoke_trace_t *trace);
+
+static void handle_invoke(int cfd, const char *buf, ssize_t n) {
+    invoke_trace_t trace;
+    invoke_trace_init(&trace, buf);
+    char async[8] = {0};
+    if (http_query_param(buf, "async", async, sizeof(async)) == 0 && strcmp(async, "1") == 0) {
+        // Not counted against the in-flight limit: the job holds nothing here
+        submit_invoke(cfd, buf, n, &trace);
+        return;
+    }
+    // Static functions need no worker, unless the output is to be streamed
+    char stream[8] = {0}, accept[64] = {0};
+    http_query_param(buf, "stream", stream, sizeof(stream));
+    http_header_value(buf, "Accept", accept, sizeof(accept));
+    int streamed = strcmp(stream, "1") == 0 || strcmp(stream, "sse") == 0 || strstr(accept, "text/event-stream");
+    if (!streamed && invoke_static(cfd, buf, n, &trace)) return;
+    int retry_after = 1;
+    if (admit_invoke(&retry_after) < 0) {
+        send_too_many(cfd, "{\"ok\":false,\"error\":\"overloaded\"}", retry_after);
+        return;
+    }
+    int overloaded = 0;
+    forward_invoke(cfd, buf, n, &trace, &overloaded, &retry_after);
+    admit_done(overloaded, retry_after);
+}
+
+// Body of an invoke (Content-Length bytes, some already in buf): malloc'd,
+// NULL if the client went away
+static char *read_invoke_payload(int cfd, const char *buf, ssize_t n, const char *hdr_end) {
+    int content_length = http_content_length(buf);
     const char *body = hdr_end + 4;
     int already = (int)(n - (body - buf));
     char *payload = NULL;
     if (content_length > 0) {
+        send_continue(cfd, buf);
         payload = (char*)malloc((size_t)content_length + 1);
         if (!payload) die("malloc");
         int copied = 0;
@@ -357,48 +964,960 @@ static void handle_invoke(int cfd, const char *buf, ssize_t n) {
             copied += (int)r;
         }
         if (payload) payload[content_length] = '\0';
+        if (payload && capture_enabled()) capture_body(&cap_req, payload, (size_t)content_length);
     } else {
         payload = strdup("");
     }
+    return payload;
+}
+
+// Streamed invoke (?stream=1, ?stream=sse or Accept: text/event-stream):
+// output chunks are sent to the client as they arrive, raw, or as SSE
+// events ({"chunk":"..."} data) ending with a "done" event holding the
+// reply. Raw streams end with an X-Faas-Status trailer. Writes to a slow
+// client block, and with them every hop back to the function's stdout.
+// line: first line read, a chunk or the reply
+static void relay_stream(int cfd, line_reader_t *r, char *line, size_t cap, int sse, const char *extra) {
+    char hdr[640];
+    snprintf(hdr, sizeof(hdr), "%sCache-Control: no-cache\r\n%s", extra, sse ? "" : "Trailer: X-Faas-Status\r\n");
+    start_chunked(cfd, sse ? "text/event-stream" : "text/plain; charset=utf-8", hdr);
+    char *data = malloc(cap + 16);
+    if (!data) die("malloc");
+    ssize_t n = (ssize_t)strlen(line);
+    while (n > 0 && strncmp(line, CHUNK_PREFIX, strlen(CHUNK_PREFIX)) == 0) {
+        size_t len;
+        if (sse) {
+            trim_newline(line);
+            len = (size_t)snprintf(data, cap + 16, "data: %s\n\n", line);
+        } else {
+            const char *v = line + strlen(CHUNK_PREFIX) + 1;
+            const char *end = strrchr(line, '"');
+            len = end > v ? json_unescape(v, (size_t)(end - v), data, cap) : 0;
+        }
+        // Client gone: closing makes the server drop the rest
+        if (len && send_chunk(cfd, data, len) < 0) {
+            keep_alive = 0;
+            free(data);
+            return;
+        }
+        n = line_reader_next(r, line, cap);
+    }
+    if (n <= 0) snprintf(line, cap, "{\"ok\":false,\"error\":\"no resp\"}");
+    trim_newline(line);
+    trace_strip(line);
+    int ok = strstr(line, "\"ok\":true") != NULL;
+    if (sse) {
+        int m = snprintf(data, cap + 16, "event: done\ndata: %s\n\n", line);
+        send_chunk(cfd, data, (size_t)m);
+        write_all(cfd, "0\r\n\r\n", 5);
+    } else {
+        int m = snprintf(data, cap + 16, "0\r\nX-Faas-Status: %s\r\n\r\n", ok ? "ok" : "error");
+        write_all(cfd, data, (size_t)m);
+    }
+    free(data);
+}
+
+// Memoized functions (memo=<seconds> at deploy): the reply kept for this
+// version and payload, or the one being produced for an identical request.
+// NULL with t set: this request executes and hands its reply to memo_finish.
+static char *memo_invoke(const ref_info_t *info, const char *payload, const spool_t *sp,
+                         int *coalesced, memo_ticket_t *t) {
+    memo_key_t k;
+    t->entry = NULL;
+    if (sp->fd >= 0) {
+        void *m = sp->len ? mmap(NULL, sp->len, PROT_READ, MAP_SHARED, sp->fd, 0) : NULL;
+        if (m == MAP_FAILED) return NULL;
+        memo_key(&k, info->id, m, sp->len);
+        if (m) munmap(m, sp->len);
+    } else {
+        memo_key(&k, info->id, payload, strlen(payload));
+    }
+    char *cached = memo_begin(&k, info->memo_ttl, coalesced, t);
+    metrics_memo(info->id, cached ? (*coalesced ? MEMO_COALESCED : MEMO_HIT) : MEMO_MISS);
+    return cached;
+}
+
+static void forward_invoke(int cfd, const char *buf, ssize_t n, const invoke_trace_t *trace,
+                           int *overloaded, int *retry_after) {
+    char fn[128] = {0};
+    char tenant[64] = {0};
+    if (invoke_target(buf, fn, sizeof(fn), tenant, sizeof(tenant)) < 0) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid fn or tenant\"}", "application/json");
+        return;
+    }
+
+    const char *hdr_end = strstr(buf, "\r\n\r\n");
+    if (!hdr_end) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"bad headers\"}", "application/json");
+        return;
+    }
+
+    // Small line-safe payloads go inline; the rest is spooled
+    int content_length = http_content_length(buf);
+    if (content_length > body_max) {
+        keep_alive = 0;
+        send_http(cfd, 413, "Payload Too Large", "{\"error\":\"payload too large\"}", "application/json");
+        return;
+    }
+    spool_t spool = { .fd = -1 };
+    char *payload = NULL;
+    if (content_length > PAYLOAD_INLINE_MAX) {
+        send_continue(cfd, buf);
+        const char *body = hdr_end + 4;
+        ssize_t already = n - (body - buf);
+        if (spool_body(cfd, body, already > 0 ? (size_t)already : 0, (size_t)content_length, &spool) < 0) {
+            send_http(cfd, 400, "Bad Request", "{\"error\":\"incomplete body\"}", "application/json");
+            return;
+        }
+        payload = strdup("");
+        if (!payload) die("strdup");
+    } else {
+        payload = read_invoke_payload(cfd, buf, n, hdr_end);
+        if (payload && content_length > 0 && !line_safe(payload, (size_t)content_length)) {
+            if (spool_body(cfd, payload, (size_t)content_length, (size_t)content_length, &spool) < 0) {
+                send_http(cfd, 500, "Internal Error", "{\"error\":\"spool failed\"}", "application/json");
+                free(payload);
+                return;
+            }
+            payload[0] = '\0';
+        }
+    }
+
+    char stream[8] = {0}, accept[64] = {0};
+    http_query_param(buf, "stream", stream, sizeof(stream));
+    http_header_value(buf, "Accept", accept, sizeof(accept));
+    int sse = strcmp(stream, "sse") == 0 || strstr(accept, "text/event-stream") != NULL;
+    int streamed = sse || strcmp(stream, "1") == 0;
+
+    char extra[512];
+    int xl = snprintf(extra, sizeof(extra), "X-Request-Id: %s\r\n", trace->rid);
+    // Streamed and traced invokes always execute: their replies are per request
+    memo_ticket_t memo = { NULL, 0 };
+    ref_info_t info;
+    if (payload && !streamed && !trace->traced && ref_lookup(fn, &info) == 0 && info.memo_ttl > 0) {
+        int coalesced = 0;
+        char *cached = memo_invoke(&info, payload, &spool, &coalesced, &memo);
+        if (cached) {
+            snprintf(extra + xl, sizeof(extra) - (size_t)xl, "X-Faas-Memo: %s\r\n", coalesced ? "coalesced" : "hit");
+            send_http_headers(cfd, 200, "OK", cached, "application/json", extra);
+            free(cached);
+            free(payload);
+            spool_close(&spool);
+            return;
+        }
+        xl += snprintf(extra + xl, sizeof(extra) - (size_t)xl, "X-Faas-Memo: miss\r\n");
+    }
 
     // Send invoke to Server via UNIX socket
     int sfd = create_unix_client_socket(SERVER_SOCK_PATH);
     if (sfd < 0) {
         send_http(cfd, 503, "Service Unavailable", "{\"error\":\"server down\"}", "application/json");
+        memo_finish(&memo, NULL);
         free(payload);
+        spool_close(&spool);
         return;
     }
 
+    char ref[128] = "";
+    if (spool.fd >= 0) snprintf(ref, sizeof(ref), ",\"payload_ref\":\"%s\",\"payload_len\":%zu", spool.ref, spool.len);
     char line[RECV_BUF];
-    int m = snprintf(line, sizeof(line), "{\"type\":\"invoke\",\"fn\":\"%s\",\"payload\":\"", fn);
+    int m = snprintf(line, sizeof(line),
+                     "{\"type\":\"invoke\",\"fn\":\"%s\",\"tenant\":\"%s\",\"rid\":\"%s\"%s%s%s,\"payload\":\"",
+                     fn, tenant, trace->rid, trace->traced ? ",\"trace\":1" : "", streamed ? ",\"stream\":1" : "", ref);
     write_all(sfd, line, (size_t)m);
-    // naive escape: replace quotes with single quotes
-    for (int i=0; payload && payload[i]; i++) {
-        char ch = payload[i];
-        if (ch == '\"') ch = '\'';
-        write_all(sfd, &ch, 1);
-    }
-    write_all(sfd, "\"}\n", 4);
+    if (payload) write_all(sfd, payload, strlen(payload));   // line-safe, see above
+    write_all(sfd, "\"}\n", 3);
 
     // read response line
     char resp[RECV_BUF];
-    ssize_t rl = read_line(sfd, resp, sizeof(resp));
+    line_reader_t reader;
+    line_reader_init(&reader, sfd);
+    ssize_t rl = line_reader_next(&reader, resp, sizeof(resp));
     if (rl <= 0) {
         send_http(cfd, 502, "Bad Gateway", "{\"error\":\"no resp\"}", "application/json");
+        memo_finish(&memo, NULL);
         close(sfd);
         free(payload);
+        spool_close(&spool);
+        return;
+    }
+
+    // Errors before any output keep their usual JSON reply
+    if (streamed && (strncmp(resp, CHUNK_PREFIX, strlen(CHUNK_PREFIX)) == 0 || strstr(resp, "\"ok\":true"))) {
+        relay_stream(cfd, &reader, resp, sizeof(resp), sse, extra);
+        close(sfd);
+        free(payload);
+        spool_close(&spool);
+        return;
+    }
+    if (trace->traced) {
+        double done_us = trace_now_us();
+        server_timing(resp, trace, done_us, extra + xl, sizeof(extra) - (size_t)xl);
+        if (trace_file) trace_export(resp, trace, done_us, fn);
+        trace_strip(resp);
+    }
+
+    // Rejected by LB admission control (queue full / CoDel / rate limit)
+    const char *ra = strstr(resp, "\"retry_after\":");
+    if (ra && (strstr(resp, "\"error\":\"overloaded\"") || strstr(resp, "\"error\":\"rate_limited\""))) {
+        sscanf(ra, "\"retry_after\":%d", retry_after);
+        *overloaded = strstr(resp, "\"error\":\"overloaded\"") != NULL;
+        xl = (int)strlen(extra);
+        snprintf(extra + xl, sizeof(extra) - (size_t)xl, "Retry-After: %d\r\n", *retry_after > 0 ? *retry_after : 1);
+        send_http_headers(cfd, 429, "Too Many Requests", resp, "application/json", extra);
+    } else {
+        send_http_headers(cfd, 200, "OK", resp, "application/json", extra);
+    }
+    memo_finish(&memo, strstr(resp, "\"ok\":true") ? resp : NULL);
+    close(sfd);
+    free(payload);
+    spool_close(&spool);
+}
+
+// ---------------------------------------------------------------------------
+// POST /invoke/batch[?fn=NAME][&stream=1]
+// Body: [{"fn":"a","payload":...},...] or, with ?fn, [payload,...]. Payloads
+// are JSON values (strings are unescaped first). All items go to the server
+// on one connection; it runs them through the LB in parallel and answers
+// {"index":i,"result":{...}} lines as they complete. Returned as one JSON
+// array in input order, or with stream=1 as NDJSON chunks in completion
+// order. The batch takes one in-flight slot here; the LB admits each item.
+// ---------------------------------------------------------------------------
+
+static const char *skip_ws(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+// End of the JSON value starting at p, NULL if malformed
+static const char *json_value_end(const char *p) {
+    if (*p == '"') {
+        for (p++; *p && *p != '"'; p++) {
+            if (*p == '\\' && p[1]) p++;
+        }
+        return *p ? p + 1 : NULL;
+    }
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        for (; *p; p++) {
+            if (*p == '"') {
+                p = json_value_end(p);
+                if (!p) return NULL;
+                p--;
+            } else if (*p == '{' || *p == '[') {
+                depth++;
+            } else if ((*p == '}' || *p == ']') && --depth == 0) {
+                return p + 1;
+            }
+        }
+        return NULL;
+    }
+    const char *start = p;
+    while (*p && !strchr(",]} \t\r\n", *p)) p++;
+    return p > start ? p : NULL;
+}
+
+// Append the invoke line of one item to out (grown as needed); -1 if it
+// could not be spooled. Items not line-safe or over PAYLOAD_INLINE_MAX go to
+// the batch's spool (created on first use), each line naming its slice.
+static int batch_line(char **out, size_t *len, size_t *cap, spool_t *sp, const char *fn, const char *tenant,
+                      const char *rid, int index, const char *val, const char *val_end) {
+    // Unescaping never makes a string longer
+    char *payload = malloc((size_t)(val_end - val) + 1);
+    if (!payload) die("malloc");
+    size_t plen;
+    if (*val == '"') {
+        plen = json_unescape(val + 1, (size_t)(val_end - val - 2), payload, (size_t)(val_end - val) + 1);
+    } else {
+        plen = (size_t)(val_end - val);
+        memcpy(payload, val, plen);
+        payload[plen] = '\0';
+    }
+    char ref[160] = "";
+    if (plen > PAYLOAD_INLINE_MAX || !line_safe(payload, plen)) {
+        if (sp->fd < 0) {
+            sp->fd = memfd_create("faas_body", MFD_CLOEXEC);
+            sp->len = 0;
+            snprintf(sp->ref, sizeof(sp->ref), "/proc/%d/fd/%d", (int)getpid(), sp->fd);
+        }
+        if (sp->fd < 0 || (plen && write_all(sp->fd, payload, plen) < 0)) {
+            free(payload);
+            return -1;
+        }
+        snprintf(ref, sizeof(ref), ",\"payload_ref\":\"%s\",\"payload_off\":%zu,\"payload_len\":%zu",
+                 sp->ref, sp->len, plen);
+        sp->len += plen;
+        payload[0] = '\0';
+    }
+    if (*len + RECV_BUF > *cap) {
+        size_t ncap = *cap ? *cap * 2 : 64 * 1024;
+        char *n = realloc(*out, ncap);
+        if (!n) {
+            free(payload);
+            return -1;
+        }
+        *out = n;
+        *cap = ncap;
+    }
+    int m = snprintf(*out + *len, RECV_BUF,
+                     "{\"type\":\"invoke\",\"fn\":\"%s\",\"tenant\":\"%s\",\"rid\":\"%s.%d\"%s,\"payload\":\"%s\"}\n",
+                     fn, tenant, rid, index, ref, payload);
+    free(payload);
+    if (m >= RECV_BUF) return -1;
+    *len += (size_t)m;
+    return 0;
+}
+
+// Parse the body into invoke lines; returns the item count, -1 with err set
+static int batch_parse(const char *body, const char *default_fn, const char *tenant, const char *rid,
+                       int max_items, char **lines, size_t *lines_len, spool_t *sp, char *err, size_t err_cap) {
+    size_t cap = 0;
+    int count = 0;
+    const char *p = skip_ws(body);
+    if (*p != '[') {
+        snprintf(err, err_cap, "body must be a JSON array");
+        return -1;
+    }
+    p = skip_ws(p + 1);
+    while (*p && *p != ']') {
+        if (count >= max_items) {
+            snprintf(err, err_cap, "more than %d items", max_items);
+            return -1;
+        }
+        const char *end = json_value_end(p);
+        if (!end) {
+            snprintf(err, err_cap, "item %d: malformed JSON", count);
+            return -1;
+        }
+        char fn[128];
+        const char *val = p, *val_end = end;
+        snprintf(fn, sizeof(fn), "%s", default_fn);
+        if (!default_fn[0]) {
+            // {"fn":"name","payload":value}
+            val = val_end = NULL;
+            fn[0] = '\0';
+            const char *q = *p == '{' ? skip_ws(p + 1) : end;
+            while (q < end && *q == '"') {
+                const char *kend = json_value_end(q);
+                const char *v = kend ? skip_ws(kend) : NULL;
+                if (!v || *v != ':') break;
+                v = skip_ws(v + 1);
+                const char *vend = json_value_end(v);
+                if (!vend) break;
+                if (kend - q == 4 && strncmp(q, "\"fn\"", 4) == 0 && *v == '"' && vend - v - 2 < (int)sizeof(fn)) {
+                    json_unescape(v + 1, (size_t)(vend - v - 2), fn, sizeof(fn));
+                } else if (kend - q == 9 && strncmp(q, "\"payload\"", 9) == 0) {
+                    val = v;
+                    val_end = vend;
+                }
+                q = skip_ws(vend);
+                if (*q == ',') q = skip_ws(q + 1);
+            }
+            if (!fn[0] || !line_field_ok(fn)) {
+                snprintf(err, err_cap, "item %d: expected an object with fn and payload (or ?fn=)", count);
+                return -1;
+            }
+            if (!val) {
+                val = "\"\""; // no payload: empty string
+                val_end = val + 2;
+            }
+        }
+        if (batch_line(lines, lines_len, &cap, sp, fn, tenant, rid, count, val, val_end) < 0) {
+            snprintf(err, err_cap, "item %d: spool failed", count);
+            return -1;
+        }
+        count++;
+        p = skip_ws(end);
+        if (*p == ',') p = skip_ws(p + 1);
+    }
+    if (*p != ']') {
+        snprintf(err, err_cap, "unterminated array");
+        return -1;
+    }
+    if (count == 0) snprintf(err, err_cap, "empty batch");
+    return count ? count : -1;
+}
+
+// One JSON value per line (NDJSON), blank lines skipped
+static int ndjson_parse(const char *body, const char *fn, const char *tenant, const char *rid,
+                        int max_items, char **lines, size_t *lines_len, spool_t *sp, char *err, size_t err_cap) {
+    size_t cap = 0;
+    int count = 0;
+    for (const char *p = body; *p;) {
+        const char *eol = strchr(p, '\n');
+        if (!eol) eol = p + strlen(p);
+        const char *v = p, *e = eol;
+        while (v < e && (*v == ' ' || *v == '\t')) v++;
+        while (e > v && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) e--;
+        if (e > v) {
+            if (count >= max_items) {
+                snprintf(err, err_cap, "more than %d items", max_items);
+                return -1;
+            }
+            if (*v == '"' && json_value_end(v) != e) {
+                snprintf(err, err_cap, "line %d: malformed JSON string", count + 1);
+                return -1;
+            }
+            if (batch_line(lines, lines_len, &cap, sp, fn, tenant, rid, count, v, e) < 0) {
+                snprintf(err, err_cap, "item %d: spool failed", count);
+                return -1;
+            }
+            count++;
+        }
+        p = *eol ? eol + 1 : eol;
+    }
+    if (count == 0) snprintf(err, err_cap, "empty input");
+    return count ? count : -1;
+}
+
+static void handle_batch(int cfd, const char *buf, ssize_t n) {
+    invoke_trace_t trace;
+    invoke_trace_init(&trace, buf);
+    char fn[128] = {0};
+    char tenant[64] = {0};
+    char stream[8] = {0};
+    if (http_query_param(buf, "fn", fn, sizeof(fn)) < 0) fn[0] = '\0';
+    http_header_value(buf, "X-Tenant", tenant, sizeof(tenant));
+    if (!line_field_ok(fn) || !line_field_ok(tenant)) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid fn or tenant\"}", "application/json");
+        return;
+    }
+    int streamed = http_query_param(buf, "stream", stream, sizeof(stream)) == 0 && strcmp(stream, "1") == 0;
+
+    const char *hdr_end = strstr(buf, "\r\n\r\n");
+    if (!hdr_end) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"bad headers\"}", "application/json");
+        return;
+    }
+    if (http_content_length(buf) > MAX_BODY) {
+        send_http(cfd, 413, "Payload Too Large", "{\"error\":\"batch body over 1 MiB\"}", "application/json");
+        return;
+    }
+    char *body = read_invoke_payload(cfd, buf, n, hdr_end);
+    if (!body) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"truncated body\"}", "application/json");
+        return;
+    }
+    char *lines = NULL;
+    size_t lines_len = 0;
+    spool_t spool = { .fd = -1 };   // item payloads not sent inline
+    char err[128];
+    int count = batch_parse(body, fn, tenant, trace.rid, BATCH_MAX, &lines, &lines_len, &spool, err, sizeof(err));
+    free(body);
+    if (count < 0) {
+        char msg[192];
+        snprintf(msg, sizeof(msg), "{\"error\":\"%s\"}", err);
+        int too_large = strstr(err, "too large") || strstr(err, "more than");
+        if (strstr(err, "spool failed")) {
+            send_http(cfd, 500, "Internal Error", msg, "application/json");
+        } else {
+            send_http(cfd, too_large ? 413 : 400, too_large ? "Payload Too Large" : "Bad Request", msg,
+                      "application/json");
+        }
+        free(lines);
+        spool_close(&spool);
         return;
     }
 
-    send_http(cfd, 200, "OK", resp, "application/json");
+    int retry_after = 1;
+    if (admit_invoke(&retry_after) < 0) {
+        send_too_many(cfd, "{\"ok\":false,\"error\":\"overloaded\"}", retry_after);
+        free(lines);
+        spool_close(&spool);
+        return;
+    }
+    int sfd = create_unix_client_socket(SERVER_SOCK_PATH);
+    if (sfd < 0) {
+        send_http(cfd, 503, "Service Unavailable", "{\"error\":\"server down\"}", "application/json");
+        admit_done(0, retry_after);
+        free(lines);
+        spool_close(&spool);
+        return;
+    }
+    char head[128];
+    int hl = snprintf(head, sizeof(head), "{\"type\":\"batch\",\"count\":%d,\"rid\":\"%s\"}\n", count, trace.rid);
+    write_all(sfd, head, (size_t)hl);
+    write_all(sfd, lines, lines_len);
+    free(lines);
+
+    char extra[128];
+    snprintf(extra, sizeof(extra), "X-Request-Id: %s\r\n", trace.rid);
+    if (streamed) start_chunked(cfd, "application/x-ndjson", extra);
+
+    // Replies arrive in completion order
+    char **results = calloc((size_t)count, sizeof(char *));
+    int received = 0, failed = 0, overloaded = 0;
+    line_reader_t rd;
+    line_reader_init(&rd, sfd);
+    char line[RECV_BUF];
+    while (results && received < count && line_reader_next(&rd, line, sizeof(line)) > 0) {
+        int index = -1;
+        const char *res = strstr(line, "\"result\":");
+        if (sscanf(line, "{\"index\":%d", &index) != 1 || index < 0 || index >= count || !res || results[index]) {
+            continue;
+        }
+        trim_newline(line);
+        res += 9;
+        size_t rlen = strlen(res);
+        if (rlen > 0 && res[rlen - 1] == '}') rlen--;
+        if (!(results[index] = strndup(res, rlen))) break;
+        received++;
+        if (!strstr(results[index], "\"ok\":true")) failed++;
+        const char *ra = strstr(results[index], "\"retry_after\":");
+        if (ra && strstr(results[index], "\"error\":\"overloaded\"")) {
+            overloaded = 1;
+            sscanf(ra, "\"retry_after\":%d", &retry_after);
+        }
+        if (streamed) {
+            size_t ll = strlen(line);
+            line[ll] = '\n';
+            send_chunk(cfd, line, ll + 1);
+        }
+    }
     close(sfd);
+    spool_close(&spool);
+
+    const char *lost = "{\"ok\":false,\"error\":\"no resp\"}";
+    if (streamed) {
+        char tail[96];
+        for (int i = 0; i < count; i++) {
+            if (results && results[i]) continue;
+            int m = snprintf(tail, sizeof(tail), "{\"index\":%d,\"result\":%s}\n", i, lost);
+            send_chunk(cfd, tail, (size_t)m);
+        }
+        int m = snprintf(tail, sizeof(tail), "{\"done\":true,\"count\":%d,\"failed\":%d}\n",
+                         count, failed + count - received);
+        send_chunk(cfd, tail, (size_t)m);
+        write_all(cfd, "0\r\n\r\n", 5);
+    } else {
+        size_t cap = 64;
+        for (int i = 0; i < count; i++) cap += (results && results[i] ? strlen(results[i]) : strlen(lost)) + 1;
+        char *out = malloc(cap);
+        if (!out) die("malloc");
+        size_t len = (size_t)snprintf(out, cap, "{\"ok\":true,\"count\":%d,\"failed\":%d,\"results\":[",
+                                      count, failed + count - received);
+        for (int i = 0; i < count; i++) {
+            const char *r = results && results[i] ? results[i] : lost;
+            size_t l = strlen(r);
+            memcpy(out + len, r, l);
+            len += l;
+            out[len++] = i + 1 < count ? ',' : ']';
+        }
+        out[len++] = '}';
+        out[len] = '\0';
+        send_http_headers(cfd, 200, "OK", out, "application/json", extra);
+        free(out);
+    }
+    for (int i = 0; results && i < count; i++) free(results[i]);
+    free(results);
+    admit_done(overloaded, retry_after);
+}
+
+// POST /map?fn=NAME[&parallel=P][&chunk=K][&retries=R]
+// Body: JSON array of inputs, or one JSON value per line. The server splits
+// the inputs into chunks of K, runs P chunks at a time (default two per
+// worker), retries failed items R times (default 2) and streams the results
+// back in input order, as NDJSON, ending with a {"done":true,...} summary.
+static void handle_map(int cfd, const char *buf, ssize_t n) {
+    invoke_trace_t trace;
+    invoke_trace_init(&trace, buf);
+    char fn[128] = {0};
+    char tenant[64] = {0};
+    char opt[16];
+    if (http_query_param(buf, "fn", fn, sizeof(fn)) < 0 || !fn[0] || !line_field_ok(fn)) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"missing or invalid fn\"}", "application/json");
+        return;
+    }
+    http_header_value(buf, "X-Tenant", tenant, sizeof(tenant));
+    if (!line_field_ok(tenant)) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid tenant\"}", "application/json");
+        return;
+    }
+    int parallel = 0, chunk = 0, retries = 2;
+    if (http_query_param(buf, "parallel", opt, sizeof(opt)) == 0) parallel = atoi(opt);
+    if (http_query_param(buf, "chunk", opt, sizeof(opt)) == 0) chunk = atoi(opt);
+    if (http_query_param(buf, "retries", opt, sizeof(opt)) == 0) retries = atoi(opt);
+
+    const char *hdr_end = strstr(buf, "\r\n\r\n");
+    if (!hdr_end) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"bad headers\"}", "application/json");
+        return;
+    }
+    if (http_content_length(buf) > MAP_BODY_MAX) {
+        send_http(cfd, 413, "Payload Too Large", "{\"error\":\"map input over 64 MiB\"}", "application/json");
+        return;
+    }
+    char *body = read_invoke_payload(cfd, buf, n, hdr_end);
+    if (!body) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"truncated body\"}", "application/json");
+        return;
+    }
+    char *lines = NULL;
+    size_t lines_len = 0;
+    spool_t spool = { .fd = -1 };   // item payloads not sent inline
+    char err[128];
+    int count = *skip_ws(body) == '['
+        ? batch_parse(body, fn, tenant, trace.rid, MAP_MAX, &lines, &lines_len, &spool, err, sizeof(err))
+        : ndjson_parse(body, fn, tenant, trace.rid, MAP_MAX, &lines, &lines_len, &spool, err, sizeof(err));
+    free(body);
+    if (count < 0) {
+        char msg[192];
+        snprintf(msg, sizeof(msg), "{\"error\":\"%s\"}", err);
+        int too_large = strstr(err, "too large") || strstr(err, "more than");
+        if (strstr(err, "spool failed")) {
+            send_http(cfd, 500, "Internal Error", msg, "application/json");
+        } else {
+            send_http(cfd, too_large ? 413 : 400, too_large ? "Payload Too Large" : "Bad Request", msg,
+                      "application/json");
+        }
+        free(lines);
+        spool_close(&spool);
+        return;
+    }
+
+    int retry_after = 1;
+    if (admit_invoke(&retry_after) < 0) {
+        send_too_many(cfd, "{\"ok\":false,\"error\":\"overloaded\"}", retry_after);
+        free(lines);
+        spool_close(&spool);
+        return;
+    }
+    int sfd = create_unix_client_socket(SERVER_SOCK_PATH);
+    if (sfd < 0) {
+        send_http(cfd, 503, "Service Unavailable", "{\"error\":\"server down\"}", "application/json");
+        admit_done(0, retry_after);
+        free(lines);
+        spool_close(&spool);
+        return;
+    }
+    char par[32] = ""; // none: the server picks (two per worker)
+    if (parallel > 0) snprintf(par, sizeof(par), ",\"parallel\":%d", parallel);
+    char head[192];
+    int hl = snprintf(head, sizeof(head),
+                      "{\"type\":\"batch\",\"count\":%d,\"ordered\":1%s,\"chunk\":%d,\"retries\":%d,\"rid\":\"%s\"}\n",
+                      count, par, chunk, retries, trace.rid);
+    write_all(sfd, head, (size_t)hl);
+    write_all(sfd, lines, lines_len);
+    free(lines);
+
+    char extra[128];
+    snprintf(extra, sizeof(extra), "X-Request-Id: %s\r\n", trace.rid);
+    start_chunked(cfd, "application/x-ndjson", extra);
+
+    // The server sends the results in order: pass them through
+    int next = 0, failed = 0, done = 0;
+    line_reader_t rd;
+    line_reader_init(&rd, sfd);
+    char line[RECV_BUF + 64];
+    while (!done && line_reader_next(&rd, line, sizeof(line)) > 0) {
+        int index = -1;
+        if (strncmp(line, "{\"done\":", 8) == 0) {
+            done = 1;
+        } else if (sscanf(line, "{\"index\":%d", &index) != 1 || index != next) {
+            continue;
+        } else {
+            next++;
+            if (!strstr(line, "\"ok\":true")) failed++;
+        }
+        send_chunk(cfd, line, strlen(line));
+    }
+    close(sfd);
+    spool_close(&spool);
+    if (!done) {
+        char tail[128];
+        for (int i = next; i < count; i++) {
+            int m = snprintf(tail, sizeof(tail), "{\"index\":%d,\"result\":{\"ok\":false,\"error\":\"no resp\"}}\n", i);
+            send_chunk(cfd, tail, (size_t)m);
+        }
+        int m = snprintf(tail, sizeof(tail), "{\"done\":true,\"count\":%d,\"failed\":%d}\n",
+                         count, failed + count - next);
+        send_chunk(cfd, tail, (size_t)m);
+    }
+    write_all(cfd, "0\r\n\r\n", 5);
+    admit_done(0, retry_after);
+}
+
+// POST /invoke?async=1[&callback=http://127.0.0.1:PORT/path]: queue a job,
+// answer 202 with its id right away
+static void submit_invoke(int cfd, const char *buf, ssize_t n, const invoke_trace_t *trace) {
+    if (!jobs_ready) {
+        send_http(cfd, 503, "Service Unavailable", "{\"error\":\"async invokes unavailable\"}", "application/json");
+        return;
+    }
+    char fn[128] = {0};
+    char tenant[64] = {0};
+    char callback[JOB_CALLBACK_MAX] = {0};
+    char key[JOB_KEY_MAX] = {0};
+    if (invoke_target(buf, fn, sizeof(fn), tenant, sizeof(tenant)) < 0) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid fn or tenant\"}", "application/json");
+        return;
+    }
+    http_query_param(buf, "callback", callback, sizeof(callback));
+    http_header_value(buf, "Idempotency-Key", key, sizeof(key));
+    if (strspn(key, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_.:") != strlen(key)) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"invalid Idempotency-Key\"}", "application/json");
+        return;
+    }
+
+    const char *hdr_end = strstr(buf, "\r\n\r\n");
+    if (!hdr_end) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"bad headers\"}", "application/json");
+        return;
+    }
+    int content_length = http_content_length(buf);
+    if (content_length > JOB_PAYLOAD_MAX) {
+        send_http(cfd, 413, "Payload Too Large", "{\"error\":\"payload too large\"}", "application/json");
+        return;
+    }
+    char *payload = read_invoke_payload(cfd, buf, n, hdr_end);
+    if (!payload) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"truncated body\"}", "application/json");
+        return;
+    }
+
+    char id[JOB_ID_MAX];
+    job_submit_t r = jobs_submit(fn, tenant, trace->rid, payload, content_length > 0 ? (size_t)content_length : 0,
+                                 callback, key, id);
     free(payload);
+    if (r == JOB_SUBMIT_BAD_CALLBACK) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"callback must be http://127.0.0.1:PORT/path\"}",
+                  "application/json");
+        return;
+    }
+    if (r == JOB_SUBMIT_FULL) {
+        send_too_many(cfd, "{\"ok\":false,\"error\":\"too many jobs\"}", last_retry_after);
+        return;
+    }
+    if (r == JOB_SUBMIT_IO) {
+        send_http(cfd, 503, "Service Unavailable", "{\"error\":\"job log unavailable\"}", "application/json");
+        return;
+    }
+    // A retried submit (same Idempotency-Key) gets the job it created first
+    int dup = r == JOB_SUBMIT_DUPLICATE;
+    char body[160], extra[256];
+    snprintf(body, sizeof(body), "{\"ok\":true,\"job\":\"%s\",\"status\":\"/jobs/%s\"%s}", id, id,
+             dup ? ",\"duplicate\":true" : "");
+    snprintf(extra, sizeof(extra), "Location: /jobs/%s\r\nX-Request-Id: %s\r\n", id, trace->rid);
+    send_http_headers(cfd, dup ? 200 : 202, dup ? "OK" : "Accepted", body, "application/json", extra);
+}
+
+// GET /jobs: table counts. GET /jobs/<id>[?wait=S]: status, waiting up to
+// S seconds for the job to finish (long poll)
+static void handle_job(int cfd, const char *buf) {
+    const char *p = buf + 9; // after "GET /jobs"
+    if (*p == ' ' || *p == '?' || (*p == '/' && (p[1] == ' ' || p[1] == '?'))) {
+        char *body = jobs_ready ? jobs_stats_json() : NULL;
+        if (!body) {
+            send_http(cfd, 503, "Service Unavailable", "{\"error\":\"async invokes unavailable\"}", "application/json");
+            return;
+        }
+        send_http(cfd, 200, "OK", body, "application/json");
+        free(body);
+        return;
+    }
+    char id[JOB_ID_MAX] = {0};
+    size_t len = *p == '/' ? strspn(p + 1, "0123456789abcdef") : 0;
+    if (len == 0 || len >= sizeof(id) || (p[1 + len] != ' ' && p[1 + len] != '?')) {
+        send_http(cfd, 404, "Not Found", "{\"error\":\"unknown job\"}", "application/json");
+        return;
+    }
+    memcpy(id, p + 1, len);
+
+    char wait[16] = {0};
+    http_query_param(buf, "wait", wait, sizeof(wait));
+    char *body = jobs_ready ? jobs_status_json(id, atoi(wait)) : NULL;
+    if (!body) {
+        send_http(cfd, 404, "Not Found", "{\"error\":\"unknown job\"}", "application/json");
+        return;
+    }
+    send_http(cfd, 200, "OK", body, "application/json");
+    free(body);
+}
+
+static void handle_alias(int cfd, const char *buf) {
+    // POST /alias?name=hello&alias=stable&version=2
+    char name[MAX_FUNC_NAME] = {0};
+    char alias[MAX_ALIAS_NAME] = {0};
+    char version[16] = {0};
+    if (http_query_param(buf, "name", name, sizeof(name)) < 0 ||
+        http_query_param(buf, "alias", alias, sizeof(alias)) < 0 ||
+        http_query_param(buf, "version", version, sizeof(version)) < 0) {
+        send_http(cfd, 400, "Bad Request", "{\"error\":\"use /alias?name=X&alias=Y&version=N\"}", "application/json");
+        return;
+    }
+
+    int sfd = create_unix_client_socket(SERVER_SOCK_PATH);
+    if (sfd < 0) {
+        send_http(cfd, 503, "Service Unavailable", "{\"error\":\"server down\"}", "application/json");
+        return;
+    }
+
+    char msg[RECV_BUF];
+    snprintf(msg, sizeof(msg), "{\"type\":\"alias\",\"name\":\"%s\",\"alias\":\"%s\",\"version\":%d}\n",
+             name, alias, atoi(version));
+    write_all(sfd, msg, strlen(msg));
+
+    char resp[RECV_BUF];
+    ssize_t rl = read_line(sfd, resp, sizeof(resp));
+    close(sfd);
+    ref_invalidate();
+    if (rl <= 0) {
+        send_http(cfd, 502, "Bad Gateway", "{\"error\":\"no response from server\"}", "application/json");
+        return;
+    }
+    if (strstr(resp, "\"ok\":true")) {
+        send_http(cfd, 200, "OK", resp, "application/json");
+    } else {
+        send_http(cfd, 400, "Bad Request", resp, "application/json");
+    }
+}
+
+static void handle_queues(int cfd) {
+    // Queue stats live in the LB: ask it directly
+    int lfd = create_unix_client_socket(LB_SOCK_PATH);
+    if (lfd < 0) {
+        send_http(cfd, 503, "Service Unavailable", "{\"error\":\"load balancer down\"}", "application/json");
+        return;
+    }
+    const char *msg = "{\"type\":\"queue_stats\"}\n";
+    write_all(lfd, msg, strlen(msg));
+
+    char *resp = malloc(QUEUE_STATS_MAX);
+    if (!resp) {
+        close(lfd);
+        send_http(cfd, 500, "Internal Error", "{\"error\":\"malloc failed\"}", "application/json");
+        return;
+    }
+    ssize_t rl = read_line(lfd, resp, QUEUE_STATS_MAX);
+    close(lfd);
+    if (rl <= 0) {
+        send_http(cfd, 502, "Bad Gateway", "{\"error\":\"no response from load balancer\"}", "application/json");
+    } else {
+        send_http(cfd, 200, "OK", resp, "application/json");
+    }
+    free(resp);
+}
+
+static void handle_metrics(int cfd) {
+    // Counters are in shared memory: no round trip to the LB or server
+    char *body = metrics_render();
+    if (!body) {
+        send_http(cfd, 503, "Service Unavailable", "metrics disabled\n", "text/plain");
+        return;
+    }
+    send_http(cfd, 200, "OK", body, "text/plain; version=0.0.4");
+    free(body);
+}
+
+static void handle_admin_status(int cfd) {
+    // Published by workers, server and LB in the metrics segment: reading it
+    // never waits on a busy worker or the LB lock
+    char *body = metrics_status_json();
+    if (!body) {
+        send_http(cfd, 503, "Service Unavailable", "{\"error\":\"metrics disabled\"}", "application/json");
+        return;
+    }
+    send_http(cfd, 200, "OK", body, "application/json");
+    free(body);
+}
+
+static void handle_admin(int cfd, const char *buf) {
+    // POST /admin?action=drain|undrain|recycle&worker=N
+    // POST /admin?action=strategy&value=RR|FIFO|WEIGHTED|AFFINITY
+    char action[16] = {0};
+    char worker[16] = "-1";
+    char value[32] = {0};
+    if (http_query_param(buf, "action", action, sizeof(action)) < 0) {
+        send_http(cfd, 400, "Bad Request",
+                  "{\"error\":\"use /admin?action=drain|undrain|recycle&worker=N or action=strategy&value=S\"}",
+                  "application/json");
+        return;
+    }
+    http_query_param(buf, "worker", worker, sizeof(worker));
+    http_query_param(buf, "value", value, sizeof(value));
+
+    int lfd = create_unix_client_socket(LB_SOCK_PATH);
+    if (lfd < 0) {
+        send_http(cfd, 503, "Service Unavailable", "{\"error\":\"load balancer down\"}", "application/json");
+        return;
+    }
+    char msg[RECV_BUF];
+    snprintf(msg, sizeof(msg), "{\"type\":\"admin\",\"action\":\"%s\",\"worker\":%d,\"value\":\"%s\"}\n",
+             action, atoi(worker), value);
+    write_all(lfd, msg, strlen(msg));
+
+    char resp[RECV_BUF];
+    ssize_t rl = read_line(lfd, resp, sizeof(resp));
+    close(lfd);
+    if (rl <= 0) {
+        send_http(cfd, 502, "Bad Gateway", "{\"error\":\"no response from load balancer\"}", "application/json");
+    } else if (strstr(resp, "\"ok\":true")) {
+        send_http(cfd, 200, "OK", resp, "application/json");
+    } else {
+        send_http(cfd, 400, "Bad Request", resp, "application/json");
+    }
+}
+
+// Thread wrapper for handle_client: invokes block until the worker answers,
+// so each connection gets its own thread
+static void* handle_client_thread(void *arg) {
+    int cfd = *(int*)arg;
+    free(arg);
+    struct timeval idle = { KEEPALIVE_IDLE_S, 0 };
+    setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+    // Headers and body go out in separate writes: without this, Nagle holds
+    // the body until the client's delayed ACK (~40ms) on kept-alive connections
+    int one = 1;
+    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    while (handle_client(cfd)) {}
+    close(cfd);
+    free(cap_req.body);
+    cap_req.body = NULL;
+    cap_req.body_cap = 0;
+    pthread_mutex_lock(&admit_lock);
+    conns_active--;
+    pthread_mutex_unlock(&admit_lock);
+    return NULL;
+}
+
+// Connection cap reached: answer from the accept loop without a thread
+static void reject_connection(int cfd) {
+    char drain[RECV_BUF];
+    while (recv(cfd, drain, sizeof(drain), MSG_DONTWAIT) > 0) {}
+    send_too_many(cfd, "{\"ok\":false,\"error\":\"overloaded\"}", 1);
+    close(cfd);
 }
 
 int api_gateway_main(void) {
     int sfd = start_http_server();
     printf("api_gateway listening on 127.0.0.1:%d\n", HTTP_PORT);
 
+    trace_setup();
+
+    const char *cap_path = getenv("FAAS_CAPTURE");
+    if (cap_path && cap_path[0]) {
+        const char *cap_payloads = getenv("FAAS_CAPTURE_PAYLOADS");
+        int store = !cap_payloads || strcmp(cap_payloads, "0") != 0;
+        if (capture_open(cap_path, store) == 0) {
+            log_info("[GATEWAY] 🎥 Capturing traffic to %s%s\n", cap_path, store ? "" : " (payload hashes only)");
+        }
+    }
+
+    const char *conns_env = getenv("FAAS_GATEWAY_CONNS");
+    if (conns_env && atoi(conns_env) > 0) conns_max = atoi(conns_env);
+    const char *inflight_env = getenv("FAAS_GATEWAY_INFLIGHT");
+    if (inflight_env && atoi(inflight_env) >= GW_INFLIGHT_MIN) {
+        inflight_max = atoi(inflight_env);
+        invoke_limit = inflight_max;
+    }
+    const char *body_env = getenv("FAAS_BODY_MAX");
+    if (body_env && atol(body_env) > 0) body_max = atol(body_env);
+    const char *static_env = getenv("FAAS_STATIC_CACHE_MB");
+    static_init(static_env && atol(static_env) > 0 ? (size_t)atol(static_env) << 20 : 0);
+    const char *memo_env = getenv("FAAS_MEMO_MB");
+    memo_init(memo_env && atol(memo_env) > 0 ? (size_t)atol(memo_env) << 20 : 0);
+    jobs_ready = jobs_init() == 0;
+
     for (;;) {
         struct sockaddr_in cli;
         socklen_t clilen = sizeof(cli);
@@ -408,7 +1927,35 @@ int api_gateway_main(void) {
             perror("accept");
             continue;
         }
-        handle_client(cfd);
-        close(cfd);
+
+        pthread_mutex_lock(&admit_lock);
+        int admitted = conns_active < conns_max;
+        if (admitted) conns_active++;
+        pthread_mutex_unlock(&admit_lock);
+        if (!admitted) {
+            reject_connection(cfd);
+            continue;
+        }
+
+        int *cfd_ptr = malloc(sizeof(int));
+        if (!cfd_ptr) {
+            close(cfd);
+            pthread_mutex_lock(&admit_lock);
+            conns_active--;
+            pthread_mutex_unlock(&admit_lock);
+            continue;
+        }
+        *cfd_ptr = cfd;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, handle_client_thread, cfd_ptr) != 0) {
+            perror("pthread_create");
+            close(cfd);
+            free(cfd_ptr);
+            pthread_mutex_lock(&admit_lock);
+            conns_active--;
+            pthread_mutex_unlock(&admit_lock);
+        } else {
+            pthread_detach(thread);
+        }
     }
 }
@@ -0,0 +1,291 @@
+#include "capture.h"
+#include "http.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CAPTURE_BUF (256 * 1024)
+#define CAPTURE_FLUSH_S 1
+#define CAPTURE_FIXED 27          // fixed part of a record after the size field
+
+static int cap_fd = -1;
+static int cap_payloads = 1;
+static uint64_t cap_t0_us = 0;
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char *cap_buf = NULL;
+static size_t cap_len = 0;
+
+uint64_t capture_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+uint64_t capture_hash(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+int capture_enabled(void) {
+    return cap_fd >= 0;
+}
+
+static void write_fully(const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t w = write(cap_fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("capture write");
+            return;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+}
+
+// cap_lock held
+static void flush_locked(void) {
+    if (cap_len > 0) write_fully(cap_buf, cap_len);
+    cap_len = 0;
+}
+
+void capture_flush(void) {
+    if (cap_fd < 0) return;
+    pthread_mutex_lock(&cap_lock);
+    flush_locked();
+    pthread_mutex_unlock(&cap_lock);
+}
+
+static void *flusher_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        sleep(CAPTURE_FLUSH_S);
+        capture_flush();
+    }
+    return NULL;
+}
+
+static unsigned char *put_le(unsigned char *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = (unsigned char)(v >> (8 * i));
+    return p + bytes;
+}
+
+static uint64_t get_le(const unsigned char *p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+int capture_open(const char *path, int store_payloads) {
+    cap_buf = malloc(CAPTURE_BUF);
+    if (!cap_buf) return -1;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        free(cap_buf);
+        cap_buf = NULL;
+        return -1;
+    }
+    cap_fd = fd;
+    cap_payloads = store_payloads;
+    cap_t0_us = capture_now_us();
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    unsigned char hdr[16];
+    memcpy(hdr, CAPTURE_MAGIC, 8);
+    put_le(hdr + 8, (uint64_t)wall.tv_sec * 1000000ULL + (uint64_t)wall.tv_nsec / 1000, 8);
+    write_fully(hdr, sizeof(hdr));
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, flusher_thread, NULL) == 0) pthread_detach(t);
+    atexit(capture_flush);
+    return 0;
+}
+
+void capture_begin(capture_req_t *r, const char *request) {
+    r->start_us = capture_now_us();
+    r->status = 0;
+    r->method[0] = r->path[0] = r->fn[0] = r->tenant[0] = '\0';
+    r->payload_hash = capture_hash("", 0);
+    r->payload_len = 0;
+    r->has_body = 0;
+
+    // Request line: METHOD SP PATH SP VERSION
+    const char *sp = strchr(request, ' ');
+    if (sp && (size_t)(sp - request) < sizeof(r->method)) {
+        memcpy(r->method, request, (size_t)(sp - request));
+        r->method[sp - request] = '\0';
+        const char *end = strchr(sp + 1, ' ');
+        size_t plen = end ? (size_t)(end - sp - 1) : 0;
+        if (plen >= sizeof(r->path)) plen = sizeof(r->path) - 1;
+        memcpy(r->path, sp + 1, plen);
+        r->path[plen] = '\0';
+    }
+    if (http_query_param(request, "fn", r->fn, sizeof(r->fn)) < 0 &&
+        http_query_param(request, "name", r->fn, sizeof(r->fn)) < 0) {
+        r->fn[0] = '\0';
+    }
+    http_header_value(request, "X-Tenant", r->tenant, sizeof(r->tenant));
+}
+
+void capture_body(capture_req_t *r, const char *body, size_t len) {
+    r->payload_hash = capture_hash(body, len);
+    r->payload_len = (uint32_t)len;
+    if (!cap_payloads) return;
+    if (len > r->body_cap) {
+        char *nb = realloc(r->body, len);
+        if (!nb) return;
+        r->body = nb;
+        r->body_cap = len;
+    }
+    if (len > 0) memcpy(r->body, body, len);
+    r->has_body = 1;
+}
+
+void capture_end(capture_req_t *r) {
+    if (cap_fd < 0 || !r->method[0]) return;
+    uint64_t now = capture_now_us();
+    size_t mlen = strlen(r->method), plen = strlen(r->path);
+    size_t flen = strlen(r->fn), tlen = strlen(r->tenant);
+    size_t blen = r->has_body ? r->payload_len : 0;
+    size_t size = CAPTURE_FIXED + 1 + mlen + 2 + plen + 1 + flen + 1 + tlen + blen;
+
+    unsigned char fixed[4 + CAPTURE_FIXED + 1 + sizeof(r->method) + 2 + sizeof(r->path) +
+                        1 + sizeof(r->fn) + 1 + sizeof(r->tenant)];
+    unsigned char *p = fixed;
+    p = put_le(p, size, 4);
+    p = put_le(p, r->start_us - cap_t0_us, 8);
+    p = put_le(p, now - r->start_us, 4);
+    p = put_le(p, (uint64_t)r->status, 2);
+    *p++ = r->has_body ? CAPTURE_F_PAYLOAD : 0;
+    p = put_le(p, r->payload_hash, 8);
+    p = put_le(p, r->payload_len, 4);
+    *p++ = (unsigned char)mlen; memcpy(p, r->method, mlen); p += mlen;
+    p = put_le(p, plen, 2);     memcpy(p, r->path, plen);   p += plen;
+    *p++ = (unsigned char)flen; memcpy(p, r->fn, flen);     p += flen;
+    *p++ = (unsigned char)tlen; memcpy(p, r->tenant, tlen); p += tlen;
+    size_t hlen = (size_t)(p - fixed);
+
+    pthread_mutex_lock(&cap_lock);
+    if (cap_len + hlen + blen > CAPTURE_BUF) flush_locked();
+    if (hlen + blen > CAPTURE_BUF) {
+        // Larger than the buffer: straight to the file
+        write_fully(fixed, hlen);
+        write_fully(r->body, blen);
+    } else {
+        memcpy(cap_buf + cap_len, fixed, hlen);
+        if (blen > 0) memcpy(cap_buf + cap_len + hlen, r->body, blen);
+        cap_len += hlen + blen;
+    }
+    pthread_mutex_unlock(&cap_lock);
+}
+
+// ---------------------------------------------------------------------------
+// Reader
+// ---------------------------------------------------------------------------
+
+struct capture_reader {
+    FILE *f;
+    unsigned char *buf;
+    size_t cap;
+};
+
+capture_reader_t *capture_reader_open(const char *path, uint64_t *start_wall_us) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    unsigned char hdr[16];
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, CAPTURE_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        fclose(f);
+        return NULL;
+    }
+    capture_reader_t *rd = calloc(1, sizeof(*rd));
+    if (!rd) {
+        fclose(f);
+        return NULL;
+    }
+    rd->f = f;
+    if (start_wall_us) *start_wall_us = get_le(hdr + 8, 8);
+    return rd;
+}
+
+// Copies a length-prefixed string, truncated to the field
+static const unsigned char *get_str(const unsigned char *p, const unsigned char *end, int lbytes,
+                                    char *out, size_t cap) {
+    if (!p || end - p < lbytes) return NULL;
+    size_t len = (size_t)get_le(p, lbytes);
+    p += lbytes;
+    if ((size_t)(end - p) < len) return NULL;
+    size_t keep = len < cap - 1 ? len : cap - 1;
+    memcpy(out, p, keep);
+    out[keep] = '\0';
+    return p + len;
+}
+
+int capture_read(capture_reader_t *rd, capture_record_t *rec) {
+    memset(rec, 0, sizeof(*rec));
+    unsigned char szb[4];
+    size_t got = fread(szb, 1, 4, rd->f);
+    if (got == 0) return 0;
+    if (got != 4) return -1;
+    size_t size = (size_t)get_le(szb, 4);
+    if (size < CAPTURE_FIXED + 5) return -1;
+    if (size > rd->cap) {
+        unsigned char *nb = realloc(rd->buf, size);
+        if (!nb) return -1;
+        rd->buf = nb;
+        rd->cap = size;
+    }
+    // A record cut short by a crash ends the capture
+    if (fread(rd->buf, 1, size, rd->f) != size) return 0;
+
+    const unsigned char *p = rd->buf, *end = rd->buf + size;
+    rec->offset_us = get_le(p, 8);
+    rec->latency_us = (uint32_t)get_le(p + 8, 4);
+    rec->status = (uint16_t)get_le(p + 12, 2);
+    rec->flags = p[14];
+    rec->payload_hash = get_le(p + 15, 8);
+    rec->payload_len = (uint32_t)get_le(p + 23, 4);
+    p += 27;
+    p = get_str(p, end, 1, rec->method, sizeof(rec->method));
+    p = get_str(p, end, 2, rec->path, sizeof(rec->path));
+    p = get_str(p, end, 1, rec->fn, sizeof(rec->fn));
+    p = get_str(p, end, 1, rec->tenant, sizeof(rec->tenant));
+    if (!p) return -1;
+    if (rec->flags & CAPTURE_F_PAYLOAD) {
+        if ((size_t)(end - p) < rec->payload_len) return -1;
+        rec->payload = malloc((size_t)rec->payload_len + 1);
+        if (!rec->payload) return -1;
+        memcpy(rec->payload, p, rec->payload_len);
+        rec->payload[rec->payload_len] = '\0';
+    }
+    return 1;
+}
+
+void capture_record_free(capture_record_t *rec) {
+    free(rec->payload);
+    rec->payload = NULL;
+}
+
+void capture_reader_close(capture_reader_t *rd) {
+    if (!rd) return;
+    fclose(rd->f);
+    free(rd->buf);
+    free(rd);
+}
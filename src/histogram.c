@@ -0,0 +1,83 @@
+#include "histogram.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SUB_COUNT (1u << HIST_SUB_BITS)
+
+static int bucket_index(uint64_t v) {
+    if (v < SUB_COUNT) return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * (int)SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+}
+
+// Highest value that maps to bucket idx (percentiles report upper bounds)
+static uint64_t bucket_value(int idx) {
+    if (idx < (int)SUB_COUNT) return (uint64_t)idx;
+    int shift = idx / (int)SUB_COUNT - 1;
+    uint64_t sub = (uint64_t)(idx % (int)SUB_COUNT) + SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+int hist_init(histogram_t *h) {
+    memset(h, 0, sizeof(*h));
+    h->nbuckets = (HIST_MAX_BITS - HIST_SUB_BITS + 1) * (int)SUB_COUNT;
+    h->counts = calloc((size_t)h->nbuckets, sizeof(uint64_t));
+    if (!h->counts) return -1;
+    h->min = UINT64_MAX;
+    return 0;
+}
+
+void hist_free(histogram_t *h) {
+    free(h->counts);
+    h->counts = NULL;
+}
+
+void hist_reset(histogram_t *h) {
+    memset(h->counts, 0, sizeof(uint64_t) * (size_t)h->nbuckets);
+    h->total = 0;
+    h->min = UINT64_MAX;
+    h->max = 0;
+    h->sum = 0;
+}
+
+void hist_record(histogram_t *h, uint64_t value) {
+    int idx = bucket_index(value);
+    if (idx >= h->nbuckets) idx = h->nbuckets - 1;
+    h->counts[idx]++;
+    h->total++;
+    h->sum += (double)value;
+    if (value < h->min) h->min = value;
+    if (value > h->max) h->max = value;
+}
+
+void hist_merge(histogram_t *dst, const histogram_t *src) {
+    for (int i = 0; i < dst->nbuckets && i < src->nbuckets; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->total && src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t hist_percentile(const histogram_t *h, double p) {
+    if (h->total == 0) return 0;
+    if (p >= 100.0) return h->max;
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)h->total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < h->nbuckets; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t v = bucket_value(i);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+double hist_mean(const histogram_t *h) {
+    return h->total ? h->sum / (double)h->total : 0.0;
+}
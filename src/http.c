@@ -0,0 +1,62 @@
+#include "http.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+int http_content_length(const char *hdrs) {
+    const char *p = strcasestr(hdrs, "Content-Length:");
+    if (!p) return -1;
+    p += strlen("Content-Length:");
+    while (*p == ' ') p++;
+    long v = strtol(p, NULL, 10);
+    return v > INT_MAX ? INT_MAX : (int)v;   // oversized: rejected by the length checks
+}
+
+int http_header_value(const char *req, const char *name, char *out, size_t out_len) {
+    const char *hdr_end = strstr(req, "\r\n\r\n");
+    size_t nlen = strlen(name);
+    const char *p = strstr(req, "\r\n");
+    while (p && (!hdr_end || p < hdr_end)) {
+        p += 2;
+        if (strncasecmp(p, name, nlen) == 0 && p[nlen] == ':') {
+            p += nlen + 1;
+            while (*p == ' ') p++;
+            size_t j = 0;
+            while (*p && *p != '\r' && *p != '\n' && j + 1 < out_len) out[j++] = *p++;
+            out[j] = '\0';
+            return 0;
+        }
+        p = strstr(p, "\r\n");
+    }
+    return -1;
+}
+
+int http_query_param(const char *req, const char *key, char *out, size_t out_len) {
+    const char *line_end = strstr(req, "\r\n");
+    const char *q = strchr(req, '?');
+    if (!q || (line_end && q > line_end)) return -1;
+    size_t klen = strlen(key);
+    const char *p = q + 1;
+    while (*p && *p != ' ' && *p != '\r') {
+        if (strncmp(p, key, klen) == 0 && p[klen] == '=') {
+            p += klen + 1;
+            size_t j = 0;
+            while (*p && *p != '&' && *p != ' ' && *p != '\r' && j + 1 < out_len) {
+                if (*p == '%' && p[1] && p[2]) {
+                    char hex[3] = { p[1], p[2], 0 };
+                    out[j++] = (char)strtol(hex, NULL, 16);
+                    p += 3;
+                } else {
+                    out[j++] = *p++;
+                }
+            }
+            out[j] = '\0';
+            return 0;
+        }
+        while (*p && *p != '&' && *p != ' ' && *p != '\r') p++;
+        if (*p == '&') p++;
+    }
+    return -1;
+}
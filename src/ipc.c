@@ -4,6 +4,7 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -84,6 +85,103 @@ ssize_t read_line(int fd, char *buf, size_t maxlen) {
     return (ssize_t)i;
 }
 
+void line_reader_init(line_reader_t *r, int fd) {
+    r->fd = fd;
+    r->start = r->end = 0;
+}
+
+ssize_t line_reader_next(line_reader_t *r, char *out, size_t maxlen) {
+    size_t i = 0;
+    while (i + 1 < maxlen) {
+        if (r->start == r->end) {
+            ssize_t n = read(r->fd, r->buf, sizeof(r->buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return -1;
+            if (n == 0) break; // EOF
+            r->start = 0;
+            r->end = (size_t)n;
+        }
+        char c = r->buf[r->start++];
+        out[i++] = c;
+        if (c == '\n') break;
+    }
+    out[i] = '\0';
+    return (ssize_t)i;
+}
+
+ssize_t read_reply(line_reader_t *r, int relay_fd, char *out, size_t maxlen) {
+    for (;;) {
+        ssize_t n = line_reader_next(r, out, maxlen);
+        if (n <= 0 || strncmp(out, CHUNK_PREFIX, strlen(CHUNK_PREFIX)) != 0) return n;
+        if (relay_fd >= 0 && write_all(relay_fd, out, (size_t)n) < 0) relay_fd = -1;
+    }
+}
+
+// /proc/<pid>/fd/<n> and nothing else
+static int body_ref_path_ok(const char *path) {
+    const char *p = path + strlen(BODY_REF_PREFIX);
+    if (strncmp(path, BODY_REF_PREFIX, strlen(BODY_REF_PREFIX)) != 0) return 0;
+    size_t pid_len = strspn(p, "0123456789");
+    if (pid_len == 0 || strncmp(p + pid_len, "/fd/", 4) != 0) return 0;
+    p += pid_len + 4;
+    size_t fd_len = strspn(p, "0123456789");
+    return fd_len > 0 && p[fd_len] == '\0';
+}
+
+int body_ref_open(const char *line, const char *key) {
+    char pat[48], path[64] = {0};
+    snprintf(pat, sizeof(pat), "\"%s\":\"", key);
+    const char *p = strstr(line, pat);
+    if (!p) return -1;
+    p += strlen(pat);
+    size_t i = 0;
+    while (*p && *p != '"' && i + 1 < sizeof(path)) path[i++] = *p++;
+    if (!body_ref_path_ok(path)) return -2;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -2;
+
+    // "<name>_off": a slice of a spool shared by several bodies (batch items),
+    // copied to a memfd of its own so that the reader sees just that body
+    char off_key[48], len_key[48];
+    int nl = (int)strlen(key) - 4;   // key without "_ref"
+    snprintf(off_key, sizeof(off_key), "\"%.*s_off\":", nl > 0 ? nl : 0, key);
+    snprintf(len_key, sizeof(len_key), "\"%.*s_len\":", nl > 0 ? nl : 0, key);
+    const char *op = strstr(line, off_key), *lp = strstr(line, len_key);
+    long long off = 0, len = 0;
+    if (!op) return fd;
+    if (!lp || sscanf(op + strlen(off_key), "%lld", &off) != 1 || sscanf(lp + strlen(len_key), "%lld", &len) != 1 ||
+        off < 0 || len < 0) {
+        close(fd);
+        return -2;
+    }
+    int slice = memfd_create("faas_body", MFD_CLOEXEC);
+    char chunk[16384];
+    while (slice >= 0 && len > 0) {
+        ssize_t r = pread(fd, chunk, len < (long long)sizeof(chunk) ? (size_t)len : sizeof(chunk), (off_t)off);
+        if (r <= 0 || write_all(slice, chunk, (size_t)r) < 0) {
+            close(slice);
+            slice = -1;
+            break;
+        }
+        off += r;
+        len -= r;
+    }
+    close(fd);
+    if (slice < 0 || lseek(slice, 0, SEEK_SET) < 0) {
+        if (slice >= 0) close(slice);
+        return -2;
+    }
+    return slice;
+}
+
+int line_safe(const char *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (c < 0x20 || c == 0x7f || c == '"' || c == '\\') return 0;
+    }
+    return 1;
+}
+
 void trim_newline(char *s) {
     size_t n = strlen(s);
     while (n > 0 && (s[n-1] == '\n' || s[n-1] == '\r')) {
@@ -92,6 +190,65 @@ void trim_newline(char *s) {
     }
 }
 
+size_t json_escape(const char *in, size_t len, char *out, size_t out_cap) {
+    size_t j = 0;
+    if (out_cap == 0) return 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)in[i];
+        char esc[8];
+        size_t elen = 0;
+        switch (c) {
+            case '"':  esc[0] = '\\'; esc[1] = '"';  elen = 2; break;
+            case '\\': esc[0] = '\\'; esc[1] = '\\'; elen = 2; break;
+            case '\n': esc[0] = '\\'; esc[1] = 'n';  elen = 2; break;
+            case '\r': esc[0] = '\\'; esc[1] = 'r';  elen = 2; break;
+            case '\t': esc[0] = '\\'; esc[1] = 't';  elen = 2; break;
+            default:
+                if (c < 0x20) {
+                    elen = (size_t)snprintf(esc, sizeof(esc), "\\u%04x", c);
+                } else {
+                    esc[0] = (char)c;
+                    elen = 1;
+                }
+        }
+        if (j + elen >= out_cap) break;
+        memcpy(out + j, esc, elen);
+        j += elen;
+    }
+    out[j] = '\0';
+    return j;
+}
+
+size_t json_unescape(const char *in, size_t len, char *out, size_t out_cap) {
+    size_t j = 0;
+    if (out_cap == 0) return 0;
+    for (size_t i = 0; i < len && j + 1 < out_cap; i++) {
+        if (in[i] == '\\' && i + 1 < len) {
+            char next = in[++i];
+            if (next == 'n') out[j++] = '\n';
+            else if (next == 'r') out[j++] = '\r';
+            else if (next == 't') out[j++] = '\t';
+            else if (next == '"') out[j++] = '"';
+            else if (next == '\\') out[j++] = '\\';
+            else if (next == '/') out[j++] = '/';
+            else if (next == 'u' && i + 4 < len) {
+                unsigned int code = 0;
+                sscanf(in + i + 1, "%4x", &code);
+                out[j++] = code < 0x80 ? (char)code : '?';
+                i += 4;
+            } else {
+                // Unknown escape: keep it verbatim
+                out[j++] = '\\';
+                if (j + 1 < out_cap) out[j++] = next;
+            }
+        } else {
+            out[j++] = in[i];
+        }
+    }
+    out[j] = '\0';
+    return j;
+}
+
 void die(const char *msg) {
     perror(msg);
     exit(1);
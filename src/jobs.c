@@ -0,0 +1,849 @@
+#include "jobs.h"
+#include "ipc.h"
+#include "log.h"
+#include "storage.h"
+#include "wal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define JOB_BUCKETS 4096
+#define JOB_TTL_S 600            // finished jobs kept this long (FAAS_JOB_TTL)
+#define JOBS_MAX 10000           // jobs in the table, finished included (FAAS_JOBS_MAX)
+#define ASYNC_INFLIGHT 64        // jobs sent to the server at once (FAAS_ASYNC_INFLIGHT)
+#define JOB_RETRY_MAX 20         // LB 429s (or refused connections) before the job fails
+#define JOB_WAIT_MAX_S 60        // cap of GET /jobs/:id?wait=
+#define JOB_RESP_MAX 8192
+#define CALLBACK_TRIES 3
+#define CALLBACK_TIMEOUT_S 5
+#define JOBS_WAL_DIR FUNCTIONS_DIR "/.jobs"   // FAAS_JOB_WAL (0 = jobs in memory only)
+#define WAL_SEGMENT_BYTES (16u << 20)
+#define WAL_KEEP_SEGMENTS 4      // closed segments kept before the oldest is compacted
+
+// WAL records
+#define REC_SUBMIT 1   // id \0 key \0 fn \0 callback \0 u64 submitted (wall ms), invoke line[, raw payload]
+#define REC_DONE 2     // id \0 u32 attempts, u64 finished (wall ms), result
+
+typedef enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE } job_state_t;
+static const char *state_names[] = { "queued", "running", "done" };
+
+typedef struct job {
+    char id[JOB_ID_MAX];
+    char key[JOB_KEY_MAX];         // idempotency key, may be empty
+    char fn[128];
+    char callback[JOB_CALLBACK_MAX];
+    const char *callback_status;   // "pending", "delivered", "failed"
+    char *line;                    // invoke line for the server, until done
+    size_t line_len;
+    size_t body_off;               // line[body_off..line_len): raw payload spooled at dispatch (0 = inline)
+    job_state_t state;
+    int attempts;                  // times sent to the server
+    double submitted_ms, started_ms, finished_ms;
+    double submitted_wall_ms;
+    double not_before_ms;          // after a 429: not before Retry-After
+    char *result;                  // server response, once done
+    int recovered;                 // replayed from the WAL after a restart
+    uint32_t seg_submit, seg_done; // WAL segments holding its records (0 = none)
+    // Owned by the dispatcher while running
+    int fd;
+    int spool_fd;                  // memfd named by the line sent, -1 if inline
+    char *rbuf;
+    size_t rlen;
+    struct job *hash_next;
+    struct job *key_next;
+    struct job *next;              // pending or delayed list
+} job_t;
+
+static job_t *job_table[JOB_BUCKETS];
+static job_t *key_table[JOB_BUCKETS];
+static job_t *pending_head = NULL, *pending_tail = NULL; // ready, FIFO
+static job_t *delayed = NULL;                            // waiting for Retry-After
+static int njobs = 0, nqueued = 0, ninflight = 0;
+static unsigned long submitted = 0, completed = 0, retried = 0, expired = 0, duplicates = 0;
+static wal_t *wal = NULL;
+static int job_ttl_s = JOB_TTL_S;
+static int jobs_max = JOBS_MAX;
+static int inflight_max = ASYNC_INFLIGHT;
+static unsigned long id_prefix = 0, id_seq = 0;
+
+// Protects everything above; jobs_done is broadcast when any job finishes
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_done;
+static int wake_fd = -1;           // eventfd: new jobs for the dispatcher
+static int epfd = -1;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static double wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static unsigned long hash_id(const char *s) {
+    unsigned long h = 5381;
+    while (*s) h = h * 33 + (unsigned char)*s++;
+    return h % JOB_BUCKETS;
+}
+
+// jobs_lock held
+static job_t *find_job(const char *id) {
+    for (job_t *j = job_table[hash_id(id)]; j; j = j->hash_next) {
+        if (strcmp(j->id, id) == 0) return j;
+    }
+    return NULL;
+}
+
+static job_t *find_key(const char *key) {
+    for (job_t *j = key_table[hash_id(key)]; j; j = j->key_next) {
+        if (strcmp(j->key, key) == 0) return j;
+    }
+    return NULL;
+}
+
+static void insert_job(job_t *j) {
+    unsigned long b = hash_id(j->id);
+    j->hash_next = job_table[b];
+    job_table[b] = j;
+    if (j->key[0]) {
+        b = hash_id(j->key);
+        j->key_next = key_table[b];
+        key_table[b] = j;
+    }
+    njobs++;
+}
+
+// Unlink from both tables and release its WAL records
+static void remove_job(job_t *j) {
+    for (job_t **pp = &job_table[hash_id(j->id)]; *pp; pp = &(*pp)->hash_next) {
+        if (*pp == j) {
+            *pp = j->hash_next;
+            break;
+        }
+    }
+    if (j->key[0]) {
+        for (job_t **pp = &key_table[hash_id(j->key)]; *pp; pp = &(*pp)->key_next) {
+            if (*pp == j) {
+                *pp = j->key_next;
+                break;
+            }
+        }
+    }
+    if (wal && j->seg_submit) wal_ref(wal, j->seg_submit, -1);
+    if (wal && j->seg_done) wal_ref(wal, j->seg_done, -1);
+    njobs--;
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+// SUBMIT record (the invoke line is left out once the job is done).
+// Returns its segment, referenced for the job, -1 on error.
+static long log_submit(const job_t *j, int with_line, int sync) {
+    size_t lens[4] = { strlen(j->id) + 1, strlen(j->key) + 1, strlen(j->fn) + 1, strlen(j->callback) + 1 };
+    size_t line_len = with_line && j->line ? j->line_len : 0;
+    size_t len = lens[0] + lens[1] + lens[2] + lens[3] + 8 + line_len;
+    unsigned char *rec = malloc(len);
+    if (!rec) return -1;
+    unsigned char *p = rec;
+    const char *fields[4] = { j->id, j->key, j->fn, j->callback };
+    for (int i = 0; i < 4; i++) {
+        memcpy(p, fields[i], lens[i]);
+        p += lens[i];
+    }
+    put_u64(p, (uint64_t)j->submitted_wall_ms);
+    if (line_len) memcpy(p + 8, j->line, line_len);
+    long seg = wal_append(wal, REC_SUBMIT, rec, len, sync, 1);
+    free(rec);
+    return seg;
+}
+
+static long log_done(const job_t *j) {
+    size_t idlen = strlen(j->id) + 1, rlen = strlen(j->result);
+    size_t len = idlen + 12 + rlen;
+    unsigned char *rec = malloc(len);
+    if (!rec) return -1;
+    memcpy(rec, j->id, idlen);
+    unsigned char *p = rec + idlen;
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)((unsigned)j->attempts >> (8 * i));
+    put_u64(p + 4, (uint64_t)(wall_ms() - (now_ms() - j->finished_ms)));
+    memcpy(p + 12, j->result, rlen);
+    // Not waited for: losing it only means running the job again
+    long seg = wal_append(wal, REC_DONE, rec, len, 0, 1);
+    free(rec);
+    return seg;
+}
+
+static void push_pending(job_t *j) {
+    j->next = NULL;
+    if (pending_tail) pending_tail->next = j; else pending_head = j;
+    pending_tail = j;
+}
+
+// http://127.0.0.1[:port]/path or http://localhost[:port]/path
+static int parse_callback(const char *url, int *port, char *path, size_t path_cap) {
+    const char *p;
+    if (strncmp(url, "http://127.0.0.1", 16) == 0) p = url + 16;
+    else if (strncmp(url, "http://localhost", 16) == 0) p = url + 16;
+    else return -1;
+    if (strpbrk(url, "\"\\ \r\n")) return -1;
+    *port = 80;
+    if (*p == ':') {
+        char *end;
+        long v = strtol(p + 1, &end, 10);
+        if (end == p + 1 || v <= 0 || v > 65535) return -1;
+        *port = (int)v;
+        p = end;
+    }
+    if (*p && *p != '/') return -1;
+    snprintf(path, path_cap, "%s", *p ? p : "/");
+    return 0;
+}
+
+job_submit_t jobs_submit(const char *fn, const char *tenant, const char *rid,
+                         const char *payload, size_t payload_len, const char *callback, const char *key, char id_out[JOB_ID_MAX]) {
+    char cb_path[JOB_CALLBACK_MAX];
+    int cb_port;
+    if (callback && callback[0] &&
+        (strlen(callback) >= JOB_CALLBACK_MAX || parse_callback(callback, &cb_port, cb_path, sizeof(cb_path)) < 0)) {
+        return JOB_SUBMIT_BAD_CALLBACK;
+    }
+
+    job_t *j = calloc(1, sizeof(*j));
+    char *line = malloc(payload_len + 512);
+    if (!j || !line) {
+        free(j);
+        free(line);
+        return JOB_SUBMIT_FULL;
+    }
+    // Same message as a synchronous invoke. A payload the line can't carry
+    // follows it raw, and goes to a memfd each time the job is sent.
+    int inline_ok = payload_len <= PAYLOAD_INLINE_MAX && line_safe(payload, payload_len);
+    int m = snprintf(line, 512, "{\"type\":\"invoke\",\"fn\":\"%s\",\"tenant\":\"%s\",\"rid\":\"%s\"", fn, tenant, rid);
+    if (m < 0 || m >= 400) m = 0;
+    if (inline_ok) {
+        m += snprintf(line + m, 512 - (size_t)m, ",\"payload\":\"");
+        memcpy(line + m, payload, payload_len);
+        m += (int)payload_len;
+        memcpy(line + m, "\"}\n", 3);
+        j->line_len = (size_t)m + 3;
+    } else {
+        m += snprintf(line + m, 512 - (size_t)m, ",\"payload\":\"\",\"payload_len\":%zu}\n", payload_len);
+        memcpy(line + m, payload, payload_len);
+        j->body_off = (size_t)m;
+        j->line_len = (size_t)m + payload_len;
+    }
+    j->line = line;
+    j->fd = -1;
+    j->spool_fd = -1;
+    snprintf(j->fn, sizeof(j->fn), "%s", fn);
+    if (key) snprintf(j->key, sizeof(j->key), "%s", key);
+    if (callback && callback[0]) {
+        snprintf(j->callback, sizeof(j->callback), "%s", callback);
+        j->callback_status = "pending";
+    }
+
+    pthread_mutex_lock(&jobs_lock);
+    job_t *dup = j->key[0] ? find_key(j->key) : NULL;
+    if (dup || njobs >= jobs_max) {
+        if (dup) {
+            snprintf(id_out, JOB_ID_MAX, "%s", dup->id);
+            duplicates++;
+        }
+        pthread_mutex_unlock(&jobs_lock);
+        free(line);
+        free(j);
+        return dup ? JOB_SUBMIT_DUPLICATE : JOB_SUBMIT_FULL;
+    }
+    snprintf(j->id, sizeof(j->id), "%lx%06lx", id_prefix, ++id_seq & 0xffffff);
+    j->submitted_ms = now_ms();
+    j->submitted_wall_ms = wall_ms();
+    insert_job(j); // visible (queued) and holding its key, not dispatched yet
+    snprintf(id_out, JOB_ID_MAX, "%s", j->id);
+    pthread_mutex_unlock(&jobs_lock);
+
+    // Durable before it is acknowledged: concurrent submits share the sync
+    long seg = wal ? log_submit(j, 1, 1) : 0;
+
+    pthread_mutex_lock(&jobs_lock);
+    if (seg < 0) {
+        remove_job(j);
+        pthread_mutex_unlock(&jobs_lock);
+        free(line);
+        free(j);
+        return JOB_SUBMIT_IO;
+    }
+    if (seg > 0) j->seg_submit = (uint32_t)seg;
+    push_pending(j);
+    nqueued++;
+    submitted++;
+    pthread_mutex_unlock(&jobs_lock);
+
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) perror("jobs eventfd");
+    return JOB_SUBMIT_OK;
+}
+
+// jobs_lock held
+static char *status_locked(const job_t *j) {
+    double now = now_ms();
+    size_t cap = 1024 + (j->result ? strlen(j->result) : 0);
+    char *out = malloc(cap);
+    if (!out) return NULL;
+    double queued = (j->state == JOB_QUEUED ? now : j->started_ms) - j->submitted_ms;
+    double run = j->state == JOB_QUEUED ? 0 : (j->state == JOB_RUNNING ? now : j->finished_ms) - j->started_ms;
+    int n = snprintf(out, cap, "{\"ok\":true,\"id\":\"%s\",\"fn\":\"%s\",\"state\":\"%s\",\"attempts\":%d,"
+                     "\"queued_ms\":%.1f,\"run_ms\":%.1f",
+                     j->id, j->fn, state_names[j->state], j->attempts, queued, run);
+    if (j->key[0]) n += snprintf(out + n, cap - (size_t)n, ",\"key\":\"%s\"", j->key);
+    if (j->recovered) n += snprintf(out + n, cap - (size_t)n, ",\"recovered\":true");
+    if (j->callback[0]) {
+        n += snprintf(out + n, cap - (size_t)n, ",\"callback\":\"%s\",\"callback_status\":\"%s\"",
+                      j->callback, j->callback_status);
+    }
+    if (j->state == JOB_DONE) {
+        n += snprintf(out + n, cap - (size_t)n, ",\"expires_in_s\":%.0f,\"result\":%s",
+                      job_ttl_s - (now - j->finished_ms) / 1000.0, j->result);
+    }
+    snprintf(out + n, cap - (size_t)n, "}");
+    return out;
+}
+
+char *jobs_status_json(const char *id, int wait_s) {
+    pthread_mutex_lock(&jobs_lock);
+    job_t *j = find_job(id);
+    if (j && j->state != JOB_DONE && wait_s > 0) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += wait_s < JOB_WAIT_MAX_S ? wait_s : JOB_WAIT_MAX_S;
+        // Re-looked up after every wake: the job may have expired meanwhile
+        while (j && j->state != JOB_DONE) {
+            if (pthread_cond_timedwait(&jobs_done, &jobs_lock, &deadline) == ETIMEDOUT) {
+                j = find_job(id);
+                break;
+            }
+            j = find_job(id);
+        }
+    }
+    char *out = j ? status_locked(j) : NULL;
+    pthread_mutex_unlock(&jobs_lock);
+    return out;
+}
+
+char *jobs_stats_json(void) {
+    char *out = malloc(1024);
+    if (!out) return NULL;
+    pthread_mutex_lock(&jobs_lock);
+    int n = snprintf(out, 1024, "{\"ok\":true,\"jobs\":%d,\"queued\":%d,\"running\":%d,\"submitted\":%lu,"
+                     "\"completed\":%lu,\"retried\":%lu,\"duplicates\":%lu,\"expired\":%lu,\"jobs_max\":%d,"
+                     "\"inflight_max\":%d,\"ttl_s\":%d",
+                     njobs, nqueued, ninflight, submitted, completed, retried, duplicates, expired, jobs_max,
+                     inflight_max, job_ttl_s);
+    pthread_mutex_unlock(&jobs_lock);
+    if (wal) {
+        wal_stats_t st;
+        wal_get_stats(wal, &st);
+        snprintf(out + n, 1024 - (size_t)n, ",\"wal\":{\"segments\":%u,\"active\":%u,\"appends\":%lu,"
+                 "\"syncs\":%lu,\"bytes\":%lu}}", st.segments, st.active, st.appends, st.syncs, st.bytes);
+    } else {
+        snprintf(out + n, 1024 - (size_t)n, ",\"wal\":false}");
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Callback delivery
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    char id[JOB_ID_MAX];
+    char url[JOB_CALLBACK_MAX];
+    char *body;
+} callback_t;
+
+static int post_local(int port, const char *path, const char *body) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct timeval tv = { CALLBACK_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    char hdr[512];
+    size_t blen = strlen(body);
+    int n = snprintf(hdr, sizeof(hdr),
+                     "POST %s HTTP/1.1\r\nHost: 127.0.0.1:%d\r\nContent-Type: application/json\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", path, port, blen);
+    int status = -1;
+    if (send(fd, hdr, (size_t)n, MSG_NOSIGNAL) == n && send(fd, body, blen, MSG_NOSIGNAL) == (ssize_t)blen) {
+        char resp[64] = {0};
+        if (recv(fd, resp, sizeof(resp) - 1, 0) > 0) sscanf(resp, "HTTP/%*s %d", &status);
+    }
+    close(fd);
+    return status;
+}
+
+static void *callback_thread(void *arg) {
+    callback_t *cb = arg;
+    int port;
+    char path[JOB_CALLBACK_MAX];
+    int delivered = 0;
+    if (parse_callback(cb->url, &port, path, sizeof(path)) == 0) {
+        for (int t = 0; t < CALLBACK_TRIES && !delivered; t++) {
+            if (t > 0) sleep(1u << (t - 1));
+            int status = post_local(port, path, cb->body);
+            delivered = status >= 200 && status < 300;
+            if (!delivered) log_warn("[JOBS] ⚠️  Callback %s for job %s failed (status %d)\n", cb->url, cb->id, status);
+        }
+    }
+    pthread_mutex_lock(&jobs_lock);
+    job_t *j = find_job(cb->id);
+    if (j) j->callback_status = delivered ? "delivered" : "failed";
+    pthread_mutex_unlock(&jobs_lock);
+    free(cb->body);
+    free(cb);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Dispatcher
+// ---------------------------------------------------------------------------
+
+static void finish_job(job_t *j, const char *resp) {
+    callback_t *cb = NULL;
+    pthread_mutex_lock(&jobs_lock);
+    j->result = strdup(resp);
+    if (!j->result) j->result = strdup("{\"ok\":false,\"error\":\"malloc failed\"}");
+    j->state = JOB_DONE;
+    j->finished_ms = now_ms();
+    free(j->line);
+    j->line = NULL;
+    ninflight--;
+    completed++;
+    if (wal) {
+        long seg = log_done(j);
+        if (seg > 0) j->seg_done = (uint32_t)seg;
+    }
+    pthread_cond_broadcast(&jobs_done);
+    if (j->callback[0] && (cb = calloc(1, sizeof(*cb)))) {
+        snprintf(cb->id, sizeof(cb->id), "%s", j->id);
+        snprintf(cb->url, sizeof(cb->url), "%s", j->callback);
+        cb->body = status_locked(j);
+    }
+    pthread_mutex_unlock(&jobs_lock);
+
+    if (cb) {
+        pthread_t t;
+        if (!cb->body || pthread_create(&t, NULL, callback_thread, cb) != 0) {
+            free(cb->body);
+            free(cb);
+        } else {
+            pthread_detach(t);
+        }
+    }
+}
+
+// Back to the queue until delay_s from now (called by the dispatcher)
+static void delay_job(job_t *j, int delay_s) {
+    pthread_mutex_lock(&jobs_lock);
+    j->state = JOB_QUEUED;
+    j->not_before_ms = now_ms() + (delay_s > 0 ? delay_s : 1) * 1000.0;
+    j->next = delayed;
+    delayed = j;
+    ninflight--;
+    nqueued++;
+    retried++;
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+// The payload of a job whose line can't carry it, in a fresh memfd named
+// by the line: -1 on error
+static int spool_job(job_t *j) {
+    int fd = memfd_create("faas_body", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    if (write_all(fd, j->line + j->body_off, j->line_len - j->body_off) < 0) {
+        close(fd);
+        return -1;
+    }
+    j->spool_fd = fd;
+    return 0;
+}
+
+static int write_job(int fd, job_t *j) {
+    if (!j->body_off) return write_all(fd, j->line, j->line_len);
+    // The stored line without its "}\n", then the reference
+    char ref[96];
+    int n = snprintf(ref, sizeof(ref), ",\"payload_ref\":\"/proc/%d/fd/%d\"}\n", (int)getpid(), j->spool_fd);
+    if (write_all(fd, j->line, j->body_off - 2) < 0) return -1;
+    return write_all(fd, ref, (size_t)n);
+}
+
+static void close_spool(job_t *j) {
+    if (j->spool_fd >= 0) close(j->spool_fd);
+    j->spool_fd = -1;
+}
+
+static void send_job(job_t *j) {
+    if (j->body_off && spool_job(j) < 0) {
+        finish_job(j, "{\"ok\":false,\"error\":\"spool failed\"}");
+        return;
+    }
+    int fd = create_unix_client_socket(SERVER_SOCK_PATH);
+    if (fd >= 0 && (write_job(fd, j) < 0 || set_nonblocking(fd) < 0)) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0) {
+        close_spool(j);
+        // Server restarting, or not up yet when recovered jobs go out
+        if (j->attempts < JOB_RETRY_MAX) {
+            delay_job(j, 1);
+        } else {
+            finish_job(j, "{\"ok\":false,\"error\":\"server unavailable\"}");
+        }
+        return;
+    }
+    j->rbuf = malloc(JOB_RESP_MAX);
+    j->rlen = 0;
+    j->fd = fd;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = j };
+    if (!j->rbuf || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        close_spool(j);
+        free(j->rbuf);
+        j->rbuf = NULL;
+        finish_job(j, "{\"ok\":false,\"error\":\"dispatch failed\"}");
+    }
+}
+
+// The server answered (or hung up): finish the job, or queue it again
+// when the LB shed it
+static void complete_job(job_t *j) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, j->fd, NULL);
+    close(j->fd);
+    j->fd = -1;
+    close_spool(j); // the worker has read the payload
+    j->rbuf[j->rlen] = '\0';
+    trim_newline(j->rbuf);
+
+    const char *ra = strstr(j->rbuf, "\"retry_after\":");
+    int shed = ra && (strstr(j->rbuf, "\"error\":\"overloaded\"") || strstr(j->rbuf, "\"error\":\"rate_limited\""));
+    if (shed && j->attempts < JOB_RETRY_MAX) {
+        int retry_after = 1;
+        sscanf(ra, "\"retry_after\":%d", &retry_after);
+        delay_job(j, retry_after);
+    } else {
+        finish_job(j, j->rlen > 0 ? j->rbuf : "{\"ok\":false,\"error\":\"no resp\"}");
+    }
+    free(j->rbuf);
+    j->rbuf = NULL;
+}
+
+static void job_readable(job_t *j) {
+    for (;;) {
+        ssize_t r = read(j->fd, j->rbuf + j->rlen, JOB_RESP_MAX - 1 - j->rlen);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (r <= 0) break;
+        j->rlen += (size_t)r;
+        if (memchr(j->rbuf + j->rlen - (size_t)r, '\n', (size_t)r) || j->rlen == JOB_RESP_MAX - 1) break;
+    }
+    complete_job(j);
+}
+
+// Start ready jobs up to the in-flight cap. Returns the epoll timeout (ms)
+// until the next delayed job is due.
+static int start_jobs(void) {
+    int timeout = 1000;
+    pthread_mutex_lock(&jobs_lock);
+    double now = now_ms();
+    for (job_t **pp = &delayed; *pp;) {
+        job_t *j = *pp;
+        if (j->not_before_ms <= now) {
+            *pp = j->next;
+            push_pending(j);
+        } else {
+            if (j->not_before_ms - now < timeout) timeout = (int)(j->not_before_ms - now) + 1;
+            pp = &j->next;
+        }
+    }
+    while (ninflight < inflight_max && pending_head) {
+        job_t *j = pending_head;
+        pending_head = j->next;
+        if (!pending_head) pending_tail = NULL;
+        j->next = NULL;
+        j->state = JOB_RUNNING;
+        j->started_ms = now_ms();
+        j->attempts++;
+        nqueued--;
+        ninflight++;
+        pthread_mutex_unlock(&jobs_lock);
+        send_job(j);
+        pthread_mutex_lock(&jobs_lock);
+    }
+    pthread_mutex_unlock(&jobs_lock);
+    return timeout;
+}
+
+// Forget finished jobs older than the TTL
+static void reap_jobs(void) {
+    pthread_mutex_lock(&jobs_lock);
+    double cutoff = now_ms() - job_ttl_s * 1000.0;
+    for (int b = 0; b < JOB_BUCKETS; b++) {
+        for (job_t **pp = &job_table[b]; *pp;) {
+            job_t *j = *pp;
+            if (j->state == JOB_DONE && j->finished_ms < cutoff) {
+                remove_job(j); // unlinks *pp
+                free(j->result);
+                free(j);
+                expired++;
+            } else {
+                pp = &j->hash_next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&jobs_lock);
+}
+
+// Copy the live records of the oldest segment to the head of the log so it
+// can be deleted. A done job is copied as SUBMIT (without its invoke line)
+// followed by DONE: replay must see them in that order.
+static void compact_wal(void) {
+    uint32_t seg = wal_compact_candidate(wal, WAL_KEEP_SEGMENTS);
+    if (!seg) return;
+    wal_ref(wal, seg, 1); // pinned until the copies are on disk
+    int moved = 0;
+    pthread_mutex_lock(&jobs_lock);
+    for (int b = 0; b < JOB_BUCKETS; b++) {
+        for (job_t *j = job_table[b]; j; j = j->hash_next) {
+            if (j->seg_submit != seg) continue;
+            long s_seg = log_submit(j, j->state != JOB_DONE, 0);
+            long d_seg = s_seg > 0 && j->state == JOB_DONE ? log_done(j) : 0;
+            if (s_seg <= 0) continue;
+            if (d_seg < 0) {
+                wal_ref(wal, (uint32_t)s_seg, -1);
+                continue;
+            }
+            wal_ref(wal, j->seg_submit, -1);
+            j->seg_submit = (uint32_t)s_seg;
+            if (d_seg > 0) {
+                if (j->seg_done) wal_ref(wal, j->seg_done, -1);
+                j->seg_done = (uint32_t)d_seg;
+            }
+            moved++;
+        }
+    }
+    pthread_mutex_unlock(&jobs_lock);
+    if (wal_sync(wal) == 0) {
+        wal_ref(wal, seg, -1);
+        log_info("[JOBS] 🗜️  Compacted WAL segment %u (%d jobs moved)\n", seg, moved);
+    }
+}
+
+static void *dispatcher_thread(void *arg) {
+    (void)arg;
+    struct epoll_event evs[64];
+    double last_reap = now_ms();
+    for (;;) {
+        int timeout = start_jobs();
+        int n = epoll_wait(epfd, evs, 64, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("jobs epoll_wait");
+            sleep(1);
+        }
+        for (int i = 0; i < n; i++) {
+            if (!evs[i].data.ptr) {
+                uint64_t v;
+                if (read(wake_fd, &v, sizeof(v)) < 0 && errno != EAGAIN) perror("jobs eventfd");
+            } else {
+                job_readable(evs[i].data.ptr);
+            }
+        }
+        if (now_ms() - last_reap >= 1000) {
+            reap_jobs();
+            if (wal) compact_wal();
+            last_reap = now_ms();
+        }
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Recovery
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    job_t *head, *tail;          // replayed jobs in submission order
+    unsigned long max_prefix;    // ids of the previous runs
+} replay_ctx_t;
+
+static void replay_record(void *arg, uint32_t seg, uint8_t type, const void *data, size_t len) {
+    replay_ctx_t *rc = arg;
+    const char *p = data, *end = p + len;
+    if (type == REC_SUBMIT) {
+        const char *f[4];
+        for (int i = 0; i < 4; i++) {
+            const char *z = memchr(p, '\0', (size_t)(end - p));
+            if (!z) return;
+            f[i] = p;
+            p = z + 1;
+        }
+        // A job copied by compaction before a crash is there twice: keep the first
+        if (end - p < 8 || !f[0][0] || strlen(f[0]) >= JOB_ID_MAX || find_job(f[0])) return;
+        job_t *j = calloc(1, sizeof(*j));
+        if (!j) return;
+        snprintf(j->id, sizeof(j->id), "%s", f[0]);
+        snprintf(j->key, sizeof(j->key), "%s", f[1]);
+        snprintf(j->fn, sizeof(j->fn), "%s", f[2]);
+        snprintf(j->callback, sizeof(j->callback), "%s", f[3]);
+        if (j->callback[0]) j->callback_status = "pending";
+        j->submitted_wall_ms = (double)get_u64((const unsigned char *)p);
+        j->submitted_ms = now_ms() - (wall_ms() - j->submitted_wall_ms);
+        p += 8;
+        if (end > p && (j->line = malloc((size_t)(end - p)))) {
+            memcpy(j->line, p, (size_t)(end - p));
+            j->line_len = (size_t)(end - p);
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            if (nl && nl + 1 < end) j->body_off = (size_t)(nl + 1 - p);
+        }
+        j->fd = -1;
+        j->spool_fd = -1;
+        j->recovered = 1;
+        j->seg_submit = seg;
+        wal_ref(wal, seg, 1);
+        insert_job(j);
+        if (rc->tail) rc->tail->next = j; else rc->head = j;
+        rc->tail = j;
+
+        size_t idlen = strlen(j->id);
+        if (idlen > 6) {
+            char prefix[JOB_ID_MAX];
+            memcpy(prefix, j->id, idlen - 6);
+            prefix[idlen - 6] = '\0';
+            unsigned long v = strtoul(prefix, NULL, 16);
+            if (v > rc->max_prefix) rc->max_prefix = v;
+        }
+    } else if (type == REC_DONE) {
+        const char *z = memchr(p, '\0', len);
+        if (!z || end - (z + 1) < 12) return;
+        job_t *j = find_job(p);
+        if (!j || j->state == JOB_DONE) return;
+        const unsigned char *q = (const unsigned char *)z + 1;
+        j->attempts = (int)((uint32_t)q[0] | (uint32_t)q[1] << 8 | (uint32_t)q[2] << 16 | (uint32_t)q[3] << 24);
+        j->finished_ms = now_ms() - (wall_ms() - (double)get_u64(q + 4));
+        j->started_ms = j->finished_ms;
+        j->result = strndup((const char *)q + 12, (size_t)(end - (const char *)q - 12));
+        j->state = JOB_DONE;
+        free(j->line);
+        j->line = NULL;
+        j->seg_done = seg;
+        wal_ref(wal, seg, 1);
+    }
+}
+
+// Rebuild the table from the WAL: unfinished jobs run again (at least once)
+static void recover_jobs(void) {
+    replay_ctx_t rc = { NULL, NULL, 0 };
+    pthread_mutex_lock(&jobs_lock);
+    int records = wal_replay(wal, replay_record, &rc);
+    int requeued = 0, done = 0;
+    for (job_t *j = rc.head, *next; j; j = next) {
+        next = j->next;
+        j->next = NULL;
+        if (j->state == JOB_DONE) {
+            if (!j->result) j->result = strdup("{\"ok\":false,\"error\":\"result lost\"}");
+            done++;
+        } else if (!j->line) {
+            // SUBMIT copy without its line and no DONE: cannot run it again
+            j->state = JOB_DONE;
+            j->finished_ms = now_ms();
+            j->result = strdup("{\"ok\":false,\"error\":\"lost in recovery\"}");
+            done++;
+        } else {
+            push_pending(j);
+            nqueued++;
+            requeued++;
+        }
+    }
+    if (rc.max_prefix >= id_prefix) id_prefix = rc.max_prefix + 1;
+    pthread_mutex_unlock(&jobs_lock);
+    wal_gc(wal);
+    if (records > 0) {
+        log_info("[JOBS] 📼 Replayed %d WAL records: %d jobs to run again, %d finished\n", records, requeued, done);
+    }
+}
+
+int jobs_init(void) {
+    const char *env = getenv("FAAS_JOB_TTL");
+    if (env && atoi(env) > 0) job_ttl_s = atoi(env);
+    env = getenv("FAAS_JOBS_MAX");
+    if (env && atoi(env) > 0) jobs_max = atoi(env);
+    env = getenv("FAAS_ASYNC_INFLIGHT");
+    if (env && atoi(env) > 0) inflight_max = atoi(env);
+    id_prefix = (unsigned long)time(NULL);
+
+    const char *wal_dir = getenv("FAAS_JOB_WAL");
+    if (!wal_dir || !wal_dir[0]) {
+        wal_dir = JOBS_WAL_DIR;
+        mkdir(FUNCTIONS_DIR, 0755);
+    }
+    if (strcmp(wal_dir, "0") != 0) {
+        wal = wal_open(wal_dir, WAL_SEGMENT_BYTES);
+        if (wal) {
+            recover_jobs();
+        } else {
+            log_warn("[JOBS] ⚠️  No WAL in %s: async jobs are kept in memory only\n", wal_dir);
+        }
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&jobs_done, &attr);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (wake_fd < 0 || epfd < 0) {
+        perror("jobs init");
+        return -1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    pthread_t t;
+    if (pthread_create(&t, NULL, dispatcher_thread, NULL) != 0) {
+        perror("pthread_create jobs");
+        return -1;
+    }
+    pthread_detach(t);
+    log_info("[GATEWAY] 📬 Async jobs: %d in flight, results kept %ds, %s\n", inflight_max, job_ttl_s,
+             wal ? wal_dir : "not persisted");
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "limiter.h"
+
+void limit_init(conc_limit_t *l, double initial, double min, double max) {
+    if (min < 1.0) min = 1.0;
+    if (max < min) max = min;
+    if (initial < min) initial = min;
+    if (initial > max) initial = max;
+    l->limit = initial;
+    l->min_limit = min;
+    l->max_limit = max;
+    l->gradient = 1.0;
+    l->samples = 0;
+    l->increases = 0;
+    l->decreases = 0;
+}
+
+int limit_update(conc_limit_t *l, double rtt_ms, double baseline_ms, int inflight) {
+    if (rtt_ms <= 0 || baseline_ms <= 0 || l->min_limit == l->max_limit) return 0;
+    l->samples++;
+
+    // gradient = tolerated latency / observed latency, clamped to [0.5, 1]
+    double gradient = LIMIT_TOLERANCE * baseline_ms / rtt_ms;
+    if (gradient > 1.0) gradient = 1.0;
+    if (gradient < 0.5) gradient = 0.5;
+    l->gradient = gradient;
+
+    // Idle workers say nothing about how much more they could take
+    if (gradient >= 1.0 && inflight * 2 < limit_value(l)) return 0;
+
+    int before = limit_value(l);
+    double estimate = l->limit * gradient + LIMIT_HEADROOM;
+    double next = (1.0 - LIMIT_SMOOTHING) * l->limit + LIMIT_SMOOTHING * estimate;
+    if (next < l->min_limit) next = l->min_limit;
+    if (next > l->max_limit) next = l->max_limit;
+    l->limit = next;
+
+    int after = limit_value(l);
+    if (after > before) { l->increases++; return 1; }
+    if (after < before) { l->decreases++; return -1; }
+    return 0;
+}
+
+int limit_value(const conc_limit_t *l) {
+    int v = (int)l->limit;
+    return v < 1 ? 1 : v;
+}
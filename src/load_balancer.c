@@ -8,35 +8,128 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>
 
 #include "ipc.h"
+#include "log.h"
+#include "metrics.h"
+#include "affinity.h"
+#include "storage.h"
+#include "limiter.h"
+#include "trace.h"
 
 #define MAX_WORKERS 32
 #define LINE_MAX 8192
+#define WARM_SET_MAX 256 // functions tracked as warm per worker
+
+// Fair queuing: requests are queued per flow (function, or function@tenant)
+// and dispatched by deficit round robin when a worker slot frees up. A
+// request costs its flow's average execution time as reported by workers,
+// so flows share worker time rather than request counts.
+#define FLOW_BUCKETS 512
+#define FLOW_MAX 4096         // beyond this, tenants share their function's flow
+#define DRR_QUANTUM_MS 10.0   // worker time credited per round, times the flow weight
+#define DRR_COST_MIN_MS 0.05
+#define DRR_COST_MAX_MS 1000.0 // bounds the rounds needed before a slow flow sends
+#define COST_EWMA_ALPHA 0.2
+#define QUEUE_TIMEOUT_MS 30000
+
+// Admission control: CoDel on queueing delay plus a hard cap on queue length
+#define CODEL_TARGET_MS 50.0     // acceptable standing queue delay
+#define CODEL_INTERVAL_MS 500.0  // delay must stay above target this long before dropping
+#define QUEUE_MAX 256            // queued requests across all flows (FAAS_QUEUE_MAX)
+#define SERVICE_EWMA_ALPHA 0.2   // smoothing of observed service time, for Retry-After
+#define BASELINE_EWMA_ALPHA 0.1  // smoothing of a flow's unqueued latency
+
+// sched_acquire() results besides a worker index
+#define SCHED_UNAVAILABLE -1     // no workers, or queue timeout
+#define SCHED_OVERLOADED -2      // queue full or dropped by CoDel
+#define SCHED_RATE_LIMITED -3    // function token bucket empty
+#define STATS_MAX (64 * 1024)
+#define RECYCLE_DRAIN_MS 30000   // in-flight requests must finish within this before a recycle
 
 typedef enum {
-    STRATEGY_RR,    // Round Robin
-    STRATEGY_FIFO,  // First In First Out
-    STRATEGY_WEIGHTED // Weighted (TODO)
+    STRATEGY_RR,      // Round Robin
+    STRATEGY_FIFO,    // First In First Out
+    STRATEGY_WEIGHTED, // Least loaded
+    STRATEGY_AFFINITY // Bounded-load consistent hashing on function ID
 } lb_strategy_t;
 
+static const char *strategy_names[] = { "RR", "FIFO", "WEIGHTED", "AFFINITY" };
+
 typedef struct {
     int worker_id;  // Worker ID from server
     pid_t pid;
     int active;
-    int load;       // current load (for weighted strategy)
+    int load;       // requests currently in flight on this worker
+    int calling;    // faas.call invokes it is blocked on (see has_slot)
     int registered; // Has been registered by server
+    int draining;   // set by POST /admin: gets no new requests
+    unsigned long jobs;   // completed requests
+    unsigned long hits;   // module cache hits reported by the worker
+    unsigned long misses; // module cache misses reported by the worker
+    // Functions believed warm in the worker's module cache (FNV hashes),
+    // mirrored from cache/evicted fields of worker responses.
+    uint64_t warm[WARM_SET_MAX];
+    int nwarm;
+    // In-flight requests allowed, tuned from latency (see limiter.h)
+    conc_limit_t limit;
+    double rtt_ewma_ms;
 } worker_info_t;
 
 static worker_info_t workers[MAX_WORKERS];
 static int num_active_workers = 0;
+static int fixed_slots = 0; // FAAS_WORKER_SLOTS: pin every worker's limit
 static lb_strategy_t strategy = STRATEGY_RR;
 static int rr_idx = 0;
 static volatile sig_atomic_t running = 1;
 
+// Protects workers[], rr_idx and the ring: invokes are handled concurrently
+static pthread_mutex_t lb_lock = PTHREAD_MUTEX_INITIALIZER;
+static hash_ring_t ring = {0};
+
 // Communication with server for worker access
 static int server_fd = -1;
 
+// Rebuild the consistent hash ring from active workers (lb_lock held)
+static void rebuild_ring(void) {
+    int ids[MAX_WORKERS];
+    int n = 0;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (workers[i].active) ids[n++] = i;
+    }
+    ring_build(&ring, ids, n);
+}
+
+static int warm_set_contains(const worker_info_t *w, uint64_t h) {
+    for (int i = 0; i < w->nwarm; i++) {
+        if (w->warm[i] == h) return 1;
+    }
+    return 0;
+}
+
+static void warm_set_add(worker_info_t *w, uint64_t h) {
+    if (warm_set_contains(w, h)) return;
+    if (w->nwarm == WARM_SET_MAX) {
+        // Full: drop the oldest entry
+        memmove(&w->warm[0], &w->warm[1], sizeof(uint64_t) * (WARM_SET_MAX - 1));
+        w->nwarm--;
+    }
+    w->warm[w->nwarm++] = h;
+}
+
+static void warm_set_remove(worker_info_t *w, uint64_t h) {
+    for (int i = 0; i < w->nwarm; i++) {
+        if (w->warm[i] == h) {
+            w->warm[i] = w->warm[--w->nwarm];
+            return;
+        }
+    }
+}
+
 static void sigchld_handler(int sig) {
     (void)sig;
     int status;
@@ -62,27 +155,56 @@ static void sigint_handler(int sig) {
 // Register a worker when server notifies us
 static void register_worker(int worker_id, pid_t worker_pid) {
     if (worker_id < 0 || worker_id >= MAX_WORKERS) {
-        fprintf(stderr, "lb: invalid worker_id %d\n", worker_id);
+        log_warn("lb: invalid worker_id %d\n", worker_id);
         return;
     }
     
+    // A recycled worker registers again in the same slot
+    if (!workers[worker_id].active) num_active_workers++;
     workers[worker_id].worker_id = worker_id;
     workers[worker_id].pid = worker_pid;
     workers[worker_id].active = 1;
+    workers[worker_id].draining = 0;
     workers[worker_id].registered = 1;
     workers[worker_id].load = 0;
-    num_active_workers++;
+    workers[worker_id].calling = 0;
+    workers[worker_id].nwarm = 0;
+    workers[worker_id].rtt_ewma_ms = 0;
+    if (fixed_slots > 0) {
+        limit_init(&workers[worker_id].limit, fixed_slots, fixed_slots, fixed_slots);
+    } else {
+        limit_init(&workers[worker_id].limit, LIMIT_INITIAL, LIMIT_MIN, LIMIT_MAX);
+    }
+    rebuild_ring();
+    metrics_worker_draining(worker_id, 0);
     
-    fprintf(stderr, "lb: registered worker %d (pid %d)\n", worker_id, worker_pid);
+    log_info("lb: registered worker %d (pid %d)\n", worker_id, worker_pid);
 }
 
 
+// Worker can take one more request right now. A worker waiting on a
+// faas.call holds its job until the call returns: anything queued behind
+// it, the call itself included, would never run.
+static int has_slot(int idx) {
+    return workers[idx].active && !workers[idx].draining && workers[idx].calling == 0 &&
+           workers[idx].load < limit_value(&workers[idx].limit);
+}
+
+// Sum of active workers' limits
+static int global_limit(void) {
+    int total = 0;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (workers[i].active && !workers[i].draining) total += limit_value(&workers[i].limit);
+    }
+    return total;
+}
+
 static int pick_worker_rr(void) {
     // Round Robin
     if (num_active_workers == 0) return -1;
     for (int i = 0; i < MAX_WORKERS; i++) {
         int idx = (rr_idx + i) % MAX_WORKERS;
-        if (workers[idx].active) {
+        if (has_slot(idx)) {
             rr_idx = (idx + 1) % MAX_WORKERS;
             return idx;
         }
@@ -93,46 +215,648 @@ static int pick_worker_rr(void) {
 static int pick_worker_fifo(void) {
     // FIFO: always pick first available worker
     for (int i = 0; i < MAX_WORKERS; i++) {
-        if (workers[i].active) {
+        if (has_slot(i)) {
             return i;
         }
     }
     return -1;
 }
 
-static int pick_worker(void) {
+static int pick_worker_weighted(void) {
+    // Least loaded, ties broken round robin
+    int best = -1;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        int idx = (rr_idx + i) % MAX_WORKERS;
+        if (has_slot(idx) && (best < 0 || workers[idx].load < workers[best].load)) {
+            best = idx;
+        }
+    }
+    if (best >= 0) rr_idx = (best + 1) % MAX_WORKERS;
+    return best;
+}
+
+static int pick_worker_affinity(const char *func_id) {
+    int load[MAX_WORKERS] = {0};
+    unsigned char warm[MAX_WORKERS] = {0};
+    uint64_t h = affinity_hash(func_id);
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (!workers[i].active) continue;
+        load[i] = has_slot(i) ? workers[i].load : -1;
+        warm[i] = (unsigned char)warm_set_contains(&workers[i], h);
+    }
+    return affinity_pick(&ring, h, load, warm, AFFINITY_BALANCE);
+}
+
+// Called with lb_lock held. Only workers with a free slot are eligible.
+static int pick_worker(const char *func_id) {
     switch (strategy) {
         case STRATEGY_RR:
             return pick_worker_rr();
         case STRATEGY_FIFO:
             return pick_worker_fifo();
         case STRATEGY_WEIGHTED:
-            // TODO: pick worker with lowest load
-            return pick_worker_rr();
+            return pick_worker_weighted();
+        case STRATEGY_AFFINITY:
+            return pick_worker_affinity(func_id);
         default:
             return pick_worker_rr();
     }
 }
 
-static void handle_invoke(int client_fd, const char *line) {
-    fprintf(stderr, "[LB] 📨 Received invoke request: %s", line);
-    
-    int widx = pick_worker();
-    if (widx < 0) {
-        fprintf(stderr, "[LB] ❌ No worker available\n");
-        const char *resp = "{\"ok\":false,\"error\":\"no worker available\"}\n";
-        write_all(client_fd, resp, strlen(resp));
-        close(client_fd);
-        return;
+// Update load and cache view of a worker from its response (lb_lock held)
+static void account_response(int widx, const char *func_id, const char *resp) {
+    worker_info_t *w = &workers[widx];
+    w->load--;
+    w->jobs++;
+    if (!resp) return;
+
+    if (strstr(resp, "\"cache\":\"hit\"")) {
+        w->hits++;
+        warm_set_add(w, affinity_hash(func_id));
+    } else if (strstr(resp, "\"cache\":\"miss\"")) {
+        w->misses++;
+        warm_set_add(w, affinity_hash(func_id));
+    }
+    const char *ev = strstr(resp, "\"evicted\":\"");
+    if (ev) {
+        char evicted[256] = {0};
+        sscanf(ev, "\"evicted\":\"%255[^\"]\"", evicted);
+        warm_set_remove(w, affinity_hash(evicted));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Fair queuing scheduler (lb_lock held everywhere below)
+// ---------------------------------------------------------------------------
+
+typedef enum { LANE_HIGH, LANE_NORMAL, LANE_COUNT } lane_t;
+
+static const char *lane_names[LANE_COUNT] = { "high", "normal" };
+
+typedef struct waiter {
+    struct waiter *next;
+    pthread_cond_t cond;
+    double enqueued_ms;
+    int widx;                  // assigned worker, -1 while queued
+    int alone;                 // worker was idle when the request was assigned
+    int dropped;               // rejected by CoDel while queued
+} waiter_t;
+
+// Per-function token bucket (shared by all tenants of the function)
+typedef struct rate_bucket {
+    char fn[MAX_FUNC_ID];
+    double rate;               // tokens/s
+    double burst;
+    double tokens;
+    double last_ms;
+    struct rate_bucket *next;
+} rate_bucket_t;
+
+typedef struct flow {
+    char key[MAX_FUNC_ID + 64]; // fn or fn@tenant
+    char fn[MAX_FUNC_ID];
+    lane_t lane;
+    int weight;
+    int max_concurrency;       // 0 = unlimited
+    int inflight;
+    double deficit;            // ms of worker time the flow may still use this round
+    double cost_ms;            // EWMA of execution time (DRR cost), quantum until measured
+    int cost_known;
+    waiter_t *head, *tail;
+    int depth;
+    int in_lane;               // linked in its lane's active list
+    struct flow *next_active;
+    struct flow *hash_next;
+    rate_bucket_t *bucket;     // NULL if the function has no rate limit
+    double rtt_base_ms;        // latency when running on an idle worker (limiter baseline)
+    unsigned long dispatched;
+    unsigned long rejected;
+    double wait_total_ms, wait_max_ms;
+} flow_t;
+
+typedef struct {
+    flow_t *head, *tail;       // active flows (non-empty queue), DRR order
+    int nactive;
+    int depth;
+    unsigned long dispatched;
+    double wait_total_ms, wait_max_ms;
+} lane_info_t;
+
+static flow_t *flow_table[FLOW_BUCKETS];
+static int nflows = 0;
+static lane_info_t lanes[LANE_COUNT];
+static int queued_total = 0;
+static pthread_condattr_t waiter_condattr;
+
+static rate_bucket_t *rate_table[FLOW_BUCKETS];
+static int queue_max = QUEUE_MAX;
+static double service_ewma_ms = 0;
+
+static struct {
+    double first_above_ms;     // when sojourn may start counting as persistent
+    double drop_next_ms;
+    int dropping;
+    unsigned count;            // drops in the current dropping state
+} codel;
+
+static unsigned long rejected_full = 0;
+static unsigned long dropped_codel = 0;
+static unsigned long rate_limited = 0;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static flow_t *flow_lookup(const char *key) {
+    for (flow_t *f = flow_table[affinity_hash(key) % FLOW_BUCKETS]; f; f = f->hash_next) {
+        if (strcmp(f->key, key) == 0) return f;
+    }
+    return NULL;
+}
+
+static rate_bucket_t *rate_bucket_get(const char *fn, const function_options_t *opts) {
+    unsigned b = (unsigned)(affinity_hash(fn) % FLOW_BUCKETS);
+    for (rate_bucket_t *r = rate_table[b]; r; r = r->next) {
+        if (strcmp(r->fn, fn) == 0) return r;
+    }
+    if (!(opts->rate_limit > 0)) return NULL;
+    rate_bucket_t *r = calloc(1, sizeof(rate_bucket_t));
+    if (!r) return NULL;
+    snprintf(r->fn, sizeof(r->fn), "%s", fn);
+    r->rate = opts->rate_limit;
+    r->burst = opts->burst > 0 ? opts->burst : 1;
+    r->tokens = r->burst;
+    r->last_ms = now_ms();
+    r->next = rate_table[b];
+    rate_table[b] = r;
+    return r;
+}
+
+// Take a token; on failure returns the seconds until one is available
+static int rate_bucket_take(rate_bucket_t *r, double now) {
+    r->tokens += (now - r->last_ms) / 1000.0 * r->rate;
+    if (r->tokens > r->burst) r->tokens = r->burst;
+    r->last_ms = now;
+    if (r->tokens >= 1.0) {
+        r->tokens -= 1.0;
+        return 0;
+    }
+    int wait_s = (int)ceil((1.0 - r->tokens) / r->rate);
+    return wait_s > 0 ? wait_s : 1;
+}
+
+static flow_t *flow_insert(const char *key, const char *fn, const function_options_t *opts) {
+    flow_t *f = flow_lookup(key);
+    if (f) return f;
+    f = calloc(1, sizeof(flow_t));
+    if (!f) return NULL;
+    snprintf(f->key, sizeof(f->key), "%s", key);
+    snprintf(f->fn, sizeof(f->fn), "%s", fn);
+    f->lane = strcmp(opts->priority, "high") == 0 ? LANE_HIGH : LANE_NORMAL;
+    f->weight = opts->weight > 0 ? opts->weight : 1;
+    f->max_concurrency = opts->max_concurrency > 0 ? opts->max_concurrency : 0;
+    f->bucket = rate_bucket_get(fn, opts);
+    f->cost_ms = DRR_QUANTUM_MS;
+    unsigned b = (unsigned)(affinity_hash(key) % FLOW_BUCKETS);
+    f->hash_next = flow_table[b];
+    flow_table[b] = f;
+    nflows++;
+    return f;
+}
+
+static int flow_capped(const flow_t *f) {
+    return f->max_concurrency > 0 && f->inflight >= f->max_concurrency;
+}
+
+static void lane_push(lane_info_t *lane, flow_t *f) {
+    f->next_active = NULL;
+    if (lane->tail) lane->tail->next_active = f; else lane->head = f;
+    lane->tail = f;
+}
+
+static flow_t *lane_pop(lane_info_t *lane) {
+    flow_t *f = lane->head;
+    if (!f) return NULL;
+    lane->head = f->next_active;
+    if (!lane->head) lane->tail = NULL;
+    f->next_active = NULL;
+    return f;
+}
+
+// Remove a waiter from its flow queue (timeout); keeps lane bookkeeping straight
+static void flow_unlink_waiter(flow_t *f, waiter_t *w) {
+    waiter_t **pp = &f->head, *prev = NULL;
+    while (*pp && *pp != w) { prev = *pp; pp = &(*pp)->next; }
+    if (!*pp) return;
+    *pp = w->next;
+    if (f->tail == w) f->tail = prev;
+    f->depth--;
+    lanes[f->lane].depth--;
+    queued_total--;
+    metrics_queue_depth(queued_total);
+    metrics_lane_depth(f->lane, lanes[f->lane].depth);
+    if (f->depth == 0 && f->in_lane) {
+        // Drop the flow from the active list
+        lane_info_t *lane = &lanes[f->lane];
+        flow_t **fp = &lane->head, *fprev = NULL;
+        while (*fp && *fp != f) { fprev = *fp; fp = &(*fp)->next_active; }
+        if (*fp) {
+            *fp = f->next_active;
+            if (lane->tail == f) lane->tail = fprev;
+        }
+        f->next_active = NULL;
+        f->in_lane = 0;
+        f->deficit = 0;
+        lane->nactive--;
+    }
+}
+
+// Deficit round robin over the lane's active flows, skipping capped ones.
+// Returns the flow allowed to send next, left at the head of the list.
+// Flows costlier than their quantum bank credit over several rounds.
+static flow_t *lane_next(lane_info_t *lane) {
+    int capped = 0;
+    while (lane->head && capped < lane->nactive) {
+        flow_t *f = lane->head;
+        if (flow_capped(f)) {
+            lane_push(lane, lane_pop(lane));
+            capped++;
+            continue;
+        }
+        if (f->deficit < f->cost_ms) {
+            f->deficit += f->weight * DRR_QUANTUM_MS;
+            if (f->deficit < f->cost_ms) {
+                lane_push(lane, lane_pop(lane));
+                capped = 0; // this flow will qualify within a few rounds
+                continue;
+            }
+        }
+        return f;
+    }
+    return NULL;
+}
+
+static void record_wait(flow_t *f, double wait_ms) {
+    lane_info_t *lane = &lanes[f->lane];
+    f->dispatched++;
+    f->wait_total_ms += wait_ms;
+    if (wait_ms > f->wait_max_ms) f->wait_max_ms = wait_ms;
+    lane->dispatched++;
+    lane->wait_total_ms += wait_ms;
+    if (wait_ms > lane->wait_max_ms) lane->wait_max_ms = wait_ms;
+    metrics_queue_wait(wait_ms / 1000.0);
+}
+
+// CoDel (RFC 8289) decision for a request leaving the queue after sojourn_ms
+static int codel_should_drop(double sojourn_ms, double now) {
+    int ok_to_drop = 0;
+    if (sojourn_ms < CODEL_TARGET_MS) {
+        codel.first_above_ms = 0;
+    } else if (codel.first_above_ms == 0) {
+        codel.first_above_ms = now + CODEL_INTERVAL_MS;
+    } else if (now >= codel.first_above_ms) {
+        ok_to_drop = 1;
+    }
+
+    if (codel.dropping) {
+        if (!ok_to_drop) {
+            codel.dropping = 0;
+            return 0;
+        }
+        if (now >= codel.drop_next_ms) {
+            codel.count++;
+            codel.drop_next_ms = now + CODEL_INTERVAL_MS / sqrt((double)codel.count);
+            return 1;
+        }
+        return 0;
+    }
+    if (ok_to_drop) {
+        // Re-enter dropping state near the previous drop rate if it was recent
+        int recent = now - codel.drop_next_ms < 8 * CODEL_INTERVAL_MS;
+        codel.count = (recent && codel.count > 2) ? codel.count - 2 : 1;
+        codel.dropping = 1;
+        codel.drop_next_ms = now + CODEL_INTERVAL_MS / sqrt((double)codel.count);
+        return 1;
+    }
+    return 0;
+}
+
+// Seconds a rejected caller should wait: time to drain the current queue
+static int retry_after_s(void) {
+    int capacity = global_limit();
+    double drain_ms = capacity > 0 ? (queued_total + 1) * service_ewma_ms / capacity : 1000.0;
+    int s = (int)ceil(drain_ms / 1000.0);
+    return s > 0 ? s : 1;
+}
+
+// Pop the head waiter of the flow at the head of lane
+static waiter_t *flow_pop(lane_info_t *lane, flow_t *f) {
+    waiter_t *w = f->head;
+    f->head = w->next;
+    if (!f->head) f->tail = NULL;
+    f->depth--;
+    lane->depth--;
+    queued_total--;
+    metrics_queue_depth(queued_total);
+    metrics_lane_depth(f->lane, lane->depth);
+    f->deficit -= f->cost_ms;
+
+    if (f->depth == 0) {
+        lane_pop(lane);
+        f->in_lane = 0;
+        f->deficit = 0;
+        lane->nactive--;
+    } else if (f->deficit < f->cost_ms) {
+        lane_push(lane, lane_pop(lane)); // turn over
+    }
+    return w;
+}
+
+// Hand free worker slots to queued requests: high lane first, then DRR.
+// Requests that queued too long under persistent overload are dropped here.
+static void dispatch(void) {
+    while (queued_total > 0) {
+        lane_info_t *lane = &lanes[LANE_HIGH];
+        flow_t *f = lane_next(lane);
+        if (!f) {
+            lane = &lanes[LANE_NORMAL];
+            f = lane_next(lane);
+        }
+        if (!f) return; // everything queued is capped
+
+        int widx = pick_worker(f->fn);
+        if (widx < 0) return; // no free slot
+
+        waiter_t *w = flow_pop(lane, f);
+        double now = now_ms();
+        double sojourn = now - w->enqueued_ms;
+        if (codel_should_drop(sojourn, now)) {
+            f->rejected++;
+            dropped_codel++;
+            w->dropped = 1;
+            pthread_cond_signal(&w->cond);
+            continue;
+        }
+
+        f->inflight++;
+        w->alone = workers[widx].load++ == 0;
+        record_wait(f, sojourn);
+        w->widx = widx;
+        pthread_cond_signal(&w->cond);
     }
+    codel.first_above_ms = 0; // queue drained: delay is no longer standing
+    codel.dropping = 0;
+}
+
+// Field of the worker-reported "usage" object in resp, -1 if absent
+static double usage_value(const char *resp, const char *key) {
+    const char *u = resp ? strstr(resp, "\"usage\":{") : NULL;
+    if (!u) return -1;
+    char pat[32];
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    const char *p = strstr(u, pat);
+    double v;
+    if (!p || sscanf(p + strlen(pat), "%lf", &v) != 1) return -1;
+    return v;
+}
+
+// A request holding a worker slot, from sched_acquire() to sched_release()
+typedef struct {
+    flow_t *flow;
+    int widx;
+    int alone;                 // no other request was in flight on the worker
+    double started_ms;
+} sched_ticket_t;
 
-    fprintf(stderr, "[LB] ✅ Selected worker %d (PID %d)\n", workers[widx].worker_id, workers[widx].pid);
+// Get a worker slot for a request of func_id (optionally on behalf of a tenant).
+// Returns the worker index, or one of SCHED_* with *retry_after set for
+// rejections. The ticket is passed back to sched_release().
+static int sched_acquire(const char *func_id, const char *tenant, sched_ticket_t *t, int *retry_after) {
+    char key[MAX_FUNC_ID + 64];
+    if (tenant && tenant[0]) {
+        snprintf(key, sizeof(key), "%s@%s", func_id, tenant);
+    } else {
+        snprintf(key, sizeof(key), "%s", func_id);
+    }
+
+    pthread_mutex_lock(&lb_lock);
+    flow_t *f = flow_lookup(key);
+    if (!f) {
+        // Options come from the function's metadata; read it without the lock
+        pthread_mutex_unlock(&lb_lock);
+        function_metadata_t meta;
+        if (load_function_metadata(func_id, &meta) < 0) function_options_default(&meta.options);
+        pthread_mutex_lock(&lb_lock);
+        if (nflows >= FLOW_MAX && tenant && tenant[0]) {
+            f = flow_lookup(func_id);
+            if (!f) f = flow_insert(func_id, func_id, &meta.options);
+        } else {
+            f = flow_insert(key, func_id, &meta.options);
+        }
+        if (!f) {
+            pthread_mutex_unlock(&lb_lock);
+            return SCHED_UNAVAILABLE;
+        }
+    }
+    t->flow = f;
+
+    if (num_active_workers <= 0) {
+        pthread_mutex_unlock(&lb_lock);
+        return SCHED_UNAVAILABLE;
+    }
+
+    if (f->bucket) {
+        int wait_s = rate_bucket_take(f->bucket, now_ms());
+        if (wait_s > 0) {
+            f->rejected++;
+            rate_limited++;
+            *retry_after = wait_s;
+            pthread_mutex_unlock(&lb_lock);
+            return SCHED_RATE_LIMITED;
+        }
+    }
+
+    // Fast path: nobody waiting, so no fairness decision to make
+    if (queued_total == 0 && !flow_capped(f)) {
+        int widx = pick_worker(func_id);
+        if (widx >= 0) {
+            t->alone = workers[widx].load++ == 0;
+            t->widx = widx;
+            t->started_ms = now_ms();
+            f->inflight++;
+            record_wait(f, 0);
+            pthread_mutex_unlock(&lb_lock);
+            return widx;
+        }
+    }
+
+    if (queued_total >= queue_max) {
+        f->rejected++;
+        rejected_full++;
+        *retry_after = retry_after_s();
+        pthread_mutex_unlock(&lb_lock);
+        return SCHED_OVERLOADED;
+    }
+
+    waiter_t w;
+    memset(&w, 0, sizeof(w));
+    pthread_cond_init(&w.cond, &waiter_condattr);
+    w.widx = -1;
+    w.enqueued_ms = now_ms();
+    if (f->tail) f->tail->next = &w; else f->head = &w;
+    f->tail = &w;
+    f->depth++;
+    lanes[f->lane].depth++;
+    queued_total++;
+    metrics_queue_depth(queued_total);
+    metrics_lane_depth(f->lane, lanes[f->lane].depth);
+    if (!f->in_lane) {
+        f->in_lane = 1;
+        f->deficit = 0;
+        lane_push(&lanes[f->lane], f);
+        lanes[f->lane].nactive++;
+    }
+    dispatch();
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += QUEUE_TIMEOUT_MS / 1000;
+    while (w.widx < 0 && !w.dropped) {
+        if (pthread_cond_timedwait(&w.cond, &lb_lock, &deadline) == ETIMEDOUT && w.widx < 0 && !w.dropped) {
+            flow_unlink_waiter(f, &w);
+            break;
+        }
+    }
+    int widx = w.widx;
+    if (w.dropped) {
+        widx = SCHED_OVERLOADED;
+        *retry_after = retry_after_s();
+    }
+    t->widx = widx;
+    t->alone = w.alone;
+    t->started_ms = now_ms();
+    pthread_mutex_unlock(&lb_lock);
+    pthread_cond_destroy(&w.cond);
+    return widx;
+}
+
+// Request finished: free its slot, tune the worker's limit from the
+// latency it saw and let queued requests in. resp is NULL on failure.
+static void sched_release(sched_ticket_t *t, const char *resp) {
+    double rtt = now_ms() - t->started_ms;
+    flow_t *f = t->flow;
+    pthread_mutex_lock(&lb_lock);
+    worker_info_t *w = &workers[t->widx];
+    int inflight = w->load;
+    account_response(t->widx, f->fn, resp);
+    double wall_us = usage_value(resp, "wall_us");
+    if (wall_us >= 0) {
+        double cost = wall_us / 1000.0;
+        if (cost < DRR_COST_MIN_MS) cost = DRR_COST_MIN_MS;
+        if (cost > DRR_COST_MAX_MS) cost = DRR_COST_MAX_MS;
+        f->cost_ms = f->cost_known ? (1 - COST_EWMA_ALPHA) * f->cost_ms + COST_EWMA_ALPHA * cost : cost;
+        f->cost_known = 1;
+    }
+    if (resp) {
+        service_ewma_ms = service_ewma_ms == 0 ? rtt
+            : (1 - SERVICE_EWMA_ALPHA) * service_ewma_ms + SERVICE_EWMA_ALPHA * rtt;
+        w->rtt_ewma_ms = w->rtt_ewma_ms == 0 ? rtt
+            : (1 - SERVICE_EWMA_ALPHA) * w->rtt_ewma_ms + SERVICE_EWMA_ALPHA * rtt;
+        // Latency on an idle worker is the flow's baseline; anything above
+        // it on a busy worker is queueing the limiter should react to
+        if (t->alone) {
+            f->rtt_base_ms = f->rtt_base_ms == 0 ? rtt
+                : (1 - BASELINE_EWMA_ALPHA) * f->rtt_base_ms + BASELINE_EWMA_ALPHA * rtt;
+        }
+        int changed = limit_update(&w->limit, rtt, f->rtt_base_ms, inflight);
+        if (changed) {
+            log_sampled(LOG_LEVEL_INFO, "[LB] 📐 Worker %d limit %s to %d (gradient %.2f)\n", t->widx,
+                    changed > 0 ? "raised" : "lowered", limit_value(&w->limit), w->limit.gradient);
+        }
+    }
+    f->inflight--;
+    dispatch();
+    pthread_mutex_unlock(&lb_lock);
+}
+
+static size_t append_wait_stats(char *out, size_t cap, size_t off, unsigned long dispatched,
+                                double total_ms, double max_ms) {
+    if (off >= cap) return off;
+    int n = snprintf(out + off, cap - off, "\"dispatched\":%lu,\"avg_wait_ms\":%.3f,\"max_wait_ms\":%.3f",
+                     dispatched, dispatched ? total_ms / dispatched : 0.0, max_ms);
+    return n > 0 ? off + (size_t)n : off;
+}
+
+#define STATS_APPEND(...) do { \
+        if (off < sizeof(out)) { \
+            int n_ = snprintf(out + off, sizeof(out) - off, __VA_ARGS__); \
+            if (n_ > 0) off += (size_t)n_; \
+        } \
+    } while (0)
+
+// {"type":"queue_stats"}: per-lane and per-flow depth / wait times, worker limits
+static void handle_queue_stats(int client_fd) {
+    static char out[STATS_MAX];
+    size_t off = 0;
+
+    pthread_mutex_lock(&lb_lock);
+    STATS_APPEND("{\"ok\":true,\"global_limit\":%d,\"adaptive\":%s,\"queued\":%d,\"queue_max\":%d,"
+                 "\"admission\":{\"rejected_full\":%lu,\"dropped_codel\":%lu,\"rate_limited\":%lu,"
+                 "\"codel_dropping\":%d,\"service_ewma_ms\":%.3f,\"retry_after\":%d},\"lanes\":{",
+                 global_limit(), fixed_slots > 0 ? "false" : "true", queued_total, queue_max, rejected_full, dropped_codel, rate_limited,
+                 codel.dropping, service_ewma_ms, retry_after_s());
+    for (int l = 0; l < LANE_COUNT; l++) {
+        STATS_APPEND("%s\"%s\":{\"depth\":%d,\"flows\":%d,", l ? "," : "", lane_names[l],
+                     lanes[l].depth, lanes[l].nactive);
+        off = append_wait_stats(out, sizeof(out), off, lanes[l].dispatched,
+                                lanes[l].wait_total_ms, lanes[l].wait_max_ms);
+        STATS_APPEND("}");
+    }
+    STATS_APPEND("},\"workers\":[");
+    int first = 1;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (!workers[i].active) continue;
+        const conc_limit_t *lim = &workers[i].limit;
+        STATS_APPEND("%s{\"id\":%d,\"load\":%d,\"jobs\":%lu,\"limit\":%d,\"limit_raw\":%.2f,"
+                     "\"gradient\":%.2f,\"rtt_ewma_ms\":%.3f,\"limit_increases\":%lu,\"limit_decreases\":%lu}",
+                     first ? "" : ",", i, workers[i].load, workers[i].jobs, limit_value(lim), lim->limit,
+                     lim->gradient, workers[i].rtt_ewma_ms, lim->increases, lim->decreases);
+        first = 0;
+    }
+    STATS_APPEND("],\"flows\":[");
+    first = 1;
+    for (int b = 0; b < FLOW_BUCKETS; b++) {
+        for (flow_t *f = flow_table[b]; f; f = f->hash_next) {
+            if (off + 512 >= sizeof(out)) break; // keep the line well-formed
+            STATS_APPEND("%s{\"key\":\"%s\",\"lane\":\"%s\",\"weight\":%d,\"max_concurrency\":%d,"
+                         "\"inflight\":%d,\"depth\":%d,\"rejected\":%lu,\"cost_ms\":%.3f,", first ? "" : ",", f->key,
+                         lane_names[f->lane], f->weight, f->max_concurrency, f->inflight, f->depth, f->rejected,
+                         f->cost_ms);
+            off = append_wait_stats(out, sizeof(out), off, f->dispatched, f->wait_total_ms, f->wait_max_ms);
+            STATS_APPEND("}");
+            first = 0;
+        }
+    }
+    pthread_mutex_unlock(&lb_lock);
+    STATS_APPEND("]}\n");
+
+    write_all(client_fd, out, off);
+}
+
+#undef STATS_APPEND
+
+static void route_invoke(int client_fd, const char *line) {
+    double recv_us = trace_now_us();
+    int traced = trace_requested(line);
+    log_debug("[LB] 📨 Received invoke request: %s", line);
 
     // Extract fn and payload from invoke line
     const char *fnp = strstr(line, "\"fn\":");
     const char *plp = strstr(line, "\"payload\":");
     if (!fnp || !plp) {
-        fprintf(stderr, "[LB] ❌ Bad invoke format (missing fn or payload)\n");
+        log_sampled(LOG_LEVEL_WARN, "[LB] ❌ Bad invoke format (missing fn or payload)\n");
         const char *resp = "{\"ok\":false,\"error\":\"bad invoke format\"}\n";
         write_all(client_fd, resp, strlen(resp));
         close(client_fd);
@@ -141,57 +865,293 @@ static void handle_invoke(int client_fd, const char *line) {
 
     // Parse fn and payload values
     char func_id[256] = {0};
+    char tenant[64] = {0};
+    char rid[TRACE_RID_MAX] = {0};
     char payload[LINE_MAX] = {0};
     sscanf(fnp, "\"fn\":\"%255[^\"]\"", func_id);
     sscanf(plp, "\"payload\":\"%8191[^\"]\"", payload);
+    const char *tnp = strstr(line, "\"tenant\":\"");
+    if (tnp) sscanf(tnp, "\"tenant\":\"%63[^\"]\"", tenant);
+    const char *rip = strstr(line, "\"rid\":\"");
+    if (rip) sscanf(rip, "\"rid\":\"%63[^\"]\"", rid);
+    int depth = 0;
+    const char *dp = strstr(line, "\"depth\":");
+    if (dp) sscanf(dp, "\"depth\":%d", &depth);
+    int stream = strstr(line, "\"stream\":1") != NULL;
+    // Spooled payload (large or binary): only the reference is passed on
+    char payload_ref[64] = {0};
+    size_t payload_len = 0;
+    long long payload_off = -1;     // slice of a shared spool (batch items)
+    const char *prp = strstr(line, "\"payload_ref\":\"");
+    if (prp) sscanf(prp, "\"payload_ref\":\"%63[^\"]\"", payload_ref);
+    const char *plen = strstr(line, "\"payload_len\":");
+    if (plen) sscanf(plen, "\"payload_len\":%zu", &payload_len);
+    const char *poff = strstr(line, "\"payload_off\":");
+    if (poff) sscanf(poff, "\"payload_off\":%lld", &payload_off);
+
+    sched_ticket_t ticket;
+    int retry_after = 1;
+    int widx = sched_acquire(func_id, tenant, &ticket, &retry_after);
+    double sched_us = trace_now_us();
+    int worker_id = -1;
+    pid_t worker_pid = 0;
+    if (widx >= 0) {
+        pthread_mutex_lock(&lb_lock);
+        worker_id = workers[widx].worker_id;
+        worker_pid = workers[widx].pid;
+        pthread_mutex_unlock(&lb_lock);
+    }
+
+    if (widx == SCHED_OVERLOADED || widx == SCHED_RATE_LIMITED) {
+        const char *why = widx == SCHED_OVERLOADED ? "overloaded" : "rate_limited";
+        log_sampled(LOG_LEVEL_WARN, "[LB] 🚫 Rejected %s (%s, retry after %ds)\n", func_id, why, retry_after);
+        char resp[256];
+        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"%s\",\"retry_after\":%d}\n", why, retry_after);
+        metrics_invoke(func_id, INVOKE_REJECTED, 0);
+        if (traced) {
+            trace_append(resp, sizeof(resp), TRACE_LB_RECV, recv_us);
+            trace_append(resp, sizeof(resp), TRACE_LB_SCHED, sched_us);
+            trace_append(resp, sizeof(resp), TRACE_LB_DONE, trace_now_us());
+        }
+        write_all(client_fd, resp, strlen(resp));
+        close(client_fd);
+        return;
+    }
+    if (widx < 0) {
+        log_sampled(LOG_LEVEL_WARN, "[LB] ❌ No worker available\n");
+        const char *resp = "{\"ok\":false,\"error\":\"no worker available\"}\n";
+        metrics_invoke(func_id, INVOKE_ERROR, (trace_now_us() - recv_us) / 1e6);
+        write_all(client_fd, resp, strlen(resp));
+        close(client_fd);
+        return;
+    }
+
+    log_debug("[LB] ✅ Selected worker %d (PID %d)\n", worker_id, worker_pid);
 
     // Build job line for worker
     char job[LINE_MAX];
-    snprintf(job, sizeof(job), "{\"type\":\"job\",\"fn\":\"%s\",\"payload\":\"%s\"}\n", 
-             func_id, payload);
+    char opts[192];
+    snprintf(opts, sizeof(opts), "%s%s", traced ? ",\"trace\":1" : "", stream ? ",\"stream\":1" : "");
+    if (depth > 0) {
+        snprintf(opts + strlen(opts), sizeof(opts) - strlen(opts), ",\"depth\":%d", depth);
+    }
+    if (payload_ref[0]) {
+        snprintf(opts + strlen(opts), sizeof(opts) - strlen(opts), ",\"payload_ref\":\"%s\",\"payload_len\":%zu",
+                 payload_ref, payload_len);
+        if (payload_off >= 0) {
+            snprintf(opts + strlen(opts), sizeof(opts) - strlen(opts), ",\"payload_off\":%lld", payload_off);
+        }
+    }
+    snprintf(job, sizeof(job), "{\"type\":\"job\",\"fn\":\"%s\",\"tenant\":\"%s\",\"rid\":\"%s\"%s,\"payload\":\"%s\"}\n",
+             func_id, tenant, rid, opts, payload);
 
-    fprintf(stderr, "[LB] 📦 Built job: %s", job);
+    log_debug("[LB] 📦 Built job: %s", job);
 
     // Send job to worker via server
     // We need to ask server to forward the job to the specific worker
-    fprintf(stderr, "[LB] 🔗 Connecting to Server...\n");
+    log_debug("[LB] 🔗 Connecting to Server...\n");
     int srv_fd = create_unix_client_socket(SERVER_SOCK_PATH);
     if (srv_fd < 0) {
-        fprintf(stderr, "[LB] ❌ Server unavailable\n");
+        log_sampled(LOG_LEVEL_ERROR, "[LB] ❌ Server unavailable\n");
         const char *resp = "{\"ok\":false,\"error\":\"server unavailable\"}\n";
+        metrics_invoke(func_id, INVOKE_ERROR, (trace_now_us() - recv_us) / 1e6);
         write_all(client_fd, resp, strlen(resp));
         close(client_fd);
+        sched_release(&ticket, NULL);
         return;
     }
 
-    fprintf(stderr, "[LB] ✅ Connected to Server\n");
+    log_debug("[LB] ✅ Connected to Server\n");
 
     // Send job request to server with worker ID
     char forward_msg[LINE_MAX];
     snprintf(forward_msg, sizeof(forward_msg), 
         "{\"type\":\"forward_to_worker\",\"worker_id\":%d,\"job\":%s}\n",
-        workers[widx].worker_id, job);
+        worker_id, job);
     
-    fprintf(stderr, "[LB] 📤 Sending to Server: %s", forward_msg);
+    log_debug("[LB] 📤 Sending to Server: %s", forward_msg);
     write_all(srv_fd, forward_msg, strlen(forward_msg));
 
     // Read response from server (which got it from worker)
-    fprintf(stderr, "[LB] ⏳ Waiting for response from Server...\n");
+    log_debug("[LB] ⏳ Waiting for response from Server...\n");
     char resp[LINE_MAX];
-    ssize_t n = read_line(srv_fd, resp, sizeof(resp));
+    line_reader_t reader;
+    line_reader_init(&reader, srv_fd);
+    ssize_t n = read_reply(&reader, client_fd, resp, sizeof(resp));
     if (n <= 0) {
-        fprintf(stderr, "[LB] ❌ Worker timeout (no response)\n");
+        log_sampled(LOG_LEVEL_WARN, "[LB] ❌ Worker timeout (no response)\n");
         const char *err = "{\"ok\":false,\"error\":\"worker timeout\"}\n";
         write_all(client_fd, err, strlen(err));
     } else {
-        fprintf(stderr, "[LB] ✅ Received response from Server: %s", resp);
-        write_all(client_fd, resp, (size_t)n);
+        log_debug("[LB] ✅ Received response from Server: %s", resp);
+        if (traced) {
+            trace_append(resp, sizeof(resp), TRACE_LB_RECV, recv_us);
+            trace_append(resp, sizeof(resp), TRACE_LB_SCHED, sched_us);
+            trace_append(resp, sizeof(resp), TRACE_LB_DONE, trace_now_us());
+        }
+        write_all(client_fd, resp, strlen(resp));
     }
 
-    workers[widx].load++;
+    metrics_invoke(func_id, n > 0 && strstr(resp, "\"ok\":true") ? INVOKE_OK : INVOKE_ERROR,
+                   (trace_now_us() - recv_us) / 1e6);
+    if (n > 0 && strstr(resp, "\"usage\":{")) {
+        double cpu_us = usage_value(resp, "cpu_us") + usage_value(resp, "child_cpu_us");
+        double rss_kb = usage_value(resp, "child_maxrss_kb");
+        double pages = usage_value(resp, "mem_pages");
+        double mem = rss_kb * 1024 > pages * 65536 ? rss_kb * 1024 : pages * 65536;
+        metrics_usage(func_id, cpu_us / 1e6, (unsigned long)usage_value(resp, "out_bytes"),
+                      mem > 0 ? (unsigned long)mem : 0);
+    }
+    sched_release(&ticket, n > 0 ? resp : NULL);
     close(srv_fd);
     close(client_fd);
-    fprintf(stderr, "[LB] 🏁 Request completed\n");
+    log_debug("[LB] 🏁 Request completed\n");
+}
+
+// A faas.call from a worker ("caller") keeps that worker out of scheduling
+// until the call returns
+static void handle_invoke(int client_fd, const char *line) {
+    int caller = -1;
+    const char *cp = strstr(line, "\"caller\":");
+    if (cp) sscanf(cp, "\"caller\":%d", &caller);
+    if (caller < 0 || caller >= MAX_WORKERS) {
+        route_invoke(client_fd, line);
+        return;
+    }
+    pthread_mutex_lock(&lb_lock);
+    workers[caller].calling++;
+    pthread_mutex_unlock(&lb_lock);
+
+    route_invoke(client_fd, line);
+
+    pthread_mutex_lock(&lb_lock);
+    if (workers[caller].calling > 0) workers[caller].calling--; // 0 if it registered again
+    dispatch();
+    pthread_mutex_unlock(&lb_lock);
+}
+
+typedef struct {
+    int fd;
+    char line[LINE_MAX];
+} invoke_job_t;
+
+// Worker slot named by an admin message, -1 if not a registered worker
+static int admin_worker(const char *line) {
+    int w = -1;
+    const char *p = strstr(line, "\"worker\":");
+    if (p) sscanf(p, "\"worker\":%d", &w);
+    return w >= 0 && w < MAX_WORKERS && workers[w].registered ? w : -1;
+}
+
+static void set_draining(int w, int draining) {
+    workers[w].draining = draining;
+    metrics_worker_draining(w, draining);
+    if (!draining) dispatch(); // capacity is back for queued requests
+}
+
+// Drain the worker, wait for its in-flight requests, then have the server
+// replace the process. Runs on its own thread: this can take a while.
+static void admin_recycle(int client_fd, int w) {
+    char resp[256];
+    pthread_mutex_lock(&lb_lock);
+    set_draining(w, 1);
+    double deadline = now_ms() + RECYCLE_DRAIN_MS;
+    while (workers[w].load > 0 && now_ms() < deadline) {
+        pthread_mutex_unlock(&lb_lock);
+        usleep(10000);
+        pthread_mutex_lock(&lb_lock);
+    }
+    int busy = workers[w].load;
+    if (busy > 0) set_draining(w, 0);
+    pthread_mutex_unlock(&lb_lock);
+
+    if (busy > 0) {
+        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"drain timeout\",\"worker\":%d,\"in_flight\":%d}\n",
+                 w, busy);
+        write_all(client_fd, resp, strlen(resp));
+        return;
+    }
+
+    int srv_fd = create_unix_client_socket(SERVER_SOCK_PATH);
+    ssize_t n = -1;
+    if (srv_fd >= 0) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "{\"type\":\"recycle\",\"worker_id\":%d}\n", w);
+        write_all(srv_fd, msg, strlen(msg));
+        n = read_line(srv_fd, resp, sizeof(resp));
+        close(srv_fd);
+    }
+    if (n <= 0) {
+        // The old process may still be there: serve with it again
+        pthread_mutex_lock(&lb_lock);
+        set_draining(w, 0);
+        pthread_mutex_unlock(&lb_lock);
+        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"server unavailable\"}\n");
+    }
+    // On success the new process registers again, which clears draining
+    write_all(client_fd, resp, strlen(resp));
+}
+
+// {"type":"admin","action":"drain|undrain|recycle|strategy","worker":N,"value":"S"}
+static void handle_admin(int client_fd, const char *line) {
+    char action[16] = {0}, value[32] = {0};
+    const char *p = strstr(line, "\"action\":\"");
+    if (p) sscanf(p, "\"action\":\"%15[^\"]\"", action);
+    p = strstr(line, "\"value\":\"");
+    if (p) sscanf(p, "\"value\":\"%31[^\"]\"", value);
+
+    char resp[256];
+    pthread_mutex_lock(&lb_lock);
+    int w = admin_worker(line);
+    if (strcmp(action, "strategy") == 0) {
+        int s = -1;
+        for (int i = 0; i < (int)(sizeof(strategy_names) / sizeof(strategy_names[0])); i++) {
+            if (strcasecmp(value, strategy_names[i]) == 0) s = i;
+        }
+        if (s < 0) {
+            snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"unknown strategy\"}\n");
+        } else {
+            const char *old = strategy_names[strategy];
+            strategy = (lb_strategy_t)s;
+            metrics_lb_strategy(strategy_names[s]);
+            log_info("[LB] 🔀 Strategy %s -> %s\n", old, strategy_names[s]);
+            snprintf(resp, sizeof(resp), "{\"ok\":true,\"strategy\":\"%s\",\"previous\":\"%s\"}\n",
+                     strategy_names[s], old);
+        }
+    } else if (strcmp(action, "drain") != 0 && strcmp(action, "undrain") != 0 && strcmp(action, "recycle") != 0) {
+        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"unknown action\"}\n");
+    } else if (w < 0) {
+        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"unknown worker\"}\n");
+    } else if (strcmp(action, "recycle") == 0) {
+        pthread_mutex_unlock(&lb_lock);
+        admin_recycle(client_fd, w);
+        return;
+    } else {
+        int draining = strcmp(action, "drain") == 0;
+        set_draining(w, draining);
+        log_info("[LB] 🚰 Worker %d %s\n", w, draining ? "draining" : "back in rotation");
+        snprintf(resp, sizeof(resp), "{\"ok\":true,\"worker\":%d,\"draining\":%s,\"in_flight\":%d}\n",
+                 w, draining ? "true" : "false", workers[w].load);
+    }
+    pthread_mutex_unlock(&lb_lock);
+    write_all(client_fd, resp, strlen(resp));
+}
+
+// Thread wrapper: invokes block on the worker, so each runs on its own thread
+static void* handle_invoke_thread(void *arg) {
+    invoke_job_t *job = (invoke_job_t*)arg;
+    handle_invoke(job->fd, job->line);
+    free(job);
+    return NULL;
+}
+
+// Admin actions may wait for a drain: off the accept loop too
+static void* handle_admin_thread(void *arg) {
+    invoke_job_t *job = (invoke_job_t*)arg;
+    handle_admin(job->fd, job->line);
+    close(job->fd);
+    free(job);
+    return NULL;
 }
 
 int load_balancer_main(int argc, char **argv) {
@@ -199,12 +1159,20 @@ int load_balancer_main(int argc, char **argv) {
     if (argc > 1) {
         if (strcmp(argv[1], "FIFO") == 0) strategy = STRATEGY_FIFO;
         else if (strcmp(argv[1], "WEIGHTED") == 0) strategy = STRATEGY_WEIGHTED;
+        else if (strcmp(argv[1], "AFFINITY") == 0) strategy = STRATEGY_AFFINITY;
         else strategy = STRATEGY_RR;
     }
 
     signal(SIGCHLD, sigchld_handler);
     signal(SIGINT, sigint_handler);
 
+    const char *slots_env = getenv("FAAS_WORKER_SLOTS");
+    if (slots_env && atoi(slots_env) > 0) fixed_slots = atoi(slots_env);
+    const char *qmax_env = getenv("FAAS_QUEUE_MAX");
+    if (qmax_env && atoi(qmax_env) > 0) queue_max = atoi(qmax_env);
+    pthread_condattr_init(&waiter_condattr);
+    pthread_condattr_setclock(&waiter_condattr, CLOCK_MONOTONIC);
+
     // Initialize workers array
     for (int i = 0; i < MAX_WORKERS; i++) {
         workers[i].active = 0;
@@ -215,11 +1183,10 @@ int load_balancer_main(int argc, char **argv) {
     }
 
     int lfd = create_unix_server_socket(LB_SOCK_PATH);
-    const char *strat_name = (strategy == STRATEGY_RR) ? "RR" : 
-                             (strategy == STRATEGY_FIFO) ? "FIFO" : "WEIGHTED";
-    fprintf(stderr, "load_balancer: listening on %s (%s strategy)\n", 
-            LB_SOCK_PATH, strat_name);
-    fprintf(stderr, "load_balancer: waiting for worker registrations from server...\n");
+    metrics_lb_strategy(strategy_names[strategy]);
+    log_info("load_balancer: listening on %s (%s strategy)\n", 
+            LB_SOCK_PATH, strategy_names[strategy]);
+    log_info("load_balancer: waiting for worker registrations from server...\n");
 
     while (running) {
         fd_set rfds;
@@ -256,11 +1223,32 @@ int load_balancer_main(int argc, char **argv) {
                 sscanf(line, "{\"type\":\"register_worker\",\"worker_id\":%d,\"pid\":%d}", 
                        &worker_id, &pid);
                 if (worker_id >= 0 && pid > 0) {
+                    pthread_mutex_lock(&lb_lock);
                     register_worker(worker_id, pid);
+                    dispatch(); // new capacity for queued requests
+                    pthread_mutex_unlock(&lb_lock);
+                }
+                close(cfd);
+            } else if (strstr(line, "\"type\":\"invoke\"") || strstr(line, "\"type\":\"admin\"")) {
+                invoke_job_t *job = malloc(sizeof(invoke_job_t));
+                pthread_t thread;
+                if (!job) {
+                    close(cfd);
+                    continue;
+                }
+                job->fd = cfd;
+                memcpy(job->line, line, (size_t)n + 1);
+                void *(*fn)(void *) = strstr(line, "\"type\":\"admin\"") ? handle_admin_thread : handle_invoke_thread;
+                if (pthread_create(&thread, NULL, fn, job) != 0) {
+                    perror("pthread_create");
+                    close(cfd);
+                    free(job);
+                } else {
+                    pthread_detach(thread);
                 }
+            } else if (strstr(line, "\"type\":\"queue_stats\"")) {
+                handle_queue_stats(cfd);
                 close(cfd);
-            } else if (strstr(line, "\"type\":\"invoke\"")) {
-                handle_invoke(cfd, line);
             } else {
                 const char *resp = "{\"ok\":false,\"error\":\"unknown msg\"}\n";
                 write_all(cfd, resp, strlen(resp));
@@ -270,8 +1258,8 @@ int load_balancer_main(int argc, char **argv) {
     }
 
     // Cleanup
-    fprintf(stderr, "load_balancer: shutting down...\n");
+    log_info("load_balancer: shutting down...\n");
     unlink(LB_SOCK_PATH);
-    fprintf(stderr, "load_balancer: shutdown complete\n");
+    log_info("load_balancer: shutdown complete\n");
     return 0;
 }
@@ -2,21 +2,101 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
 #include <time.h>
+#include <math.h>
+#include <getopt.h>
 #include <pthread.h>
 
+#include "capture.h"
+#include "histogram.h"
+
 #define SERVER_SOCK_PATH "/tmp/faas_server.sock"
 #define LINE_MAX 8192
+#define MAX_THREADS 1024
+#define MAX_CONNS 65536
+#define MAX_OPS 32
+#define MAX_PAYLOAD (1024 * 1024)      // gateway MAX_BODY
+#define UNIX_MAX_PAYLOAD (LINE_MAX - 512) // must fit the JSON line
+#define DRAIN_TIMEOUT_S 30             // wait for in-flight requests after the run
+#define REPLAY_DEFAULT_TARGET "127.0.0.1:8080"
+
+typedef enum { ARRIVAL_CONSTANT, ARRIVAL_POISSON } arrival_t;
+typedef enum { OP_INVOKE, OP_DEPLOY } op_kind_t;
+typedef enum { SIZE_FIXED, SIZE_UNIFORM, SIZE_EXP } size_dist_t;
+
+// One entry of the workload mix
+typedef struct {
+    op_kind_t kind;
+    char target[128];     // function ref (invoke) or name (deploy)
+    char lang[16];        // deploy only
+    char *code;           // deploy body
+    size_t code_len;
+    double weight;
+    const char *fixed_payload; // -p, used as is
+    size_dist_t dist;
+    int size_a, size_b;   // fixed: a; uniform: [a, b]; exp: mean a
+    // Results (under results_t.lock)
+    histogram_t latency;
+    long ok;
+    long errors;
+} op_t;
 
 typedef struct {
-    int thread_id;
-    int num_requests;
     const char *function_id;
-    int *success_count;
-    int *error_count;
-    pthread_mutex_t *mutex;
+    const char *payload;
+    // Closed loop
+    int num_threads;
+    int requests_per_thread;
+    int think_ms;
+    // Open loop
+    int open_loop;
+    double rate;          // target requests/s
+    double duration_s;
+    double warmup_s;      // requests scheduled before this are not measured
+    arrival_t arrival;
+    int max_in_flight;    // sender threads, or connections in HTTP mode
+    const char *json_path;
+    // HTTP mode
+    const char *http_target; // host:port of the gateway, NULL = unix socket to server
+    const char *workload_path;
+    op_t ops[MAX_OPS];
+    int nops;
+    double total_weight;
+    // Replay of a gateway capture (HTTP, open loop)
+    const char *replay_path;
+    double replay_speed;  // 2 = twice as fast as captured
+} config_t;
+
+// Shared open-loop schedule: intended send time of the next request
+typedef struct {
+    pthread_mutex_t lock;
+    double next_ns;       // offset from start
+    double end_ns;
+    uint64_t rng;
+} schedule_t;
+
+// Results shared by all threads (recording is cheap next to a request)
+typedef struct {
+    pthread_mutex_t lock;
+    histogram_t latency;  // from intended send time (corrected)
+    histogram_t service;  // from actual send time
+    long ok;
+    long errors;
+    long late;            // sent more than 1ms after their intended time
+} results_t;
+
+typedef struct {
+    int thread_id;
+    const config_t *cfg;
+    schedule_t *sched;
+    results_t *res;
+    struct timespec start;
 } thread_args_t;
 
 static int connect_to_server(void) {
@@ -53,129 +133,1150 @@ static ssize_t read_line(int fd, char *buf, size_t maxlen) {
     return (ssize_t)i;
 }
 
-static void* worker_thread(void *arg) {
-    thread_args_t *args = (thread_args_t*)arg;
-    
-    for (int i = 0; i < args->num_requests; i++) {
-        int fd = connect_to_server();
-        if (fd < 0) {
-            pthread_mutex_lock(args->mutex);
-            (*args->error_count)++;
-            pthread_mutex_unlock(args->mutex);
-            continue;
-        }
-
-        // Send invoke request
-        char req[LINE_MAX];
-        snprintf(req, sizeof(req), 
-            "{\"type\":\"invoke\",\"fn\":\"%s\",\"payload\":\"test from thread %d req %d\"}\n",
-            args->function_id, args->thread_id, i);
-        
-        if (write(fd, req, strlen(req)) < 0) {
-            pthread_mutex_lock(args->mutex);
-            (*args->error_count)++;
-            pthread_mutex_unlock(args->mutex);
-            close(fd);
-            continue;
-        }
-
-        // Read response
-        char resp[LINE_MAX];
-        ssize_t n = read_line(fd, resp, sizeof(resp));
-        if (n > 0 && strstr(resp, "\"ok\":true")) {
-            pthread_mutex_lock(args->mutex);
-            (*args->success_count)++;
-            pthread_mutex_unlock(args->mutex);
+static double elapsed_ns(const struct timespec *from) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from->tv_sec) * 1e9 + (now.tv_nsec - from->tv_nsec);
+}
+
+static void sleep_until(const struct timespec *start, double offset_ns) {
+    struct timespec t = *start;
+    long long ns = (long long)t.tv_nsec + (long long)offset_ns;
+    t.tv_sec += (time_t)(ns / 1000000000LL);
+    t.tv_nsec = (long)(ns % 1000000000LL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0) {}
+}
+
+static double rng_uniform(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return (double)(*s >> 11) / 9007199254740992.0;
+}
+
+// Gap to the next arrival for the configured distribution
+static double next_gap_ns(const config_t *cfg, uint64_t *rng) {
+    double gap = 1e9 / cfg->rate;
+    if (cfg->arrival == ARRIVAL_POISSON) {
+        double u = rng_uniform(rng);
+        if (u < 1e-12) u = 1e-12;
+        gap = -gap * log(u);
+    }
+    return gap;
+}
+
+// ---------------------------------------------------------------------------
+// Workload
+// ---------------------------------------------------------------------------
+
+static op_t *pick_op(config_t *cfg, uint64_t *rng) {
+    if (cfg->nops == 1) return &cfg->ops[0];
+    double r = rng_uniform(rng) * cfg->total_weight;
+    for (int i = 0; i < cfg->nops; i++) {
+        r -= cfg->ops[i].weight;
+        if (r < 0) return &cfg->ops[i];
+    }
+    return &cfg->ops[cfg->nops - 1];
+}
+
+static size_t payload_size(const op_t *op, uint64_t *rng, size_t max) {
+    double n = op->size_a;
+    if (op->dist == SIZE_UNIFORM) {
+        n = op->size_a + rng_uniform(rng) * (op->size_b - op->size_a + 1);
+    } else if (op->dist == SIZE_EXP) {
+        double u = rng_uniform(rng);
+        if (u < 1e-12) u = 1e-12;
+        n = -op->size_a * log(u);
+    }
+    if (n < 0) n = 0;
+    return (size_t)n > max ? max : (size_t)n;
+}
+
+// Fill buf with the payload of one request; returns its length.
+// Generated payloads are printable and quote-free.
+static size_t make_payload(const op_t *op, uint64_t *rng, char *buf, size_t cap, int thread_id, long seq) {
+    if (op->fixed_payload) {
+        return (size_t)snprintf(buf, cap, "%s", op->fixed_payload);
+    }
+    if (op->dist == SIZE_FIXED && op->size_a == 0) {
+        return (size_t)snprintf(buf, cap, "test from thread %d req %ld", thread_id, seq);
+    }
+    size_t n = payload_size(op, rng, cap - 1);
+    for (size_t i = 0; i < n; i++) buf[i] = (char)('a' + (i % 26));
+    buf[n] = '\0';
+    return n;
+}
+
+static int parse_size(op_t *op, const char *spec) {
+    if (strncmp(spec, "uniform:", 8) == 0) {
+        op->dist = SIZE_UNIFORM;
+        if (sscanf(spec + 8, "%d:%d", &op->size_a, &op->size_b) != 2 || op->size_b < op->size_a) return -1;
+    } else if (strncmp(spec, "exp:", 4) == 0) {
+        op->dist = SIZE_EXP;
+        if (sscanf(spec + 4, "%d", &op->size_a) != 1) return -1;
+    } else {
+        op->dist = SIZE_FIXED;
+        if (sscanf(spec, "%d", &op->size_a) != 1) return -1;
+    }
+    return op->size_a >= 0 ? 0 : -1;
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = sz >= 0 ? malloc((size_t)sz + 1) : NULL;
+    if (buf) {
+        *len = fread(buf, 1, (size_t)sz, f);
+        buf[*len] = '\0';
+    }
+    fclose(f);
+    return buf;
+}
+
+// Workload file, one operation per line:
+//   invoke <fn-ref> [weight=W] [payload=N|uniform:MIN:MAX|exp:MEAN]
+//   deploy <name> <lang> <file> [weight=W]
+// Blank lines and lines starting with # are ignored.
+static int load_workload(config_t *cfg, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+        if (cfg->nops == MAX_OPS) {
+            fprintf(stderr, "%s:%d: too many operations (max %d)\n", path, lineno, MAX_OPS);
+            fclose(f);
+            return -1;
+        }
+
+        op_t *op = &cfg->ops[cfg->nops];
+        memset(op, 0, sizeof(*op));
+        op->weight = 1;
+        char kind[16] = {0}, file[512] = {0};
+        int consumed = 0;
+        if (sscanf(p, "%15s %127s%n", kind, op->target, &consumed) < 2) goto bad;
+        p += consumed;
+        if (strcmp(kind, "invoke") == 0) {
+            op->kind = OP_INVOKE;
+        } else if (strcmp(kind, "deploy") == 0) {
+            op->kind = OP_DEPLOY;
+            if (sscanf(p, "%15s %511s%n", op->lang, file, &consumed) < 2) goto bad;
+            p += consumed;
+            op->code = read_file(file, &op->code_len);
+            if (!op->code) {
+                fprintf(stderr, "%s:%d: cannot read %s\n", path, lineno, file);
+                fclose(f);
+                return -1;
+            }
         } else {
-            pthread_mutex_lock(args->mutex);
-            (*args->error_count)++;
-            pthread_mutex_unlock(args->mutex);
+            goto bad;
+        }
+
+        char opt[256];
+        while (sscanf(p, "%255s%n", opt, &consumed) == 1) {
+            p += consumed;
+            if (strncmp(opt, "weight=", 7) == 0) {
+                op->weight = atof(opt + 7);
+                if (op->weight <= 0) goto bad;
+            } else if (strncmp(opt, "payload=", 8) == 0 && op->kind == OP_INVOKE) {
+                if (parse_size(op, opt + 8) < 0) goto bad;
+            } else {
+                goto bad;
+            }
+        }
+        cfg->nops++;
+        continue;
+bad:
+        fprintf(stderr, "%s:%d: invalid line: %s", path, lineno, line);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    if (cfg->nops == 0) {
+        fprintf(stderr, "%s: no operations\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Results
+// ---------------------------------------------------------------------------
+
+// op is NULL for replayed requests (see replay_done)
+static void record(results_t *res, op_t *op, int ok, int late, double latency_us, double service_us) {
+    pthread_mutex_lock(&res->lock);
+    if (ok) res->ok++; else res->errors++;
+    if (late) res->late++;
+    hist_record(&res->latency, (uint64_t)latency_us);
+    hist_record(&res->service, (uint64_t)service_us);
+    if (op) {
+        if (ok) op->ok++; else op->errors++;
+        hist_record(&op->latency, (uint64_t)latency_us);
+    }
+    pthread_mutex_unlock(&res->lock);
+}
+
+// ---------------------------------------------------------------------------
+// Replay: captured requests re-sent at their original offsets (divided by
+// the speed), same method, path, tenant and body. Bodies captured as a hash
+// only are replaced by as many filler bytes. Latencies are compared per
+// request kind (method, path without query, function).
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    char key[256];
+    long count;
+    long errors;
+    long status_mismatch;
+    histogram_t captured;  // gateway-side latency at capture time (us)
+    histogram_t replayed;  // corrected latency now (us)
+} replay_group_t;
+
+typedef struct {
+    double at_ns;          // offset_us / speed
+    capture_record_t rec;
+    replay_group_t *group;
+} replay_req_t;
+
+typedef struct {
+    replay_req_t *reqs;
+    size_t n, next;
+    replay_group_t *groups;
+    int ngroups;
+    replay_group_t all;
+} replay_t;
+
+static replay_t replay;
+
+static void json_hist(FILE *f, const char *key, const histogram_t *h);
+
+static int cmp_replay_req(const void *a, const void *b) {
+    double x = ((const replay_req_t*)a)->at_ns, y = ((const replay_req_t*)b)->at_ns;
+    return x < y ? -1 : x > y;
+}
+
+// "POST /invoke hello:stable"
+static void replay_key(const capture_record_t *rec, char *key, size_t cap) {
+    size_t plen = strcspn(rec->path, "?");
+    snprintf(key, cap, "%s %.*s%s%s", rec->method, (int)plen, rec->path, rec->fn[0] ? " " : "", rec->fn);
+}
+
+// Loads the whole capture, sorted by arrival (records are written as the
+// responses complete). Returns the number of requests or -1.
+static long replay_load(const char *path, double speed) {
+    capture_reader_t *rd = capture_reader_open(path, NULL);
+    if (!rd) return -1;
+    size_t cap = 0;
+    capture_record_t rec;
+    int rc;
+    while ((rc = capture_read(rd, &rec)) > 0) {
+        if (replay.n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            replay_req_t *r = realloc(replay.reqs, sizeof(replay_req_t) * cap);
+            if (!r) { perror("realloc"); exit(1); }
+            replay.reqs = r;
+        }
+        replay.reqs[replay.n++] = (replay_req_t){ .at_ns = rec.offset_us * 1000.0 / speed, .rec = rec };
+    }
+    capture_reader_close(rd);
+    if (rc < 0) {
+        fprintf(stderr, "Warning: %s is corrupt after %zu records\n", path, replay.n);
+    }
+    qsort(replay.reqs, replay.n, sizeof(replay_req_t), cmp_replay_req);
+
+    // Groups: the array does not move once every record has its own
+    replay.groups = calloc(replay.n ? replay.n : 1, sizeof(replay_group_t));
+    if (!replay.groups || hist_init(&replay.all.captured) < 0 || hist_init(&replay.all.replayed) < 0) {
+        perror("init");
+        exit(1);
+    }
+    snprintf(replay.all.key, sizeof(replay.all.key), "all");
+    for (size_t i = 0; i < replay.n; i++) {
+        const capture_record_t *r = &replay.reqs[i].rec;
+        char key[256];
+        replay_key(r, key, sizeof(key));
+        replay_group_t *g = NULL;
+        for (int j = 0; j < replay.ngroups && !g; j++) {
+            if (strcmp(replay.groups[j].key, key) == 0) g = &replay.groups[j];
         }
+        if (!g) {
+            g = &replay.groups[replay.ngroups++];
+            snprintf(g->key, sizeof(g->key), "%s", key);
+            if (hist_init(&g->captured) < 0 || hist_init(&g->replayed) < 0) {
+                perror("hist_init");
+                exit(1);
+            }
+        }
+        replay.reqs[i].group = g;
+        hist_record(&g->captured, r->latency_us);
+        hist_record(&replay.all.captured, r->latency_us);
+    }
+    return (long)replay.n;
+}
+
+// Single epoll thread: no lock needed
+static void replay_done(replay_req_t *rr, int ok, int status, double latency_us) {
+    replay_group_t *gs[2] = { rr->group, &replay.all };
+    for (int i = 0; i < 2; i++) {
+        gs[i]->count++;
+        if (!ok) gs[i]->errors++;
+        if (status != rr->rec.status) gs[i]->status_mismatch++;
+        hist_record(&gs[i]->replayed, (uint64_t)latency_us);
+    }
+}
+
+static void replay_print_group(const replay_group_t *g) {
+    double cp50 = hist_percentile(&g->captured, 50) / 1000.0, rp50 = hist_percentile(&g->replayed, 50) / 1000.0;
+    double cp99 = hist_percentile(&g->captured, 99) / 1000.0, rp99 = hist_percentile(&g->replayed, 99) / 1000.0;
+    printf("%-36.36s %7ld %9.2f %9.2f %+8.1f%% %9.2f %9.2f %+8.1f%% %8ld %7ld\n", g->key, g->count,
+           cp50, rp50, cp50 > 0 ? (rp50 - cp50) / cp50 * 100.0 : 0.0,
+           cp99, rp99, cp99 > 0 ? (rp99 - cp99) / cp99 * 100.0 : 0.0,
+           g->status_mismatch, g->errors);
+}
+
+static void replay_report(void) {
+    printf("\n=== Replay (ms, captured vs replayed) ===\n");
+    printf("%-36s %7s %9s %9s %9s %9s %9s %9s %8s %7s\n", "request", "count", "cap p50", "rep p50",
+           "diff", "cap p99", "rep p99", "diff", "status!=", "errors");
+    for (int i = 0; i < replay.ngroups; i++) replay_print_group(&replay.groups[i]);
+    replay_print_group(&replay.all);
+}
+
+static void replay_json_group(FILE *f, const replay_group_t *g) {
+    fprintf(f, "{\"request\":\"%s\",\"count\":%ld,\"errors\":%ld,\"status_mismatch\":%ld,",
+            g->key, g->count, g->errors, g->status_mismatch);
+    json_hist(f, "captured_us", &g->captured);
+    fprintf(f, ",");
+    json_hist(f, "replayed_us", &g->replayed);
+    fprintf(f, "}");
+}
+
+static void replay_free(void) {
+    for (size_t i = 0; i < replay.n; i++) capture_record_free(&replay.reqs[i].rec);
+    for (int i = 0; i < replay.ngroups; i++) {
+        hist_free(&replay.groups[i].captured);
+        hist_free(&replay.groups[i].replayed);
+    }
+    hist_free(&replay.all.captured);
+    hist_free(&replay.all.replayed);
+    free(replay.reqs);
+    free(replay.groups);
+}
 
+// ---------------------------------------------------------------------------
+// Unix socket transport (one connection per request, blocking threads)
+// ---------------------------------------------------------------------------
+
+// One invoke over a fresh connection. Returns 1 if the function ran.
+static int invoke_once(const op_t *op, uint64_t *rng, int thread_id, long seq) {
+    char payload[UNIX_MAX_PAYLOAD];
+    make_payload(op, rng, payload, sizeof(payload), thread_id, seq);
+
+    int fd = connect_to_server();
+    if (fd < 0) return 0;
+
+    char req[LINE_MAX];
+    snprintf(req, sizeof(req), "{\"type\":\"invoke\",\"fn\":\"%s\",\"payload\":\"%s\"}\n", op->target, payload);
+    if (write(fd, req, strlen(req)) < 0) {
         close(fd);
-        
+        return 0;
+    }
+
+    char resp[LINE_MAX];
+    ssize_t n = read_line(fd, resp, sizeof(resp));
+    close(fd);
+    return n > 0 && strstr(resp, "\"ok\":true") != NULL;
+}
+
+static void* closed_loop_thread(void *arg) {
+    thread_args_t *args = (thread_args_t*)arg;
+    config_t *cfg = (config_t*)args->cfg;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(args->thread_id + 1);
+
+    for (int i = 0; i < cfg->requests_per_thread; i++) {
+        op_t *op = pick_op(cfg, &rng);
+        double t0 = elapsed_ns(&args->start);
+        int ok = invoke_once(op, &rng, args->thread_id, i);
+        double lat_us = (elapsed_ns(&args->start) - t0) / 1000.0;
+        record(args->res, op, ok, 0, lat_us, lat_us);
+
         // Small delay between requests
-        usleep(10000); // 10ms
+        if (cfg->think_ms > 0) usleep((useconds_t)cfg->think_ms * 1000);
     }
 
     return NULL;
 }
 
-int main(int argc, char **argv) {
-    if (argc < 4) {
-        fprintf(stderr, "Usage: %s <function_id> <num_threads> <requests_per_thread>\n", argv[0]);
-        fprintf(stderr, "Example: %s hello_1234567890 10 100\n", argv[0]);
-        return 1;
+// Open loop: requests follow the arrival schedule whatever the response
+// times. A request whose thread was still busy goes out late, but its
+// latency is still measured from when it should have been sent, so queueing
+// in the system under test is not hidden (coordinated omission).
+static void* open_loop_thread(void *arg) {
+    thread_args_t *args = (thread_args_t*)arg;
+    config_t *cfg = (config_t*)args->cfg;
+    schedule_t *sched = args->sched;
+    double warmup_ns = cfg->warmup_s * 1e9;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(args->thread_id + 1);
+    long seq = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&sched->lock);
+        double intended = sched->next_ns;
+        if (intended >= sched->end_ns) {
+            pthread_mutex_unlock(&sched->lock);
+            break;
+        }
+        sched->next_ns += next_gap_ns(cfg, &sched->rng);
+        op_t *op = pick_op(cfg, &sched->rng);
+        pthread_mutex_unlock(&sched->lock);
+
+        sleep_until(&args->start, intended);
+        double sent = elapsed_ns(&args->start);
+        int ok = invoke_once(op, &rng, args->thread_id, seq++);
+        double done = elapsed_ns(&args->start);
+
+        if (intended < warmup_ns) continue;
+        record(args->res, op, ok, sent - intended > 1e6, (done - intended) / 1000.0, (done - sent) / 1000.0);
     }
 
-    const char *function_id = argv[1];
-    int num_threads = atoi(argv[2]);
-    int requests_per_thread = atoi(argv[3]);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// HTTP transport: keep-alive connections to the gateway, one epoll thread
+// ---------------------------------------------------------------------------
 
-    if (num_threads <= 0 || num_threads > 100) {
-        fprintf(stderr, "Error: num_threads must be between 1 and 100\n");
-        return 1;
+typedef enum { CONN_CLOSED, CONN_CONNECTING, CONN_IDLE, CONN_BUSY } conn_state_t;
+
+typedef struct {
+    int fd;
+    conn_state_t state;
+    int connected;
+    char *out;            // request being sent
+    size_t out_len, out_off;
+    char *in;             // response being read
+    size_t in_len, in_cap;
+    op_t *op;
+    replay_req_t *rr;     // replayed request instead of op
+    int status;
+    double intended_ns;
+    double sent_ns;
+} http_conn_t;
+
+// Arrivals waiting for a free connection (open loop)
+typedef struct {
+    double intended_ns;
+    op_t *op;
+    replay_req_t *rr;
+} arrival_slot_t;
+
+typedef struct {
+    config_t *cfg;
+    results_t *res;
+    struct timespec start;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    char host[256];
+    int epfd;
+    http_conn_t *conns;
+    int nconns;
+    int *free_stack;      // idle or closed connections
+    int nfree;
+    int busy;
+    arrival_slot_t *queue; // FIFO ring of pending arrivals
+    size_t qhead, qlen, qcap;
+    uint64_t rng;
+    long seq;
+} http_ctx_t;
+
+static int resolve_target(http_ctx_t *ctx, const char *target) {
+    char host[256];
+    snprintf(host, sizeof(host), "%s", target);
+    char *colon = strrchr(host, ':');
+    const char *port = "8080";
+    if (colon) {
+        *colon = '\0';
+        port = colon + 1;
+    }
+    struct addrinfo hints = {0}, *ai = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(host[0] ? host : "127.0.0.1", port, &hints, &ai);
+    if (rc != 0) {
+        fprintf(stderr, "Error: cannot resolve %s: %s\n", target, gai_strerror(rc));
+        return -1;
     }
+    memcpy(&ctx->addr, ai->ai_addr, ai->ai_addrlen);
+    ctx->addrlen = ai->ai_addrlen;
+    snprintf(ctx->host, sizeof(ctx->host), "%s", target);
+    freeaddrinfo(ai);
+    return 0;
+}
+
+static void conn_close(http_ctx_t *ctx, http_conn_t *c) {
+    if (c->fd >= 0) {
+        epoll_ctl(ctx->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->connected = 0;
+    c->state = CONN_CLOSED;
+    c->in_len = 0;
+}
+
+static void conn_release(http_ctx_t *ctx, int idx) {
+    ctx->free_stack[ctx->nfree++] = idx;
+    ctx->busy--;
+}
+
+static void conn_finish(http_ctx_t *ctx, int idx, int ok, int keep) {
+    http_conn_t *c = &ctx->conns[idx];
+    double done = elapsed_ns(&ctx->start);
+    if (c->intended_ns >= ctx->cfg->warmup_s * 1e9) {
+        record(ctx->res, c->op, ok, c->sent_ns - c->intended_ns > 1e6,
+               (done - c->intended_ns) / 1000.0, (done - c->sent_ns) / 1000.0);
+        if (c->rr) replay_done(c->rr, ok, c->status, (done - c->intended_ns) / 1000.0);
+    }
+    free(c->out);
+    c->out = NULL;
+    if (keep) {
+        c->state = CONN_IDLE;
+        c->in_len = 0;
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)idx };
+        epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    } else {
+        conn_close(ctx, c);
+    }
+    conn_release(ctx, idx);
+}
+
+static void conn_flush(http_ctx_t *ctx, int idx) {
+    http_conn_t *c = &ctx->conns[idx];
+    while (c->out_off < c->out_len) {
+        ssize_t w = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.u32 = (uint32_t)idx };
+                epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+                return;
+            }
+            conn_finish(ctx, idx, 0, 0);
+            return;
+        }
+        c->out_off += (size_t)w;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)idx };
+    epoll_ctl(ctx->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// Start a request on connection idx (connecting first if needed): an
+// operation of the mix, or a replayed request when rr is set
+static void conn_start(http_ctx_t *ctx, int idx, op_t *op, replay_req_t *rr, double intended_ns) {
+    http_conn_t *c = &ctx->conns[idx];
+    size_t body_len;
+    char *payload = NULL;
+    const char *body;
+    const char *method = "POST";
+    char path[512];
+    char tenant[96] = "";
+
+    if (rr) {
+        method = rr->rec.method;
+        snprintf(path, sizeof(path), "%s", rr->rec.path);
+        if (rr->rec.tenant[0]) snprintf(tenant, sizeof(tenant), "X-Tenant: %s\r\n", rr->rec.tenant);
+        body_len = rr->rec.payload_len;
+        body = rr->rec.payload;
+        if (!body) {
+            payload = malloc(body_len + 1);
+            if (!payload) { perror("malloc"); exit(1); }
+            memset(payload, 'x', body_len);
+            body = payload;
+        }
+    } else if (op->kind == OP_DEPLOY) {
+        snprintf(path, sizeof(path), "/deploy?name=%s&lang=%s", op->target, op->lang);
+        body = op->code;
+        body_len = op->code_len;
+    } else {
+        snprintf(path, sizeof(path), "/invoke?fn=%s", op->target);
+        payload = malloc(MAX_PAYLOAD + 1);
+        if (!payload) { perror("malloc"); exit(1); }
+        body_len = make_payload(op, &ctx->rng, payload, MAX_PAYLOAD + 1, 0, ctx->seq++);
+        body = payload;
+    }
+
+    char hdr[1024];
+    int hlen = snprintf(hdr, sizeof(hdr), "%s %s HTTP/1.1\r\nHost: %s\r\n%sContent-Length: %zu\r\n\r\n",
+                        method, path, ctx->host, tenant, body_len);
+    c->out = malloc((size_t)hlen + body_len);
+    if (!c->out) { perror("malloc"); exit(1); }
+    memcpy(c->out, hdr, (size_t)hlen);
+    memcpy(c->out + hlen, body, body_len);
+    free(payload);
+    c->out_len = (size_t)hlen + body_len;
+    c->out_off = 0;
+    c->in_len = 0;
+    c->op = op;
+    c->rr = rr;
+    c->status = 0;
+    c->intended_ns = intended_ns;
+    c->sent_ns = elapsed_ns(&ctx->start);
+    c->state = CONN_BUSY;
+    ctx->busy++;
+
+    if (c->fd < 0) {
+        c->fd = socket(ctx->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (c->fd < 0) {
+            conn_finish(ctx, idx, 0, 0);
+            return;
+        }
+        struct epoll_event ev = { .events = EPOLLOUT, .data.u32 = (uint32_t)idx };
+        epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+        if (connect(c->fd, (struct sockaddr*)&ctx->addr, ctx->addrlen) < 0 && errno != EINPROGRESS) {
+            conn_finish(ctx, idx, 0, 0);
+        }
+        return; // request goes out once connected (EPOLLOUT)
+    }
+    conn_flush(ctx, idx);
+}
+
+// Parse a complete response if one is buffered. Returns 1 when done.
+static int conn_parse(http_ctx_t *ctx, int idx) {
+    http_conn_t *c = &ctx->conns[idx];
+    c->in[c->in_len] = '\0';
+    char *hdr_end = strstr(c->in, "\r\n\r\n");
+    if (!hdr_end) return 0;
+    size_t hdr_len = (size_t)(hdr_end - c->in) + 4;
+
+    int status = 0;
+    sscanf(c->in, "HTTP/%*s %d", &status);
+    long clen = 0;
+    char *cl = strcasestr(c->in, "\r\nContent-Length:");
+    if (cl && cl < hdr_end) clen = atol(cl + 17);
+    if (c->in_len < hdr_len + (size_t)clen) return 0;
+
+    char *connh = strcasestr(c->in, "\r\nConnection:");
+    int keep = !(connh && connh < hdr_end && strncasecmp(connh + 13, " close", 6) == 0);
+    c->status = status;
+    int ok = status >= 200 && status < 300;
+    int invoke = c->rr ? strncmp(c->rr->rec.path, "/invoke", 7) == 0 : c->op->kind == OP_INVOKE;
+    if (ok && invoke) {
+        ok = strstr(c->in + hdr_len, "\"ok\":true") != NULL;
+    }
+    conn_finish(ctx, idx, ok, keep);
+    return 1;
+}
+
+static void conn_event(http_ctx_t *ctx, int idx, uint32_t events) {
+    http_conn_t *c = &ctx->conns[idx];
+    if (c->state == CONN_IDLE) {
+        // Server closed an idle keep-alive connection
+        conn_close(ctx, c);
+        return;
+    }
+    if (c->state != CONN_BUSY) return;
+
+    if (!c->connected && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) {
+            conn_finish(ctx, idx, 0, 0);
+            return;
+        }
+        c->connected = 1;
+        conn_flush(ctx, idx);
+        return;
+    }
+    if (events & EPOLLOUT) {
+        conn_flush(ctx, idx);
+        if (c->state != CONN_BUSY) return;
+    }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        for (;;) {
+            if (c->in_cap - c->in_len < 4096) {
+                size_t cap = c->in_cap ? c->in_cap * 2 : 16384;
+                char *in = realloc(c->in, cap + 1);
+                if (!in) { perror("realloc"); exit(1); }
+                c->in = in;
+                c->in_cap = cap;
+            }
+            ssize_t r = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+            if (r > 0) {
+                c->in_len += (size_t)r;
+                if (conn_parse(ctx, idx)) return;
+                continue;
+            }
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            conn_finish(ctx, idx, 0, 0); // closed mid-response
+            return;
+        }
+    }
+}
+
+static void queue_push(http_ctx_t *ctx, double intended_ns, op_t *op, replay_req_t *rr) {
+    if (ctx->qlen == ctx->qcap) {
+        size_t cap = ctx->qcap ? ctx->qcap * 2 : 1024;
+        arrival_slot_t *q = malloc(sizeof(arrival_slot_t) * cap);
+        if (!q) { perror("malloc"); exit(1); }
+        for (size_t i = 0; i < ctx->qlen; i++) q[i] = ctx->queue[(ctx->qhead + i) % ctx->qcap];
+        free(ctx->queue);
+        ctx->queue = q;
+        ctx->qcap = cap;
+        ctx->qhead = 0;
+    }
+    ctx->queue[(ctx->qhead + ctx->qlen) % ctx->qcap] = (arrival_slot_t){ intended_ns, op, rr };
+    ctx->qlen++;
+}
+
+// Event loop driving every connection. Open loop: arrivals are generated on
+// schedule and wait in a FIFO (still timed from their intended send time)
+// when all connections are busy; a replay is an open loop whose arrivals
+// are the captured ones. Closed loop: every connection sends its next
+// request as soon as the previous response arrives.
+static void run_http(http_ctx_t *ctx) {
+    config_t *cfg = ctx->cfg;
+    double end_ns = cfg->duration_s * 1e9;
+    double drain_end_ns = end_ns + DRAIN_TIMEOUT_S * 1e9;
+    double next_arrival = 0;
+    struct epoll_event events[256];
+
+    for (;;) {
+        double now = elapsed_ns(&ctx->start);
+        int generating = now < end_ns;
+
+        if (cfg->open_loop) {
+            if (cfg->replay_path) {
+                while (replay.next < replay.n && replay.reqs[replay.next].at_ns <= now) {
+                    replay_req_t *rr = &replay.reqs[replay.next++];
+                    queue_push(ctx, rr->at_ns, NULL, rr);
+                }
+                next_arrival = replay.next < replay.n ? replay.reqs[replay.next].at_ns : end_ns;
+            } else {
+                while (next_arrival <= now && next_arrival < end_ns) {
+                    queue_push(ctx, next_arrival, pick_op(cfg, &ctx->rng), NULL);
+                    next_arrival += next_gap_ns(cfg, &ctx->rng);
+                }
+            }
+            while (ctx->qlen > 0 && ctx->nfree > 0) {
+                arrival_slot_t a = ctx->queue[ctx->qhead];
+                ctx->qhead = (ctx->qhead + 1) % ctx->qcap;
+                ctx->qlen--;
+                conn_start(ctx, ctx->free_stack[--ctx->nfree], a.op, a.rr, a.intended_ns);
+            }
+        } else if (generating) {
+            while (ctx->nfree > 0) {
+                conn_start(ctx, ctx->free_stack[--ctx->nfree], pick_op(cfg, &ctx->rng), NULL, now);
+            }
+        }
+
+        int pending = ctx->busy > 0 || (cfg->open_loop && (ctx->qlen > 0 || next_arrival < end_ns));
+        if (!generating && !pending) break;
+        if (now >= drain_end_ns) {
+            fprintf(stderr, "Warning: %d requests still in flight, %zu never sent\n", ctx->busy, ctx->qlen);
+            break;
+        }
+
+        int timeout_ms = 100;
+        if (cfg->open_loop && next_arrival < end_ns) {
+            double wait = (next_arrival - elapsed_ns(&ctx->start)) / 1e6;
+            timeout_ms = wait <= 0 ? 0 : (int)wait;
+        } else if (!cfg->open_loop && generating) {
+            double wait = (end_ns - now) / 1e6;
+            if (wait < timeout_ms) timeout_ms = (int)wait + 1;
+        }
+        int n = epoll_wait(ctx->epfd, events, 256, timeout_ms);
+        for (int i = 0; i < n; i++) {
+            conn_event(ctx, (int)events[i].data.u32, events[i].events);
+        }
+    }
+
+    for (int i = 0; i < ctx->nconns; i++) {
+        conn_close(ctx, &ctx->conns[i]);
+        free(ctx->conns[i].in);
+        free(ctx->conns[i].out);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Reporting
+// ---------------------------------------------------------------------------
+
+static void print_hist(const char *label, const histogram_t *h) {
+    printf("%-22s p50 %9.2f  p90 %9.2f  p99 %9.2f  p99.9 %9.2f  max %9.2f ms\n", label,
+           hist_percentile(h, 50) / 1000.0, hist_percentile(h, 90) / 1000.0,
+           hist_percentile(h, 99) / 1000.0, hist_percentile(h, 99.9) / 1000.0, h->max / 1000.0);
+}
+
+static void json_hist(FILE *f, const char *key, const histogram_t *h) {
+    fprintf(f, "\"%s\":{\"count\":%llu,\"mean\":%.1f,\"min\":%llu,\"p50\":%llu,\"p90\":%llu,"
+            "\"p99\":%llu,\"p999\":%llu,\"max\":%llu}", key, (unsigned long long)h->total, hist_mean(h),
+            (unsigned long long)(h->total ? h->min : 0),
+            (unsigned long long)hist_percentile(h, 50), (unsigned long long)hist_percentile(h, 90),
+            (unsigned long long)hist_percentile(h, 99), (unsigned long long)hist_percentile(h, 99.9),
+            (unsigned long long)h->max);
+}
 
-    if (requests_per_thread <= 0 || requests_per_thread > 10000) {
-        fprintf(stderr, "Error: requests_per_thread must be between 1 and 10000\n");
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <function_id> <num_threads> <requests_per_thread>\n", prog);
+    fprintf(stderr, "       %s -f <function_id> | -W <workload> [options]\n", prog);
+    fprintf(stderr, "Closed loop (default):\n");
+    fprintf(stderr, "  -t <threads>        concurrent clients (default 10)\n");
+    fprintf(stderr, "  -n <requests>       requests per client (default 100)\n");
+    fprintf(stderr, "  -T <ms>             think time between requests (default 10)\n");
+    fprintf(stderr, "Open loop (enabled by -r):\n");
+    fprintf(stderr, "  -r <rps>            target arrival rate\n");
+    fprintf(stderr, "  -d <seconds>        duration including warm-up (default 10)\n");
+    fprintf(stderr, "  -a const|poisson    inter-arrival distribution (default poisson)\n");
+    fprintf(stderr, "  -w <seconds>        warm-up excluded from results (default 0)\n");
+    fprintf(stderr, "  -c <n>              max requests in flight (default 64)\n");
+    fprintf(stderr, "HTTP mode (through the gateway, keep-alive, single epoll thread):\n");
+    fprintf(stderr, "  -H <host:port>      gateway address, e.g. 127.0.0.1:8080\n");
+    fprintf(stderr, "                      -c is the connection count; without -r every\n");
+    fprintf(stderr, "                      connection loops back-to-back for -d seconds\n");
+    fprintf(stderr, "Replay (HTTP, default target %s):\n", REPLAY_DEFAULT_TARGET);
+    fprintf(stderr, "  -R <capture>        re-send the requests of a FAAS_CAPTURE file at their\n");
+    fprintf(stderr, "                      original times, instead of -f/-W\n");
+    fprintf(stderr, "  -s <speed>          time scale, 2 = twice as fast (default 1)\n");
+    fprintf(stderr, "Common:\n");
+    fprintf(stderr, "  -W <file>           workload mix (see README), instead of -f\n");
+    fprintf(stderr, "  -p <payload>        payload string (no quotes)\n");
+    fprintf(stderr, "  -j <file|->         write JSON results\n");
+    fprintf(stderr, "Example: %s -f hello:latest -r 200 -d 30 -w 5 -j run.json\n", prog);
+}
+
+int main(int argc, char **argv) {
+    static config_t cfg = {
+        .num_threads = 10,
+        .requests_per_thread = 100,
+        .think_ms = 10,
+        .duration_s = 10,
+        .arrival = ARRIVAL_POISSON,
+        .max_in_flight = 64,
+        .replay_speed = 1,
+    };
+
+    if (argc >= 4 && argv[1][0] != '-') {
+        // Legacy form: <function_id> <num_threads> <requests_per_thread>
+        cfg.function_id = argv[1];
+        cfg.num_threads = atoi(argv[2]);
+        cfg.requests_per_thread = atoi(argv[3]);
+    } else {
+        int opt;
+        while ((opt = getopt(argc, argv, "f:t:n:T:r:d:a:w:c:p:j:H:W:R:s:h")) != -1) {
+            switch (opt) {
+                case 'f': cfg.function_id = optarg; break;
+                case 't': cfg.num_threads = atoi(optarg); break;
+                case 'n': cfg.requests_per_thread = atoi(optarg); break;
+                case 'T': cfg.think_ms = atoi(optarg); break;
+                case 'r': cfg.rate = atof(optarg); cfg.open_loop = 1; break;
+                case 'd': cfg.duration_s = atof(optarg); break;
+                case 'a':
+                    if (strcmp(optarg, "const") == 0) cfg.arrival = ARRIVAL_CONSTANT;
+                    else if (strcmp(optarg, "poisson") == 0) cfg.arrival = ARRIVAL_POISSON;
+                    else { usage(argv[0]); return 1; }
+                    break;
+                case 'w': cfg.warmup_s = atof(optarg); break;
+                case 'c': cfg.max_in_flight = atoi(optarg); break;
+                case 'p': cfg.payload = optarg; break;
+                case 'j': cfg.json_path = optarg; break;
+                case 'H': cfg.http_target = optarg; break;
+                case 'W': cfg.workload_path = optarg; break;
+                case 'R': cfg.replay_path = optarg; break;
+                case 's': cfg.replay_speed = atof(optarg); break;
+                default: usage(argv[0]); return 1;
+            }
+        }
+    }
+
+    if (!cfg.function_id && !cfg.workload_path && !cfg.replay_path) {
+        usage(argv[0]);
         return 1;
     }
+    if (cfg.replay_path) {
+        if (cfg.replay_speed <= 0) {
+            fprintf(stderr, "Error: speed must be > 0\n");
+            return 1;
+        }
+        long n = replay_load(cfg.replay_path, cfg.replay_speed);
+        if (n <= 0) {
+            fprintf(stderr, "Error: nothing to replay in %s\n", cfg.replay_path);
+            return 1;
+        }
+        // Open loop over the captured arrivals, ending with the last one
+        if (!cfg.http_target) cfg.http_target = REPLAY_DEFAULT_TARGET;
+        cfg.open_loop = 1;
+        cfg.warmup_s = 0;
+        cfg.duration_s = replay.reqs[n - 1].at_ns / 1e9 + 0.001;
+        cfg.rate = n / cfg.duration_s;
+    }
+    if (cfg.payload && strchr(cfg.payload, '"')) {
+        fprintf(stderr, "Error: payload must not contain quotes\n");
+        return 1;
+    }
+
+    if (cfg.replay_path) {
+        // Requests come from the capture
+    } else if (cfg.workload_path) {
+        if (load_workload(&cfg, cfg.workload_path) < 0) return 1;
+    } else {
+        op_t *op = &cfg.ops[cfg.nops++];
+        op->kind = OP_INVOKE;
+        op->weight = 1;
+        op->fixed_payload = cfg.payload;
+        snprintf(op->target, sizeof(op->target), "%s", cfg.function_id);
+    }
+    for (int i = 0; i < cfg.nops; i++) {
+        if (cfg.ops[i].kind == OP_DEPLOY && !cfg.http_target) {
+            fprintf(stderr, "Error: deploy operations need HTTP mode (-H)\n");
+            return 1;
+        }
+        cfg.total_weight += cfg.ops[i].weight;
+        if (hist_init(&cfg.ops[i].latency) < 0) {
+            perror("hist_init");
+            return 1;
+        }
+    }
+
+    int num_threads = 0;
+    if (cfg.http_target) {
+        if (cfg.duration_s <= 0 || cfg.warmup_s < 0 || cfg.warmup_s >= cfg.duration_s ||
+            (cfg.open_loop && cfg.rate <= 0)) {
+            fprintf(stderr, "Error: need rate > 0 (open loop) and 0 <= warm-up < duration\n");
+            return 1;
+        }
+        if (cfg.max_in_flight <= 0 || cfg.max_in_flight > MAX_CONNS) {
+            fprintf(stderr, "Error: connections must be between 1 and %d\n", MAX_CONNS);
+            return 1;
+        }
+    } else if (cfg.open_loop) {
+        if (cfg.rate <= 0 || cfg.duration_s <= 0 || cfg.warmup_s < 0 || cfg.warmup_s >= cfg.duration_s) {
+            fprintf(stderr, "Error: need rate > 0 and 0 <= warm-up < duration\n");
+            return 1;
+        }
+        if (cfg.max_in_flight <= 0 || cfg.max_in_flight > MAX_THREADS) {
+            fprintf(stderr, "Error: max in flight must be between 1 and %d\n", MAX_THREADS);
+            return 1;
+        }
+        num_threads = cfg.max_in_flight;
+    } else {
+        if (cfg.num_threads <= 0 || cfg.num_threads > 100) {
+            fprintf(stderr, "Error: num_threads must be between 1 and 100\n");
+            return 1;
+        }
+        if (cfg.requests_per_thread <= 0 || cfg.requests_per_thread > 10000) {
+            fprintf(stderr, "Error: requests_per_thread must be between 1 and 10000\n");
+            return 1;
+        }
+        num_threads = cfg.num_threads;
+    }
 
     printf("=== Load Injector ===\n");
-    printf("Function ID: %s\n", function_id);
-    printf("Threads: %d\n", num_threads);
-    printf("Requests per thread: %d\n", requests_per_thread);
-    printf("Total requests: %d\n", num_threads * requests_per_thread);
+    if (cfg.replay_path) {
+        printf("Replay: %s (%zu requests, %d kinds, %.1fx speed)\n", cfg.replay_path, replay.n,
+               replay.ngroups, cfg.replay_speed);
+    } else if (cfg.workload_path) {
+        printf("Workload: %s (%d operations)\n", cfg.workload_path, cfg.nops);
+    } else {
+        printf("Function ID: %s\n", cfg.function_id);
+    }
+    if (cfg.http_target) {
+        printf("Transport: HTTP/1.1 keep-alive to %s, %d connections\n", cfg.http_target, cfg.max_in_flight);
+    }
+    if (cfg.replay_path) {
+        printf("Mode: replay, %.1fs at %.1f req/s on average\n", cfg.duration_s, cfg.rate);
+    } else if (cfg.open_loop) {
+        printf("Mode: open loop, %s arrivals at %.1f req/s\n",
+               cfg.arrival == ARRIVAL_POISSON ? "poisson" : "constant", cfg.rate);
+        printf("Duration: %.1fs (warm-up %.1fs), max in flight: %d\n",
+               cfg.duration_s, cfg.warmup_s, cfg.max_in_flight);
+    } else if (cfg.http_target) {
+        printf("Mode: closed loop, %.1fs (warm-up %.1fs)\n", cfg.duration_s, cfg.warmup_s);
+    } else {
+        printf("Mode: closed loop\n");
+        printf("Threads: %d\n", cfg.num_threads);
+        printf("Requests per thread: %d\n", cfg.requests_per_thread);
+        printf("Total requests: %d\n", cfg.num_threads * cfg.requests_per_thread);
+    }
     printf("=====================\n\n");
 
-    int success_count = 0;
-    int error_count = 0;
-    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-
-    pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
-    thread_args_t *args = malloc(sizeof(thread_args_t) * num_threads);
+    results_t res = { .lock = PTHREAD_MUTEX_INITIALIZER };
+    if (hist_init(&res.latency) < 0 || hist_init(&res.service) < 0) {
+        perror("hist_init");
+        return 1;
+    }
 
-    struct timespec start, end;
+    struct timespec start;
     clock_gettime(CLOCK_MONOTONIC, &start);
 
-    // Create threads
-    for (int i = 0; i < num_threads; i++) {
-        args[i].thread_id = i;
-        args[i].num_requests = requests_per_thread;
-        args[i].function_id = function_id;
-        args[i].success_count = &success_count;
-        args[i].error_count = &error_count;
-        args[i].mutex = &mutex;
-
-        if (pthread_create(&threads[i], NULL, worker_thread, &args[i]) != 0) {
-            perror("pthread_create");
+    if (cfg.http_target) {
+        static http_ctx_t ctx;
+        ctx.cfg = &cfg;
+        ctx.res = &res;
+        ctx.rng = 88172645463325252ULL ^ (uint64_t)time(NULL);
+        if (resolve_target(&ctx, cfg.http_target) < 0) return 1;
+        ctx.epfd = epoll_create1(0);
+        ctx.nconns = cfg.max_in_flight;
+        ctx.conns = calloc((size_t)ctx.nconns, sizeof(http_conn_t));
+        ctx.free_stack = malloc(sizeof(int) * (size_t)ctx.nconns);
+        if (ctx.epfd < 0 || !ctx.conns || !ctx.free_stack) {
+            perror("init");
             return 1;
         }
-    }
+        for (int i = 0; i < ctx.nconns; i++) {
+            ctx.conns[i].fd = -1;
+            ctx.free_stack[ctx.nfree++] = ctx.nconns - 1 - i;
+        }
+        ctx.busy = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ctx.start = start;
+        run_http(&ctx);
+        close(ctx.epfd);
+        free(ctx.conns);
+        free(ctx.free_stack);
+        free(ctx.queue);
+    } else {
+        schedule_t sched = {
+            .lock = PTHREAD_MUTEX_INITIALIZER,
+            .next_ns = 0,
+            .end_ns = cfg.duration_s * 1e9,
+            .rng = 88172645463325252ULL ^ (uint64_t)time(NULL),
+        };
 
-    // Wait for all threads
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(threads[i], NULL);
+        pthread_t *threads = malloc(sizeof(pthread_t) * num_threads);
+        thread_args_t *args = calloc((size_t)num_threads, sizeof(thread_args_t));
+        if (!threads || !args) {
+            perror("malloc");
+            return 1;
+        }
+
+        // Create threads
+        for (int i = 0; i < num_threads; i++) {
+            args[i].thread_id = i;
+            args[i].cfg = &cfg;
+            args[i].sched = &sched;
+            args[i].res = &res;
+            args[i].start = start;
+
+            void *(*fn)(void *) = cfg.open_loop ? open_loop_thread : closed_loop_thread;
+            if (pthread_create(&threads[i], NULL, fn, &args[i]) != 0) {
+                perror("pthread_create");
+                return 1;
+            }
+        }
+
+        // Wait for all threads
+        for (int i = 0; i < num_threads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+        free(args);
     }
 
-    clock_gettime(CLOCK_MONOTONIC, &end);
+    long success_count = res.ok, error_count = res.errors, late = res.late;
+    histogram_t *latency = &res.latency, *service = &res.service;
+    int timed = cfg.open_loop || cfg.http_target;
 
-    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
-    int total = success_count + error_count;
-    double rps = total / elapsed;
+    double elapsed = elapsed_ns(&start) / 1e9;
+    double measured = timed ? (cfg.duration_s - cfg.warmup_s) : elapsed;
+    long total = success_count + error_count;
+    double rps = measured > 0 ? total / measured : 0;
+    double goodput = measured > 0 ? success_count / measured : 0;
 
     printf("\n=== Results ===\n");
-    printf("Total requests: %d\n", total);
-    printf("Successful: %d (%.1f%%)\n", success_count, 100.0 * success_count / total);
-    printf("Errors: %d (%.1f%%)\n", error_count, 100.0 * error_count / total);
+    printf("Total requests: %ld\n", total);
+    if (total > 0) {
+        printf("Successful: %ld (%.1f%%)\n", success_count, 100.0 * success_count / total);
+        printf("Errors: %ld (%.1f%%)\n", error_count, 100.0 * error_count / total);
+    }
     printf("Elapsed time: %.2f seconds\n", elapsed);
-    printf("Requests/sec: %.2f\n", rps);
+    printf("Requests/sec: %.2f (goodput %.2f)\n", rps, goodput);
+    if (cfg.open_loop) {
+        printf("Sent late (>1ms behind schedule): %ld\n", late);
+        print_hist("Latency (corrected):", latency);
+        print_hist("Service time:", service);
+    } else {
+        print_hist("Latency:", latency);
+    }
+    if (cfg.nops > 1) {
+        for (int i = 0; i < cfg.nops; i++) {
+            char label[160];
+            snprintf(label, sizeof(label), "%s %s:", cfg.ops[i].kind == OP_DEPLOY ? "deploy" : "invoke",
+                     cfg.ops[i].target);
+            print_hist(label, &cfg.ops[i].latency);
+        }
+    }
+    if (cfg.replay_path) replay_report();
     printf("===============\n");
 
-    free(threads);
-    free(args);
-    pthread_mutex_destroy(&mutex);
+    if (cfg.json_path) {
+        FILE *f = strcmp(cfg.json_path, "-") == 0 ? stdout : fopen(cfg.json_path, "w");
+        if (!f) {
+            perror("fopen");
+        } else {
+            fprintf(f, "{\"function\":\"%s\",\"workload\":\"%s\",\"transport\":\"%s\",\"mode\":\"%s\",",
+                    cfg.function_id ? cfg.function_id : "", cfg.workload_path ? cfg.workload_path : "",
+                    cfg.http_target ? "http" : "unix", cfg.replay_path ? "replay" : cfg.open_loop ? "open" : "closed");
+            if (cfg.open_loop && !cfg.replay_path) {
+                fprintf(f, "\"arrival\":\"%s\",\"target_rps\":%.3f,\"late\":%ld,",
+                        cfg.arrival == ARRIVAL_POISSON ? "poisson" : "constant", cfg.rate, late);
+            }
+            if (timed) {
+                fprintf(f, "\"duration_s\":%.3f,\"warmup_s\":%.3f,\"max_in_flight\":%d,",
+                        cfg.duration_s, cfg.warmup_s, cfg.max_in_flight);
+            } else {
+                fprintf(f, "\"threads\":%d,\"requests_per_thread\":%d,\"think_ms\":%d,",
+                        cfg.num_threads, cfg.requests_per_thread, cfg.think_ms);
+            }
+            fprintf(f, "\"requests\":%ld,\"ok\":%ld,\"errors\":%ld,\"elapsed_s\":%.3f,\"rps\":%.3f,\"goodput_rps\":%.3f,",
+                    total, success_count, error_count, elapsed, rps, goodput);
+            json_hist(f, "latency_us", latency);
+            fprintf(f, ",");
+            json_hist(f, "service_us", service);
+            fprintf(f, ",\"ops\":[");
+            for (int i = 0; i < cfg.nops; i++) {
+                op_t *op = &cfg.ops[i];
+                fprintf(f, "%s{\"op\":\"%s\",\"target\":\"%s\",\"weight\":%.3f,\"ok\":%ld,\"errors\":%ld,",
+                        i ? "," : "", op->kind == OP_DEPLOY ? "deploy" : "invoke", op->target,
+                        op->weight, op->ok, op->errors);
+                json_hist(f, "latency_us", &op->latency);
+                fprintf(f, "}");
+            }
+            fprintf(f, "]");
+            if (cfg.replay_path) {
+                fprintf(f, ",\"replay\":{\"file\":\"%s\",\"speed\":%.3f,\"groups\":[",
+                        cfg.replay_path, cfg.replay_speed);
+                for (int i = 0; i < replay.ngroups; i++) {
+                    if (i) fprintf(f, ",");
+                    replay_json_group(f, &replay.groups[i]);
+                }
+                fprintf(f, "],\"all\":");
+                replay_json_group(f, &replay.all);
+                fprintf(f, "}");
+            }
+            fprintf(f, "}\n");
+            if (f != stdout) fclose(f);
+        }
+    }
+
+    for (int i = 0; i < cfg.nops; i++) {
+        hist_free(&cfg.ops[i].latency);
+        free(cfg.ops[i].code);
+    }
+    if (cfg.replay_path) replay_free();
+    hist_free(latency);
+    hist_free(service);
+    pthread_mutex_destroy(&res.lock);
 
     return 0;
 }
@@ -0,0 +1,269 @@
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define LOG_RING_SLOTS 256       // lines buffered per thread
+#define LOG_MSG_MAX 480          // longer lines are truncated
+#define LOG_MAX_RINGS 4096       // rings are reused when their thread exits
+#define LOG_DRAIN_IDLE_NS 2000000 // drainer poll interval when idle (2ms)
+#define LOG_OUT_BUF 65536
+#define LOG_RATE_DEFAULT 20
+
+typedef struct {
+    struct timespec ts;
+    int level;
+    int len;
+    char msg[LOG_MSG_MAX];
+} log_record_t;
+
+typedef struct {
+    atomic_uint head;            // next slot written (producer)
+    atomic_uint tail;            // next slot read (drainer)
+    atomic_int in_use;           // owned by a live thread
+    atomic_ulong dropped;        // lines lost because the ring was full
+    log_record_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+int log_level = LOG_LEVEL_INFO;
+
+static log_ring_t *rings[LOG_MAX_RINGS];
+static atomic_int nrings = 0;
+static pthread_mutex_t reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER; // one consumer at a time
+static pthread_key_t ring_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static int drainer_started = 0;
+static int log_sync = 0;
+static int log_rate = LOG_RATE_DEFAULT;
+static atomic_ulong dropped_total = 0;
+static _Thread_local log_ring_t *my_ring = NULL;
+
+static const char *level_names[] = { "ERROR", "WARN ", "INFO ", "DEBUG" };
+
+// Thread exit: hand the ring to the next thread (pending lines are kept)
+static void ring_release(void *arg) {
+    log_ring_t *r = arg;
+    atomic_store_explicit(&r->in_use, 0, memory_order_release);
+}
+
+static void atfork_prepare(void) {
+    pthread_mutex_lock(&reg_lock);
+    pthread_mutex_lock(&drain_lock);
+}
+
+static void atfork_parent(void) {
+    pthread_mutex_unlock(&drain_lock);
+    pthread_mutex_unlock(&reg_lock);
+}
+
+// The child only has the forking thread: start over with fresh rings (the
+// parent still owns and drains the inherited lines) and a new drainer
+static void atfork_child(void) {
+    atomic_store(&nrings, 0);
+    drainer_started = 0;
+    my_ring = NULL;
+    pthread_setspecific(ring_key, NULL);
+    pthread_mutex_init(&drain_lock, NULL);
+    pthread_mutex_init(&reg_lock, NULL);
+}
+
+static void key_init(void) {
+    pthread_key_create(&ring_key, ring_release);
+    pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+    atexit(log_flush);
+}
+
+void log_init(void) {
+    pthread_once(&key_once, key_init);
+    const char *lvl = getenv("FAAS_LOG_LEVEL");
+    if (lvl) {
+        if (strcmp(lvl, "error") == 0) log_level = LOG_LEVEL_ERROR;
+        else if (strcmp(lvl, "warn") == 0) log_level = LOG_LEVEL_WARN;
+        else if (strcmp(lvl, "info") == 0) log_level = LOG_LEVEL_INFO;
+        else if (strcmp(lvl, "debug") == 0) log_level = LOG_LEVEL_DEBUG;
+    }
+    const char *rate = getenv("FAAS_LOG_RATE");
+    if (rate && atoi(rate) > 0) log_rate = atoi(rate);
+    const char *sync = getenv("FAAS_LOG_SYNC");
+    log_sync = sync && strcmp(sync, "0") != 0;
+}
+
+static size_t format_record(char *out, size_t cap, const log_record_t *rec) {
+    struct tm tm;
+    localtime_r(&rec->ts.tv_sec, &tm);
+    int n = snprintf(out, cap, "%02d:%02d:%02d.%03ld %s [%d] %.*s\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                     rec->ts.tv_nsec / 1000000, level_names[rec->level], (int)getpid(), rec->len, rec->msg);
+    return n < 0 ? 0 : ((size_t)n < cap ? (size_t)n : cap - 1);
+}
+
+static void write_out(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(STDERR_FILENO, buf, len);
+        if (w <= 0) return;
+        buf += w;
+        len -= (size_t)w;
+    }
+}
+
+// Drain every ring once; returns the number of lines written
+static size_t drain_once(void) {
+    static char out[LOG_OUT_BUF];
+    size_t off = 0, lines = 0;
+
+    pthread_mutex_lock(&drain_lock);
+    int n = atomic_load_explicit(&nrings, memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        log_ring_t *r = rings[i];
+        unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            if (LOG_OUT_BUF - off < LOG_MSG_MAX + 64) {
+                write_out(out, off);
+                off = 0;
+            }
+            off += format_record(out + off, LOG_OUT_BUF - off, &r->slots[tail % LOG_RING_SLOTS]);
+            lines++;
+        }
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+
+        unsigned long dropped = atomic_exchange(&r->dropped, 0);
+        if (dropped) {
+            log_record_t note = { .level = LOG_LEVEL_WARN };
+            clock_gettime(CLOCK_REALTIME, &note.ts);
+            note.len = snprintf(note.msg, sizeof(note.msg), "[LOG] %lu lines dropped (ring full)", dropped);
+            if (LOG_OUT_BUF - off < LOG_MSG_MAX + 64) {
+                write_out(out, off);
+                off = 0;
+            }
+            off += format_record(out + off, LOG_OUT_BUF - off, &note);
+        }
+    }
+    if (off) write_out(out, off);
+    pthread_mutex_unlock(&drain_lock);
+    return lines;
+}
+
+static void *drainer_thread(void *arg) {
+    (void)arg;
+    struct timespec idle = { 0, LOG_DRAIN_IDLE_NS };
+    for (;;) {
+        if (drain_once() == 0) nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+void log_flush(void) {
+    drain_once();
+}
+
+unsigned long log_dropped(void) {
+    return atomic_load(&dropped_total);
+}
+
+// Claim a free ring (left by an exited thread) or register a new one
+static log_ring_t *ring_for_thread(void) {
+    if (my_ring) return my_ring;
+    pthread_once(&key_once, key_init);
+
+    int n = atomic_load_explicit(&nrings, memory_order_acquire);
+    for (int i = 0; i < n; i++) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&rings[i]->in_use, &expected, 1)) {
+            my_ring = rings[i];
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&reg_lock);
+    if (!my_ring) {
+        n = atomic_load(&nrings);
+        log_ring_t *r = n < LOG_MAX_RINGS ? calloc(1, sizeof(log_ring_t)) : NULL;
+        if (r) {
+            atomic_store(&r->in_use, 1);
+            rings[n] = r;
+            atomic_store_explicit(&nrings, n + 1, memory_order_release);
+            my_ring = r;
+        }
+    }
+    if (my_ring && !drainer_started) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, drainer_thread, NULL) == 0) {
+            pthread_detach(t);
+            drainer_started = 1;
+        }
+    }
+    pthread_mutex_unlock(&reg_lock);
+
+    if (my_ring) pthread_setspecific(ring_key, my_ring);
+    return my_ring;
+}
+
+static void log_vwrite(int level, unsigned long suppressed, const char *fmt, va_list ap) {
+    log_record_t local;
+    log_record_t *rec = &local;
+    log_ring_t *r = log_sync ? NULL : ring_for_thread();
+    unsigned head = 0;
+
+    if (r) {
+        head = atomic_load_explicit(&r->head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head - tail >= LOG_RING_SLOTS) {
+            atomic_fetch_add(&r->dropped, 1);
+            atomic_fetch_add(&dropped_total, 1);
+            return;
+        }
+        rec = &r->slots[head % LOG_RING_SLOTS];
+    }
+
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    rec->level = level;
+    int n = vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    if (n < 0) n = 0;
+    if (n >= (int)sizeof(rec->msg)) n = (int)sizeof(rec->msg) - 1;
+    while (n > 0 && (rec->msg[n - 1] == '\n' || rec->msg[n - 1] == '\r')) n--;
+    if (suppressed) {
+        int m = snprintf(rec->msg + n, sizeof(rec->msg) - (size_t)n, " (+%lu suppressed)", suppressed);
+        if (m > 0) n += m;
+        if (n >= (int)sizeof(rec->msg)) n = (int)sizeof(rec->msg) - 1;
+    }
+    rec->len = n;
+
+    if (r) {
+        atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    } else {
+        char out[LOG_MSG_MAX + 64];
+        write_out(out, format_record(out, sizeof(out), rec));
+    }
+}
+
+void log_write(int level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, 0, fmt, ap);
+    va_end(ap);
+}
+
+void log_write_sampled(int level, log_limit_t *lim, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, atomic_exchange(&lim->suppressed, 0), fmt, ap);
+    va_end(ap);
+}
+
+int log_allow(log_limit_t *lim) {
+    long now = (long)time(NULL);
+    long window = atomic_load(&lim->window);
+    if (window != now && atomic_compare_exchange_strong(&lim->window, &window, now)) {
+        atomic_store(&lim->count, 0);
+    }
+    if (atomic_fetch_add(&lim->count, 1) < log_rate) return 1;
+    atomic_fetch_add(&lim->suppressed, 1);
+    return 0;
+}
@@ -16,6 +16,9 @@
 #include <sys/socket.h>
 #include <pthread.h>
 
+#include "log.h"
+#include "metrics.h"
+
 // Forward declarations of component main functions
 extern int load_balancer_main(int argc, char **argv);
 extern int api_gateway_main(void);
@@ -84,9 +87,16 @@ int main(int argc, char **argv) {
     printf("[MAIN] PID principal: %d\n", getpid());
     printf("\n");
     
+    log_init();
+    // Before any thread or fork: every process shares this segment
+    if (metrics_init() < 0) {
+        log_warn("[MAIN] ⚠️  Metrics disabled (no shared segment)\n");
+    }
+
     // Setup signal handlers
     signal(SIGINT, sigint_handler);
     signal(SIGTERM, sigint_handler);
+    signal(SIGPIPE, SIG_IGN); // clients closing early: write errors, not a dead gateway
     
     // Start Load Balancer in separate thread
     pthread_t lb_thread;
@@ -130,13 +140,14 @@ int main(int argc, char **argv) {
     printf("📊 Composants actifs:\n");
     printf("  • Load Balancer:  /tmp/faas_lb.sock\n");
     printf("  • API Gateway:    http://127.0.0.1:8080\n");
-    printf("  • Server:         PID %d (+ 4 workers)\n", server_pid);
+    printf("  • Server:         PID %d (+ %s workers)\n", server_pid,
+           getenv("FAAS_WORKERS") ? getenv("FAAS_WORKERS") : "4");
     printf("\n");
     printf("🧪 Pour tester:\n");
     printf("  curl -X POST 'http://127.0.0.1:8080/deploy?name=hello&lang=c' \\\n");
     printf("    -H \"Content-Type: text/plain\" --data-binary @examples/hello.c\n");
     printf("\n");
-    printf("  curl -X POST 'http://127.0.0.1:8080/invoke?fn=hello_<timestamp>'\n");
+    printf("  curl -X POST 'http://127.0.0.1:8080/invoke?fn=hello:latest'\n");
     printf("\n");
     printf("⏹️  Appuyez sur Ctrl+C pour arrêter...\n");
     printf("\n");
@@ -0,0 +1,193 @@
+#include "memo.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+typedef struct memo_entry {
+    memo_key_t key;
+    struct memo_entry *chain;          // same bucket
+    struct memo_entry *prev, *next;    // shard LRU, most recent first (ready only)
+    char *resp;                        // NULL while pending
+    size_t cost;                       // bytes accounted once ready
+    int ttl;
+    time_t expires;
+} memo_entry_t;
+
+// Waiters for any pending entry of the shard sleep on done
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    memo_entry_t *buckets[MEMO_BUCKETS];
+    memo_entry_t *head, *tail;
+    size_t bytes;
+} memo_shard_t;
+
+static memo_shard_t shards[MEMO_SHARDS];
+static size_t shard_max = MEMO_BYTES / MEMO_SHARDS;
+
+void memo_init(size_t max_bytes) {
+    if (max_bytes) shard_max = max_bytes / MEMO_SHARDS;
+    for (int i = 0; i < MEMO_SHARDS; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        pthread_cond_init(&shards[i].done, NULL);
+    }
+}
+
+static inline uint64_t lane(uint64_t h, uint64_t w, uint64_t m) {
+    h ^= w * m;
+    h = (h << 31) | (h >> 33);
+    return h * 0x9E3779B97F4A7C15ull;
+}
+
+static inline uint64_t fmix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+
+// Eight bytes at a time: payloads up to the spool limit get hashed here
+static void hash_bytes(uint64_t *h1, uint64_t *h2, const unsigned char *p, size_t len) {
+    uint64_t w;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, p + i, 8);
+        *h1 = lane(*h1, w, 0x87C37B91114253D5ull);
+        *h2 = lane(*h2, w, 0x4CF5AD432745937Full);
+    }
+    if (i < len) {
+        w = 0;
+        memcpy(&w, p + i, len - i);
+        *h1 = lane(*h1, w, 0x87C37B91114253D5ull);
+        *h2 = lane(*h2, w, 0x4CF5AD432745937Full);
+    }
+}
+
+void memo_key(memo_key_t *k, const char *id, const void *payload, size_t len) {
+    snprintf(k->id, sizeof(k->id), "%s", id);
+    uint64_t h1 = 0x243F6A8885A308D3ull, h2 = 0x13198A2E03707344ull;
+    hash_bytes(&h1, &h2, (const unsigned char *)id, strlen(id) + 1);
+    hash_bytes(&h1, &h2, payload, len);
+    k->h1 = fmix(h1 ^ len);
+    k->h2 = fmix(h2 + len);
+    k->len = len;
+}
+
+static memo_entry_t **bucket(memo_shard_t *s, const memo_key_t *k) {
+    return &s->buckets[(k->h1 >> 16) % MEMO_BUCKETS];
+}
+
+static memo_entry_t *find(memo_shard_t *s, const memo_key_t *k) {
+    for (memo_entry_t *e = *bucket(s, k); e; e = e->chain) {
+        if (e->key.h1 == k->h1 && e->key.h2 == k->h2 && e->key.len == k->len && strcmp(e->key.id, k->id) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void lru_unlink(memo_shard_t *s, memo_entry_t *e) {
+    if (e->prev) e->prev->next = e->next; else s->head = e->next;
+    if (e->next) e->next->prev = e->prev; else s->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push(memo_shard_t *s, memo_entry_t *e) {
+    e->prev = NULL;
+    e->next = s->head;
+    if (s->head) s->head->prev = e; else s->tail = e;
+    s->head = e;
+}
+
+// Locked
+static void remove_entry(memo_shard_t *s, memo_entry_t *e) {
+    memo_entry_t **pp = bucket(s, &e->key);
+    while (*pp != e) pp = &(*pp)->chain;
+    *pp = e->chain;
+    if (e->resp) {
+        lru_unlink(s, e);
+        s->bytes -= e->cost;
+        free(e->resp);
+    }
+    free(e);
+}
+
+char *memo_begin(const memo_key_t *k, int ttl, int *coalesced, memo_ticket_t *t) {
+    int si = (int)(k->h1 % MEMO_SHARDS);
+    memo_shard_t *s = &shards[si];
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += MEMO_WAIT_SEC;
+    *coalesced = 0;
+    t->entry = NULL;
+    t->shard = si;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        memo_entry_t *e = find(s, k);
+        if (!e) {
+            // First one: executes, the identical requests behind it wait
+            e = calloc(1, sizeof(*e));
+            if (!e) {
+                pthread_mutex_unlock(&s->lock);
+                return NULL;
+            }
+            e->key = *k;
+            e->ttl = ttl;
+            memo_entry_t **b = bucket(s, k);
+            e->chain = *b;
+            *b = e;
+            pthread_mutex_unlock(&s->lock);
+            t->entry = e;
+            return NULL;
+        }
+        if (e->resp) {
+            if (time(NULL) >= e->expires) {
+                remove_entry(s, e);
+                continue;
+            }
+            lru_unlink(s, e);
+            lru_push(s, e);
+            char *copy = strdup(e->resp);
+            pthread_mutex_unlock(&s->lock);
+            return copy;
+        }
+        // Pending: woken when any entry of the shard completes, then look
+        // again (if the leader failed, the entry is gone and one of us leads)
+        *coalesced = 1;
+        if (pthread_cond_timedwait(&s->done, &s->lock, &deadline) == ETIMEDOUT) {
+            *coalesced = 0;
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+    }
+}
+
+void memo_finish(memo_ticket_t *t, const char *resp) {
+    memo_entry_t *e = t->entry;
+    if (!e) return;
+    t->entry = NULL;
+    memo_shard_t *s = &shards[t->shard];
+    size_t len = resp ? strlen(resp) : 0;
+    char *copy = resp && len <= MEMO_ENTRY_MAX ? strdup(resp) : NULL;
+
+    pthread_mutex_lock(&s->lock);
+    if (copy && sizeof(*e) + len + 1 <= shard_max) {
+        e->resp = copy;
+        e->cost = sizeof(*e) + len + 1;
+        e->expires = time(NULL) + e->ttl;
+        s->bytes += e->cost;
+        lru_push(s, e);
+        while (s->bytes > shard_max && s->tail != e) remove_entry(s, s->tail);
+    } else {
+        free(copy);
+        remove_entry(s, e);
+    }
+    pthread_cond_broadcast(&s->done);
+    pthread_mutex_unlock(&s->lock);
+}
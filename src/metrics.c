@@ -0,0 +1,519 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define METRICS_SHARDS 16
+#define METRICS_BUCKETS 14        // last one is +Inf
+#define METRICS_FN_NAME 128
+#define METRICS_FD_ENV "FAAS_METRICS_FD"
+
+static const double bucket_bounds[METRICS_BUCKETS - 1] = {
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+};
+
+static const int status_codes[] = { 200, 201, 202, 304, 400, 404, 413, 429, 500, 502, 503, 0 }; // 0 = other
+#define STATUS_COUNT (sizeof(status_codes) / sizeof(status_codes[0]))
+
+static const char *route_names[ROUTE_COUNT] = {
+    "deploy", "invoke", "batch", "map", "alias", "function", "queues", "metrics", "admin", "jobs", "static", "other",
+};
+static const char *outcome_names[INVOKE_OUTCOME_COUNT] = { "ok", "error", "rejected" };
+static const char *memo_names[MEMO_RESULT_COUNT] = { "hit", "miss", "coalesced" };
+static const char *compile_names[COMPILE_STAGE_COUNT] = { "deploy", "module" };
+static const char *state_names[WORKER_STATE_COUNT] = { "dead", "idle", "busy", "compiling" };
+static const char *lane_names[METRICS_LANES] = { "high", "normal" };
+
+typedef struct {
+    atomic_ulong buckets[METRICS_BUCKETS]; // non-cumulative, summed at render
+    atomic_ulong sum_us;
+} metrics_hist_t;
+
+typedef struct {
+    atomic_ulong http[ROUTE_COUNT][STATUS_COUNT];
+    atomic_ulong invokes[METRICS_MAX_FNS][INVOKE_OUTCOME_COUNT];
+    metrics_hist_t invoke_latency[METRICS_MAX_FNS];
+    atomic_ulong fn_cpu_us[METRICS_MAX_FNS];
+    atomic_ulong fn_out_bytes[METRICS_MAX_FNS];
+    atomic_ulong memo[METRICS_MAX_FNS][MEMO_RESULT_COUNT];
+    metrics_hist_t queue_wait;
+    atomic_ulong worker_jobs[METRICS_MAX_WORKERS];
+    atomic_ulong worker_busy_us[METRICS_MAX_WORKERS];
+    atomic_ulong cache_hits;
+    atomic_ulong cache_misses;
+    metrics_hist_t compile[COMPILE_STAGE_COUNT];
+    atomic_ulong spawns;
+    atomic_ulong crashes;
+} __attribute__((aligned(64))) metrics_shard_t;
+
+// One writer each: the worker (state, fn, cached), the server (pid), the
+// LB (draining). fn is guarded by a sequence counter, odd while written.
+typedef struct {
+    atomic_int pid;
+    atomic_int state;
+    atomic_int draining;
+    atomic_int cached;
+    atomic_ulong since_us;     // CLOCK_MONOTONIC, when state was entered
+    atomic_ulong jobs_base;    // slot's job count when this process started
+    atomic_uint fn_seq;
+    char fn[METRICS_FN_NAME];
+} __attribute__((aligned(64))) worker_status_t;
+
+typedef struct {
+    // Function name registry: slot state 0 = free, 1 = being written, 2 = ready
+    atomic_int fn_state[METRICS_MAX_FNS];
+    char fn_name[METRICS_MAX_FNS][METRICS_FN_NAME];
+    atomic_ulong fn_peak_mem[METRICS_MAX_FNS]; // bytes, max over invocations
+    atomic_long queue_depth;
+    atomic_uint next_shard;
+    metrics_shard_t shards[METRICS_SHARDS];
+    worker_status_t workers[METRICS_MAX_WORKERS];
+    atomic_long lane_depth[METRICS_LANES];
+    char strategy[16];
+} metrics_shm_t;
+
+static metrics_shm_t *shm = NULL;
+static _Thread_local int my_shard = -1;
+
+static int map_segment(int fd) {
+    void *p = mmap(NULL, sizeof(metrics_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return -1;
+    shm = p;
+    return 0;
+}
+
+int metrics_init(void) {
+    // Not close-on-exec: workers map it again after execl
+    int fd = memfd_create("faas_metrics", 0);
+    if (fd < 0 || ftruncate(fd, sizeof(metrics_shm_t)) < 0 || map_segment(fd) < 0) {
+        perror("metrics segment");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    char val[16];
+    snprintf(val, sizeof(val), "%d", fd);
+    setenv(METRICS_FD_ENV, val, 1);
+    return 0;
+}
+
+int metrics_attach(void) {
+    const char *env = getenv(METRICS_FD_ENV);
+    if (shm) return 0;
+    if (!env) return -1;
+    return map_segment(atoi(env));
+}
+
+static metrics_shard_t *shard(void) {
+    if (my_shard < 0) {
+        // Spread processes too: worker processes are single-threaded
+        my_shard = (int)((atomic_fetch_add_explicit(&shm->next_shard, 1, memory_order_relaxed) +
+                          (unsigned)getpid()) % METRICS_SHARDS);
+    }
+    return &shm->shards[my_shard];
+}
+
+static inline void add(atomic_ulong *c, unsigned long v) {
+    atomic_fetch_add_explicit(c, v, memory_order_relaxed);
+}
+
+static void hist_observe(metrics_hist_t *h, double seconds) {
+    int b = 0;
+    while (b < METRICS_BUCKETS - 1 && seconds > bucket_bounds[b]) b++;
+    add(&h->buckets[b], 1);
+    add(&h->sum_us, seconds > 0 ? (unsigned long)(seconds * 1e6) : 0);
+}
+
+static unsigned long hash_name(const char *s) {
+    unsigned long h = 5381;
+    while (*s) h = h * 33 + (unsigned char)*s++;
+    return h;
+}
+
+// Slot of fn in the shared registry (open addressing), -1 when full
+static int fn_slot(const char *fn) {
+    unsigned long h = hash_name(fn);
+    for (int i = 0; i < METRICS_MAX_FNS; i++) {
+        int slot = (int)((h + (unsigned long)i) % METRICS_MAX_FNS);
+        int state = atomic_load_explicit(&shm->fn_state[slot], memory_order_acquire);
+        if (state == 0) {
+            int expected = 0;
+            if (atomic_compare_exchange_strong(&shm->fn_state[slot], &expected, 1)) {
+                snprintf(shm->fn_name[slot], METRICS_FN_NAME, "%s", fn);
+                atomic_store_explicit(&shm->fn_state[slot], 2, memory_order_release);
+                return slot;
+            }
+            state = expected;
+        }
+        while (state == 1) state = atomic_load_explicit(&shm->fn_state[slot], memory_order_acquire);
+        if (strncmp(shm->fn_name[slot], fn, METRICS_FN_NAME - 1) == 0) return slot;
+    }
+    return -1;
+}
+
+void metrics_http(metrics_route_t route, int status) {
+    if (!shm) return;
+    size_t s = 0;
+    while (status_codes[s] && status_codes[s] != status) s++;
+    add(&shard()->http[route][s], 1);
+}
+
+void metrics_invoke(const char *fn, metrics_outcome_t outcome, double seconds) {
+    if (!shm) return;
+    int slot = fn_slot(fn);
+    if (slot < 0) return;
+    metrics_shard_t *sh = shard();
+    add(&sh->invokes[slot][outcome], 1);
+    if (outcome != INVOKE_REJECTED) hist_observe(&sh->invoke_latency[slot], seconds);
+}
+
+void metrics_usage(const char *fn, double cpu_seconds, unsigned long out_bytes, unsigned long mem_bytes) {
+    if (!shm) return;
+    int slot = fn_slot(fn);
+    if (slot < 0) return;
+    metrics_shard_t *sh = shard();
+    add(&sh->fn_cpu_us[slot], cpu_seconds > 0 ? (unsigned long)(cpu_seconds * 1e6) : 0);
+    add(&sh->fn_out_bytes[slot], out_bytes);
+    unsigned long peak = atomic_load_explicit(&shm->fn_peak_mem[slot], memory_order_relaxed);
+    while (mem_bytes > peak &&
+           !atomic_compare_exchange_weak_explicit(&shm->fn_peak_mem[slot], &peak, mem_bytes,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void metrics_memo(const char *fn, metrics_memo_t result) {
+    if (!shm) return;
+    int slot = fn_slot(fn);
+    if (slot >= 0) add(&shard()->memo[slot][result], 1);
+}
+
+void metrics_queue_wait(double seconds) {
+    if (shm) hist_observe(&shard()->queue_wait, seconds);
+}
+
+void metrics_queue_depth(long depth) {
+    if (shm) atomic_store_explicit(&shm->queue_depth, depth, memory_order_relaxed);
+}
+
+void metrics_worker_job(int worker, double busy_seconds) {
+    if (!shm || worker < 0 || worker >= METRICS_MAX_WORKERS) return;
+    metrics_shard_t *sh = shard();
+    add(&sh->worker_jobs[worker], 1);
+    add(&sh->worker_busy_us[worker], (unsigned long)(busy_seconds * 1e6));
+}
+
+void metrics_cache(int hit) {
+    if (shm) add(hit ? &shard()->cache_hits : &shard()->cache_misses, 1);
+}
+
+void metrics_compile(metrics_compile_t stage, double seconds) {
+    if (shm) hist_observe(&shard()->compile[stage], seconds);
+}
+
+void metrics_worker_spawn(void) {
+    if (shm) add(&shard()->spawns, 1);
+}
+
+void metrics_worker_crash(void) {
+    if (shm) add(&shard()->crashes, 1);
+}
+
+static unsigned long mono_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000UL + (unsigned long)ts.tv_nsec / 1000;
+}
+
+static worker_status_t *worker_status(int worker) {
+    if (!shm || worker < 0 || worker >= METRICS_MAX_WORKERS) return NULL;
+    return &shm->workers[worker];
+}
+
+// Async-signal-safe (called from SIGCHLD)
+void metrics_worker_pid(int worker, int pid) {
+    worker_status_t *w = worker_status(worker);
+    if (!w) return;
+    if (pid) {
+        unsigned long jobs = 0;
+        for (int i = 0; i < METRICS_SHARDS; i++) {
+            jobs += atomic_load_explicit(&shm->shards[i].worker_jobs[worker], memory_order_relaxed);
+        }
+        atomic_store(&w->jobs_base, jobs);
+    }
+    atomic_store(&w->pid, pid);
+    atomic_store(&w->state, pid ? WORKER_IDLE : WORKER_DEAD);
+    atomic_store(&w->since_us, mono_us());
+}
+
+void metrics_worker_state(int worker, metrics_worker_state_t state, const char *fn) {
+    worker_status_t *w = worker_status(worker);
+    if (!w) return;
+    if (fn) {
+        atomic_fetch_add_explicit(&w->fn_seq, 1, memory_order_acq_rel);
+        snprintf(w->fn, sizeof(w->fn), "%s", fn);
+        atomic_fetch_add_explicit(&w->fn_seq, 1, memory_order_release);
+    }
+    atomic_store(&w->state, state);
+    atomic_store(&w->since_us, mono_us());
+}
+
+void metrics_worker_cached(int worker, int modules) {
+    worker_status_t *w = worker_status(worker);
+    if (w) atomic_store_explicit(&w->cached, modules, memory_order_relaxed);
+}
+
+void metrics_worker_draining(int worker, int draining) {
+    worker_status_t *w = worker_status(worker);
+    if (w) atomic_store(&w->draining, draining);
+}
+
+void metrics_lb_strategy(const char *name) {
+    if (shm) snprintf(shm->strategy, sizeof(shm->strategy), "%s", name);
+}
+
+void metrics_lane_depth(int lane, long depth) {
+    if (shm && lane >= 0 && lane < METRICS_LANES) {
+        atomic_store_explicit(&shm->lane_depth[lane], depth, memory_order_relaxed);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Rendering
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    char *buf;
+    size_t len, cap;
+} out_t;
+
+static void out_printf(out_t *o, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void out_printf(out_t *o, const char *fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (o->len + (size_t)n < o->cap) {
+            o->len += (size_t)n;
+            return;
+        }
+        size_t cap = o->cap * 2 + (size_t)n;
+        char *b = realloc(o->buf, cap);
+        if (!b) return;
+        o->buf = b;
+        o->cap = cap;
+    }
+}
+
+#define SUM_SHARDS(expr) ({ unsigned long s_ = 0; \
+    for (int i_ = 0; i_ < METRICS_SHARDS; i_++) { metrics_shard_t *sh = &shm->shards[i_]; \
+        s_ += atomic_load_explicit(&(expr), memory_order_relaxed); } s_; })
+
+static void render_hist(out_t *o, const char *name, const char *labels, size_t offset) {
+    // offset: position of the histogram inside a shard
+    unsigned long cum = 0, sum_us = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        unsigned long n = 0;
+        for (int i = 0; i < METRICS_SHARDS; i++) {
+            metrics_hist_t *h = (metrics_hist_t *)((char *)&shm->shards[i] + offset);
+            n += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+            if (b == 0) sum_us += atomic_load_explicit(&h->sum_us, memory_order_relaxed);
+        }
+        cum += n;
+        if (b < METRICS_BUCKETS - 1) {
+            out_printf(o, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, labels, labels[0] ? "," : "", bucket_bounds[b], cum);
+        } else {
+            out_printf(o, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, labels[0] ? "," : "", cum);
+        }
+    }
+    out_printf(o, "%s_sum%s%s%s %.6f\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "", sum_us / 1e6);
+    out_printf(o, "%s_count%s%s%s %lu\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "", cum);
+}
+
+char *metrics_render(void) {
+    if (!shm) return NULL;
+    out_t o = { malloc(16384), 0, 16384 };
+    if (!o.buf) return NULL;
+    o.buf[0] = '\0';
+    char labels[METRICS_FN_NAME + 32];
+
+    out_printf(&o, "# HELP faas_http_requests_total HTTP requests by route and status.\n");
+    out_printf(&o, "# TYPE faas_http_requests_total counter\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        for (size_t s = 0; s < STATUS_COUNT; s++) {
+            unsigned long n = SUM_SHARDS(sh->http[r][s]);
+            if (!n) continue;
+            if (status_codes[s]) {
+                out_printf(&o, "faas_http_requests_total{route=\"%s\",status=\"%d\"} %lu\n", route_names[r], status_codes[s], n);
+            } else {
+                out_printf(&o, "faas_http_requests_total{route=\"%s\",status=\"other\"} %lu\n", route_names[r], n);
+            }
+        }
+    }
+
+    out_printf(&o, "# HELP faas_invocations_total Invocations through the load balancer by function and outcome.\n");
+    out_printf(&o, "# TYPE faas_invocations_total counter\n");
+    for (int f = 0; f < METRICS_MAX_FNS; f++) {
+        if (atomic_load(&shm->fn_state[f]) != 2) continue;
+        for (int k = 0; k < INVOKE_OUTCOME_COUNT; k++) {
+            unsigned long n = SUM_SHARDS(sh->invokes[f][k]);
+            if (n) out_printf(&o, "faas_invocations_total{function=\"%s\",outcome=\"%s\"} %lu\n",
+                              shm->fn_name[f], outcome_names[k], n);
+        }
+    }
+    out_printf(&o, "# HELP faas_invoke_duration_seconds Invoke latency seen by the load balancer (queue + execution).\n");
+    out_printf(&o, "# TYPE faas_invoke_duration_seconds histogram\n");
+    for (int f = 0; f < METRICS_MAX_FNS; f++) {
+        if (atomic_load(&shm->fn_state[f]) != 2) continue;
+        snprintf(labels, sizeof(labels), "function=\"%s\"", shm->fn_name[f]);
+        render_hist(&o, "faas_invoke_duration_seconds", labels,
+                    offsetof(metrics_shard_t, invoke_latency) + (size_t)f * sizeof(metrics_hist_t));
+    }
+
+    out_printf(&o, "# HELP faas_function_cpu_seconds_total CPU time of invocations (worker thread plus runtime process).\n");
+    out_printf(&o, "# TYPE faas_function_cpu_seconds_total counter\n");
+    for (int f = 0; f < METRICS_MAX_FNS; f++) {
+        if (atomic_load(&shm->fn_state[f]) != 2) continue;
+        unsigned long us = SUM_SHARDS(sh->fn_cpu_us[f]);
+        if (us) out_printf(&o, "faas_function_cpu_seconds_total{function=\"%s\"} %.6f\n", shm->fn_name[f], us / 1e6);
+    }
+    out_printf(&o, "# HELP faas_function_output_bytes_total Output returned by invocations.\n");
+    out_printf(&o, "# TYPE faas_function_output_bytes_total counter\n");
+    for (int f = 0; f < METRICS_MAX_FNS; f++) {
+        if (atomic_load(&shm->fn_state[f]) != 2) continue;
+        unsigned long n = SUM_SHARDS(sh->fn_out_bytes[f]);
+        if (n) out_printf(&o, "faas_function_output_bytes_total{function=\"%s\"} %lu\n", shm->fn_name[f], n);
+    }
+    out_printf(&o, "# HELP faas_function_peak_memory_bytes Largest runtime RSS or WASM linear memory seen.\n");
+    out_printf(&o, "# TYPE faas_function_peak_memory_bytes gauge\n");
+    for (int f = 0; f < METRICS_MAX_FNS; f++) {
+        if (atomic_load(&shm->fn_state[f]) != 2) continue;
+        unsigned long peak = atomic_load(&shm->fn_peak_mem[f]);
+        if (peak) out_printf(&o, "faas_function_peak_memory_bytes{function=\"%s\"} %lu\n", shm->fn_name[f], peak);
+    }
+
+    out_printf(&o, "# HELP faas_memo_requests_total Gateway result cache lookups (memoized functions).\n");
+    out_printf(&o, "# TYPE faas_memo_requests_total counter\n");
+    for (int f = 0; f < METRICS_MAX_FNS; f++) {
+        if (atomic_load(&shm->fn_state[f]) != 2) continue;
+        for (int k = 0; k < MEMO_RESULT_COUNT; k++) {
+            unsigned long n = SUM_SHARDS(sh->memo[f][k]);
+            if (n) out_printf(&o, "faas_memo_requests_total{function=\"%s\",result=\"%s\"} %lu\n",
+                              shm->fn_name[f], memo_names[k], n);
+        }
+    }
+    out_printf(&o, "# HELP faas_memo_hit_ratio Lookups answered without an execution (hit or coalesced).\n");
+    out_printf(&o, "# TYPE faas_memo_hit_ratio gauge\n");
+    for (int f = 0; f < METRICS_MAX_FNS; f++) {
+        if (atomic_load(&shm->fn_state[f]) != 2) continue;
+        unsigned long hits = SUM_SHARDS(sh->memo[f][MEMO_HIT]) + SUM_SHARDS(sh->memo[f][MEMO_COALESCED]);
+        unsigned long total = hits + SUM_SHARDS(sh->memo[f][MEMO_MISS]);
+        if (total) out_printf(&o, "faas_memo_hit_ratio{function=\"%s\"} %.4f\n", shm->fn_name[f], (double)hits / total);
+    }
+
+    out_printf(&o, "# HELP faas_queue_depth Requests waiting for a worker slot.\n");
+    out_printf(&o, "# TYPE faas_queue_depth gauge\n");
+    out_printf(&o, "faas_queue_depth %ld\n", atomic_load(&shm->queue_depth));
+    out_printf(&o, "# HELP faas_queue_wait_seconds Time spent waiting for a worker slot.\n");
+    out_printf(&o, "# TYPE faas_queue_wait_seconds histogram\n");
+    render_hist(&o, "faas_queue_wait_seconds", "", offsetof(metrics_shard_t, queue_wait));
+
+    out_printf(&o, "# HELP faas_worker_jobs_total Jobs executed per worker.\n");
+    out_printf(&o, "# TYPE faas_worker_jobs_total counter\n");
+    for (int w = 0; w < METRICS_MAX_WORKERS; w++) {
+        unsigned long n = SUM_SHARDS(sh->worker_jobs[w]);
+        if (n) out_printf(&o, "faas_worker_jobs_total{worker=\"%d\"} %lu\n", w, n);
+    }
+    out_printf(&o, "# HELP faas_worker_busy_seconds_total Time each worker spent executing jobs.\n");
+    out_printf(&o, "# TYPE faas_worker_busy_seconds_total counter\n");
+    for (int w = 0; w < METRICS_MAX_WORKERS; w++) {
+        unsigned long us = SUM_SHARDS(sh->worker_busy_us[w]);
+        if (us) out_printf(&o, "faas_worker_busy_seconds_total{worker=\"%d\"} %.6f\n", w, us / 1e6);
+    }
+
+    out_printf(&o, "# HELP faas_module_cache_requests_total Worker module cache lookups.\n");
+    out_printf(&o, "# TYPE faas_module_cache_requests_total counter\n");
+    out_printf(&o, "faas_module_cache_requests_total{result=\"hit\"} %lu\n", SUM_SHARDS(sh->cache_hits));
+    out_printf(&o, "faas_module_cache_requests_total{result=\"miss\"} %lu\n", SUM_SHARDS(sh->cache_misses));
+
+    out_printf(&o, "# HELP faas_compile_duration_seconds Compilation time (deploy: source to WASM, module: WASM in a worker).\n");
+    out_printf(&o, "# TYPE faas_compile_duration_seconds histogram\n");
+    for (int c = 0; c < COMPILE_STAGE_COUNT; c++) {
+        snprintf(labels, sizeof(labels), "stage=\"%s\"", compile_names[c]);
+        render_hist(&o, "faas_compile_duration_seconds", labels,
+                    offsetof(metrics_shard_t, compile) + (size_t)c * sizeof(metrics_hist_t));
+    }
+
+    out_printf(&o, "# HELP faas_worker_spawns_total Worker processes started.\n");
+    out_printf(&o, "# TYPE faas_worker_spawns_total counter\n");
+    out_printf(&o, "faas_worker_spawns_total %lu\n", SUM_SHARDS(sh->spawns));
+    out_printf(&o, "# HELP faas_worker_crashes_total Worker processes that died unexpectedly.\n");
+    out_printf(&o, "# TYPE faas_worker_crashes_total counter\n");
+    out_printf(&o, "faas_worker_crashes_total %lu\n", SUM_SHARDS(sh->crashes));
+    return o.buf;
+}
+
+// Resident set of a process, from /proc (0 if gone)
+static unsigned long rss_kb(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(f);
+    return resident * (unsigned long)(sysconf(_SC_PAGESIZE) / 1024);
+}
+
+char *metrics_status_json(void) {
+    if (!shm) return NULL;
+    out_t o = { malloc(8192), 0, 8192 };
+    if (!o.buf) return NULL;
+    o.buf[0] = '\0';
+    unsigned long now = mono_us();
+
+    out_printf(&o, "{\"strategy\":\"%s\",\"queued\":%ld,\"lanes\":{", shm->strategy[0] ? shm->strategy : "?",
+               atomic_load(&shm->queue_depth));
+    for (int l = 0; l < METRICS_LANES; l++) {
+        out_printf(&o, "%s\"%s\":%ld", l ? "," : "", lane_names[l], atomic_load(&shm->lane_depth[l]));
+    }
+    out_printf(&o, "},\"workers\":[");
+    int first = 1;
+    for (int i = 0; i < METRICS_MAX_WORKERS; i++) {
+        worker_status_t *w = &shm->workers[i];
+        unsigned long jobs = SUM_SHARDS(sh->worker_jobs[i]);
+        unsigned long base = atomic_load(&w->jobs_base);
+        int pid = atomic_load(&w->pid);
+        int state = atomic_load(&w->state);
+        if (!pid && !jobs && state == WORKER_DEAD) continue; // never used
+        if (state < 0 || state >= WORKER_STATE_COUNT) state = WORKER_DEAD;
+
+        char fn[METRICS_FN_NAME] = "";
+        if (state == WORKER_BUSY || state == WORKER_COMPILING) {
+            for (int tries = 0; tries < 8; tries++) {
+                unsigned seq = atomic_load_explicit(&w->fn_seq, memory_order_acquire);
+                if (seq & 1) continue;
+                memcpy(fn, w->fn, sizeof(fn));
+                atomic_thread_fence(memory_order_acquire);
+                if (atomic_load_explicit(&w->fn_seq, memory_order_relaxed) == seq) break;
+                fn[0] = '\0';
+            }
+            fn[sizeof(fn) - 1] = '\0';
+        }
+        unsigned long since = atomic_load(&w->since_us);
+        out_printf(&o, "%s{\"id\":%d,\"pid\":%d,\"state\":\"%s\",\"draining\":%s,\"function\":\"%s\","
+                   "\"state_ms\":%.1f,\"jobs\":%lu,\"cached_modules\":%d,\"rss_kb\":%lu}",
+                   first ? "" : ",", i, pid, state_names[state], atomic_load(&w->draining) ? "true" : "false", fn,
+                   since && now > since ? (now - since) / 1000.0 : 0.0, jobs > base ? jobs - base : 0,
+                   atomic_load(&w->cached), pid ? rss_kb(pid) : 0);
+        first = 0;
+    }
+    out_printf(&o, "]}\n");
+    return o.buf;
+}
@@ -0,0 +1,132 @@
+#include "pipeline.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+// Copy [s, e) without surrounding blanks; -1 if empty or too long
+static int copy_trimmed(const char *s, const char *e, char *out, size_t cap) {
+    while (s < e && isspace((unsigned char)*s)) s++;
+    while (e > s && isspace((unsigned char)e[-1])) e--;
+    if (e == s || (size_t)(e - s) >= cap) return -1;
+    memcpy(out, s, (size_t)(e - s));
+    out[e - s] = '\0';
+    return 0;
+}
+
+static int valid_word(const char *s, const char *extra) {
+    for (; *s; s++) {
+        if (!isalnum((unsigned char)*s) && *s != '_' && *s != '-' && !strchr(extra, *s)) return 0;
+    }
+    return 1;
+}
+
+static int stage_index(const pipeline_t *p, const char *name) {
+    if (strcmp(name, "input") == 0) return PIPELINE_INPUT;
+    for (int i = 0; i < p->nstages; i++) {
+        if (strcmp(p->stages[i].name, name) == 0) return i;
+    }
+    return -2;
+}
+
+int pipeline_parse(const char *spec, pipeline_t *p, char *err, size_t err_len) {
+    memset(p, 0, sizeof(*p));
+    int lineno = 0;
+    for (const char *line = spec; *line;) {
+        const char *eol = strchr(line, '\n');
+        if (!eol) eol = line + strlen(line);
+        const char *hash = memchr(line, '#', (size_t)(eol - line));
+        const char *end = hash ? hash : eol;
+        const char *next = *eol ? eol + 1 : eol;
+        lineno++;
+
+        const char *s = line;
+        while (s < end && isspace((unsigned char)*s)) s++;
+        if (s == end) {
+            line = next;
+            continue;
+        }
+        if (p->nstages == PIPELINE_MAX_STAGES) {
+            snprintf(err, err_len, "more than %d stages", PIPELINE_MAX_STAGES);
+            return -1;
+        }
+        pipeline_stage_t *st = &p->stages[p->nstages];
+
+        const char *eq = memchr(s, '=', (size_t)(end - s));
+        const char *arrow = NULL;
+        for (const char *a = s; a + 1 < end; a++) {
+            if (a[0] == '<' && a[1] == '-') {
+                arrow = a;
+                break;
+            }
+        }
+        if (eq && arrow && arrow < eq) eq = NULL;
+        if (eq) {
+            if (copy_trimmed(s, eq, st->name, sizeof(st->name)) < 0 || !valid_word(st->name, "")) {
+                snprintf(err, err_len, "line %d: bad stage name", lineno);
+                return -1;
+            }
+        } else {
+            snprintf(st->name, sizeof(st->name), "s%d", p->nstages + 1);
+        }
+        if (strcmp(st->name, "input") == 0 || stage_index(p, st->name) >= 0) {
+            snprintf(err, err_len, "line %d: stage %s defined twice", lineno, st->name);
+            return -1;
+        }
+        const char *fs = eq ? eq + 1 : s;
+        if (copy_trimmed(fs, arrow ? arrow : end, st->fn, sizeof(st->fn)) < 0 || !valid_word(st->fn, ":")) {
+            snprintf(err, err_len, "line %d: bad function reference", lineno);
+            return -1;
+        }
+
+        if (arrow) {
+            for (const char *in = arrow + 2; in < end;) {
+                const char *comma = memchr(in, ',', (size_t)(end - in));
+                const char *in_end = comma ? comma : end;
+                char name[PIPELINE_STAGE_NAME];
+                if (copy_trimmed(in, in_end, name, sizeof(name)) < 0) {
+                    snprintf(err, err_len, "line %d: empty input", lineno);
+                    return -1;
+                }
+                int idx = stage_index(p, name);
+                if (idx == -2) {
+                    snprintf(err, err_len, "line %d: unknown input %s (stages can only read earlier ones)",
+                             lineno, name);
+                    return -1;
+                }
+                if (st->ninputs == PIPELINE_MAX_INPUTS) {
+                    snprintf(err, err_len, "line %d: more than %d inputs", lineno, PIPELINE_MAX_INPUTS);
+                    return -1;
+                }
+                st->inputs[st->ninputs++] = idx;
+                in = comma ? comma + 1 : end;
+            }
+        } else {
+            st->inputs[0] = p->nstages - 1; // previous stage, or the payload for the first
+            st->ninputs = 1;
+        }
+        p->nstages++;
+        line = next;
+    }
+    if (p->nstages == 0) {
+        snprintf(err, err_len, "no stages");
+        return -1;
+    }
+    return 0;
+}
+
+size_t pipeline_format(const pipeline_t *p, char *out, size_t cap) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (int i = 0; i < p->nstages && len < cap; i++) {
+        const pipeline_stage_t *st = &p->stages[i];
+        len += (size_t)snprintf(out + len, cap - len, "%s = %s <-", st->name, st->fn);
+        for (int j = 0; j < st->ninputs && len < cap; j++) {
+            int in = st->inputs[j];
+            len += (size_t)snprintf(out + len, cap - len, "%s %s", j ? "," : "",
+                                    in == PIPELINE_INPUT ? "input" : p->stages[in].name);
+        }
+        if (len < cap) len += (size_t)snprintf(out + len, cap - len, "\n");
+    }
+    return len < cap ? len : cap - 1;
+}
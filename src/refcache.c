@@ -0,0 +1,81 @@
+#include "refcache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define REF_SLOTS 256
+
+// Valid for the generation they were resolved in
+typedef struct {
+    char ref[REF_MAX];
+    ref_info_t info;
+    int found;
+    unsigned long gen;       // 0: empty
+} ref_slot_t;
+
+static pthread_mutex_t ref_lock = PTHREAD_MUTEX_INITIALIZER;
+static ref_slot_t ref_slots[REF_SLOTS];
+static unsigned long ref_gen = 1;
+
+void ref_invalidate(void) {
+    pthread_mutex_lock(&ref_lock);
+    ref_gen++;
+    pthread_mutex_unlock(&ref_lock);
+}
+
+static unsigned ref_hash(const char *s) {
+    unsigned h = 2166136261u;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h % REF_SLOTS;
+}
+
+static int resolve(const char *ref, ref_info_t *info) {
+    const char *colon = strchr(ref, ':');
+    int version;
+    char tail;
+    info->pinned = 0;
+    if (colon) {
+        char name[MAX_FUNC_NAME];
+        snprintf(name, sizeof(name), "%.*s", (int)(colon - ref), ref);
+        if (sscanf(colon + 1, "v%d%c", &version, &tail) == 1 && version > 0) {
+            generate_function_id(info->id, sizeof(info->id), name, version);
+            info->pinned = 1;
+        } else if (get_function_alias(name, colon + 1, info->id, sizeof(info->id)) < 0) {
+            return -1;
+        }
+    } else if (get_function_alias(ref, "latest", info->id, sizeof(info->id)) < 0) {
+        // A version ID, or a name stored before aliases were persisted
+        if (function_exists(ref) || find_function_by_name(ref, info->id) < 0) {
+            snprintf(info->id, sizeof(info->id), "%s", ref);
+            info->pinned = 1;
+        }
+    }
+    function_metadata_t meta;
+    if (load_function_metadata(info->id, &meta) < 0) return -1;
+    snprintf(info->lang, sizeof(info->lang), "%s", meta.language);
+    info->memo_ttl = meta.options.memo_ttl;
+    return 0;
+}
+
+int ref_lookup(const char *ref, ref_info_t *info) {
+    if (strlen(ref) >= REF_MAX) return -1;
+    ref_slot_t *s = &ref_slots[ref_hash(ref)];
+    pthread_mutex_lock(&ref_lock);
+    unsigned long gen = ref_gen;
+    int hit = s->gen == gen && strcmp(s->ref, ref) == 0;
+    int found = hit && s->found;
+    if (found) *info = s->info;
+    pthread_mutex_unlock(&ref_lock);
+    if (hit) return found ? 0 : -1;
+
+    found = resolve(ref, info) == 0;
+    // Resolved against the aliases of gen: useless if they moved meanwhile
+    pthread_mutex_lock(&ref_lock);
+    snprintf(s->ref, sizeof(s->ref), "%s", ref);
+    if (found) s->info = *info;
+    s->found = found;
+    s->gen = gen;
+    pthread_mutex_unlock(&ref_lock);
+    return found ? 0 : -1;
+}
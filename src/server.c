@@ -9,25 +9,49 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 #include "ipc.h"
+#include "log.h"
+#include "metrics.h"
+#include "pipeline.h"
 #include "storage.h"
+#include "trace.h"
 
 #define LINE_MAX 8192
 #define MAX_WORKERS 32
-#define WORKER_POOL_SIZE 4  // Pre-fork this many workers at startup
+#define WORKER_POOL_SIZE 4  // Pre-fork this many workers at startup (FAAS_WORKERS overrides)
+
+#define ALIAS_BUCKETS 1024
+#define BATCH_PARALLEL 16   // batch items in flight per batch (FAAS_BATCH_PARALLEL overrides)
+#define BATCH_THREADS_MAX 256
+#define BATCH_RETRIES 5     // LB sheds of one batch item before its 429 reply is kept
 
 typedef struct {
     pid_t pid;
     int pipe_to_worker[2];   // Pipe to send jobs to worker
     int pipe_from_worker[2]; // Pipe to receive results from worker
+    line_reader_t from;      // Buffered reads of pipe_from_worker[0]
     int active;
+    pthread_mutex_t lock;    // One request/response exchange on the pipes at a time
 } worker_info_t;
 
+// Function reference table: "name:alias" / "name:vN" -> version ID
+typedef struct alias_entry {
+    char key[MAX_FUNC_NAME + MAX_ALIAS_NAME + 2];
+    char id[MAX_FUNC_ID];
+    struct alias_entry *next;
+} alias_entry_t;
+
 static worker_info_t workers[MAX_WORKERS];
 static int num_workers = 0;
 static volatile sig_atomic_t running = 1;
 
+static alias_entry_t *alias_table[ALIAS_BUCKETS];
+static pthread_rwlock_t alias_lock = PTHREAD_RWLOCK_INITIALIZER;
+// Moves of "latest" (deploy, alias), table and persisted file together
+static pthread_mutex_t latest_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void sigint_handler(int sig) {
     (void)sig;
     running = 0;
@@ -42,33 +66,212 @@ static void sigchld_handler(int sig) {
         for (int i = 0; i < MAX_WORKERS; i++) {
             if (workers[i].active && workers[i].pid == pid) {
                 fprintf(stderr, "server: worker %d (pid %d) exited with status %d\n", i, pid, WEXITSTATUS(status));
+                if (running) metrics_worker_crash(); // workers only exit on shutdown
                 close(workers[i].pipe_to_worker[1]);
                 close(workers[i].pipe_from_worker[0]);
                 workers[i].active = 0;
                 workers[i].pid = 0;
                 num_workers--;
+                metrics_worker_pid(i, 0);
             }
         }
     }
 }
 
-// Create a worker process via fork()
-static int create_worker(void) {
-    if (num_workers >= MAX_WORKERS) {
-        fprintf(stderr, "server: max workers reached\n");
+static unsigned long hash_str(const char *s) {
+    unsigned long h = 5381;
+    while (*s) h = h * 33 + (unsigned char)*s++;
+    return h;
+}
+
+// Insert or atomically repoint a reference (readers see old or new ID, never partial)
+static void alias_table_set(const char *name, const char *alias, const char *id) {
+    char key[MAX_FUNC_NAME + MAX_ALIAS_NAME + 2];
+    snprintf(key, sizeof(key), "%s:%s", name, alias);
+    unsigned long b = hash_str(key) % ALIAS_BUCKETS;
+
+    pthread_rwlock_wrlock(&alias_lock);
+    alias_entry_t *e = alias_table[b];
+    while (e && strcmp(e->key, key) != 0) e = e->next;
+    if (!e) {
+        e = calloc(1, sizeof(*e));
+        if (!e) {
+            pthread_rwlock_unlock(&alias_lock);
+            return;
+        }
+        snprintf(e->key, sizeof(e->key), "%s", key);
+        e->next = alias_table[b];
+        alias_table[b] = e;
+    }
+    snprintf(e->id, sizeof(e->id), "%s", id);
+    pthread_rwlock_unlock(&alias_lock);
+}
+
+static int alias_table_get(const char *key, char *out_id, size_t len) {
+    unsigned long b = hash_str(key) % ALIAS_BUCKETS;
+    int found = -1;
+    pthread_rwlock_rdlock(&alias_lock);
+    for (alias_entry_t *e = alias_table[b]; e; e = e->next) {
+        if (strcmp(e->key, key) == 0) {
+            snprintf(out_id, len, "%s", e->id);
+            found = 0;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&alias_lock);
+    return found;
+}
+
+// Resolve a function reference to a concrete version ID:
+//   name:alias, name:vN -> table lookup
+//   name                -> name:latest
+//   anything else       -> already a version ID, used as-is
+static int resolve_function_ref(const char *ref, char *out_id, size_t len) {
+    if (strchr(ref, ':')) {
+        return alias_table_get(ref, out_id, len);
+    }
+    char key[MAX_FUNC_NAME + MAX_ALIAS_NAME + 2];
+    snprintf(key, sizeof(key), "%s:latest", ref);
+    if (alias_table_get(key, out_id, len) == 0) return 0;
+    snprintf(out_id, len, "%s", ref);
+    return 0;
+}
+
+typedef struct {
+    char name[MAX_FUNC_NAME];
+    char id[MAX_FUNC_ID];
+    int version;
+} latest_entry_t;
+
+typedef struct {
+    latest_entry_t *items;
+    int count;
+    int cap;
+} latest_list_t;
+
+static void load_version_cb(const function_metadata_t *meta, void *ctx) {
+    latest_list_t *l = ctx;
+    // A build that failed at deploy never got its vN: still unreachable
+    const char *lang = meta->language;
+    if (strcmp(lang, "c") == 0 || strcmp(lang, "rust") == 0 || strcmp(lang, "rs") == 0 || strcmp(lang, "go") == 0) {
+        char wasm_path[512];
+        snprintf(wasm_path, sizeof(wasm_path), "%s/%s/code.wasm", FUNCTIONS_DIR, meta->id);
+        if (access(wasm_path, F_OK) != 0) return;
+    }
+    char alias[MAX_ALIAS_NAME];
+    snprintf(alias, sizeof(alias), "v%d", meta->version);
+    alias_table_set(meta->name, alias, meta->id);
+
+    for (int i = 0; i < l->count; i++) {
+        if (strcmp(l->items[i].name, meta->name) == 0) {
+            if (meta->version > l->items[i].version) {
+                snprintf(l->items[i].id, MAX_FUNC_ID, "%s", meta->id);
+                l->items[i].version = meta->version;
+            }
+            return;
+        }
+    }
+    if (l->count == l->cap) {
+        int ncap = l->cap ? l->cap * 2 : 64;
+        latest_entry_t *n = realloc(l->items, (size_t)ncap * sizeof(*n));
+        if (!n) return;
+        l->items = n;
+        l->cap = ncap;
+    }
+    latest_entry_t *it = &l->items[l->count++];
+    snprintf(it->name, sizeof(it->name), "%s", meta->name);
+    snprintf(it->id, sizeof(it->id), "%s", meta->id);
+    it->version = meta->version;
+}
+
+static void load_alias_cb(const char *name, const char *alias, const char *id, void *ctx) {
+    (void)ctx;
+    alias_table_set(name, alias, id);
+}
+
+// Rebuild the reference table from disk: every version, then persisted aliases
+// (which may pin "latest" to an older version after a rollback).
+static void load_alias_table(void) {
+    latest_list_t latest = {0};
+    scan_functions(load_version_cb, &latest);
+    for (int i = 0; i < latest.count; i++) {
+        alias_table_set(latest.items[i].name, "latest", latest.items[i].id);
+    }
+    free(latest.items);
+    scan_function_aliases(load_alias_cb, NULL);
+    log_info("server: loaded %d function names\n", latest.count);
+}
+
+static int valid_ref_part(const char *s) {
+    if (!*s) return 0;
+    for (; *s; s++) {
+        if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') ||
+              (*s >= '0' && *s <= '9') || *s == '_' || *s == '-')) return 0;
+    }
+    return 1;
+}
+
+// vN references are fixed and cannot be repointed
+static int reserved_alias(const char *alias) {
+    return alias[0] == 'v' && alias[1] >= '0' && alias[1] <= '9';
+}
+
+// Point name:latest at a new version unless a newer one got there first:
+// concurrent deploys finish pre-warming in any order
+static void advance_latest(const char *name, const char *func_id, int version) {
+    char key[MAX_FUNC_NAME + MAX_ALIAS_NAME + 2], cur[MAX_FUNC_ID];
+    function_metadata_t meta;
+    snprintf(key, sizeof(key), "%s:latest", name);
+    pthread_mutex_lock(&latest_lock);
+    if (alias_table_get(key, cur, sizeof(cur)) < 0 || load_function_metadata(cur, &meta) < 0 ||
+        meta.version < version) {
+        alias_table_set(name, "latest", func_id);
+        set_function_alias(name, "latest", func_id);
+    }
+    pthread_mutex_unlock(&latest_lock);
+}
+
+// Send a message to a worker and read its reply; output chunks of a
+// streamed job are passed to relay_fd as they come (see read_reply)
+static ssize_t worker_exchange(int worker_id, const char *msg, int relay_fd, char *resp, size_t resp_len) {
+    worker_info_t *w = &workers[worker_id];
+    pthread_mutex_lock(&w->lock);
+    if (!w->active) {
+        pthread_mutex_unlock(&w->lock);
         return -1;
     }
+    ssize_t rl = -1;
+    if (write_all(w->pipe_to_worker[1], msg, strlen(msg)) >= 0) {
+        rl = read_reply(&w->from, relay_fd, resp, resp_len);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return rl;
+}
 
-    // Find free slot
-    int slot = -1;
+// Load a version into every worker's module cache before it becomes reachable.
+// Returns the workers warmed, -1 if none of the running ones could load it.
+static int prewarm_function(const char *func_id) {
+    char msg[256];
+    snprintf(msg, sizeof(msg), "{\"type\":\"warm\",\"fn\":\"%s\"}\n", func_id);
+
+    int warmed = 0, active = 0;
     for (int i = 0; i < MAX_WORKERS; i++) {
-        if (!workers[i].active) {
-            slot = i;
-            break;
+        if (!workers[i].active) continue;
+        active++;
+        char resp[LINE_MAX];
+        ssize_t rl = worker_exchange(i, msg, -1, resp, sizeof(resp));
+        if (rl > 0 && strstr(resp, "\"ok\":true")) {
+            warmed++;
+        } else {
+            log_warn("[SERVER] ⚠️  Pre-warm of %s failed on worker %d\n", func_id, i);
         }
     }
-    if (slot < 0) return -1;
+    log_info("[SERVER] 🔥 %s pre-warmed on %d worker(s)\n", func_id, warmed);
+    return active > 0 && warmed == 0 ? -1 : warmed;
+}
 
+// Start a worker process in a free slot via fork() and register it with the LB
+static int spawn_worker(int slot) {
     // Create pipes for bidirectional communication
     int pipe_to[2], pipe_from[2];
     if (pipe(pipe_to) < 0 || pipe(pipe_from) < 0) {
@@ -116,10 +319,15 @@ static int create_worker(void) {
     workers[slot].pipe_to_worker[1] = pipe_to[1];
     workers[slot].pipe_from_worker[0] = pipe_from[0];
     workers[slot].pipe_from_worker[1] = -1;
+    line_reader_init(&workers[slot].from, pipe_from[0]);
+    pthread_mutex_lock(&workers[slot].lock);
     workers[slot].active = 1;
+    pthread_mutex_unlock(&workers[slot].lock);
     num_workers++;
+    metrics_worker_spawn();
+    metrics_worker_pid(slot, pid);
 
-    fprintf(stderr, "server: created worker %d (pid %d)\n", slot, pid);
+    log_info("server: created worker %d (pid %d)\n", slot, pid);
     
     // Register worker with Load Balancer
     int lb_fd = create_unix_client_socket(LB_SOCK_PATH);
@@ -130,21 +338,76 @@ static int create_worker(void) {
             slot, pid);
         write_all(lb_fd, reg_msg, strlen(reg_msg));
         close(lb_fd);
-        fprintf(stderr, "server: registered worker %d with load balancer\n", slot);
+        log_info("server: registered worker %d with load balancer\n", slot);
     } else {
-        fprintf(stderr, "server: warning - could not register worker with load balancer\n");
+        log_warn("server: warning - could not register worker with load balancer\n");
     }
 
     return slot;
 }
 
+static int create_worker(void) {
+    if (num_workers >= MAX_WORKERS) {
+        log_error("server: max workers reached\n");
+        return -1;
+    }
+
+    // Find free slot
+    int slot = -1;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (!workers[i].active) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) return -1;
+    return spawn_worker(slot);
+}
+
+// {"type":"recycle","worker_id":N}: replace a worker process by a fresh one.
+// The LB drains it first; a dead slot is simply respawned.
+static void handle_recycle(int client_fd, const char *line) {
+    int slot = -1;
+    sscanf(line, "{\"type\":\"recycle\",\"worker_id\":%d", &slot);
+    if (slot < 0 || slot >= MAX_WORKERS) {
+        const char *resp = "{\"ok\":false,\"error\":\"invalid worker\"}\n";
+        write_all(client_fd, resp, strlen(resp));
+        return;
+    }
+
+    worker_info_t *w = &workers[slot];
+    pid_t old_pid = 0;
+    pthread_mutex_lock(&w->lock); // waits for an exchange still in progress
+    if (w->active) {
+        old_pid = w->pid;
+        w->active = 0; // before the kill: SIGCHLD must not count a crash
+        w->pid = 0;
+        close(w->pipe_to_worker[1]);
+        close(w->pipe_from_worker[0]);
+        num_workers--;
+        kill(old_pid, SIGTERM);
+        metrics_worker_pid(slot, 0);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    char resp[128];
+    if (spawn_worker(slot) < 0) {
+        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"spawn failed\",\"worker\":%d}\n", slot);
+    } else {
+        log_info("[SERVER] ♻️  worker %d recycled (pid %d -> %d)\n", slot, old_pid, w->pid);
+        snprintf(resp, sizeof(resp), "{\"ok\":true,\"worker\":%d,\"old_pid\":%d,\"pid\":%d}\n",
+                 slot, old_pid, w->pid);
+    }
+    write_all(client_fd, resp, strlen(resp));
+}
+
 // Compile code to WASM based on language
 static int compile_to_wasm(const char *func_id, const char *lang, const char *code_path, char *wasm_path, size_t wasm_path_len) {
     snprintf(wasm_path, wasm_path_len, "%s/%s/code.wasm", FUNCTIONS_DIR, func_id);
     
     // Check if already compiled
     if (access(wasm_path, F_OK) == 0) {
-        fprintf(stderr, "[SERVER] WASM already exists: %s\n", wasm_path);
+        log_info("[SERVER] WASM already exists: %s\n", wasm_path);
         return 0;
     }
     
@@ -165,32 +428,63 @@ static int compile_to_wasm(const char *func_id, const char *lang, const char *co
             "tinygo build -target=wasi -o %s %s 2>&1", 
             wasm_path, code_path);
     } else if (strcmp(lang, "python") == 0 || strcmp(lang, "py") == 0) {
-        fprintf(stderr, "[SERVER] Python will be executed with python3 runtime (no WASM)\n");
+        log_info("[SERVER] Python will be executed with python3 runtime (no WASM)\n");
         return 0;
     } else if (strcmp(lang, "js") == 0 || strcmp(lang, "javascript") == 0) {
-        fprintf(stderr, "[SERVER] JavaScript will be executed with node runtime (no WASM)\n");
+        log_info("[SERVER] JavaScript will be executed with node runtime (no WASM)\n");
         return 0;
     } else if (strcmp(lang, "php") == 0) {
-        fprintf(stderr, "[SERVER] PHP will be executed with php runtime (no WASM)\n");
+        log_info("[SERVER] PHP will be executed with php runtime (no WASM)\n");
         return 0;
     } else if (strcmp(lang, "html") == 0) {
-        fprintf(stderr, "[SERVER] HTML stored as static file (no compilation)\n");
+        log_info("[SERVER] HTML stored as static file (no compilation)\n");
         return 0;
     } else {
-        fprintf(stderr, "[SERVER] Unsupported language for WASM: %s\n", lang);
+        log_warn("[SERVER] Unsupported language for WASM: %s\n", lang);
         return -1;
     }
     
-    fprintf(stderr, "[SERVER] 🔨 Compiling %s to WASM...\n", lang);
-    fprintf(stderr, "[SERVER] Command: %s\n", cmd);
+    log_info("[SERVER] 🔨 Compiling %s to WASM...\n", lang);
+    log_debug("[SERVER] Command: %s\n", cmd);
     
+    double t0 = trace_now_us();
     int ret = system(cmd);
+    metrics_compile(COMPILE_DEPLOY, (trace_now_us() - t0) / 1e6);
     if (ret != 0) {
-        fprintf(stderr, "[SERVER] ❌ Compilation failed (exit code %d)\n", ret);
+        log_error("[SERVER] ❌ Compilation failed (exit code %d)\n", ret);
         return -1;
     }
     
-    fprintf(stderr, "[SERVER] ✅ Compilation successful: %s\n", wasm_path);
+    log_info("[SERVER] ✅ Compilation successful: %s\n", wasm_path);
+    return 0;
+}
+
+// Check a pipeline spec and rewrite it with the version ID of every stage
+static int pin_pipeline(char **code, size_t *code_len, char *err, size_t err_len) {
+    pipeline_t p;
+    if (pipeline_parse(*code, &p, err, err_len) < 0) return -1;
+    for (int i = 0; i < p.nstages; i++) {
+        char func_id[MAX_FUNC_ID];
+        function_metadata_t meta;
+        if (resolve_function_ref(p.stages[i].fn, func_id, sizeof(func_id)) < 0 ||
+            load_function_metadata(func_id, &meta) < 0) {
+            snprintf(err, err_len, "stage %s: unknown function %s", p.stages[i].name, p.stages[i].fn);
+            return -1;
+        }
+        if (strcmp(meta.language, "pipeline") == 0) {
+            snprintf(err, err_len, "stage %s: %s is a pipeline (nesting is not supported)", p.stages[i].name, func_id);
+            return -1;
+        }
+        snprintf(p.stages[i].fn, sizeof(p.stages[i].fn), "%s", func_id);
+    }
+    char *pinned = malloc(LINE_MAX);
+    if (!pinned) {
+        snprintf(err, err_len, "malloc failed");
+        return -1;
+    }
+    *code_len = pipeline_format(&p, pinned, LINE_MAX);
+    free(*code);
+    *code = pinned;
     return 0;
 }
 
@@ -216,20 +510,13 @@ static void handle_deploy(int client_fd, const char *line) {
     // Extract code (between quotes, handle escapes)
     const char *code_start = code_p + 8; // Skip "code":"
     const char *code_end = code_start;
-    size_t code_len = 0;
     
-    // Find end of code string (handle escaped quotes)
-    while (*code_end) {
-        if (*code_end == '\\' && *(code_end + 1)) {
-            code_end += 2;
-            code_len += 2;
-        } else if (*code_end == '\"') {
-            break;
-        } else {
-            code_end++;
-            code_len++;
-        }
+    // Find end of code string (skip escaped quotes)
+    while (*code_end && *code_end != '\"') {
+        if (*code_end == '\\' && *(code_end + 1)) code_end++;
+        code_end++;
     }
+    size_t code_len = (size_t)(code_end - code_start);
     
     char *code = (char*)malloc(code_len + 1);
     if (!code) {
@@ -237,46 +524,101 @@ static void handle_deploy(int client_fd, const char *line) {
         write_all(client_fd, resp, strlen(resp));
         return;
     }
+    code_len = json_unescape(code_start, code_len, code, code_len + 1);
     
-    // Unescape code
-    size_t j = 0;
-    for (size_t i = 0; i < code_len; i++) {
-        if (code_start[i] == '\\' && i + 1 < code_len) {
-            char next = code_start[i + 1];
-            if (next == 'n') { code[j++] = '\n'; i++; }
-            else if (next == 'r') { code[j++] = '\r'; i++; }
-            else if (next == 't') { code[j++] = '\t'; i++; }
-            else if (next == '\"') { code[j++] = '\"'; i++; }
-            else if (next == '\\') { code[j++] = '\\'; i++; }
-            else { code[j++] = code_start[i]; }
-        } else {
-            code[j++] = code_start[i];
-        }
-    }
-    code[j] = '\0';
-    code_len = j;
+    log_info("[SERVER] 📥 Deploy request: name=%s, lang=%s, code_len=%zu\n", name, lang, code_len);
     
-    fprintf(stderr, "[SERVER] 📥 Deploy request: name=%s, lang=%s, code_len=%zu\n", name, lang, code_len);
-    
-    // Check if function name already exists
-    if (function_name_exists(name)) {
-        char resp[512];
-        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"function '%s' already exists\"}\n", name);
+    // Optional extra alias to flip along with "latest" (e.g. "stable")
+    char alias[MAX_ALIAS_NAME] = {0};
+    const char *alias_p = strstr(line, "\"alias\":\"");
+    if (alias_p) sscanf(alias_p, "\"alias\":\"%31[^\"]\"", alias);
+
+    if (!valid_ref_part(name) || (alias[0] && (!valid_ref_part(alias) || reserved_alias(alias)))) {
+        const char *resp = "{\"ok\":false,\"error\":\"invalid name or alias (use [A-Za-z0-9_-], not vN)\"}\n";
+        write_all(client_fd, resp, strlen(resp));
+        free(code);
+        return;
+    }
+
+    // Raw uploads come spooled by the gateway: copied from there to disk,
+    // except pipeline specs, which are parsed here
+    int code_fd = body_ref_open(line, "code_ref");
+    if (code_fd == -2) {
+        const char *resp = "{\"ok\":false,\"error\":\"upload unavailable\"}\n";
+        write_all(client_fd, resp, strlen(resp));
+        free(code);
+        return;
+    }
+    if (code_fd >= 0) {
+        const char *clp = strstr(line, "\"code_len\":");
+        if (clp) sscanf(clp, "\"code_len\":%zu", &code_len);
+        log_info("[SERVER] 📥 Spooled upload: %zu bytes\n", code_len);
+    }
+    if (code_fd >= 0 && strcmp(lang, "pipeline") == 0) {
+        char *spec = realloc(code, LINE_MAX);
+        if (spec) code = spec;
+        size_t len = 0;
+        ssize_t r;
+        while (spec && len + 1 < LINE_MAX && (r = read(code_fd, code + len, LINE_MAX - 1 - len)) > 0) len += (size_t)r;
+        code[spec ? len : 0] = '\0';
+        code_len = spec ? len : 0;
+        close(code_fd);
+        code_fd = -1;
+    }
+
+    // Pipelines: stages must exist; they are pinned to their current version
+    char err[256];
+    if (strcmp(lang, "pipeline") == 0 && pin_pipeline(&code, &code_len, err, sizeof(err)) < 0) {
+        char resp[384];
+        char escaped[300];
+        json_escape(err, strlen(err), escaped, sizeof(escaped));
+        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"pipeline: %s\"}\n", escaped);
         write_all(client_fd, resp, strlen(resp));
         free(code);
         return;
     }
     
+    // Scheduling options (all optional)
+    function_options_t opts;
+    function_options_default(&opts);
+    const char *prio_p = strstr(line, "\"priority\":\"");
+    const char *weight_p = strstr(line, "\"weight\":");
+    const char *maxc_p = strstr(line, "\"max_concurrency\":");
+    const char *rate_p = strstr(line, "\"rate_limit\":");
+    const char *burst_p = strstr(line, "\"burst\":");
+    if (prio_p) sscanf(prio_p, "\"priority\":\"%7[^\"]\"", opts.priority);
+    if (weight_p) sscanf(weight_p, "\"weight\":%d", &opts.weight);
+    if (maxc_p) sscanf(maxc_p, "\"max_concurrency\":%d", &opts.max_concurrency);
+    if (rate_p) sscanf(rate_p, "\"rate_limit\":%lf", &opts.rate_limit);
+    if (burst_p) sscanf(burst_p, "\"burst\":%d", &opts.burst);
+    const char *memo_p = strstr(line, "\"memo_ttl\":");
+    if (memo_p) sscanf(memo_p, "\"memo_ttl\":%d", &opts.memo_ttl);
+    if (opts.memo_ttl < 0) opts.memo_ttl = 0;
+    if (strcmp(opts.priority, "high") != 0) snprintf(opts.priority, sizeof(opts.priority), "normal");
+    if (opts.weight <= 0) opts.weight = 1;
+    if (opts.max_concurrency < 0) opts.max_concurrency = 0;
+    if (!(opts.rate_limit > 0)) opts.rate_limit = 0;
+    if (opts.burst <= 0) opts.burst = opts.rate_limit >= 1 ? (int)opts.rate_limit : 1;
+
+    // Phase timings returned to the client: store, compile, pre-warm
+    double t_start = trace_now_us();
+
+    // Redeploying an existing name creates a new version
+    int version = reserve_function_version(name);
+
     // Store function
     char func_id[MAX_FUNC_ID];
-    if (store_function(name, lang, code, code_len, func_id) < 0) {
+    int stored = version < 0 ? -1 : code_fd >= 0 ? store_function_fd(name, lang, code_fd, code_len, version, &opts, func_id)
+                              : store_function(name, lang, code, code_len, version, &opts, func_id);
+    if (code_fd >= 0) close(code_fd);
+    if (stored < 0) {
         const char *resp = "{\"ok\":false,\"error\":\"failed to store function\"}\n";
         write_all(client_fd, resp, strlen(resp));
         free(code);
         return;
     }
     
-    fprintf(stderr, "[SERVER] 💾 Function stored: %s\n", func_id);
+    log_info("[SERVER] 💾 Function stored: %s\n", func_id);
     
     // Compile to WASM if applicable
     char code_path[512];
@@ -286,28 +628,326 @@ static void handle_deploy(int client_fd, const char *line) {
                       (strcmp(lang, "rust") == 0 || strcmp(lang, "rs") == 0) ? "rs" :
                       (strcmp(lang, "go") == 0) ? "go" :
                       (strcmp(lang, "php") == 0) ? "php" :
-                      (strcmp(lang, "html") == 0) ? "html" : "txt";
+                      (strcmp(lang, "html") == 0) ? "html" :
+                      (strcmp(lang, "pipeline") == 0) ? "pipeline" : "txt";
     snprintf(code_path, sizeof(code_path), "%s/%s/code.%s", FUNCTIONS_DIR, func_id, ext);
     
     char wasm_path[512];
+    double t_stored = trace_now_us();
     int compile_result = compile_to_wasm(func_id, lang, code_path, wasm_path, sizeof(wasm_path));
+    double t_compiled = trace_now_us();
     
-    // Return success with function ID
+    int is_wasm = (compile_result == 0 && access(wasm_path, F_OK) == 0);
+    int needs_wasm = strcmp(lang, "c") == 0 || strcmp(lang, "rust") == 0 ||
+                     strcmp(lang, "rs") == 0 || strcmp(lang, "go") == 0;
+
     char resp[512];
-    if (compile_result == 0 && access(wasm_path, F_OK) == 0) {
-        snprintf(resp, sizeof(resp), 
-            "{\"ok\":true,\"id\":\"%s\",\"name\":\"%s\",\"lang\":\"%s\",\"wasm\":true}\n", 
-            func_id, name, lang);
-    } else {
-        snprintf(resp, sizeof(resp), 
-            "{\"ok\":true,\"id\":\"%s\",\"name\":\"%s\",\"lang\":\"%s\",\"wasm\":false}\n", 
-            func_id, name, lang);
+    if (needs_wasm && !is_wasm) {
+        // Keep aliases on the previous version: never route traffic to a broken build
+        snprintf(resp, sizeof(resp),
+            "{\"ok\":false,\"error\":\"compilation failed\",\"id\":\"%s\",\"version\":%d,"
+            "\"timing\":{\"store_ms\":%.3f,\"compile_ms\":%.3f}}\n",
+            func_id, version, (t_stored - t_start) / 1000.0, (t_compiled - t_stored) / 1000.0);
+        write_all(client_fd, resp, strlen(resp));
+        free(code);
+        return;
+    }
+
+    // Compile done: pre-warm every worker, then publish vN and flip aliases
+    int warmed = prewarm_function(func_id);
+    double t_warmed = trace_now_us();
+    if (warmed < 0) {
+        // Never published: gone, so that a restart does not publish it either
+        if (remove_function_version(func_id) < 0) log_warn("[SERVER] ⚠️  Could not remove %s\n", func_id);
+        snprintf(resp, sizeof(resp),
+            "{\"ok\":false,\"error\":\"pre-warm failed\",\"id\":\"%s\",\"version\":%d}\n", func_id, version);
+        write_all(client_fd, resp, strlen(resp));
+        free(code);
+        return;
+    }
+    char vname[MAX_ALIAS_NAME];
+    snprintf(vname, sizeof(vname), "v%d", version);
+    alias_table_set(name, vname, func_id);
+    advance_latest(name, func_id, version);
+    if (alias[0]) {
+        alias_table_set(name, alias, func_id);
+        set_function_alias(name, alias, func_id);
     }
     
+    // Return success with function ID
+    snprintf(resp, sizeof(resp), 
+        "{\"ok\":true,\"id\":\"%s\",\"name\":\"%s\",\"lang\":\"%s\",\"version\":%d,\"wasm\":%s,\"warmed\":%d,"
+        "\"timing\":{\"store_ms\":%.3f,\"compile_ms\":%.3f,\"warm_ms\":%.3f}}\n",
+        func_id, name, lang, version, is_wasm ? "true" : "false", warmed,
+        (t_stored - t_start) / 1000.0, (t_compiled - t_stored) / 1000.0, (t_warmed - t_compiled) / 1000.0);
+    
     write_all(client_fd, resp, strlen(resp));
     free(code);
 }
 
+// Handle alias request: point name:alias at an existing version (pre-warmed first)
+static void handle_alias(int client_fd, const char *line) {
+    // Parse: {"type":"alias","name":"xxx","alias":"stable","version":2}
+    char name[MAX_FUNC_NAME] = {0};
+    char alias[MAX_ALIAS_NAME] = {0};
+    int version = 0;
+
+    const char *name_p = strstr(line, "\"name\":\"");
+    const char *alias_p = strstr(line, "\"alias\":\"");
+    const char *version_p = strstr(line, "\"version\":");
+    if (name_p) sscanf(name_p, "\"name\":\"%63[^\"]\"", name);
+    if (alias_p) sscanf(alias_p, "\"alias\":\"%31[^\"]\"", alias);
+    if (version_p) sscanf(version_p, "\"version\":%d", &version);
+
+    if (!valid_ref_part(name) || !valid_ref_part(alias) || reserved_alias(alias) || version <= 0) {
+        const char *resp = "{\"ok\":false,\"error\":\"need name, alias (not vN) and version\"}\n";
+        write_all(client_fd, resp, strlen(resp));
+        return;
+    }
+
+    char key[MAX_FUNC_NAME + MAX_ALIAS_NAME + 2];
+    char func_id[MAX_FUNC_ID];
+    snprintf(key, sizeof(key), "%s:v%d", name, version);
+    if (alias_table_get(key, func_id, sizeof(func_id)) < 0) {
+        char resp[256];
+        snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"unknown version %s\"}\n", key);
+        write_all(client_fd, resp, strlen(resp));
+        return;
+    }
+
+    int warmed = prewarm_function(func_id);
+    int is_latest = strcmp(alias, "latest") == 0;
+    if (is_latest) pthread_mutex_lock(&latest_lock);
+    alias_table_set(name, alias, func_id);
+    if (set_function_alias(name, alias, func_id) < 0) {
+        log_warn("[SERVER] ⚠️  Alias %s:%s not persisted\n", name, alias);
+    }
+    if (is_latest) pthread_mutex_unlock(&latest_lock);
+    log_info("[SERVER] 🔀 %s:%s -> %s\n", name, alias, func_id);
+
+    char resp[512];
+    snprintf(resp, sizeof(resp),
+        "{\"ok\":true,\"name\":\"%s\",\"alias\":\"%s\",\"id\":\"%s\",\"version\":%d,\"warmed\":%d}\n",
+        name, alias, func_id, version, warmed);
+    write_all(client_fd, resp, strlen(resp));
+}
+
+// Pass an invoke line through the Load Balancer; resp gets its reply line,
+// output chunks of a streamed invoke go to relay_fd.
+// Resolve name / name:alias to a version ID first so everything downstream
+// (LB, workers) only ever sees concrete, already-warm versions.
+static void invoke_via_lb(char *line, size_t line_cap, int relay_fd, char *resp, size_t resp_cap, double recv_us) {
+    const char *fnp = strstr(line, "\"fn\":\"");
+    if (fnp) {
+        const char *ref_start = fnp + 6;
+        const char *ref_end = strchr(ref_start, '\"');
+        char ref[MAX_FUNC_NAME + MAX_ALIAS_NAME + 2] = {0};
+        char func_id[MAX_FUNC_ID];
+        if (ref_end && (size_t)(ref_end - ref_start) < sizeof(ref)) {
+            memcpy(ref, ref_start, (size_t)(ref_end - ref_start));
+            if (resolve_function_ref(ref, func_id, sizeof(func_id)) < 0) {
+                snprintf(resp, resp_cap, "{\"ok\":false,\"error\":\"unknown function %s\"}\n", ref);
+                return;
+            }
+            if (strcmp(ref, func_id) != 0) {
+                char resolved[LINE_MAX];
+                snprintf(resolved, sizeof(resolved), "%.*s%s%s",
+                         (int)(ref_start - line), line, func_id, ref_end);
+                snprintf(line, line_cap, "%s", resolved);
+            }
+        }
+    }
+    log_debug("[SERVER] 🔄 Forwarding to Load Balancer: %s", line);
+
+    int lb_fd = create_unix_client_socket(LB_SOCK_PATH);
+    if (lb_fd < 0) {
+        log_sampled(LOG_LEVEL_ERROR, "[SERVER] ❌ Load Balancer unavailable\n");
+        snprintf(resp, resp_cap, "{\"ok\":false,\"error\":\"load balancer unavailable\"}\n");
+        return;
+    }
+
+    log_debug("[SERVER] 📤 Sending to LB: %s", line);
+    write_all(lb_fd, line, strlen(line));
+
+    log_debug("[SERVER] ⏳ Waiting for response from LB...\n");
+    line_reader_t reader;
+    line_reader_init(&reader, lb_fd);
+    ssize_t rl = read_reply(&reader, relay_fd, resp, resp_cap);
+    if (rl <= 0) {
+        log_sampled(LOG_LEVEL_WARN, "[SERVER] ❌ LB timeout (no response)\n");
+        snprintf(resp, resp_cap, "{\"ok\":false,\"error\":\"lb timeout\"}\n");
+    } else {
+        log_debug("[SERVER] ✅ Received response from LB: %s", resp);
+        if (trace_requested(line)) {
+            trace_append(resp, resp_cap, TRACE_SRV_RECV, recv_us);
+            trace_append(resp, resp_cap, TRACE_SRV_DONE, trace_now_us());
+        }
+    }
+    close(lb_fd);
+}
+
+// Batch from the gateway: {"type":"batch","count":N,...} then N invoke lines
+// on the same connection (POST /invoke/batch and POST /map). Items go
+// through the LB (its queues and admission apply to each), `parallel`
+// threads at a time, each taking `chunk` consecutive items. An item the LB
+// sheds is tried again after its retry_after; one that fails otherwise up to
+// `retries` more times. Replies are written back as {"index":i,"result":...}
+// lines, in completion order or, with "ordered":1, in input order (results
+// held for a window of items past the oldest missing one), then
+// {"done":true,...}.
+typedef struct {
+    int client_fd;
+    int count;
+    char **lines;
+    int chunk, retries, ordered, window;
+    pthread_mutex_t lock;        // everything below, and writes to client_fd
+    pthread_cond_t progress;     // emitted moved (ordered)
+    int next_chunk;
+    char **results;              // ordered: replies waiting for their turn
+    int emitted;
+    int failed, retried;
+} batch_t;
+
+// One item through the LB, retried as above; returns the extra attempts
+static int invoke_item(const char *item, char *resp, size_t resp_cap, int retries) {
+    char line[LINE_MAX];
+    int sheds = 0, failures = 0;
+    for (;;) {
+        snprintf(line, sizeof(line), "%s", item); // invoke_via_lb rewrites the fn ref
+        invoke_via_lb(line, sizeof(line), -1, resp, resp_cap, trace_now_us());
+        const char *ra = strstr(resp, "\"retry_after\":");
+        if (ra && (strstr(resp, "\"error\":\"overloaded\"") || strstr(resp, "\"error\":\"rate_limited\""))) {
+            if (sheds++ >= BATCH_RETRIES) break;
+            int retry_after = 1;
+            sscanf(ra, "\"retry_after\":%d", &retry_after);
+            sleep(retry_after > 0 && retry_after <= 5 ? (unsigned)retry_after : 1);
+        } else if (!strstr(resp, "\"ok\":true") && failures < retries) {
+            failures++;
+        } else {
+            break;
+        }
+    }
+    return sheds + failures;
+}
+
+static void batch_reply(batch_t *b, int i, const char *resp, int extra_attempts) {
+    char out[LINE_MAX + 32];
+    int m = snprintf(out, sizeof(out), "{\"index\":%d,\"result\":%s}\n", i, resp);
+    if (m >= (int)sizeof(out)) m = (int)sizeof(out) - 1;
+    pthread_mutex_lock(&b->lock);
+    if (!strstr(resp, "\"ok\":true")) b->failed++;
+    b->retried += extra_attempts;
+    if (!b->ordered) {
+        write_all(b->client_fd, out, (size_t)m);
+    } else {
+        b->results[i] = strndup(out, (size_t)m);
+        if (!b->results[i]) b->results[i] = strdup("{\"index\":-1}\n");
+        int before = b->emitted;
+        while (b->emitted < b->count && b->results[b->emitted]) {
+            write_all(b->client_fd, b->results[b->emitted], strlen(b->results[b->emitted]));
+            free(b->results[b->emitted]);
+            b->results[b->emitted++] = NULL;
+        }
+        if (b->emitted != before) pthread_cond_broadcast(&b->progress);
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+static void *batch_thread(void *arg) {
+    batch_t *b = arg;
+    char resp[LINE_MAX];
+    for (;;) {
+        pthread_mutex_lock(&b->lock);
+        int first = b->next_chunk++ * b->chunk;
+        // Ordered: don't run too far ahead of the oldest missing reply
+        while (b->ordered && first < b->count && first >= b->emitted + b->window) {
+            pthread_cond_wait(&b->progress, &b->lock);
+        }
+        pthread_mutex_unlock(&b->lock);
+        if (first >= b->count) break;
+        int last = first + b->chunk < b->count ? first + b->chunk : b->count;
+        for (int i = first; i < last; i++) {
+            int extra = invoke_item(b->lines[i], resp, sizeof(resp), b->retries);
+            trim_newline(resp);
+            batch_reply(b, i, resp, extra);
+        }
+    }
+    return NULL;
+}
+
+static int batch_opt(const char *header, const char *key, int def) {
+    const char *p = strstr(header, key);
+    int v = def;
+    if (p) sscanf(p + strlen(key), "%d", &v);
+    return v;
+}
+
+static void handle_batch(int client_fd, const char *header) {
+    int count = batch_opt(header, "\"count\":", 0);
+    if (count <= 0 || count > MAP_MAX) {
+        const char *resp = "{\"ok\":false,\"error\":\"bad batch count\"}\n";
+        write_all(client_fd, resp, strlen(resp));
+        return;
+    }
+
+    batch_t b = { .client_fd = client_fd, .count = 0 };
+    b.lines = calloc((size_t)count, sizeof(char *));
+    if (!b.lines) return;
+    line_reader_t rd;
+    line_reader_init(&rd, client_fd);
+    char line[LINE_MAX];
+    while (b.count < count && line_reader_next(&rd, line, sizeof(line)) > 0) {
+        if (!(b.lines[b.count] = strdup(line))) break;
+        b.count++;
+    }
+
+    // Default: BATCH_PARALLEL (FAAS_BATCH_PARALLEL), or two per worker for a map
+    int parallel = BATCH_PARALLEL;
+    const char *env = getenv("FAAS_BATCH_PARALLEL");
+    if (env && atoi(env) > 0) parallel = atoi(env);
+    b.ordered = batch_opt(header, "\"ordered\":", 0);
+    if (b.ordered) parallel = 2 * (num_workers > 0 ? num_workers : 1);
+    parallel = batch_opt(header, "\"parallel\":", parallel);
+    if (parallel < 1) parallel = 1;
+    if (parallel > BATCH_THREADS_MAX) parallel = BATCH_THREADS_MAX;
+    if (parallel > b.count) parallel = b.count > 0 ? b.count : 1;
+    b.chunk = batch_opt(header, "\"chunk\":", 0);
+    if (b.chunk < 1) {
+        b.chunk = b.count / parallel;
+        if (b.chunk > 16) b.chunk = 16;
+        if (b.chunk < 1) b.chunk = 1;
+    }
+    b.retries = batch_opt(header, "\"retries\":", 0);
+    if (b.retries < 0) b.retries = 0;
+    if (b.retries > BATCH_RETRIES) b.retries = BATCH_RETRIES;
+    b.window = 4 * parallel * b.chunk;
+    if (b.ordered && !(b.results = calloc((size_t)b.count, sizeof(char *)))) b.ordered = 0;
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.progress, NULL);
+    log_debug("[SERVER] 📦 Batch of %d invokes, %d threads, chunks of %d%s\n", b.count, parallel, b.chunk,
+              b.ordered ? ", ordered" : "");
+
+    double t0 = trace_now_us();
+    pthread_t tids[BATCH_THREADS_MAX];
+    int started = 0;
+    for (int i = 0; i < parallel; i++) {
+        if (pthread_create(&tids[started], NULL, batch_thread, &b) == 0) started++;
+    }
+    if (started == 0) batch_thread(&b);
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+
+    char done[160];
+    int m = snprintf(done, sizeof(done), "{\"done\":true,\"count\":%d,\"failed\":%d,\"retried\":%d,\"ms\":%.1f}\n",
+                     b.count, b.failed + count - b.count, b.retried, (trace_now_us() - t0) / 1000.0);
+    write_all(client_fd, done, (size_t)m);
+
+    pthread_cond_destroy(&b.progress);
+    pthread_mutex_destroy(&b.lock);
+    for (int i = 0; i < b.count; i++) free(b.lines[i]);
+    free(b.lines);
+    free(b.results);
+}
+
 static void handle_request(int client_fd) {
     char line[LINE_MAX];
     ssize_t n = read_line(client_fd, line, sizeof(line));
@@ -315,6 +955,7 @@ static void handle_request(int client_fd) {
         close(client_fd);
         return;
     }
+    double recv_us = trace_now_us();
 
     // Check if this is a deploy request from API Gateway
     if (strstr(line, "\"type\":\"deploy\"")) {
@@ -323,15 +964,27 @@ static void handle_request(int client_fd) {
         return;
     }
 
+    if (strstr(line, "\"type\":\"alias\"")) {
+        handle_alias(client_fd, line);
+        close(client_fd);
+        return;
+    }
+
+    if (strstr(line, "\"type\":\"recycle\"")) {
+        handle_recycle(client_fd, line);
+        close(client_fd);
+        return;
+    }
+
     // Check if this is a forward_to_worker request from LB
     if (strstr(line, "\"type\":\"forward_to_worker\"")) {
-        fprintf(stderr, "[SERVER] 📨 Received forward_to_worker from LB: %s", line);
+        log_debug("[SERVER] 📨 Received forward_to_worker from LB: %s", line);
         
         // Extract worker_id and job
         int worker_id = -1;
         const char *job_start = strstr(line, "\"job\":");
         if (!job_start) {
-            fprintf(stderr, "[SERVER] ❌ Invalid forward request (no job field)\n");
+            log_sampled(LOG_LEVEL_WARN, "[SERVER] ❌ Invalid forward request (no job field)\n");
             const char *resp = "{\"ok\":false,\"error\":\"invalid forward request\"}\n";
             write_all(client_fd, resp, strlen(resp));
             close(client_fd);
@@ -339,10 +992,10 @@ static void handle_request(int client_fd) {
         }
         
         sscanf(line, "{\"type\":\"forward_to_worker\",\"worker_id\":%d", &worker_id);
-        fprintf(stderr, "[SERVER] 🎯 Target worker: %d\n", worker_id);
+        log_debug("[SERVER] 🎯 Target worker: %d\n", worker_id);
         
         if (worker_id < 0 || worker_id >= MAX_WORKERS || !workers[worker_id].active) {
-            fprintf(stderr, "[SERVER] ❌ Invalid worker %d (active=%d)\n", worker_id, 
+            log_sampled(LOG_LEVEL_WARN, "[SERVER] ❌ Invalid worker %d (active=%d)\n", worker_id, 
                     (worker_id >= 0 && worker_id < MAX_WORKERS) ? workers[worker_id].active : -1);
             const char *resp = "{\"ok\":false,\"error\":\"invalid worker\"}\n";
             write_all(client_fd, resp, strlen(resp));
@@ -354,64 +1007,41 @@ static void handle_request(int client_fd) {
         job_start += 6; // Skip "job":
         while (*job_start == ' ') job_start++;
         
-        fprintf(stderr, "[SERVER] 📤 Sending job to worker %d via pipe: %s", worker_id, job_start);
-        
-        // Send job to worker via pipe
-        write_all(workers[worker_id].pipe_to_worker[1], job_start, strlen(job_start));
+        log_debug("[SERVER] 📤 Sending job to worker %d via pipe: %s", worker_id, job_start);
         
-        fprintf(stderr, "[SERVER] ⏳ Waiting for response from worker %d...\n", worker_id);
-        
-        // Read response from worker
+        // Send job to worker via pipe and read its response
         char resp[LINE_MAX];
-        ssize_t rl = read_line(workers[worker_id].pipe_from_worker[0], resp, sizeof(resp));
+        ssize_t rl = worker_exchange(worker_id, job_start, client_fd, resp, sizeof(resp));
         if (rl <= 0) {
-            fprintf(stderr, "[SERVER] ❌ Worker %d timeout (no response)\n", worker_id);
+            log_sampled(LOG_LEVEL_WARN, "[SERVER] ❌ Worker %d timeout (no response)\n", worker_id);
             const char *err = "{\"ok\":false,\"error\":\"worker timeout\"}\n";
             write_all(client_fd, err, strlen(err));
         } else {
-            fprintf(stderr, "[SERVER] ✅ Received response from worker %d: %s", worker_id, resp);
-            write_all(client_fd, resp, (size_t)rl);
+            log_debug("[SERVER] ✅ Received response from worker %d: %s", worker_id, resp);
+            if (trace_requested(job_start)) {
+                trace_append(resp, sizeof(resp), TRACE_FWD_RECV, recv_us);
+                trace_append(resp, sizeof(resp), TRACE_FWD_DONE, trace_now_us());
+            }
+            write_all(client_fd, resp, strlen(resp));
         }
         
         close(client_fd);
-        fprintf(stderr, "[SERVER] 🏁 forward_to_worker completed\n");
+        log_debug("[SERVER] 🏁 forward_to_worker completed\n");
         return;
     }
 
-    // Otherwise, forward request to Load Balancer (for invoke requests)
-    fprintf(stderr, "[SERVER] 🔄 Forwarding to Load Balancer: %s", line);
-    
-    int lb_fd = create_unix_client_socket(LB_SOCK_PATH);
-    if (lb_fd < 0) {
-        fprintf(stderr, "[SERVER] ❌ Load Balancer unavailable\n");
-        const char *resp = "{\"ok\":false,\"error\":\"load balancer unavailable\"}\n";
-        write_all(client_fd, resp, strlen(resp));
+    if (strstr(line, "\"type\":\"batch\"")) {
+        handle_batch(client_fd, line);
         close(client_fd);
         return;
     }
 
-    fprintf(stderr, "[SERVER] ✅ Connected to Load Balancer\n");
-
-    // Send request to LB
-    fprintf(stderr, "[SERVER] 📤 Sending to LB: %s", line);
-    write_all(lb_fd, line, strlen(line));
-
-    // Read response from LB
-    fprintf(stderr, "[SERVER] ⏳ Waiting for response from LB...\n");
+    // Otherwise, forward request to Load Balancer (for invoke requests)
     char resp[LINE_MAX];
-    ssize_t rl = read_line(lb_fd, resp, sizeof(resp));
-    if (rl <= 0) {
-        fprintf(stderr, "[SERVER] ❌ LB timeout (no response)\n");
-        const char *err = "{\"ok\":false,\"error\":\"lb timeout\"}\n";
-        write_all(client_fd, err, strlen(err));
-    } else {
-        fprintf(stderr, "[SERVER] ✅ Received response from LB: %s", resp);
-        write_all(client_fd, resp, (size_t)rl);
-    }
-
-    close(lb_fd);
+    invoke_via_lb(line, sizeof(line), client_fd, resp, sizeof(resp), recv_us);
+    write_all(client_fd, resp, strlen(resp));
     close(client_fd);
-    fprintf(stderr, "[SERVER] 🏁 Request completed\n");
+    log_debug("[SERVER] 🏁 Request completed\n");
 }
 
 // Thread wrapper for handle_request
@@ -424,27 +1054,37 @@ static void* handle_request_thread(void *arg) {
 
 int server_main(void) {
     signal(SIGINT, sigint_handler);
+    signal(SIGPIPE, SIG_IGN); // a client gone mid-stream is a write error
     signal(SIGCHLD, sigchld_handler);
 
     // Initialize workers array
     for (int i = 0; i < MAX_WORKERS; i++) {
         workers[i].active = 0;
         workers[i].pid = 0;
+        pthread_mutex_init(&workers[i].lock, NULL);
+    }
+
+    load_alias_table();
+
+    int pool_size = WORKER_POOL_SIZE;
+    const char *pool_env = getenv("FAAS_WORKERS");
+    if (pool_env && atoi(pool_env) > 0) {
+        pool_size = atoi(pool_env) < MAX_WORKERS ? atoi(pool_env) : MAX_WORKERS;
     }
 
     int sfd = create_unix_server_socket(SERVER_SOCK_PATH);
-    fprintf(stderr, "server: listening on %s\n", SERVER_SOCK_PATH);
-    fprintf(stderr, "server: pre-forking %d workers...\n", WORKER_POOL_SIZE);
+    log_info("server: listening on %s\n", SERVER_SOCK_PATH);
+    log_info("server: pre-forking %d workers...\n", pool_size);
 
     // Pre-fork worker pool
-    for (int i = 0; i < WORKER_POOL_SIZE; i++) {
+    for (int i = 0; i < pool_size; i++) {
         if (create_worker() < 0) {
-            fprintf(stderr, "server: failed to create worker %d\n", i);
+            log_error("server: failed to create worker %d\n", i);
         }
         usleep(50000); // 50ms delay between worker creation
     }
 
-    fprintf(stderr, "server: %d workers ready, forwarding requests to load balancer\n", num_workers);
+    log_info("server: %d workers ready, forwarding requests to load balancer\n", num_workers);
 
     while (running) {
         fd_set rfds;
@@ -482,7 +1122,7 @@ int server_main(void) {
     }
 
     // Cleanup: kill all workers
-    fprintf(stderr, "server: shutting down, killing %d workers...\n", num_workers);
+    log_info("server: shutting down, killing %d workers...\n", num_workers);
     for (int i = 0; i < MAX_WORKERS; i++) {
         if (workers[i].active) {
             kill(workers[i].pid, SIGTERM);
@@ -492,6 +1132,6 @@ int server_main(void) {
     }
     
     unlink(SERVER_SOCK_PATH);
-    fprintf(stderr, "server: shutdown complete\n");
+    log_info("server: shutdown complete\n");
     return 0;
 }
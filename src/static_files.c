@@ -0,0 +1,131 @@
+#include "static_files.h"
+#include "refcache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char id[MAX_FUNC_ID];
+    char *data;              // NULL: free entry
+    size_t size;
+    time_t mtime;
+    int refs;                // requests sending it; evicted only at 0
+    unsigned long last_used;
+} file_entry_t;
+
+static pthread_mutex_t static_lock = PTHREAD_MUTEX_INITIALIZER;
+static file_entry_t files[STATIC_CACHE_ENTRIES];
+static size_t cache_bytes = 0, cache_max = STATIC_CACHE_BYTES;
+static unsigned long cache_clock = 0;
+
+void static_init(size_t max_bytes) {
+    if (max_bytes) cache_max = max_bytes;
+}
+
+// Room for size more bytes: least recently used idle entries go first.
+// Returns a free entry, or NULL if everything left is being sent. Locked.
+static file_entry_t *make_room(size_t size) {
+    for (;;) {
+        file_entry_t *free_e = NULL, *victim = NULL;
+        for (int i = 0; i < STATIC_CACHE_ENTRIES; i++) {
+            file_entry_t *e = &files[i];
+            if (!e->data) {
+                if (!free_e) free_e = e;
+            } else if (e->refs == 0 && (!victim || e->last_used < victim->last_used)) {
+                victim = e;
+            }
+        }
+        if (free_e && cache_bytes + size <= cache_max) return free_e;
+        if (!victim) return NULL;
+        munmap(victim->data, victim->size);
+        cache_bytes -= victim->size;
+        victim->data = NULL;
+    }
+}
+
+static void fill(static_file_t *f, const char *id, size_t size, time_t mtime, int pinned) {
+    snprintf(f->id, sizeof(f->id), "%s", id);
+    f->size = size;
+    f->mtime = mtime;
+    f->pinned = pinned;
+    snprintf(f->etag, sizeof(f->etag), "\"%s-%lx\"", id, (unsigned long)mtime);
+}
+
+int static_open(const char *ref, static_file_t *f) {
+    ref_info_t info;
+    f->data = NULL;
+    f->fd = -1;
+    f->slot = -1;
+    if (ref_lookup(ref, &info) < 0 || strcmp(info.lang, "html") != 0) return 0;
+    const char *id = info.id;
+    int pinned = info.pinned;
+
+    pthread_mutex_lock(&static_lock);
+    for (int i = 0; i < STATIC_CACHE_ENTRIES; i++) {
+        file_entry_t *e = &files[i];
+        if (e->data && strcmp(e->id, id) == 0) {
+            e->refs++;
+            e->last_used = ++cache_clock;
+            fill(f, id, e->size, e->mtime, pinned);
+            f->data = e->data;
+            f->slot = i;
+            pthread_mutex_unlock(&static_lock);
+            return 1;
+        }
+    }
+    pthread_mutex_unlock(&static_lock);
+
+    char path[512];
+    function_code_path(id, "html", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    fill(f, id, (size_t)st.st_size, st.st_mtime, pinned);
+    f->fd = fd;
+    if (st.st_size == 0 || st.st_size > STATIC_CACHED_MAX || (size_t)st.st_size > cache_max) return 1;
+
+    char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) return 1;
+    pthread_mutex_lock(&static_lock);
+    file_entry_t *e = make_room((size_t)st.st_size);
+    if (!e) {
+        // Cache full of files being sent: this one goes uncached
+        pthread_mutex_unlock(&static_lock);
+        munmap(data, (size_t)st.st_size);
+        return 1;
+    }
+    // Another request may have mapped it meanwhile: two entries for an
+    // immutable file are harmless, the older one ages out
+    snprintf(e->id, sizeof(e->id), "%s", id);
+    e->data = data;
+    e->size = (size_t)st.st_size;
+    e->mtime = st.st_mtime;
+    e->refs = 1;
+    e->last_used = ++cache_clock;
+    cache_bytes += e->size;
+    f->data = data;
+    f->slot = (int)(e - files);
+    pthread_mutex_unlock(&static_lock);
+    close(fd);
+    f->fd = -1;
+    return 1;
+}
+
+void static_release(static_file_t *f) {
+    if (f->slot >= 0) {
+        pthread_mutex_lock(&static_lock);
+        files[f->slot].refs--;
+        pthread_mutex_unlock(&static_lock);
+    }
+    if (f->fd >= 0) close(f->fd);
+    f->slot = f->fd = -1;
+    f->data = NULL;
+}
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -12,10 +13,48 @@
 #include <dirent.h>
 #include <errno.h>
 
-void generate_function_id(char *buf, size_t len, const char *name) {
-    // Simple ID: name + timestamp
-    time_t now = time(NULL);
-    snprintf(buf, len, "%s_%ld", name, (long)now);
+void generate_function_id(char *buf, size_t len, const char *name, int version) {
+    // ID: name + version, stable and predictable for callers (hello_v3)
+    snprintf(buf, len, "%s_v%d", name, version);
+}
+
+void function_options_default(function_options_t *opts) {
+    memset(opts, 0, sizeof(*opts));
+    snprintf(opts->priority, sizeof(opts->priority), "normal");
+    opts->weight = 1;
+    opts->max_concurrency = 0;
+    opts->rate_limit = 0;
+    opts->burst = 0;
+    opts->memo_ttl = 0;
+}
+
+static void max_version_cb(const function_metadata_t *meta, void *ctx) {
+    struct { const char *name; int max; } *m = ctx;
+    if (strcmp(meta->name, m->name) == 0 && meta->version > m->max) {
+        m->max = meta->version;
+    }
+}
+
+int reserve_function_version(const char *name) {
+    struct { const char *name; int max; } m = { name, 0 };
+    scan_functions(max_version_cb, &m);
+    if (mkdir(FUNCTIONS_DIR, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir functions");
+        return -1;
+    }
+    // The scan only sees stored versions: a concurrent deploy may hold the
+    // next directory already, the first mkdir to succeed owns the number
+    for (int version = m.max + 1; version < m.max + 1000; version++) {
+        char id[MAX_FUNC_ID], dir[512];
+        generate_function_id(id, sizeof(id), name, version);
+        snprintf(dir, sizeof(dir), "%s/%s", FUNCTIONS_DIR, id);
+        if (mkdir(dir, 0755) == 0) return version;
+        if (errno != EEXIST) {
+            perror("mkdir function dir");
+            return -1;
+        }
+    }
+    return -1;
 }
 
 static const char* get_file_extension(const char *lang) {
@@ -26,12 +65,43 @@ static const char* get_file_extension(const char *lang) {
     if (strcmp(lang, "go") == 0) return "go";
     if (strcmp(lang, "php") == 0) return "php";
     if (strcmp(lang, "html") == 0) return "html";
+    if (strcmp(lang, "pipeline") == 0) return "pipeline";
     return "txt";
 }
 
-int store_function(const char *name, const char *lang, const char *code, size_t code_len, char *out_id) {
+// Copy code_len bytes of code_fd into fd: in the kernel when it can
+static int copy_code(int fd, int code_fd, size_t code_len) {
+    size_t done = 0;
+    while (done < code_len) {
+        ssize_t n = sendfile(fd, code_fd, NULL, code_len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    if (done == code_len) return 0;
+    if (done > 0) return -1;
+    // sendfile unsupported for this pair: plain reads
+    char buf[65536];
+    while (done < code_len) {
+        size_t want = code_len - done < sizeof(buf) ? code_len - done : sizeof(buf);
+        ssize_t n = read(code_fd, buf, want);
+        if (n <= 0 || write_all(fd, buf, (size_t)n) < 0) return -1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// Code in memory (code) or read from code_fd
+static int store_version(const char *name, const char *lang, const char *code, int code_fd, size_t code_len,
+                         int version, const function_options_t *opts, char *out_id) {
+    function_options_t defaults;
+    if (!opts) {
+        function_options_default(&defaults);
+        opts = &defaults;
+    }
+
     char id[MAX_FUNC_ID];
-    generate_function_id(id, sizeof(id), name);
+    generate_function_id(id, sizeof(id), name, version);
 
     // Create function directory
     char func_dir[512];
@@ -40,7 +110,10 @@ int store_function(const char *name, const char *lang, const char *code, size_t
         perror("mkdir functions");
         return -1;
     }
-    if (mkdir(func_dir, 0755) < 0) {
+    // Reserved by reserve_function_version, or created here
+    char meta_path[512];
+    snprintf(meta_path, sizeof(meta_path), "%s/metadata.json", func_dir);
+    if (mkdir(func_dir, 0755) < 0 && (errno != EEXIST || access(meta_path, F_OK) == 0)) {
         perror("mkdir function dir");
         return -1;
     }
@@ -54,7 +127,7 @@ int store_function(const char *name, const char *lang, const char *code, size_t
         perror("open code file");
         return -1;
     }
-    if (write(fd, code, code_len) != (ssize_t)code_len) {
+    if (code ? write(fd, code, code_len) != (ssize_t)code_len : copy_code(fd, code_fd, code_len) < 0) {
         perror("write code");
         close(fd);
         return -1;
@@ -62,8 +135,6 @@ int store_function(const char *name, const char *lang, const char *code, size_t
     close(fd);
 
     // Write metadata
-    char meta_path[512];
-    snprintf(meta_path, sizeof(meta_path), "%s/metadata.json", func_dir);
     FILE *mf = fopen(meta_path, "w");
     if (!mf) {
         perror("fopen metadata");
@@ -74,6 +145,13 @@ int store_function(const char *name, const char *lang, const char *code, size_t
     fprintf(mf, "  \"name\": \"%s\",\n", name);
     fprintf(mf, "  \"language\": \"%s\",\n", lang);
     fprintf(mf, "  \"entrypoint\": \"main\",\n");
+    fprintf(mf, "  \"version\": %d,\n", version);
+    fprintf(mf, "  \"priority\": \"%s\",\n", opts->priority);
+    fprintf(mf, "  \"weight\": %d,\n", opts->weight);
+    fprintf(mf, "  \"max_concurrency\": %d,\n", opts->max_concurrency);
+    fprintf(mf, "  \"rate_limit\": %g,\n", opts->rate_limit);
+    fprintf(mf, "  \"burst\": %d,\n", opts->burst);
+    fprintf(mf, "  \"memo_ttl\": %d,\n", opts->memo_ttl);
     fprintf(mf, "  \"created_at\": \"%ld\",\n", (long)time(NULL));
     fprintf(mf, "  \"size\": %zu\n", code_len);
     fprintf(mf, "}\n");
@@ -83,9 +161,19 @@ int store_function(const char *name, const char *lang, const char *code, size_t
     return 0;
 }
 
+int store_function(const char *name, const char *lang, const char *code, size_t code_len, int version,
+                   const function_options_t *opts, char *out_id) {
+    return store_version(name, lang, code, -1, code_len, version, opts, out_id);
+}
+
+int store_function_fd(const char *name, const char *lang, int code_fd, size_t code_len, int version,
+                      const function_options_t *opts, char *out_id) {
+    return store_version(name, lang, NULL, code_fd, code_len, version, opts, out_id);
+}
+
 int load_function(const char *id, char *code_buf, size_t buf_len) {
     // Try to find code file (try multiple extensions)
-    const char *exts[] = {"c", "js", "py", "rs", "go", "wasm", NULL};
+    const char *exts[] = {"c", "js", "py", "rs", "go", "php", "html", "wasm", "pipeline", NULL};
     for (int i = 0; exts[i]; i++) {
         char path[512];
         snprintf(path, sizeof(path), "%s/%s/code.%s", FUNCTIONS_DIR, id, exts[i]);
@@ -100,6 +188,10 @@ int load_function(const char *id, char *code_buf, size_t buf_len) {
     return -1;
 }
 
+void function_code_path(const char *id, const char *lang, char *path, size_t len) {
+    snprintf(path, len, "%s/%s/code.%s", FUNCTIONS_DIR, id, get_file_extension(lang));
+}
+
 int load_function_metadata(const char *id, function_metadata_t *meta) {
     char path[512];
     snprintf(path, sizeof(path), "%s/%s/metadata.json", FUNCTIONS_DIR, id);
@@ -109,6 +201,7 @@ int load_function_metadata(const char *id, function_metadata_t *meta) {
     // Simple JSON parsing (naive)
     char line[512];
     memset(meta, 0, sizeof(*meta));
+    function_options_default(&meta->options);
     while (fgets(line, sizeof(line), f)) {
         if (strstr(line, "\"id\"")) {
             sscanf(line, " \"id\": \"%127[^\"]\"", meta->id);
@@ -120,9 +213,27 @@ int load_function_metadata(const char *id, function_metadata_t *meta) {
             sscanf(line, " \"entrypoint\": \"%63[^\"]\"", meta->entrypoint);
         } else if (strstr(line, "\"size\"")) {
             sscanf(line, " \"size\": %zu", &meta->size);
+        } else if (strstr(line, "\"version\"")) {
+            sscanf(line, " \"version\": %d", &meta->version);
+        } else if (strstr(line, "\"created_at\"")) {
+            sscanf(line, " \"created_at\": \"%ld\"", &meta->created_at);
+        } else if (strstr(line, "\"priority\"")) {
+            sscanf(line, " \"priority\": \"%7[^\"]\"", meta->options.priority);
+        } else if (strstr(line, "\"weight\"")) {
+            sscanf(line, " \"weight\": %d", &meta->options.weight);
+        } else if (strstr(line, "\"max_concurrency\"")) {
+            sscanf(line, " \"max_concurrency\": %d", &meta->options.max_concurrency);
+        } else if (strstr(line, "\"rate_limit\"")) {
+            sscanf(line, " \"rate_limit\": %lf", &meta->options.rate_limit);
+        } else if (strstr(line, "\"burst\"")) {
+            sscanf(line, " \"burst\": %d", &meta->options.burst);
+        } else if (strstr(line, "\"memo_ttl\"")) {
+            sscanf(line, " \"memo_ttl\": %d", &meta->options.memo_ttl);
         }
     }
     fclose(f);
+    if (meta->version <= 0) meta->version = 1; // deployed before versioning
+    if (meta->options.weight <= 0) meta->options.weight = 1;
     return 0;
 }
 
@@ -132,56 +243,142 @@ int function_exists(const char *id) {
     return access(path, F_OK) == 0;
 }
 
+int remove_function_version(const char *id) {
+    char dir_path[512];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s", FUNCTIONS_DIR, id);
+    DIR *dir = opendir(dir_path);
+    if (!dir) return -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (unlink(path) < 0) perror(path);
+    }
+    closedir(dir);
+    return rmdir(dir_path);
+}
+
 int function_name_exists(const char *name) {
     char func_id[MAX_FUNC_ID];
     return find_function_by_name(name, func_id) == 0;
 }
 
-int find_function_by_name(const char *name, char *out_id) {
-    // Scan functions directory for matching name
+int scan_functions(void (*cb)(const function_metadata_t *meta, void *ctx), void *ctx) {
     DIR *dir = opendir(FUNCTIONS_DIR);
     if (!dir) return -1;
-    
+
     struct dirent *entry;
-    time_t latest_time = 0;
-    int found = 0;
-    
     while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] == '.') continue;
-        
-        // Load metadata for this function
+        if (entry->d_name[0] == '.') continue; // also skips .aliases
+
         function_metadata_t meta;
+        if (strlen(entry->d_name) >= sizeof(meta.id)) continue;
+        if (load_function_metadata(entry->d_name, &meta) < 0) continue;
+        // Directory name is authoritative for the ID
+        snprintf(meta.id, sizeof(meta.id), "%s", entry->d_name);
+        cb(&meta, ctx);
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    char *out_id;
+    int best_version;
+    long best_time;
+    int found;
+} find_by_name_ctx_t;
+
+static void find_by_name_cb(const function_metadata_t *meta, void *ctx) {
+    find_by_name_ctx_t *c = ctx;
+    if (strcmp(meta->name, c->name) != 0) return;
+    if (!c->found || meta->version > c->best_version ||
+        (meta->version == c->best_version && meta->created_at > c->best_time)) {
+        snprintf(c->out_id, MAX_FUNC_ID, "%s", meta->id);
+        c->best_version = meta->version;
+        c->best_time = meta->created_at;
+        c->found = 1;
+    }
+}
+
+int find_function_by_name(const char *name, char *out_id) {
+    // Scan functions directory for matching name, keep the most recent version
+    find_by_name_ctx_t c = { name, out_id, 0, 0, 0 };
+    if (scan_functions(find_by_name_cb, &c) < 0) return -1;
+    return c.found ? 0 : -1;
+}
+
+int get_function_alias(const char *name, const char *alias, char *out_id, size_t len) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s@%s", ALIASES_DIR, name, alias);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[MAX_FUNC_ID] = {0};
+    int ok = fgets(line, sizeof(line), f) != NULL;
+    fclose(f);
+    line[strcspn(line, "\n")] = '\0';
+    if (!ok || !line[0]) return -1;
+    snprintf(out_id, len, "%s", line);
+    return 0;
+}
+
+int set_function_alias(const char *name, const char *alias, const char *id) {
+    if (mkdir(FUNCTIONS_DIR, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir functions");
+        return -1;
+    }
+    if (mkdir(ALIASES_DIR, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir aliases");
+        return -1;
+    }
+
+    // Alias file: functions/.aliases/<name>@<alias> containing the version ID
+    char path[512], tmp_path[600];
+    snprintf(path, sizeof(path), "%s/%s@%s", ALIASES_DIR, name, alias);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path, (int)getpid());
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        perror("fopen alias");
+        return -1;
+    }
+    fprintf(f, "%s\n", id);
+    if (fclose(f) != 0 || rename(tmp_path, path) < 0) {
+        perror("write alias");
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int scan_function_aliases(void (*cb)(const char *name, const char *alias, const char *id, void *ctx), void *ctx) {
+    DIR *dir = opendir(ALIASES_DIR);
+    if (!dir) return -1;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        if (strstr(entry->d_name, ".tmp.")) continue; // interrupted write
+
+        char name[MAX_FUNC_NAME] = {0};
+        char alias[MAX_ALIAS_NAME] = {0};
+        if (sscanf(entry->d_name, "%63[^@]@%31s", name, alias) != 2) continue;
+
         char path[512];
-        snprintf(path, sizeof(path), "%s/%s/metadata.json", FUNCTIONS_DIR, entry->d_name);
-        
+        snprintf(path, sizeof(path), "%s/%s", ALIASES_DIR, entry->d_name);
         FILE *f = fopen(path, "r");
         if (!f) continue;
-        
-        char line[512];
-        char func_name[MAX_FUNC_NAME] = {0};
-        time_t created_at = 0;
-        
-        while (fgets(line, sizeof(line), f)) {
-            if (strstr(line, "\"name\"")) {
-                sscanf(line, " \"name\": \"%63[^\"]\"", func_name);
-            } else if (strstr(line, "\"created_at\"")) {
-                long ts;
-                sscanf(line, " \"created_at\": \"%ld\"", &ts);
-                created_at = (time_t)ts;
-            }
+        char id[MAX_FUNC_ID] = {0};
+        if (fgets(id, sizeof(id), f)) {
+            trim_newline(id);
+            if (id[0]) cb(name, alias, id, ctx);
         }
         fclose(f);
-        
-        // Check if name matches
-        if (strcmp(func_name, name) == 0) {
-            if (!found || created_at > latest_time) {
-                strncpy(out_id, entry->d_name, MAX_FUNC_ID - 1);
-                latest_time = created_at;
-                found = 1;
-            }
-        }
     }
-    
+
     closedir(dir);
-    return found ? 0 : -1;
+    return 0;
 }
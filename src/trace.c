@@ -0,0 +1,55 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_FIELD ",\"trace\":\""
+
+double trace_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int trace_requested(const char *line) {
+    return strstr(line, "\"trace\":1") != NULL;
+}
+
+void trace_append(char *resp, size_t cap, const char *stage, double ts_us) {
+    char *end = strrchr(resp, '}');
+    if (!end) return;
+
+    char entry[64];
+    int has_field = strstr(resp, TRACE_FIELD) != NULL;
+    int n = snprintf(entry, sizeof(entry), has_field ? ";%s:%.0f" : TRACE_FIELD "%s:%.0f\"", stage, ts_us);
+    // The trace field is last: new entries go before its closing quote
+    char *at = has_field ? end - 1 : end;
+    size_t len = strlen(resp);
+    if (n <= 0 || len + (size_t)n >= cap) return;
+    memmove(at + n, at, len - (size_t)(at - resp) + 1);
+    memcpy(at, entry, (size_t)n);
+}
+
+double trace_get(const char *resp, const char *stage) {
+    const char *p = strstr(resp, TRACE_FIELD);
+    if (!p) return 0;
+    p += strlen(TRACE_FIELD);
+    size_t slen = strlen(stage);
+    while (*p && *p != '"') {
+        if (strncmp(p, stage, slen) == 0 && p[slen] == ':') return atof(p + slen + 1);
+        p = strpbrk(p, ";\"");
+        if (!p || *p == '"') break;
+        p++;
+    }
+    return 0;
+}
+
+void trace_strip(char *resp) {
+    char *p = strstr(resp, TRACE_FIELD);
+    if (!p) return;
+    char *close = strchr(p + strlen(TRACE_FIELD), '"');
+    if (!close) return;
+    memmove(p, close + 1, strlen(close + 1) + 1);
+}
@@ -0,0 +1,406 @@
+#include "wal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define WAL_HDR 9                 // u32 length + u32 crc + u8 type
+#define WAL_BUF_INITIAL (1 << 20)
+
+typedef struct {
+    uint32_t no;
+    long refs;
+} wal_seg_t;
+
+struct wal {
+    char dir[256];
+    size_t segment_bytes;
+    int fd;                       // active segment
+    uint32_t active;
+    size_t active_size;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;          // flusher: data buffered
+    pthread_cond_t flushed;       // appenders: durable moved
+    char *buf, *spare;            // double buffer: appenders fill buf while spare is written
+    size_t len, cap, spare_cap;
+    uint64_t appended, durable;   // byte positions across segments
+    int rotating, failed, stop;
+    pthread_t flusher;
+
+    wal_seg_t *segs;              // sorted by number
+    unsigned nsegs, segs_cap;
+    wal_stats_t stats;
+};
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void seg_path(const wal_t *w, uint32_t no, char *out, size_t cap) {
+    snprintf(out, cap, "%s/wal-%08u.log", w->dir, no);
+}
+
+static int write_fully(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t r = write(fd, p, len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+// New segment files must survive a crash too
+static void sync_dir(const wal_t *w) {
+    int dfd = open(w->dir, O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+}
+
+// lock held
+static wal_seg_t *find_seg(wal_t *w, uint32_t no) {
+    for (unsigned i = 0; i < w->nsegs; i++) {
+        if (w->segs[i].no == no) return &w->segs[i];
+    }
+    return NULL;
+}
+
+static int add_seg(wal_t *w, uint32_t no) {
+    if (w->nsegs == w->segs_cap) {
+        unsigned cap = w->segs_cap ? w->segs_cap * 2 : 16;
+        wal_seg_t *s = realloc(w->segs, cap * sizeof(*s));
+        if (!s) return -1;
+        w->segs = s;
+        w->segs_cap = cap;
+    }
+    unsigned i = w->nsegs++;
+    while (i > 0 && w->segs[i - 1].no > no) {
+        w->segs[i] = w->segs[i - 1];
+        i--;
+    }
+    w->segs[i].no = no;
+    w->segs[i].refs = 0;
+    return 0;
+}
+
+// lock held: delete a closed segment without live records
+static void drop_seg_if_dead(wal_t *w, wal_seg_t *s) {
+    if (s->refs > 0 || s->no == w->active) return;
+    char path[300];
+    seg_path(w, s->no, path, sizeof(path));
+    if (unlink(path) < 0 && errno != ENOENT) perror(path);
+    unsigned i = (unsigned)(s - w->segs);
+    memmove(&w->segs[i], &w->segs[i + 1], (w->nsegs - i - 1) * sizeof(*s));
+    w->nsegs--;
+}
+
+static int open_segment(wal_t *w, uint32_t no) {
+    char path[300];
+    seg_path(w, no, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (add_seg(w, no) < 0) {
+        close(fd);
+        return -1;
+    }
+    sync_dir(w);
+    w->fd = fd;
+    w->active = no;
+    w->active_size = 0;
+    return 0;
+}
+
+static void *flusher_thread(void *arg) {
+    wal_t *w = arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->len == 0 && !w->stop) pthread_cond_wait(&w->work, &w->lock);
+        if (w->len == 0 && w->stop) break;
+
+        // Take everything buffered so far; appenders continue in the other buffer
+        char *data = w->buf;
+        size_t n = w->len;
+        uint64_t target = w->appended;
+        int fd = w->fd;
+        w->buf = w->spare;
+        w->spare = data;
+        size_t c = w->cap;
+        w->cap = w->spare_cap;
+        w->spare_cap = c;
+        w->len = 0;
+        pthread_mutex_unlock(&w->lock);
+
+        int rc = write_fully(fd, data, n);
+        if (rc == 0) rc = fdatasync(fd);
+        if (rc < 0) perror("wal write");
+
+        pthread_mutex_lock(&w->lock);
+        if (rc < 0) w->failed = 1;
+        w->durable = target;
+        w->stats.syncs++;
+        pthread_cond_broadcast(&w->flushed);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// lock held: wait until everything appended so far is on disk
+static int wait_durable(wal_t *w, uint64_t pos) {
+    pthread_cond_signal(&w->work);
+    while (w->durable < pos && !w->failed) pthread_cond_wait(&w->flushed, &w->lock);
+    return w->failed ? -1 : 0;
+}
+
+wal_t *wal_open(const char *dir, size_t segment_bytes) {
+    pthread_once(&crc_once, crc_init);
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return NULL;
+    }
+    wal_t *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    snprintf(w->dir, sizeof(w->dir), "%s", dir);
+    w->segment_bytes = segment_bytes;
+    w->fd = -1;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->flushed, NULL);
+    w->cap = w->spare_cap = WAL_BUF_INITIAL;
+    w->buf = malloc(w->cap);
+    w->spare = malloc(w->spare_cap);
+
+    // Existing segments, replayed later; appends go to a new one
+    uint32_t last = 0;
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *e;
+        while ((e = readdir(d))) {
+            unsigned no;
+            if (sscanf(e->d_name, "wal-%8u.log", &no) == 1 && no > 0) {
+                add_seg(w, no);
+                if (no > last) last = no;
+            }
+        }
+        closedir(d);
+    }
+    if (!w->buf || !w->spare || open_segment(w, last + 1) < 0 ||
+        pthread_create(&w->flusher, NULL, flusher_thread, w) != 0) {
+        if (w->fd >= 0) close(w->fd);
+        free(w->buf);
+        free(w->spare);
+        free(w->segs);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+void wal_close(wal_t *w) {
+    if (!w) return;
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->flusher, NULL);
+    close(w->fd);
+    free(w->buf);
+    free(w->spare);
+    free(w->segs);
+    free(w);
+}
+
+int wal_replay(wal_t *w, wal_replay_fn fn, void *ctx) {
+    // Segment list snapshot: fn may drop references (and segments) as it goes
+    pthread_mutex_lock(&w->lock);
+    unsigned n = w->nsegs;
+    uint32_t *nos = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (!nos) {
+        pthread_mutex_unlock(&w->lock);
+        return -1;
+    }
+    for (unsigned i = 0; i < n; i++) nos[i] = w->segs[i].no;
+    uint32_t active = w->active;
+    pthread_mutex_unlock(&w->lock);
+
+    int records = 0;
+    unsigned char *rec = NULL;
+    size_t rec_cap = 0;
+    for (unsigned i = 0; i < n; i++) {
+        if (nos[i] == active) continue;
+        char path[300];
+        seg_path(w, nos[i], path, sizeof(path));
+        FILE *f = fopen(path, "rb");
+        if (!f) continue;
+        unsigned char hdr[WAL_HDR];
+        while (fread(hdr, 1, WAL_HDR, f) == WAL_HDR) {
+            uint32_t len = get_u32(hdr), crc = get_u32(hdr + 4);
+            if (len == 0 || len > (1u << 30)) break;
+            if (len - 1 > rec_cap) {
+                unsigned char *nr = realloc(rec, len);
+                if (!nr) break;
+                rec = nr;
+                rec_cap = len;
+            }
+            if (len > 1 && fread(rec, 1, len - 1, f) != len - 1) break;
+            uint32_t c = crc32_update(0, hdr + 8, 1);
+            c = crc32_update(c, rec, len - 1);
+            if (c != crc) {
+                fprintf(stderr, "wal: %s: corrupt record, rest of the segment ignored\n", path);
+                break;
+            }
+            fn(ctx, nos[i], hdr[8], rec, len - 1);
+            records++;
+        }
+        fclose(f);
+    }
+    free(rec);
+    free(nos);
+    return records;
+}
+
+void wal_gc(wal_t *w) {
+    pthread_mutex_lock(&w->lock);
+    for (unsigned i = 0; i < w->nsegs;) {
+        unsigned before = w->nsegs;
+        drop_seg_if_dead(w, &w->segs[i]);
+        if (w->nsegs == before) i++;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+long wal_append(wal_t *w, uint8_t type, const void *data, size_t len, int sync, int pin) {
+    size_t reclen = WAL_HDR + len;
+    unsigned char hdr[WAL_HDR];
+    put_u32(hdr, (uint32_t)(len + 1));
+    hdr[8] = type;
+    uint32_t crc = crc32_update(0, &type, 1);
+    put_u32(hdr + 4, crc32_update(crc, data, len));
+
+    pthread_mutex_lock(&w->lock);
+    while (w->rotating) pthread_cond_wait(&w->flushed, &w->lock);
+    if (w->failed) {
+        pthread_mutex_unlock(&w->lock);
+        return -1;
+    }
+    if (w->active_size > 0 && w->active_size + reclen > w->segment_bytes) {
+        // Rotate once the active segment is fully written
+        w->rotating = 1;
+        int rc = wait_durable(w, w->appended);
+        if (rc == 0) {
+            close(w->fd);
+            rc = open_segment(w, w->active + 1);
+            if (rc < 0) w->failed = 1;
+        }
+        // The old segment may already have no live record left
+        wal_seg_t *prev = find_seg(w, w->active - 1);
+        if (rc == 0 && prev) drop_seg_if_dead(w, prev);
+        w->rotating = 0;
+        pthread_cond_broadcast(&w->flushed);
+        if (rc < 0) {
+            pthread_mutex_unlock(&w->lock);
+            return -1;
+        }
+    }
+    if (w->len + reclen > w->cap) {
+        size_t cap = (w->len + reclen) * 2;
+        char *nb = realloc(w->buf, cap);
+        if (!nb) {
+            pthread_mutex_unlock(&w->lock);
+            return -1;
+        }
+        w->buf = nb;
+        w->cap = cap;
+    }
+    memcpy(w->buf + w->len, hdr, WAL_HDR);
+    if (len > 0) memcpy(w->buf + w->len + WAL_HDR, data, len);
+    w->len += reclen;
+    w->active_size += reclen;
+    w->appended += reclen;
+    w->stats.appends++;
+    w->stats.bytes += reclen;
+    long seg = (long)w->active;
+    // Before the lock is let go: a rotation could otherwise find the
+    // segment unreferenced and delete it under the new record
+    wal_seg_t *s = pin ? find_seg(w, w->active) : NULL;
+    if (s) s->refs++;
+    int rc = 0;
+    if (sync) {
+        rc = wait_durable(w, w->appended);
+    } else {
+        pthread_cond_signal(&w->work);
+    }
+    if (rc < 0 && pin && (s = find_seg(w, (uint32_t)seg))) s->refs--;
+    pthread_mutex_unlock(&w->lock);
+    return rc < 0 ? -1 : seg;
+}
+
+int wal_sync(wal_t *w) {
+    pthread_mutex_lock(&w->lock);
+    int rc = wait_durable(w, w->appended);
+    pthread_mutex_unlock(&w->lock);
+    return rc;
+}
+
+void wal_ref(wal_t *w, uint32_t seg, int delta) {
+    pthread_mutex_lock(&w->lock);
+    wal_seg_t *s = find_seg(w, seg);
+    if (s) {
+        s->refs += delta;
+        if (delta < 0) drop_seg_if_dead(w, s);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+uint32_t wal_compact_candidate(wal_t *w, unsigned keep) {
+    pthread_mutex_lock(&w->lock);
+    uint32_t no = 0;
+    // segs[] is sorted and the active segment is the last one
+    if (w->nsegs > keep + 1 && w->segs[0].no != w->active) no = w->segs[0].no;
+    pthread_mutex_unlock(&w->lock);
+    return no;
+}
+
+void wal_get_stats(wal_t *w, wal_stats_t *st) {
+    pthread_mutex_lock(&w->lock);
+    *st = w->stats;
+    st->segments = w->nsegs;
+    st->active = w->active;
+    pthread_mutex_unlock(&w->lock);
+}
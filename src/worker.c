@@ -2,10 +2,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include "ipc.h"
+#include "log.h"
+#include "metrics.h"
+#include "pipeline.h"
 #include "storage.h"
+#include "trace.h"
 
 // Enable Wasmer (requires libwasmer)
 #define USE_WASMER
@@ -17,87 +29,548 @@
 #define LINE_MAX 8192
 #define CODE_BUF_SIZE 65536
 
+// Stage timestamps of the current job, reported when the job is traced
+static int job_traced = 0;
+static double job_recv_us = 0;
+static double job_ready_us = 0;
+
+// Slot number given by the server (WORKER_ID), labels this worker's metrics
+static int worker_index = -1;
+
+// Per-stage report of the current job when it is a pipeline
+static char job_stages[3584];
+static int in_pipeline = 0;
+
+// Tenant of the current job and how deep in function-to-function calls it
+// is ("depth" of the invoke line), carried to the functions it calls
+static char job_tenant[64];
+static int call_depth = 0;
+
+// Streamed job: output sent in chunk lines while the function runs. The
+// execution path gets the descriptor as an argument, -1 for calls and
+// stages whose output is not the job's.
+static int job_stream_fd = -1;        // job pipe to the server, -1 when not streaming
+static size_t stream_bytes = 0;
+static char stream_carry[4];          // incomplete UTF-8 sequence, sent with the next bytes
+static size_t stream_carry_len = 0;
+
+static void stream_emit(int stream_fd, const char *data, size_t len) {
+    char line[LINE_MAX];
+    size_t m = (size_t)snprintf(line, sizeof(line), CHUNK_PREFIX "\"");
+    m += json_escape(data, len, line + m, sizeof(line) - m - 4);
+    memcpy(line + m, "\"}\n", 3);
+    // Blocks while the server (and behind it the client) is behind
+    write_all(stream_fd, line, m + 3);
+}
+
+// Length of buf without a trailing incomplete UTF-8 sequence
+static size_t utf8_complete(const unsigned char *buf, size_t n) {
+    size_t i = n;
+    while (i > 0 && n - i < 3 && (buf[i - 1] & 0xC0) == 0x80) i--;
+    if (i == 0 || buf[i - 1] < 0xC0) return n;
+    size_t need = buf[i - 1] >= 0xF0 ? 4 : buf[i - 1] >= 0xE0 ? 3 : 2;
+    return n - (i - 1) < need ? i - 1 : n;
+}
+
+// Output as it is produced, in chunks cut on character boundaries
+static void stream_write(int stream_fd, const char *data, size_t len) {
+    char buf[STREAM_CHUNK + sizeof(stream_carry)];
+    stream_bytes += len;
+    while (len > 0) {
+        size_t take = len < STREAM_CHUNK ? len : STREAM_CHUNK;
+        memcpy(buf, stream_carry, stream_carry_len);
+        memcpy(buf + stream_carry_len, data, take);
+        size_t n = stream_carry_len + take;
+        size_t cut = utf8_complete((const unsigned char *)buf, n);
+        stream_carry_len = n - cut;
+        memcpy(stream_carry, buf + cut, stream_carry_len);
+        if (cut) stream_emit(stream_fd, buf, cut);
+        data += take;
+        len -= take;
+    }
+}
+
+static void stream_end(int stream_fd) {
+    if (stream_carry_len) stream_emit(stream_fd, stream_carry, stream_carry_len);
+    stream_carry_len = 0;
+}
+
+// Resources used by the current job, reported in the "usage" field
+typedef struct {
+    int active;                // a job is being accounted
+    double start_us;
+    struct rusage self_start;  // this thread (WASM runs in-process)
+    long child_cpu_us;         // runtime process (python, node, php)
+    long child_maxrss_kb;
+    unsigned mem_pages;        // WASM linear memory, 64 KiB pages
+} job_usage_t;
+
+static job_usage_t job_usage;
+
+static long tv_us(struct timeval tv) {
+    return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+static void usage_begin(void) {
+    memset(&job_usage, 0, sizeof(job_usage));
+    job_usage.active = 1;
+    job_usage.start_us = trace_now_us();
+    getrusage(RUSAGE_THREAD, &job_usage.self_start);
+}
+
+// ,"usage":{...} for the job that just finished (empty if none)
+static void usage_format(char *out, size_t len, size_t out_bytes) {
+    out[0] = '\0';
+    if (!job_usage.active) return;
+    struct rusage now;
+    getrusage(RUSAGE_THREAD, &now);
+    long cpu_us = tv_us(now.ru_utime) - tv_us(job_usage.self_start.ru_utime) +
+                  tv_us(now.ru_stime) - tv_us(job_usage.self_start.ru_stime);
+    snprintf(out, len, ",\"usage\":{\"wall_us\":%.0f,\"cpu_us\":%ld,\"child_cpu_us\":%ld,"
+             "\"child_maxrss_kb\":%ld,\"mem_pages\":%u,\"out_bytes\":%zu}",
+             trace_now_us() - job_usage.start_us, cpu_us, job_usage.child_cpu_us,
+             job_usage.child_maxrss_kb, job_usage.mem_pages, out_bytes);
+    job_usage.active = 0;
+}
+
 #ifdef USE_WASMER
-// Execute WASM function using Wasmer C API 3.x with WASI support
-// NO FORK! Worker is already a forked process from Server
-static int execute_wasm(const char *wasm_path, const char *func_name, char *output, size_t out_len) {
-    fprintf(stderr, "[WORKER] 🚀 Execute WASM directly in worker process (PID %d)\n", getpid());
-    
-    // Redirect stdout to capture output
-    int stdout_backup = dup(STDOUT_FILENO);
-    int pipefd[2];
-    if (pipe(pipefd) < 0) {
-        fprintf(stderr, "[WORKER] ❌ Pipe creation failed\n");
-        snprintf(output, out_len, "pipe creation failed");
-        return -1;
+#define MODULE_CACHE_SIZE 16  // default, override with WORKER_MODULE_CACHE
+
+// Compiled modules cached per worker so warm invocations skip engine creation
+// and compilation. Each module keeps its own store (instances are per call).
+typedef struct {
+    char func_id[MAX_FUNC_ID];
+    wasm_store_t *store;
+    wasm_module_t *module;
+    unsigned long last_used;
+} module_cache_entry_t;
+
+// Cache outcome of the current job, reported back so the LB can track
+// which functions are warm on this worker
+static const char *job_cache_status = NULL; // "hit" / "miss"
+static char job_evicted[MAX_FUNC_ID];
+
+static wasm_engine_t *engine = NULL;
+static module_cache_entry_t *module_cache = NULL;
+static int module_cache_size = 0;
+static unsigned long cache_clock = 0;
+
+static void module_cache_init(void) {
+    const char *env = getenv("WORKER_MODULE_CACHE");
+    module_cache_size = env ? atoi(env) : MODULE_CACHE_SIZE;
+    if (module_cache_size <= 0) module_cache_size = MODULE_CACHE_SIZE;
+    module_cache = calloc((size_t)module_cache_size, sizeof(module_cache_entry_t));
+    if (!module_cache) die("calloc module cache");
+}
+
+static int cached_modules(void) {
+    int n = 0;
+    for (int i = 0; i < module_cache_size; i++) {
+        if (module_cache[i].module) n++;
     }
-    
-    dup2(pipefd[1], STDOUT_FILENO);
-    close(pipefd[1]);
-    
+    return n;
+}
+
+// Return cached module for func_id, compiling it on miss (LRU eviction).
+static module_cache_entry_t *get_cached_module(const char *func_id, const char *wasm_path, int *hit) {
+    *hit = 0;
+    if (!module_cache) module_cache_init();
+    if (!engine) {
+        log_info("[WORKER] 🔧 Initializing Wasmer engine...\n");
+        engine = wasm_engine_new();
+        if (!engine) return NULL;
+    }
+
+    module_cache_entry_t *victim = &module_cache[0];
+    for (int i = 0; i < module_cache_size; i++) {
+        module_cache_entry_t *e = &module_cache[i];
+        if (e->module && strcmp(e->func_id, func_id) == 0) {
+            e->last_used = ++cache_clock;
+            *hit = 1;
+            metrics_cache(1);
+            return e;
+        }
+        if (!e->module) {
+            if (victim->module) victim = e;
+        } else if (victim->module && e->last_used < victim->last_used) {
+            victim = e;
+        }
+    }
+
     // Load WASM file
-    fprintf(stderr, "[WORKER] 📂 Loading WASM file: %s\n", wasm_path);
+    log_info("[WORKER] 📂 Loading WASM file: %s\n", wasm_path);
     FILE *file = fopen(wasm_path, "rb");
     if (!file) {
-        fprintf(stderr, "[WORKER] ❌ Cannot open wasm file: %s\n", wasm_path);
-        dup2(stdout_backup, STDOUT_FILENO);
-        close(stdout_backup);
-        close(pipefd[0]);
-        snprintf(output, out_len, "cannot open wasm file");
-        return -1;
+        log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Cannot open wasm file: %s\n", wasm_path);
+        return NULL;
     }
-
     fseek(file, 0, SEEK_END);
     size_t file_size = ftell(file);
     rewind(file);
-    uint8_t *wasm_bytes = malloc(file_size);
-    if (!wasm_bytes) {
+
+    wasm_byte_vec_t binary;
+    wasm_byte_vec_new_uninitialized(&binary, file_size);
+    if (fread(binary.data, 1, file_size, file) != file_size) {
+        log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Short read on wasm file\n");
         fclose(file);
-        fprintf(stderr, "[WORKER] ❌ Malloc failed\n");
-        dup2(stdout_backup, STDOUT_FILENO);
-        close(stdout_backup);
-        close(pipefd[0]);
-        snprintf(output, out_len, "malloc failed");
-        return -1;
+        wasm_byte_vec_delete(&binary);
+        return NULL;
     }
-    fread(wasm_bytes, 1, file_size, file);
     fclose(file);
 
-    fprintf(stderr, "[WORKER] 📦 Loaded WASM file: %zu bytes\n", file_size);
+    log_info("[WORKER] 📦 Loaded WASM file: %zu bytes\n", file_size);
 
-    // Initialize Wasmer 3.x
-    fprintf(stderr, "[WORKER] 🔧 Initializing Wasmer engine...\n");
-    wasm_engine_t *engine = wasm_engine_new();
+    metrics_cache(0);
+    metrics_worker_state(worker_index, WORKER_COMPILING, func_id);
+    double t0 = trace_now_us();
     wasm_store_t *store = wasm_store_new(engine);
-
-    wasm_byte_vec_t binary;
-    wasm_byte_vec_new_uninitialized(&binary, file_size);
-    memcpy(binary.data, wasm_bytes, file_size);
-    free(wasm_bytes);
-
     wasm_module_t *module = wasm_module_new(store, &binary);
     wasm_byte_vec_delete(&binary);
-    
+    metrics_compile(COMPILE_MODULE, (trace_now_us() - t0) / 1e6);
+    metrics_worker_state(worker_index, WORKER_BUSY, NULL);
     if (!module) {
-        fprintf(stderr, "[WORKER] ❌ Failed to compile wasm module\n");
+        log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Failed to compile wasm module\n");
         wasm_store_delete(store);
-        wasm_engine_delete(engine);
-        dup2(stdout_backup, STDOUT_FILENO);
-        close(stdout_backup);
-        close(pipefd[0]);
+        return NULL;
+    }
+
+    if (victim->module) {
+        log_info("[WORKER] ♻️  Evicting cached module %s\n", victim->func_id);
+        snprintf(job_evicted, sizeof(job_evicted), "%s", victim->func_id);
+        wasm_module_delete(victim->module);
+        wasm_store_delete(victim->store);
+    }
+    snprintf(victim->func_id, sizeof(victim->func_id), "%s", func_id);
+    victim->store = store;
+    victim->module = module;
+    victim->last_used = ++cache_clock;
+
+    log_info("[WORKER] ✅ WASM module compiled and cached\n");
+    return victim;
+}
+
+static int execute_function(const char *func_id, const char *payload, int spool_fd, int stream_fd,
+                            char *output, size_t out_len);
+static int payload_fd(const char *payload, size_t len);
+
+// ---------------------------------------------------------------------------
+// Host import faas.call: a module invokes another function
+//   i32 call(i32 ref, i32 ref_len, i32 in, i32 in_len, i32 out, i32 out_cap)
+// ref is a function reference as in /invoke?fn=, in the payload. The output
+// is copied to out (truncated to out_cap) and its full length returned, or
+// -1 with the error message in out. A pinned version (ID or name:vN) whose
+// module is in this worker's cache runs right here, payload and output going
+// from and to guest memory; anything else goes through the server like an
+// invoke, queued and admitted by the LB, while this worker waits.
+// ---------------------------------------------------------------------------
+
+#define CALL_DEPTH_MAX 4
+#define CALL_MODULE "faas"
+#define CALL_TIMEOUT_S 60        // LB queue timeout (30 s) plus the callee's run
+
+typedef struct {
+    wasm_store_t *store;
+    wasm_memory_t *memory;       // caller's, set once instantiated
+    const char *func_id;         // caller
+} call_env_t;
+
+// Version ID named by ref without the alias table: an ID, or name:vN
+static int pinned_id(const char *ref, char *id, size_t len) {
+    const char *colon = strchr(ref, ':');
+    int version;
+    char tail;
+    if (colon && sscanf(colon + 1, "v%d%c", &version, &tail) == 1 && version > 0) {
+        char name[MAX_FUNC_NAME];
+        snprintf(name, sizeof(name), "%.*s", (int)(colon - ref), ref);
+        generate_function_id(id, len, name, version);
+    } else if (!colon) {
+        snprintf(id, len, "%s", ref);
+    } else {
+        return -1;
+    }
+    return function_exists(id) ? 0 : -1;
+}
+
+// Function reference as the gateway accepts it: name[:alias], or an ID.
+// Goes into the invoke line unescaped.
+static int valid_ref(const char *ref) {
+    if (!*ref) return 0;
+    for (; *ref; ref++) {
+        if (!((*ref >= 'a' && *ref <= 'z') || (*ref >= 'A' && *ref <= 'Z') ||
+              (*ref >= '0' && *ref <= '9') || *ref == '_' || *ref == '-' || *ref == ':')) return 0;
+    }
+    return 1;
+}
+
+static int module_cached(const char *func_id) {
+    for (int i = 0; module_cache && i < module_cache_size; i++) {
+        if (module_cache[i].module && strcmp(module_cache[i].func_id, func_id) == 0) return 1;
+    }
+    return 0;
+}
+
+// Invoke through the server (alias resolution, LB queues and admission).
+// Payloads the line can't carry as they are go in a memfd of this worker,
+// named like a gateway spool and open until the reply. The LB gives no new
+// request to a worker waiting on a call ("caller"), and the wait is bounded:
+// calls that cross between busy workers fail instead of deadlocking.
+static int call_remote(const char *ref, const char *payload, size_t payload_len, char *output, size_t out_len) {
+    int fd = create_unix_client_socket(SERVER_SOCK_PATH);
+    if (fd < 0) {
+        snprintf(output, out_len, "server unavailable");
+        return -1;
+    }
+    struct timeval tv = { CALL_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char *line = malloc(LINE_MAX);
+    char *resp = malloc(LINE_MAX);
+    int spool = -1, rc = -1;
+    if (!line || !resp) {
+        snprintf(output, out_len, "malloc failed");
+        goto out;
+    }
+    char body_ref[128] = "";
+    if (payload_len > PAYLOAD_INLINE_MAX || !line_safe(payload, payload_len)) {
+        if ((spool = payload_fd(payload, payload_len)) < 0) {
+            snprintf(output, out_len, "payload spool failed");
+            goto out;
+        }
+        snprintf(body_ref, sizeof(body_ref), ",\"payload_ref\":\"/proc/%d/fd/%d\",\"payload_len\":%zu",
+                 (int)getpid(), spool, payload_len);
+    }
+    int m = snprintf(line, LINE_MAX,
+                     "{\"type\":\"invoke\",\"fn\":\"%s\",\"tenant\":\"%s\",\"depth\":%d,\"caller\":%d%s,"
+                     "\"payload\":\"%s\"}\n",
+                     ref, job_tenant, call_depth + 1, worker_index, body_ref, spool >= 0 ? "" : payload);
+    if (m < 0 || m >= LINE_MAX) {
+        snprintf(output, out_len, "bad function reference");
+        goto out;
+    }
+    write_all(fd, line, (size_t)m);
+    errno = 0;
+    if (read_line(fd, resp, LINE_MAX) <= 0) {
+        snprintf(output, out_len, errno == EAGAIN || errno == EWOULDBLOCK ? "call timed out" : "no response");
+        goto out;
+    }
+    rc = strstr(resp, "\"ok\":true") ? 0 : -1;
+    const char *field = rc == 0 ? "\"output\":\"" : "\"error\":\"";
+    const char *v = strstr(resp, field);
+    output[0] = '\0';
+    if (v) {
+        v += strlen(field);
+        const char *end = v;
+        while (*end && *end != '"') end += *end == '\\' && end[1] ? 2 : 1;
+        json_unescape(v, (size_t)(end - v), output, out_len);
+    }
+out:
+    free(line);
+    free(resp);
+    if (spool >= 0) close(spool);
+    close(fd);
+    return rc;
+}
+
+static int call_function(const char *caller, const char *ref, const char *payload, size_t payload_len,
+                         char *output, size_t out_len) {
+    if (call_depth >= CALL_DEPTH_MAX) {
+        snprintf(output, out_len, "call depth %d exceeded", CALL_DEPTH_MAX);
+        return -1;
+    }
+    char id[MAX_FUNC_ID];
+    // The caller's own store is busy with this call: recursion goes remote
+    if (pinned_id(ref, id, sizeof(id)) < 0 || strcmp(id, caller) == 0 || !module_cached(id)) {
+        log_debug("[WORKER] 📞 %s -> %s through the server\n", caller, ref);
+        return call_remote(ref, payload, payload_len, output, out_len);
+    }
+    log_debug("[WORKER] 📞 %s -> %s in process\n", caller, id);
+    // Job state belongs to the caller
+    const char *cache_status = job_cache_status;
+    double ready_us = job_ready_us;
+    unsigned mem_pages = job_usage.mem_pages;
+    call_depth++;
+    // Bytes past a NUL only reach the callee from a memfd
+    int spool = memchr(payload, '\0', payload_len) ? payload_fd(payload, payload_len) : -1;
+    // The callee's output comes back here, never to the caller's stream
+    int rc = execute_function(id, payload, spool, -1, output, out_len);
+    if (spool >= 0) close(spool);
+    call_depth--;
+    job_cache_status = cache_status;
+    job_ready_us = ready_us;
+    job_usage.mem_pages = mem_pages;
+    return rc;
+}
+
+static wasm_trap_t *host_trap(wasm_store_t *store, const char *msg) {
+    wasm_message_t m;
+    wasm_byte_vec_new(&m, strlen(msg) + 1, msg);
+    wasm_trap_t *trap = wasm_trap_new(store, &m);
+    wasm_byte_vec_delete(&m);
+    return trap;
+}
+
+static wasm_trap_t *host_call(void *env, const wasm_val_vec_t *args, wasm_val_vec_t *results) {
+    call_env_t *ce = env;
+    uint64_t a[6];
+    for (int i = 0; i < 6; i++) a[i] = (uint32_t)args->data[i].of.i32;
+    if (!ce->memory) return host_trap(ce->store, "faas.call: no memory");
+    size_t size = wasm_memory_data_size(ce->memory);
+    if (a[0] + a[1] > size || a[2] + a[3] > size || a[4] + a[5] > size) {
+        return host_trap(ce->store, "faas.call: buffer out of bounds");
+    }
+    const char *mem = wasm_memory_data(ce->memory);
+    char ref[MAX_FUNC_NAME + MAX_ALIAS_NAME + 2];
+    char *payload = malloc(a[3] + 1);
+    char *output = malloc(LINE_MAX);
+    int rc = -1;
+    if (!payload || !output) {
+        free(payload);
+        free(output);
+        return host_trap(ce->store, "faas.call: out of memory");
+    }
+    if (a[1] == 0 || a[1] >= sizeof(ref)) {
+        snprintf(output, LINE_MAX, "bad function reference");
+    } else {
+        memcpy(ref, mem + a[0], a[1]);
+        ref[a[1]] = '\0';
+        if (strlen(ref) != a[1] || !valid_ref(ref)) {
+            snprintf(output, LINE_MAX, "bad function reference");
+        } else {
+            memcpy(payload, mem + a[2], a[3]);
+            payload[a[3]] = '\0';
+            rc = call_function(ce->func_id, ref, payload, a[3], output, LINE_MAX);
+        }
+    }
+    // NUL-terminated when it fits
+    size_t n = strlen(output);
+    memcpy(wasm_memory_data(ce->memory) + a[4], output, n < a[5] ? n + 1 : a[5]);
+    results->data[0].kind = WASM_I32;
+    results->data[0].of.i32 = rc < 0 ? -1 : (int32_t)n;
+    free(payload);
+    free(output);
+    return NULL;
+}
+
+// Imports of a module that imports faas.call: WASI's looked up by name, ours
+// added, in the module's import order (wasi_get_imports only knows WASI).
+// 0 if the module has no faas import (use wasi_get_imports), -1 on error.
+static int faas_imports(wasm_store_t *store, wasi_env_t *wasi_env, const wasm_module_t *module,
+                        call_env_t *ce, wasm_extern_vec_t *imports) {
+    wasm_importtype_vec_t types;
+    wasm_module_imports(module, &types);
+    int wanted = 0;
+    for (size_t i = 0; i < types.size && !wanted; i++) {
+        const wasm_name_t *mod = wasm_importtype_module(types.data[i]);
+        wanted = mod->size == strlen(CALL_MODULE) && memcmp(mod->data, CALL_MODULE, mod->size) == 0;
+    }
+    if (!wanted) {
+        wasm_importtype_vec_delete(&types);
+        return 0;
+    }
+
+    wasmer_named_extern_vec_t wasi;
+    if (!wasi_get_unordered_imports(wasi_env, module, &wasi)) {
+        wasm_importtype_vec_delete(&types);
+        return -1;
+    }
+    wasm_extern_vec_new_uninitialized(imports, types.size);
+    int rc = 0;
+    for (size_t i = 0; i < types.size; i++) {
+        const wasm_name_t *mod = wasm_importtype_module(types.data[i]);
+        const wasm_name_t *name = wasm_importtype_name(types.data[i]);
+        imports->data[i] = NULL;
+        if (mod->size == strlen(CALL_MODULE) && memcmp(mod->data, CALL_MODULE, mod->size) == 0) {
+            if (name->size == 4 && memcmp(name->data, "call", 4) == 0) {
+                wasm_valtype_t *p[6], *r[1] = { wasm_valtype_new(WASM_I32) };
+                for (int k = 0; k < 6; k++) p[k] = wasm_valtype_new(WASM_I32);
+                wasm_valtype_vec_t params, res;
+                wasm_valtype_vec_new(&params, 6, p);
+                wasm_valtype_vec_new(&res, 1, r);
+                wasm_functype_t *type = wasm_functype_new(&params, &res);
+                imports->data[i] = wasm_func_as_extern(wasm_func_new_with_env(store, type, host_call, ce, NULL));
+                wasm_functype_delete(type);
+            }
+        } else {
+            for (size_t k = 0; k < wasi.size; k++) {
+                const wasm_name_t *wm = wasmer_named_extern_module(wasi.data[k]);
+                const wasm_name_t *wn = wasmer_named_extern_name(wasi.data[k]);
+                if (wm->size == mod->size && memcmp(wm->data, mod->data, mod->size) == 0 &&
+                    wn->size == name->size && memcmp(wn->data, name->data, name->size) == 0) {
+                    imports->data[i] = wasm_extern_copy(wasmer_named_extern_unwrap(wasi.data[k]));
+                    break;
+                }
+            }
+        }
+        if (!imports->data[i]) {
+            log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Unresolved import %.*s.%.*s\n",
+                        (int)mod->size, mod->data, (int)name->size, name->data);
+            rc = -1;
+        }
+    }
+    wasmer_named_extern_vec_delete(&wasi);
+    wasm_importtype_vec_delete(&types);
+    if (rc < 0) {
+        wasm_extern_vec_delete(imports);
+        return -1;
+    }
+    return 1;
+}
+
+// Streamed WASM job: forwards what the guest writes while it runs
+typedef struct {
+    int in_fd;       // read end of the guest's stdout
+    int stream_fd;
+} stream_reader_t;
+
+static void *stream_reader(void *arg) {
+    const stream_reader_t *sr = arg;
+    int fd = sr->in_fd;
+    char buf[STREAM_CHUNK];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        stream_write(sr->stream_fd, buf, (size_t)n);
+    }
+    return NULL;
+}
+
+// Execute WASM function using Wasmer C API 3.x with WASI support
+// NO FORK! Worker is already a forked process from Server
+static int execute_wasm(const char *func_id, const char *wasm_path, const char *func_name, int in_fd,
+                        int stream_fd, char *output, size_t out_len) {
+    log_debug("[WORKER] 🚀 Execute WASM directly in worker process (PID %d)\n", getpid());
+
+    int hit;
+    module_cache_entry_t *cached = get_cached_module(func_id, wasm_path, &hit);
+    job_ready_us = trace_now_us();
+    if (!cached) {
         snprintf(output, out_len, "failed to compile wasm module");
         return -1;
     }
+    log_debug("[WORKER] %s module cache %s\n", hit ? "⚡" : "🧊", hit ? "hit" : "miss");
+    job_cache_status = hit ? "hit" : "miss";
+    wasm_store_t *store = cached->store;
+    wasm_module_t *module = cached->module;
 
-    fprintf(stderr, "[WORKER] ✅ WASM module compiled\n");
+    // Redirect stdout to capture output
+    int stdout_backup = dup(STDOUT_FILENO);
+    int pipefd[2];
+    if (pipe(pipefd) < 0) {
+        log_sampled(LOG_LEVEL_ERROR, "[WORKER] ❌ Pipe creation failed\n");
+        close(stdout_backup);
+        snprintf(output, out_len, "pipe creation failed");
+        return -1;
+    }
+    
+    dup2(pipefd[1], STDOUT_FILENO);
+    close(pipefd[1]);
 
     // WASI setup
     wasi_config_t *wasi_config = wasi_config_new("worker");
     if (!wasi_config) {
-        fprintf(stderr, "[WORKER] ❌ Failed to create WASI config\n");
-        wasm_module_delete(module);
-        wasm_store_delete(store);
-        wasm_engine_delete(engine);
+        log_sampled(LOG_LEVEL_ERROR, "[WORKER] ❌ Failed to create WASI config\n");
         dup2(stdout_backup, STDOUT_FILENO);
         close(stdout_backup);
         close(pipefd[0]);
@@ -111,10 +584,7 @@ static int execute_wasm(const char *wasm_path, const char *func_name, char *outp
     
     wasi_env_t *wasi_env = wasi_env_new(store, wasi_config);
     if (!wasi_env) {
-        fprintf(stderr, "[WORKER] ❌ Failed to create WASI environment\n");
-        wasm_module_delete(module);
-        wasm_store_delete(store);
-        wasm_engine_delete(engine);
+        log_sampled(LOG_LEVEL_ERROR, "[WORKER] ❌ Failed to create WASI environment\n");
         dup2(stdout_backup, STDOUT_FILENO);
         close(stdout_backup);
         close(pipefd[0]);
@@ -122,16 +592,16 @@ static int execute_wasm(const char *wasm_path, const char *func_name, char *outp
         return -1;
     }
 
-    fprintf(stderr, "[WORKER] ✅ WASI environment created\n");
+    log_debug("[WORKER] ✅ WASI environment created\n");
 
-    // Get WASI imports
+    // Get WASI imports (and faas.call if the module imports it)
     wasm_extern_vec_t imports;
-    bool ok = wasi_get_imports(store, wasi_env, module, &imports);
+    call_env_t call_env = { store, NULL, func_id };
+    int with_call = faas_imports(store, wasi_env, module, &call_env, &imports);
+    bool ok = with_call > 0 || (with_call == 0 && wasi_get_imports(store, wasi_env, module, &imports));
     if (!ok) {
-        fprintf(stderr, "[WORKER] ❌ Failed to get WASI imports\n");
-        wasm_module_delete(module);
-        wasm_store_delete(store);
-        wasm_engine_delete(engine);
+        log_sampled(LOG_LEVEL_ERROR, "[WORKER] ❌ Failed to get WASI imports\n");
+        wasi_env_delete(wasi_env);
         dup2(stdout_backup, STDOUT_FILENO);
         close(stdout_backup);
         close(pipefd[0]);
@@ -139,16 +609,14 @@ static int execute_wasm(const char *wasm_path, const char *func_name, char *outp
         return -1;
     }
 
-    fprintf(stderr, "[WORKER] ✅ WASI imports retrieved\n");
+    log_debug("[WORKER] ✅ WASI imports retrieved\n");
 
     // Instantiate module
     wasm_instance_t *instance = wasm_instance_new(store, module, &imports, NULL);
     if (!instance) {
-        fprintf(stderr, "[WORKER] ❌ Failed to instantiate wasm module\n");
+        log_sampled(LOG_LEVEL_ERROR, "[WORKER] ❌ Failed to instantiate wasm module\n");
         wasm_extern_vec_delete(&imports);
-        wasm_module_delete(module);
-        wasm_store_delete(store);
-        wasm_engine_delete(engine);
+        wasi_env_delete(wasi_env);
         dup2(stdout_backup, STDOUT_FILENO);
         close(stdout_backup);
         close(pipefd[0]);
@@ -156,7 +624,7 @@ static int execute_wasm(const char *wasm_path, const char *func_name, char *outp
         return -1;
     }
 
-    fprintf(stderr, "[WORKER] ✅ WASM instance created\n");
+    log_debug("[WORKER] ✅ WASM instance created\n");
 
     // Get exports
     wasm_extern_vec_t exports;
@@ -174,21 +642,19 @@ static int execute_wasm(const char *wasm_path, const char *func_name, char *outp
             memcmp(name->data, func_name, name->size) == 0) {
             if (wasm_extern_kind(exports.data[i]) == WASM_EXTERN_FUNC) {
                 target_func = wasm_extern_as_func(exports.data[i]);
-                fprintf(stderr, "[WORKER] ✅ Found function: %s\n", func_name);
+                log_debug("[WORKER] ✅ Found function: %s\n", func_name);
                 break;
             }
         }
     }
 
     if (!target_func) {
-        fprintf(stderr, "[WORKER] ❌ Function '%s' not found in exports\n", func_name);
+        log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Function '%s' not found in exports\n", func_name);
         wasm_extern_vec_delete(&exports);
         wasm_exporttype_vec_delete(&export_types);
         wasm_instance_delete(instance);
         wasm_extern_vec_delete(&imports);
-        wasm_module_delete(module);
-        wasm_store_delete(store);
-        wasm_engine_delete(engine);
+        wasi_env_delete(wasi_env);
         dup2(stdout_backup, STDOUT_FILENO);
         close(stdout_backup);
         close(pipefd[0]);
@@ -196,11 +662,17 @@ static int execute_wasm(const char *wasm_path, const char *func_name, char *outp
         return -1;
     }
 
+    for (size_t i = 0; i < exports.size && !call_env.memory; ++i) {
+        if (wasm_extern_kind(exports.data[i]) == WASM_EXTERN_MEMORY) {
+            call_env.memory = wasm_extern_as_memory(exports.data[i]);
+        }
+    }
+
     // Prepare arguments and results
     size_t param_arity = wasm_func_param_arity(target_func);
     size_t result_arity = wasm_func_result_arity(target_func);
 
-    fprintf(stderr, "[WORKER] 🔧 Function signature: %zu params, %zu results\n", param_arity, result_arity);
+    log_debug("[WORKER] 🔧 Function signature: %zu params, %zu results\n", param_arity, result_arity);
 
     wasm_val_vec_t args_vec;
     wasm_val_vec_new_uninitialized(&args_vec, param_arity);
@@ -212,34 +684,53 @@ static int execute_wasm(const char *wasm_path, const char *func_name, char *outp
     wasm_val_vec_t results_vec;
     wasm_val_vec_new_uninitialized(&results_vec, result_arity);
 
-    // Call function (stdout is redirected to pipe)
-    fprintf(stderr, "[WORKER] ⚡ Executing WASM function...\n");
+    // Call function (stdout is redirected to pipe, read during the call when streaming)
+    pthread_t reader;
+    stream_reader_t sr = { pipefd[0], stream_fd };
+    int streaming = stream_fd >= 0 && pthread_create(&reader, NULL, stream_reader, &sr) == 0;
+    // Our stdin is the job pipe from the server: the call reads its payload
+    int stdin_backup = in_fd >= 0 ? dup(STDIN_FILENO) : -1;
+    if (stdin_backup >= 0) dup2(in_fd, STDIN_FILENO);
+    log_debug("[WORKER] ⚡ Executing WASM function...\n");
     wasm_trap_t *trap = wasm_func_call(target_func, &args_vec, &results_vec);
+    if (stdin_backup >= 0) {
+        dup2(stdin_backup, STDIN_FILENO);
+        close(stdin_backup);
+    }
     if (trap) {
         wasm_message_t message;
         wasm_trap_message(trap, &message);
-        fprintf(stderr, "[WORKER] ❌ WASM trap: %.*s\n", (int)message.size, message.data);
+        log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ WASM trap: %.*s\n", (int)message.size, message.data);
         wasm_trap_delete(trap);
     } else {
-        fprintf(stderr, "[WORKER] ✅ Execution completed successfully\n");
+        log_debug("[WORKER] ✅ Execution completed successfully\n");
+    }
+
+    // Linear memory only grows: its size after the call is the peak
+    for (size_t i = 0; i < exports.size; ++i) {
+        if (wasm_extern_kind(exports.data[i]) == WASM_EXTERN_MEMORY) {
+            job_usage.mem_pages = wasm_memory_size(wasm_extern_as_memory(exports.data[i]));
+            break;
+        }
     }
 
-    // Restore stdout
+    // Restore stdout (last reference to the pipe's write end: EOF for the reader)
     fflush(stdout);
     dup2(stdout_backup, STDOUT_FILENO);
     close(stdout_backup);
+    if (streaming) pthread_join(reader, NULL);
 
     // Read captured output from pipe
     size_t total_read = 0;
     ssize_t n;
-    while (total_read < out_len - 1 && 
+    while (!streaming && total_read < out_len - 1 && 
            (n = read(pipefd[0], output + total_read, out_len - total_read - 1)) > 0) {
         total_read += n;
     }
     output[total_read] = '\0';
     close(pipefd[0]);
 
-    fprintf(stderr, "[WORKER] 📤 Captured output (%zu bytes): %s\n", total_read, output);
+    log_debug("[WORKER] 📤 Captured output (%zu bytes): %s\n", total_read, output);
 
     // Cleanup Wasmer
     wasm_val_vec_delete(&args_vec);
@@ -248,11 +739,9 @@ static int execute_wasm(const char *wasm_path, const char *func_name, char *outp
     wasm_exporttype_vec_delete(&export_types);
     wasm_instance_delete(instance);
     wasm_extern_vec_delete(&imports);
-    wasm_module_delete(module);
-    wasm_store_delete(store);
-    wasm_engine_delete(engine);
+    wasi_env_delete(wasi_env);
 
-    fprintf(stderr, "[WORKER] ✅ Wasmer cleanup complete\n");
+    log_debug("[WORKER] ✅ Wasmer cleanup complete (module kept in cache)\n");
     return 0;
 }
 #endif
@@ -263,18 +752,80 @@ static int check_wasm_exists(const char *func_id, char *wasm_path, size_t wasm_p
     return access(wasm_path, F_OK) == 0 ? 0 : -1;
 }
 
-// Execute function based on language
-static int execute_function(const char *func_id, const char *payload, char *output, size_t out_len) {
-    fprintf(stderr, "[WORKER] 🔍 Loading metadata for: %s\n", func_id);
-    
-    function_metadata_t meta;
-    if (load_function_metadata(func_id, &meta) < 0) {
-        fprintf(stderr, "[WORKER] ❌ Metadata not found\n");
-        snprintf(output, out_len, "function not found");
+// The payload as a file the function reads on stdin: a memfd holds any size
+// without a writer to keep draining it while the function runs
+static int payload_fd(const char *payload, size_t len) {
+    int fd = memfd_create("faas_payload", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    if (write_all(fd, payload, len) != (ssize_t)len || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
         return -1;
     }
+    return fd;
+}
 
-    fprintf(stderr, "[WORKER] ✅ Metadata loaded: lang=%s\n", meta.language);
+// Run a language runtime on the function file, capturing stdout and stderr
+// like popen("<runtime> <file> 2>&1"), but reaping the child with wait4()
+// so its CPU time and peak RSS are accounted to the job. stdin is in_fd
+// (the payload), never the worker's own job pipe.
+static int run_runtime(const char *runtime, const char *code_path, int in_fd, int stream_fd,
+                       char *output, size_t out_len) {
+    int pfd[2];
+    if (pipe(pfd) < 0) return -1;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pfd[0]);
+        close(pfd[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = in_fd < 0 ? open("/dev/null", O_RDONLY) : -1;
+        dup2(in_fd >= 0 ? in_fd : null_fd, STDIN_FILENO);
+        dup2(pfd[1], STDOUT_FILENO);
+        dup2(pfd[1], STDERR_FILENO);
+        close(pfd[0]);
+        close(pfd[1]);
+        signal(SIGPIPE, SIG_DFL);
+        execlp(runtime, runtime, code_path, (char *)NULL);
+        dprintf(STDOUT_FILENO, "%s: not found\n", runtime);
+        _exit(127);
+    }
+    close(pfd[1]);
+
+    size_t total = 0;
+    ssize_t n;
+    char chunk[STREAM_CHUNK];
+    while (stream_fd >= 0 && (n = read(pfd[0], chunk, sizeof(chunk))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        stream_write(stream_fd, chunk, (size_t)n);
+    }
+    while (stream_fd < 0 && total < out_len - 1 && (n = read(pfd[0], output + total, out_len - 1 - total)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        total += (size_t)n;
+    }
+    output[total] = '\0';
+    close(pfd[0]);
+
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) < 0) {
+        if (errno != EINTR) return 0;
+    }
+    job_usage.child_cpu_us += tv_us(ru.ru_utime) + tv_us(ru.ru_stime);
+    if (ru.ru_maxrss > job_usage.child_maxrss_kb) job_usage.child_maxrss_kb = ru.ru_maxrss;
+    return 0;
+}
+
+// Execute function based on language, payload readable on in_fd
+static int run_function(const char *func_id, const function_metadata_t *m, const char *payload, int in_fd,
+                        int stream_fd, char *output, size_t out_len) {
+    function_metadata_t meta = *m;
 
     char code_path[512];
     const char *ext = (strcmp(meta.language, "c") == 0) ? "c" :
@@ -289,20 +840,20 @@ static int execute_function(const char *func_id, const char *payload, char *outp
     // Strategy 1: Execute WASM with Wasmer (C/Rust/Go)
     if (strcmp(meta.language, "c") == 0 || strcmp(meta.language, "rust") == 0 || 
         strcmp(meta.language, "rs") == 0 || strcmp(meta.language, "go") == 0) {
-        fprintf(stderr, "[WORKER] 🎯 Detected WASM language: %s\n", meta.language);
+        log_debug("[WORKER] 🎯 Detected WASM language: %s\n", meta.language);
         char wasm_path[512];
         if (check_wasm_exists(func_id, wasm_path, sizeof(wasm_path)) == 0) {
-            fprintf(stderr, "[WORKER] ✅ WASM file found: %s\n", wasm_path);
+            log_debug("[WORKER] ✅ WASM file found: %s\n", wasm_path);
 #ifdef USE_WASMER
-            fprintf(stderr, "[WORKER] 🚀 Executing WASM with Wasmer...\n");
-            return execute_wasm(wasm_path, "_start", output, out_len);
+            log_debug("[WORKER] 🚀 Executing WASM with Wasmer...\n");
+            return execute_wasm(func_id, wasm_path, "_start", in_fd, stream_fd, output, out_len);
 #else
-            fprintf(stderr, "[WORKER] ❌ USE_WASMER not defined!\n");
+            log_error("[WORKER] ❌ USE_WASMER not defined!\n");
             snprintf(output, out_len, "wasm file found at %s (Wasmer not enabled, rebuild with -DUSE_WASMER and link libwasmer)", wasm_path);
             return 0;
 #endif
         } else {
-            fprintf(stderr, "[WORKER] ❌ WASM file not found: %s\n", wasm_path);
+            log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ WASM file not found: %s\n", wasm_path);
             snprintf(output, out_len, "wasm file not found (should be compiled during deploy)");
             return -1;
         }
@@ -310,42 +861,24 @@ static int execute_function(const char *func_id, const char *payload, char *outp
     
     // Strategy 2: Execute with native runtime (JS/Python)
     else if (strcmp(meta.language, "js") == 0 || strcmp(meta.language, "javascript") == 0) {
-        char cmd[1024];
-        snprintf(cmd, sizeof(cmd), "node %s 2>&1", code_path);
-        FILE *fp = popen(cmd, "r");
-        if (!fp) {
+        if (run_runtime("node", code_path, in_fd, stream_fd, output, out_len) < 0) {
             snprintf(output, out_len, "failed to execute js (install node)");
             return -1;
         }
-        size_t n = fread(output, 1, out_len - 1, fp);
-        output[n] = '\0';
-        pclose(fp);
         return 0;
     }
     else if (strcmp(meta.language, "python") == 0 || strcmp(meta.language, "py") == 0) {
-        char cmd[1024];
-        snprintf(cmd, sizeof(cmd), "python3 %s 2>&1", code_path);
-        FILE *fp = popen(cmd, "r");
-        if (!fp) {
+        if (run_runtime("python3", code_path, in_fd, stream_fd, output, out_len) < 0) {
             snprintf(output, out_len, "failed to execute python (install python3)");
             return -1;
         }
-        size_t n = fread(output, 1, out_len - 1, fp);
-        output[n] = '\0';
-        pclose(fp);
         return 0;
     }
     else if (strcmp(meta.language, "php") == 0) {
-        char cmd[1024];
-        snprintf(cmd, sizeof(cmd), "php %s 2>&1", code_path);
-        FILE *fp = popen(cmd, "r");
-        if (!fp) {
+        if (run_runtime("php", code_path, in_fd, stream_fd, output, out_len) < 0) {
             snprintf(output, out_len, "failed to execute php (install php-cli)");
             return -1;
         }
-        size_t n = fread(output, 1, out_len - 1, fp);
-        output[n] = '\0';
-        pclose(fp);
         return 0;
     }
     else if (strcmp(meta.language, "html") == 0) {
@@ -367,25 +900,264 @@ static int execute_function(const char *func_id, const char *payload, char *outp
     return 0;
 }
 
-static void run_worker_loop(int fd) {
+static int execute_pipeline(const char *func_id, const char *payload, int stream_fd, char *output, size_t out_len);
+
+// payload: inline text, or spool_fd >= 0: a spooled payload (BODY_REF_PREFIX)
+// handed to the function as its stdin, never copied here
+static int execute_function(const char *func_id, const char *payload, int spool_fd, int stream_fd,
+                            char *output, size_t out_len) {
+    log_debug("[WORKER] 🔍 Loading metadata for: %s\n", func_id);
+
+    function_metadata_t meta;
+    if (load_function_metadata(func_id, &meta) < 0) {
+        log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Metadata not found\n");
+        snprintf(output, out_len, "function not found");
+        return -1;
+    }
+
+    log_debug("[WORKER] ✅ Metadata loaded: lang=%s\n", meta.language);
+    job_ready_us = trace_now_us(); // WASM: moved past compilation in execute_wasm
+
+    if (strcmp(meta.language, "pipeline") == 0) {
+        if (spool_fd < 0) return execute_pipeline(func_id, payload, stream_fd, output, out_len);
+        // Stage inputs live in memory: a spooled payload is read up to out_len
+        char *text = malloc(out_len);
+        if (!text) {
+            snprintf(output, out_len, "malloc failed");
+            return -1;
+        }
+        size_t len = 0;
+        ssize_t r;
+        while (len + 1 < out_len && (r = read(spool_fd, text + len, out_len - 1 - len)) > 0) len += (size_t)r;
+        text[len] = '\0';
+        int rc = execute_pipeline(func_id, text, stream_fd, output, out_len);
+        free(text);
+        return rc;
+    }
+    int in_fd = spool_fd >= 0 ? spool_fd : payload_fd(payload, strlen(payload));
+    int rc = run_function(func_id, &meta, payload, in_fd, stream_fd, output, out_len);
+    if (in_fd >= 0 && in_fd != spool_fd) close(in_fd);
+    return rc;
+}
+
+// Run every stage of a pipeline in this worker, in spec order. Outputs stay
+// in memory and become the stdin of the stages reading them; the stage
+// modules land in this worker's cache, so routing the pipeline to the same
+// worker (AFFINITY) keeps all of them warm.
+static int execute_pipeline(const char *func_id, const char *payload, int stream_fd, char *output, size_t out_len) {
+    if (in_pipeline) {
+        snprintf(output, out_len, "nested pipeline %s", func_id);
+        return -1;
+    }
+    char spec[LINE_MAX];
+    pipeline_t p;
+    char err[160];
+    if (load_function(func_id, spec, sizeof(spec)) < 0) {
+        snprintf(output, out_len, "pipeline spec not found");
+        return -1;
+    }
+    if (pipeline_parse(spec, &p, err, sizeof(err)) < 0) {
+        snprintf(output, out_len, "bad pipeline: %s", err);
+        return -1;
+    }
+
+    char *outs[PIPELINE_MAX_STAGES] = {0};
+    char *input = malloc(out_len * PIPELINE_MAX_INPUTS);
+    int rc = input ? 0 : -1;
+    if (!input) snprintf(output, out_len, "malloc failed");
+    size_t sl = (size_t)snprintf(job_stages, sizeof(job_stages), ",\"stages\":[");
+#ifdef USE_WASMER
+    int hits = 0, misses = 0;
+#endif
+    in_pipeline = 1;
+    for (int i = 0; i < p.nstages && rc == 0; i++) {
+        const pipeline_stage_t *st = &p.stages[i];
+        // Inputs joined by newlines (one line each when they already end with one)
+        size_t len = 0;
+        for (int j = 0; j < st->ninputs; j++) {
+            const char *src = st->inputs[j] == PIPELINE_INPUT ? payload : outs[st->inputs[j]];
+            size_t n = strlen(src);
+            if (len && input[len - 1] != '\n' && len < out_len * PIPELINE_MAX_INPUTS - 1) input[len++] = '\n';
+            if (n > out_len * PIPELINE_MAX_INPUTS - 1 - len) n = out_len * PIPELINE_MAX_INPUTS - 1 - len;
+            memcpy(input + len, src, n);
+            len += n;
+        }
+        input[len] = '\0';
+
+        if (!(outs[i] = malloc(out_len))) {
+            snprintf(output, out_len, "malloc failed");
+            rc = -1;
+            break;
+        }
+        double t0 = trace_now_us();
+#ifdef USE_WASMER
+        job_cache_status = NULL;
+#endif
+        // Only the last stage's output is the pipeline's
+        rc = execute_function(st->fn, input, -1, i == p.nstages - 1 ? stream_fd : -1, outs[i], out_len);
+        double ms = (trace_now_us() - t0) / 1000.0;
+        const char *cache = "";
+#ifdef USE_WASMER
+        if (job_cache_status) {
+            cache = strcmp(job_cache_status, "hit") == 0 ? ",\"cache\":\"hit\"" : ",\"cache\":\"miss\"";
+            if (strcmp(job_cache_status, "hit") == 0) hits++; else misses++;
+        }
+#endif
+        if (sl < sizeof(job_stages)) {
+            sl += (size_t)snprintf(job_stages + sl, sizeof(job_stages) - sl,
+                                   "%s{\"name\":\"%s\",\"fn\":\"%s\",\"ok\":%s,\"ms\":%.3f%s}",
+                                   i ? "," : "", st->name, st->fn, rc == 0 ? "true" : "false", ms, cache);
+        }
+        if (rc < 0) snprintf(output, out_len, "stage %s (%s): %s", st->name, st->fn, outs[i]);
+    }
+    in_pipeline = 0;
+    if (sl < sizeof(job_stages)) snprintf(job_stages + sl, sizeof(job_stages) - sl, "]");
+    if (rc == 0) snprintf(output, out_len, "%s", outs[p.nstages - 1]);
+#ifdef USE_WASMER
+    // Reported to the LB as one function: warm only if every WASM stage was
+    job_cache_status = misses ? "miss" : hits ? "hit" : NULL;
+#endif
+    for (int i = 0; i < p.nstages; i++) free(outs[i]);
+    free(input);
+    return rc;
+}
+
+// Pre-warm: load (and for WASM, compile into the module cache) without executing
+static int warm_function(const char *func_id, char *output, size_t out_len) {
+    function_metadata_t meta;
+    if (load_function_metadata(func_id, &meta) < 0) {
+        snprintf(output, out_len, "function not found");
+        return -1;
+    }
+
+    // A pipeline warms its stages
+    if (strcmp(meta.language, "pipeline") == 0) {
+        char spec[LINE_MAX];
+        pipeline_t p;
+        char err[160];
+        if (load_function(func_id, spec, sizeof(spec)) < 0 || pipeline_parse(spec, &p, err, sizeof(err)) < 0) {
+            snprintf(output, out_len, "bad pipeline");
+            return -1;
+        }
+        for (int i = 0; i < p.nstages; i++) {
+            if (warm_function(p.stages[i].fn, output, out_len) < 0) return -1;
+        }
+        return 0;
+    }
+
+    if (strcmp(meta.language, "c") == 0 || strcmp(meta.language, "rust") == 0 ||
+        strcmp(meta.language, "rs") == 0 || strcmp(meta.language, "go") == 0) {
+        char wasm_path[512];
+        if (check_wasm_exists(func_id, wasm_path, sizeof(wasm_path)) < 0) {
+            snprintf(output, out_len, "wasm file not found");
+            return -1;
+        }
+#ifdef USE_WASMER
+        int hit;
+        if (!get_cached_module(func_id, wasm_path, &hit)) {
+            snprintf(output, out_len, "failed to compile wasm module");
+            return -1;
+        }
+#endif
+    }
+    output[0] = '\0';
+    return 0;
+}
+
+static void send_result(int out_fd, int ok, const char *field, const char *text) {
+    char extra[MAX_FUNC_ID + 256 + sizeof(job_stages)] = "";
+    size_t m = 0;
+#ifdef USE_WASMER
+    if (job_cache_status) {
+        m += (size_t)snprintf(extra, sizeof(extra), ",\"cache\":\"%s\"", job_cache_status);
+        if (job_evicted[0]) {
+            m += (size_t)snprintf(extra + m, sizeof(extra) - m, ",\"evicted\":\"%s\"", job_evicted);
+        }
+    }
+    job_cache_status = NULL;
+    job_evicted[0] = '\0';
+#endif
+    if (job_stages[0] && m < sizeof(extra)) {
+        m += (size_t)snprintf(extra + m, sizeof(extra) - m, "%s", job_stages);
+    }
+    job_stages[0] = '\0';
+    if (job_stream_fd >= 0 && m < sizeof(extra)) {
+        m += (size_t)snprintf(extra + m, sizeof(extra) - m, ",\"streamed\":%zu", stream_bytes);
+    }
+    if (m < sizeof(extra)) usage_format(extra + m, sizeof(extra) - m, strlen(text) + stream_bytes);
+    // The output gives way to the fields so the line stays under LINE_MAX
+    size_t extra_len = strlen(extra);
+    char escaped[LINE_MAX - 256];
+    size_t esc_cap = extra_len + 256 < LINE_MAX - 256 ? LINE_MAX - 256 - extra_len : 256;
+    if (esc_cap > sizeof(escaped)) esc_cap = sizeof(escaped);
+    json_escape(text, strlen(text), escaped, esc_cap);
+    char resp[LINE_MAX];
+    snprintf(resp, sizeof(resp), "{\"ok\":%s,\"%s\":\"%s\"%s}\n",
+             ok ? "true" : "false", field, escaped, extra);
+    if (job_traced) {
+        double done = trace_now_us();
+        trace_append(resp, sizeof(resp), TRACE_WK_RECV, job_recv_us);
+        trace_append(resp, sizeof(resp), TRACE_WK_READY, job_ready_us ? job_ready_us : done);
+        trace_append(resp, sizeof(resp), TRACE_WK_DONE, done);
+        job_traced = 0;
+    }
+    write_all(out_fd, resp, strlen(resp));
+}
+
+static void run_worker_loop(int in_fd, int out_fd) {
     char line[LINE_MAX];
+    // Replies go to out_fd, which a WASM call redirects: chunks of streamed
+    // jobs are written through their own descriptor
+    int chunk_fd = dup(out_fd);
     for (;;) {
-        ssize_t n = read_line(fd, line, sizeof(line));
+        ssize_t n = read_line(in_fd, line, sizeof(line));
         if (n <= 0) {
-            fprintf(stderr, "worker: connection closed\n");
+            log_info("worker: connection closed\n");
             break;
         }
+        if (strstr(line, "\"type\":\"warm\"")) {
+            char func_id[MAX_FUNC_ID] = {0};
+            const char *fnp = strstr(line, "\"fn\":");
+            if (fnp) sscanf(fnp, "\"fn\":\"%127[^\"]\"", func_id);
+
+            char output[256];
+            log_info("[WORKER] 🔥 Pre-warming %s\n", func_id);
+            metrics_worker_state(worker_index, WORKER_BUSY, func_id);
+            if (warm_function(func_id, output, sizeof(output)) < 0) {
+                send_result(out_fd, 0, "error", output);
+            } else {
+                const char *resp = "{\"ok\":true,\"warm\":true}\n";
+                write_all(out_fd, resp, strlen(resp));
+            }
+#ifdef USE_WASMER
+            job_evicted[0] = '\0';
+            metrics_worker_cached(worker_index, cached_modules());
+#endif
+            metrics_worker_state(worker_index, WORKER_IDLE, NULL);
+        }
         // Accept both "type":"job" and "type":"invoke"
-        if (strstr(line, "\"type\":\"job\"") || strstr(line, "\"type\":\"invoke\"")) {
-            fprintf(stderr, "[WORKER] 📨 Received message: %s\n", line);
+        else if (strstr(line, "\"type\":\"job\"") || strstr(line, "\"type\":\"invoke\"")) {
+            job_recv_us = trace_now_us();
+            job_ready_us = 0;
+            job_traced = trace_requested(line);
+            usage_begin();
+            job_tenant[0] = '\0';
+            call_depth = 0;
+            const char *tnp = strstr(line, "\"tenant\":\"");
+            if (tnp) sscanf(tnp, "\"tenant\":\"%63[^\"]\"", job_tenant);
+            const char *dp = strstr(line, "\"depth\":");
+            if (dp) sscanf(dp, "\"depth\":%d", &call_depth);
+            job_stream_fd = strstr(line, "\"stream\":1") && chunk_fd >= 0 ? chunk_fd : -1;
+            stream_bytes = 0;
+            log_debug("[WORKER] 📨 Received message: %s\n", line);
             
             // Extract fn and payload
             const char *fnp = strstr(line, "\"fn\":");
             const char *plp = strstr(line, "\"payload\":");
             if (!fnp || !plp) {
-                fprintf(stderr, "[WORKER] ❌ Missing fn or payload in message\n");
+                log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Missing fn or payload in message\n");
                 const char *resp = "{\"ok\":false,\"error\":\"no fn or payload\"}\n";
-                write_all(fd, resp, strlen(resp));
+                write_all(out_fd, resp, strlen(resp));
                 continue;
             }
 
@@ -394,39 +1166,63 @@ static void run_worker_loop(int fd) {
             sscanf(fnp, "\"fn\":\"%127[^\"]\"", func_id);
             sscanf(plp, "\"payload\":\"%8191[^\"]\"", payload);
 
-            fprintf(stderr, "[WORKER] 📨 Received job: fn=%s, payload=%s\n", func_id, payload);
+            // Large or binary payloads arrive spooled, opened here for this job
+            int spool_fd = body_ref_open(line, "payload_ref");
+            if (spool_fd == -2) {
+                log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Spooled payload unavailable for %s\n", func_id);
+                send_result(out_fd, 0, "error", "payload unavailable");
+                continue;
+            }
+
+            log_debug("[WORKER] 📨 Received job: fn=%s, payload=%s\n", func_id, spool_fd >= 0 ? "(spooled)" : payload);
+            metrics_worker_state(worker_index, WORKER_BUSY, func_id);
 
             // Execute function
             char output[LINE_MAX];
-            fprintf(stderr, "[WORKER] 🚀 Calling execute_function()...\n");
-            if (execute_function(func_id, payload, output, sizeof(output)) < 0) {
-                fprintf(stderr, "[WORKER] ❌ Execution failed: %s\n", output);
-                char resp[LINE_MAX];
-                snprintf(resp, sizeof(resp), "{\"ok\":false,\"error\":\"%s\"}\n", output);
-                write_all(fd, resp, strlen(resp));
+            log_debug("[WORKER] 🚀 Calling execute_function()...\n");
+            int rc = execute_function(func_id, payload, spool_fd, job_stream_fd, output, sizeof(output));
+            if (spool_fd >= 0) close(spool_fd);
+            if (job_stream_fd >= 0) {
+                // Output that was not produced incrementally (HTML, echo) still goes as chunks
+                if (rc == 0 && output[0]) {
+                    stream_write(job_stream_fd, output, strlen(output));
+                    output[0] = '\0';
+                }
+                stream_end(job_stream_fd);
+            }
+            metrics_worker_job(worker_index, (trace_now_us() - job_recv_us) / 1e6);
+            if (rc < 0) {
+                log_sampled(LOG_LEVEL_WARN, "[WORKER] ❌ Execution failed: %s\n", output);
+                send_result(out_fd, 0, "error", output);
             } else {
-                fprintf(stderr, "[WORKER] ✅ Execution succeeded: %s\n", output);
-                char resp[LINE_MAX];
-                snprintf(resp, sizeof(resp), "{\"ok\":true,\"output\":\"%s\"}\n", output);
-                write_all(fd, resp, strlen(resp));
+                log_debug("[WORKER] ✅ Execution succeeded: %s\n", output);
+                send_result(out_fd, 1, "output", output);
             }
+            job_stream_fd = -1;
+#ifdef USE_WASMER
+            metrics_worker_cached(worker_index, cached_modules());
+#endif
+            metrics_worker_state(worker_index, WORKER_IDLE, NULL);
         } else {
             const char *resp = "{\"ok\":false,\"error\":\"unknown job\"}\n";
-            write_all(fd, resp, strlen(resp));
+            write_all(out_fd, resp, strlen(resp));
         }
     }
 }
 
 int main(void) {
-    // Worker now reads jobs from stdin (pipe from server)
+    // Worker reads jobs from stdin (pipe from server) and answers on stdout
     const char *worker_id = getenv("WORKER_ID");
     if (!worker_id) worker_id = "unknown";
+    worker_index = getenv("WORKER_ID") ? atoi(worker_id) : -1;
+    log_init();
+    metrics_attach();
+    metrics_worker_state(worker_index, WORKER_IDLE, NULL);
     
-    fprintf(stderr, "worker[%s] pid=%d started, reading from stdin\n", worker_id, getpid());
+    log_info("worker[%s] pid=%d started, reading from stdin\n", worker_id, getpid());
     
-    // Read jobs from stdin (pipe from server)
-    run_worker_loop(STDIN_FILENO);
+    run_worker_loop(STDIN_FILENO, STDOUT_FILENO);
     
-    fprintf(stderr, "worker[%s] exiting\n", worker_id);
+    log_info("worker[%s] exiting\n", worker_id);
     return 0;
 }